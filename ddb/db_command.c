@@ -57,7 +57,9 @@
 #include <machine/db_interface.h>
 #include <kern/debug.h>
 #include <kern/thread.h>
+#include <kern/kmutex.h>
 #include <kern/slab.h>
+#include <kern/slab_trace.h>
 #include <ipc/ipc_pset.h> /* 4proto */
 #include <ipc/ipc_port.h> /* 4proto */
 
@@ -331,6 +333,10 @@ struct db_command db_show_cmds[] = {
 	{ "msg",	(db_command_fun_t)ipc_msg_print,		0,	0 },
 	{ "ipc_port",	db_show_port_id,	0,	0 },
 	{ "slabinfo",	(db_command_fun_t)db_show_slab_info,	0,	0 },
+#if MACH_SLAB_TRACE
+	{ "slabtrace",	(db_command_fun_t)db_show_slab_trace,	0,	0 },
+#endif	/* MACH_SLAB_TRACE */
+	{ "kmutex",	(db_command_fun_t)db_show_kmutex_stats,	0,	0 },
 	{ "vmstat",	(db_command_fun_t)db_show_vmstat,		0,	0 },
 	{ (char *)0, }
 };
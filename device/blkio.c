@@ -30,6 +30,8 @@
  * 	Block IO driven from generic kernel IO interface.
  */
 #include <mach/kern_return.h>
+#include <kern/assert.h>
+#include <kern/mach_clock.h>
 
 #include <device/blkio.h>
 #include <device/buf.h>
@@ -64,3 +66,255 @@ vm_offset_t block_io_mmap(dev_t dev, vm_offset_t off, int prot)
 	return (0);
 }
 
+
+/*
+ * Block request queue, deadline style: waiting requests are kept both
+ * sorted by sector and in a FIFO per direction.  Requests are started
+ * in batches of one direction, in ascending sector order from where
+ * the previous one ended, unless the oldest request of the direction
+ * has expired.  Reads are preferred, but writes get a batch after
+ * BLKIO_WRITES_STARVED read batches.
+ */
+#define BLKIO_READ_EXPIRE	(hz / 2)	/* ticks */
+#define BLKIO_WRITE_EXPIRE	(5 * hz)	/* ticks */
+#define BLKIO_BATCH		16		/* requests per batch */
+#define BLKIO_WRITES_STARVED	2		/* read batches before a write one */
+
+void blkio_queue_init(
+	struct blkio_queue	*q,
+	blkio_start_fn_t	start,
+	blkio_merge_fn_t	merge,
+	unsigned int		max_depth,
+	unsigned long		max_sectors,
+	void			*private)
+{
+	assert(max_depth > 0);
+
+	list_init(&q->sorted);
+	list_init(&q->fifo[0]);
+	list_init(&q->fifo[1]);
+	list_init(&q->active);
+	q->queued = 0;
+	q->depth = 0;
+	q->max_depth = max_depth;
+	q->max_sectors = merge ? max_sectors : 0;
+	q->next_sector = 0;
+	q->batch_write = 0;
+	q->batch = 0;
+	q->starved = 0;
+	q->merge = merge;
+	q->start = start;
+	q->private = private;
+
+	q->nr_reads = 0;
+	q->nr_writes = 0;
+	q->nr_merges = 0;
+	q->nr_started = 0;
+	q->depth_sum = 0;
+	q->peak_depth = 0;
+	q->latency_sum = 0;
+	q->max_latency = 0;
+}
+
+/* Try to merge REQ into a waiting request.  */
+static boolean_t blkio_try_merge(
+	struct blkio_queue	*q,
+	struct blkio_req	*req)
+{
+	struct blkio_req *into;
+	boolean_t front;
+
+	if (q->max_sectors == 0)
+		return FALSE;
+
+	list_for_each_entry(&q->sorted, into, node) {
+		if (into->write != req->write
+		    || into->nr_sectors + req->nr_sectors > q->max_sectors)
+			continue;
+
+		if (into->sector + into->nr_sectors == req->sector)
+			front = FALSE;
+		else if (req->sector + req->nr_sectors == into->sector)
+			front = TRUE;
+		else
+			continue;
+
+		if (!q->merge(q, into, req, front))
+			continue;
+
+		if (front)
+			into->sector = req->sector;
+		into->nr_sectors += req->nr_sectors;
+		q->nr_merges++;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Return the next request to start in the current batch, if any.  */
+static struct blkio_req *blkio_next_sorted(
+	struct blkio_queue	*q,
+	int			write)
+{
+	struct blkio_req *req;
+
+	list_for_each_entry(&q->sorted, req, node)
+		if (req->write == write && req->sector >= q->next_sector)
+			return req;
+
+	return NULL;
+}
+
+/* Choose the next request to start.  */
+static struct blkio_req *blkio_choose(struct blkio_queue *q)
+{
+	struct blkio_req *req, *oldest;
+	int write;
+
+	if (q->batch > 0) {
+		req = blkio_next_sorted(q, q->batch_write);
+		if (req != NULL) {
+			q->batch--;
+			return req;
+		}
+	}
+
+	/* Start a new batch.  */
+	if (!list_empty(&q->fifo[0])
+	    && (list_empty(&q->fifo[1])
+		|| q->starved < BLKIO_WRITES_STARVED)) {
+		write = 0;
+		if (!list_empty(&q->fifo[1]))
+			q->starved++;
+	} else {
+		write = 1;
+		q->starved = 0;
+	}
+
+	oldest = list_first_entry(&q->fifo[write], struct blkio_req, fifo);
+	if ((long) (elapsed_ticks - oldest->deadline) >= 0)
+		req = oldest;
+	else {
+		req = blkio_next_sorted(q, write);
+		if (req == NULL)
+			req = oldest;
+	}
+
+	q->batch_write = write;
+	q->batch = BLKIO_BATCH - 1;
+	return req;
+}
+
+/* Start requests until the queue is empty or full.  */
+static void blkio_dispatch(struct blkio_queue *q)
+{
+	struct blkio_req *req;
+
+	while (q->queued > 0 && q->depth < q->max_depth) {
+		req = blkio_choose(q);
+		list_remove(&req->node);
+		list_remove(&req->fifo);
+		q->queued--;
+
+		list_insert_tail(&q->active, &req->node);
+		q->depth++;
+		q->next_sector = req->sector + req->nr_sectors;
+
+		q->nr_started++;
+		q->depth_sum += q->depth;
+		if (q->depth > q->peak_depth)
+			q->peak_depth = q->depth;
+
+		q->start(q, req);
+	}
+}
+
+boolean_t blkio_submit(
+	struct blkio_queue	*q,
+	struct blkio_req	*req)
+{
+	struct blkio_req *tmp;
+
+	req->queued = elapsed_ticks;
+	req->deadline = elapsed_ticks
+		+ (req->write ? BLKIO_WRITE_EXPIRE : BLKIO_READ_EXPIRE);
+
+	if (blkio_try_merge(q, req))
+		return FALSE;
+
+	list_for_each_entry(&q->sorted, tmp, node)
+		if (tmp->sector > req->sector)
+			break;
+	list_insert_before(&tmp->node, &req->node);
+	list_insert_tail(&q->fifo[req->write != 0], &req->fifo);
+	q->queued++;
+
+	blkio_dispatch(q);
+	return TRUE;
+}
+
+void blkio_done(
+	struct blkio_queue	*q,
+	struct blkio_req	*req)
+{
+	unsigned long latency;
+
+	assert(q->depth > 0);
+	list_remove(&req->node);
+	q->depth--;
+
+	if (req->write)
+		q->nr_writes++;
+	else
+		q->nr_reads++;
+	latency = elapsed_ticks - req->queued;
+	q->latency_sum += latency;
+	if (latency > q->max_latency)
+		q->max_latency = latency;
+
+	blkio_dispatch(q);
+}
+
+struct blkio_req *blkio_lookup(
+	struct blkio_queue	*q,
+	void			*private)
+{
+	struct blkio_req *req;
+
+	list_for_each_entry(&q->active, req, node)
+		if (req->private == private)
+			return req;
+
+	return NULL;
+}
+
+io_return_t blkio_get_status(
+	const struct blkio_queue	*q,
+	dev_status_t			status,
+	mach_msg_type_number_t		*status_count)
+{
+	struct blkio_status *bs = (struct blkio_status *) status;
+	unsigned long done;
+
+	if (*status_count < BLKIO_STATUS_COUNT)
+		return D_INVALID_OPERATION;
+
+	done = q->nr_reads + q->nr_writes;
+	bs->reads = q->nr_reads;
+	bs->writes = q->nr_writes;
+	bs->merges = q->nr_merges;
+	bs->queued = q->queued;
+	bs->depth = q->depth;
+	bs->max_depth = q->max_depth;
+	bs->peak_depth = q->peak_depth;
+	bs->avg_depth = q->nr_started
+		? (unsigned long long) q->depth_sum * 100 / q->nr_started
+		: 0;
+	bs->avg_latency = done
+		? (unsigned long long) q->latency_sum * tick / done : 0;
+	bs->max_latency = q->max_latency * tick;
+
+	*status_count = BLKIO_STATUS_COUNT;
+	return D_SUCCESS;
+}
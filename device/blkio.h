@@ -20,7 +20,107 @@
 #define _DEVICE_BLKIO_H_
 
 #include <sys/types.h>
+#include <mach/boolean.h>
+#include <mach/message.h>
+#include <kern/list.h>
+#include <device/device_types.h>
+#include <device/blkio_status.h>
 
 extern vm_offset_t block_io_mmap(dev_t dev, vm_offset_t off, int prot);
 
+/*
+ * Generic block request queue.
+ *
+ * Drivers wrap their requests in a blkio_req and submit them to the
+ * queue of the device, which merges adjacent requests, orders them by
+ * sector with a deadline so that none starves, prefers reads over
+ * writes, and starts at most max_depth of them at once.
+ *
+ * The queue has no lock of its own: the driver serializes all calls
+ * on a queue, usually with the lock or interrupt masking that protects
+ * its completion handler.
+ */
+
+struct blkio_queue;
+
+struct blkio_req {
+	struct list	node;		/* in the sorted or active list */
+	struct list	fifo;		/* in the FIFO of its direction */
+	unsigned long long sector;	/* first sector */
+	unsigned long	nr_sectors;	/* size in sectors */
+	int		write;		/* whether this is a write */
+	unsigned long	queued;		/* tick when submitted */
+	unsigned long	deadline;	/* tick by which it should start */
+	void		*private;	/* driver request */
+};
+
+/*
+ * Called to merge REQ into INTO, in front of it if FRONT, behind it
+ * otherwise.  Returns FALSE if the driver can't build such a request;
+ * on success, REQ is no longer referenced by the queue.
+ */
+typedef boolean_t (*blkio_merge_fn_t)(struct blkio_queue *q,
+				      struct blkio_req *into,
+				      struct blkio_req *req,
+				      boolean_t front);
+
+/* Called to pass REQ to the hardware.  */
+typedef void (*blkio_start_fn_t)(struct blkio_queue *q, struct blkio_req *req);
+
+struct blkio_queue {
+	struct list	sorted;		/* waiting requests, by sector */
+	struct list	fifo[2];	/* waiting reads and writes, by age */
+	struct list	active;		/* started requests */
+	unsigned int	queued;		/* number of waiting requests */
+	unsigned int	depth;		/* number of started requests */
+	unsigned int	max_depth;	/* limit on depth */
+	unsigned long	max_sectors;	/* limit on merged requests, 0 if none */
+	unsigned long long next_sector;	/* end of the last started request */
+	int		batch_write;	/* direction of the current batch */
+	unsigned int	batch;		/* requests left in the current batch */
+	unsigned int	starved;	/* read batches while writes waited */
+	blkio_merge_fn_t merge;
+	blkio_start_fn_t start;
+	void		*private;	/* driver queue */
+
+	/* Statistics */
+	unsigned long	nr_reads;
+	unsigned long	nr_writes;
+	unsigned long	nr_merges;
+	unsigned long	nr_started;
+	unsigned long	depth_sum;	/* depth after each start */
+	unsigned int	peak_depth;
+	unsigned long	latency_sum;	/* in ticks */
+	unsigned long	max_latency;	/* in ticks */
+};
+
+/*
+ * Initialize queue Q, which starts requests with START and merges
+ * them with MERGE.  Merging is disabled if MERGE is NULL or
+ * MAX_SECTORS is 0.
+ */
+extern void blkio_queue_init(struct blkio_queue *q,
+			     blkio_start_fn_t start,
+			     blkio_merge_fn_t merge,
+			     unsigned int max_depth,
+			     unsigned long max_sectors,
+			     void *private);
+
+/*
+ * Queue request REQ, and start requests if the queue isn't full.
+ * Returns FALSE if REQ was merged into a queued request.
+ */
+extern boolean_t blkio_submit(struct blkio_queue *q, struct blkio_req *req);
+
+/* Note that the started request REQ completed, and start more.  */
+extern void blkio_done(struct blkio_queue *q, struct blkio_req *req);
+
+/* Return the started request of the driver request PRIVATE, if any.  */
+extern struct blkio_req *blkio_lookup(struct blkio_queue *q, void *private);
+
+/* Fill in the BLKIO_STATUS flavor of device_get_status.  */
+extern io_return_t blkio_get_status(const struct blkio_queue *q,
+				    dev_status_t status,
+				    mach_msg_type_number_t *status_count);
+
 #endif /* _DEVICE_BLKIO_H_ */
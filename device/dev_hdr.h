@@ -60,6 +60,7 @@
 #include <mach/port.h>
 #include <kern/lock.h>
 #include <kern/queue.h>
+#include <device/io_latency_status.h>
 
 typedef struct dev_ops *dev_ops_t;
 
@@ -100,6 +101,9 @@ struct mach_device {
 	int		bsize;		/* replacement for DEV_BSIZE */
 	struct dev_ops	*dev_ops;	/* and operations vector */
 	struct device	dev;		/* the real device structure */
+	unsigned int	io_latency[IO_LATENCY_BUCKETS];
+					/* completion latency histogram */
+	unsigned int	io_done_queues;	/* completion queues used */
 };
 typedef	struct mach_device *mach_device_t;
 #define	MACH_DEVICE_NULL ((mach_device_t)0)
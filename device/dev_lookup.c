@@ -28,6 +28,7 @@
  *	Date: 	3/89
  */
 
+#include <string.h>
 #include <mach/port.h>
 #include <mach/vm_param.h>
 
@@ -159,6 +160,9 @@ device_lookup(const char *name)
 	    new_device->dev_ops = dev_ops;
 	    new_device->dev_number = dev_minor;
 	    new_device->bsize = DEV_BSIZE;	/* change later */
+	    memset(new_device->io_latency, 0,
+		   sizeof new_device->io_latency);
+	    new_device->io_done_queues = 0;
 
 	    simple_lock(&dev_number_lock);
 	}
@@ -59,6 +59,9 @@ struct device_emulation_ops
 			     rpc_recnum_t, rpc_vm_offset_t, rpc_vm_size_t);
   io_return_t (*writev_trap) (void *, dev_mode_t,
 			      rpc_recnum_t, rpc_io_buf_vec_t *, rpc_vm_size_t);
+  io_return_t (*readv_trap) (void *, mach_port_name_t, dev_mode_t,
+			     rpc_recnum_t, io_buf_vec_t *, unsigned,
+			     vm_size_t *);
 };
 
 #endif /* _I386AT_DEVICE_EMUL_H_ */
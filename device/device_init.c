@@ -29,6 +29,7 @@
  *
  * 	Initialize device service as part of kernel task.
  */
+#include <mach/machine.h>
 #include <ipc/ipc_port.h>
 #include <ipc/ipc_space.h>
 #include <kern/debug.h>
@@ -49,6 +50,8 @@ ipc_port_t	master_device_port;
 void
 device_service_create(void)
 {
+	int i;
+
 	master_device_port = ipc_port_alloc_kernel();
 	if (master_device_port == IP_NULL)
 	    panic("can't allocate master device port");
@@ -62,6 +65,9 @@ device_service_create(void)
 	device_pager_init();
 	chario_init();
 
-	(void) kernel_thread(kernel_task, io_done_thread, 0);
+	for (i = 0; i < NCPUS; i++)
+	    if (machine_slot[i].is_cpu)
+		(void) kernel_thread(kernel_task, io_done_thread,
+				     (void *) (long) i);
 	(void) kernel_thread(kernel_task, net_thread, 0);
 }
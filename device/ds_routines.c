@@ -72,6 +72,7 @@
 #include <kern/counters.h>
 #include <kern/debug.h>
 #include <kern/printf.h>
+#include <kern/processor.h>
 #include <kern/queue.h>
 #include <kern/slab.h>
 #include <kern/thread.h>
@@ -79,8 +80,11 @@
 #include <kern/sched_prim.h>
 
 #include <vm/memory_object.h>
+#include <vm/vm_fault.h>
 #include <vm/vm_map.h>
 #include <vm/vm_kern.h>
+#include <vm/vm_object.h>
+#include <vm/vm_page.h>
 #include <vm/vm_user.h>
 
 #include <device/device_types.h>
@@ -449,6 +453,48 @@ ds_device_writev_trap (device_t dev, dev_mode_t mode,
 					mode, recnum, iovec, count);
 }
 
+io_return_t
+ds_device_readv_trap (device_t dev, mach_port_name_t rcv_name,
+		      dev_mode_t mode, rpc_recnum_t recnum,
+		      rpc_io_buf_vec_t *iovec, rpc_vm_size_t count,
+		      rpc_vm_size_t *bytes_read)
+{
+  io_buf_vec_t kiovec[16];	/* XXX */
+  rpc_io_buf_vec_t riov;
+  rpc_vm_size_t rcount;
+  vm_size_t amt = 0;
+  io_return_t err;
+  unsigned i;
+
+  /* Refuse if device is dead or not completely open.  */
+  if (dev == DEVICE_NULL)
+    return D_NO_SUCH_DEVICE;
+
+  if (! dev->emul_ops->readv_trap)
+    return D_INVALID_OPERATION;
+
+  if (count > 16)
+    return KERN_INVALID_VALUE;
+
+  /* Copy in the vector, the buffers themselves stay in user space.  */
+  for (i = 0; i < count; i++)
+    {
+      if (copyin (iovec + i, &riov, sizeof riov))
+	return KERN_INVALID_ARGUMENT;
+      kiovec[i].data = riov.data;
+      kiovec[i].count = riov.count;
+    }
+
+  err = (*dev->emul_ops->readv_trap) (dev->emul_data, rcv_name, mode,
+				      recnum, kiovec, count, &amt);
+
+  /* Report how much was transferred even if the read stopped early.  */
+  rcount = amt;
+  if (copyout (&rcount, bytes_read, sizeof rcount))
+    return KERN_INVALID_ARGUMENT;
+  return err;
+}
+
 void
 device_reference (device_t dev)
 {
@@ -1450,6 +1496,22 @@ mach_device_get_status(
 
 	/* XXX note that a CLOSE may proceed at any point */
 
+	if (flavor == IO_LATENCY_STATUS) {
+	    struct io_latency_status *ls;
+	    int i;
+
+	    if (*status_count < IO_LATENCY_STATUS_COUNT)
+		return (D_INVALID_OPERATION);
+
+	    ls = (struct io_latency_status *) status;
+	    ls->tick = tick;
+	    for (i = 0; i < IO_LATENCY_BUCKETS; i++)
+		ls->count[i] = device->io_latency[i];
+	    ls->queues = device->io_done_queues;
+	    *status_count = IO_LATENCY_STATUS_COUNT;
+	    return (D_SUCCESS);
+	}
+
 	return ((*device->dev_ops->d_getstat)(device->dev_number,
 					      flavor,
 					      status,
@@ -1515,12 +1577,52 @@ ds_no_senders(mach_no_senders_notification_t *notification)
 	       notification->not_count);
 }
 
-/* Shall be taken at splio only */
-def_simple_lock_irq_data(static,	io_done_list_lock)	/* Lock for... */
-queue_head_t		io_done_list;
+/*
+ * Completed requests are queued on the processor that submitted
+ * them, and processed by an io_done thread bound to it, so that
+ * completions of different devices are not serialized on a single
+ * processor.
+ */
+struct io_done_queue {
+	decl_simple_lock_irq_data(,	lock)	/* Shall be taken at splio only */
+	queue_head_t		list;
+	boolean_t		active;		/* has an io_done thread */
+};
+
+static struct io_done_queue	io_done_queue[NCPUS];
 
 #define	splio	splsched	/* XXX must block ALL io devices */
 
+/*
+ * Wake up the io_done thread of the master processor, which also
+ * frees the buffers of the Linux network glue.
+ */
+void io_done_wakeup(void)
+{
+	thread_wakeup((event_t)&io_done_queue[master_cpu]);
+}
+
+/*
+ * Account for the completion latency of ior on its device, and for
+ * the queue of processor cpu which processes it.
+ */
+static void io_done_latency(const io_req_t ior, int cpu)
+{
+	unsigned long	ticks;
+	int		i;
+
+	if (ior->io_device == MACH_DEVICE_NULL)
+	    return;
+
+	ticks = elapsed_ticks - ior->io_start;
+	for (i = 0; i < IO_LATENCY_BUCKETS - 1 && ticks >= (1UL << i); i++)
+	    continue;
+	__atomic_add_fetch(&ior->io_device->io_latency[i], 1,
+			   __ATOMIC_RELAXED);
+	__atomic_or_fetch(&ior->io_device->io_done_queues, 1U << (cpu % 32),
+			  __ATOMIC_RELAXED);
+}
+
 void iodone(io_req_t ior)
 {
 	spl_t			s;
@@ -1545,28 +1647,43 @@ void iodone(io_req_t ior)
 	    ior_unlock(ior);
 	    thread_wakeup((event_t)ior);
 	} else {
+	    struct io_done_queue *q;
+
+	    /*
+	     * Complete on the submitting processor where possible.
+	     */
+	    if (ior->io_cpu >= 0 && ior->io_cpu < NCPUS &&
+		io_done_queue[ior->io_cpu].active)
+		q = &io_done_queue[ior->io_cpu];
+	    else
+		q = &io_done_queue[master_cpu];
+
 	    ior->io_op |= IO_DONE;
-	    simple_lock_nocheck(&io_done_list_lock.slock);
-	    enqueue_tail(&io_done_list, (queue_entry_t)ior);
-	    thread_wakeup((event_t)&io_done_list);
-	    simple_unlock_nocheck(&io_done_list_lock.slock);
+	    simple_lock_nocheck(&q->lock.slock);
+	    enqueue_tail(&q->list, (queue_entry_t)ior);
+	    thread_wakeup((event_t)q);
+	    simple_unlock_nocheck(&q->lock.slock);
 	}
 	splx(s);
 }
 
 static void  __attribute__ ((noreturn)) io_done_thread_continue(void)
 {
+	struct io_done_queue	*q = &io_done_queue[cpu_number()];
+
 	for (;;) {
 	    spl_t		s;
 	    io_req_t		ior;
 
 #if defined (LINUX_DEV) && defined (CONFIG_INET)
-	    free_skbuffs ();
+	    if (cpu_number() == master_cpu)
+		free_skbuffs ();
 #endif
-	    s = simple_lock_irq(&io_done_list_lock);
-	    while ((ior = (io_req_t)dequeue_head(&io_done_list)) != 0) {
-		simple_unlock_irq(s, &io_done_list_lock);
+	    s = simple_lock_irq(&q->lock);
+	    while ((ior = (io_req_t)dequeue_head(&q->list)) != 0) {
+		simple_unlock_irq(s, &q->lock);
 
+		io_done_latency(ior, q - io_done_queue);
 		if ((*ior->io_done)(ior)) {
 		    /*
 		     * IO done - free io_req_elt
@@ -1575,18 +1692,24 @@ static void  __attribute__ ((noreturn)) io_done_thread_continue(void)
 		}
 		/* else routine has re-queued it somewhere */
 
-		s = simple_lock_irq(&io_done_list_lock);
+		s = simple_lock_irq(&q->lock);
 	    }
 
-	    assert_wait(&io_done_list, FALSE);
-	    simple_unlock_irq(s, &io_done_list_lock);
+	    assert_wait((event_t)q, FALSE);
+	    simple_unlock_irq(s, &q->lock);
 	    counter(c_io_done_thread_block++);
 	    thread_block(io_done_thread_continue);
 	}
 }
 
+/*
+ * Started once for each processor, whose number is the thread
+ * argument.
+ */
 void io_done_thread(void)
 {
+	int	cpu = (long) current_thread()->ith_other;
+
 	/*
 	 * Set thread privileges and highest priority.
 	 */
@@ -1594,6 +1717,13 @@ void io_done_thread(void)
 	stack_privilege(current_thread());
 	thread_set_own_priority(0);
 
+	/*
+	 * Get onto our processor.
+	 */
+	thread_bind(current_thread(), cpu_to_processor(cpu));
+	thread_block(thread_no_continuation);
+	io_done_queue[cpu].active = TRUE;
+
 	io_done_thread_continue();
 	/*NOTREACHED*/
 }
@@ -1605,9 +1735,13 @@ static void mach_device_trap_init(void);		/* forward */
 void mach_device_init(void)
 {
 	vm_offset_t	device_io_min, device_io_max;
+	int		i;
 
-	queue_init(&io_done_list);
-	simple_lock_init_irq(&io_done_list_lock);
+	for (i = 0; i < NCPUS; i++) {
+		queue_init(&io_done_queue[i].list);
+		simple_lock_init_irq(&io_done_queue[i].lock);
+		io_done_queue[i].active = FALSE;
+	}
 
 	kmem_submap(device_io_map, kernel_map, &device_io_min, &device_io_max,
 		    DEVICE_IO_MAP_SIZE);
@@ -1689,7 +1823,146 @@ mach_device_trap_init(void)
 static io_req_t
 ds_trap_req_alloc(const mach_device_t device, vm_size_t data_size)
 {
-	return (io_req_t) kmem_cache_alloc(&io_trap_cache);
+	io_req_t ior;
+
+	ior = (io_req_t) kmem_cache_alloc(&io_trap_cache);
+	io_req_init(ior);
+	return ior;
+}
+
+/*
+ * Fault in the page at addr of map for writing, and wire it.  The
+ * page is wired by itself rather than through the map entry, so that
+ * it stays in place whatever the task does with its map meanwhile,
+ * and its object is referenced so that it remains allocated.
+ */
+static kern_return_t
+ds_user_page_pin(vm_map_t map, vm_offset_t addr, vm_page_t *mp)
+{
+	vm_map_t lmap;
+	vm_map_version_t version;
+	vm_object_t object;
+	vm_offset_t offset;
+	vm_prot_t prot;
+	boolean_t wired;
+	vm_page_t m;
+	kern_return_t kr;
+
+	for (;;) {
+		kr = vm_fault(map, addr, VM_PROT_READ|VM_PROT_WRITE,
+			      FALSE, FALSE, NULL);
+		if (kr != KERN_SUCCESS)
+			return kr;
+
+		lmap = map;
+		kr = vm_map_lookup(&lmap, addr, VM_PROT_READ|VM_PROT_WRITE,
+				   &version, &object, &offset, &prot, &wired);
+		if (kr != KERN_SUCCESS)
+			return kr;
+
+		m = VM_PAGE_NULL;
+		if (object != VM_OBJECT_NULL) {
+			vm_object_lock(object);
+			m = vm_page_lookup(object, offset);
+			if (m != VM_PAGE_NULL &&
+			    (m->busy || m->absent || m->error))
+				m = VM_PAGE_NULL;
+			if (m != VM_PAGE_NULL) {
+				vm_page_lock_queues();
+				vm_page_wire(m);
+				vm_page_unlock_queues();
+				vm_object_reference_locked(object);
+			}
+			vm_object_unlock(object);
+		}
+		vm_map_unlock_read(lmap);
+
+		if (m != VM_PAGE_NULL) {
+			*mp = m;
+			return KERN_SUCCESS;
+		}
+
+		/* The page went away before we could wire it, retry */
+	}
+}
+
+/*
+ * Undo ds_user_page_pin, once the device wrote to the page.
+ */
+static void
+ds_user_page_unpin(vm_page_t m)
+{
+	vm_object_t object = m->object;
+
+	vm_object_lock(object);
+	m->dirty = TRUE;
+	vm_page_lock_queues();
+	vm_page_unwire(m);
+	vm_page_unlock_queues();
+	vm_object_unlock(object);
+	vm_object_deallocate(object);
+}
+
+/*
+ * Wire the pages of the buffer [addr, addr + size) of the current
+ * task for writing and map them into device_io_map.  Return the
+ * kernel address of the buffer in *kaddr.
+ */
+kern_return_t
+ds_user_buffer_map(vm_offset_t addr, vm_size_t size, vm_offset_t *kaddr)
+{
+	vm_map_t map = current_map();
+	vm_offset_t start, end, kva, o;
+	vm_page_t m;
+	kern_return_t kr;
+
+	start = trunc_page(addr);
+	end = round_page(addr + size);
+	if (size == 0 || end <= start)
+		return KERN_INVALID_ARGUMENT;
+
+	kva = vm_map_min(device_io_map);
+	kr = vm_map_enter(device_io_map, &kva, end - start, 0, TRUE,
+			  VM_OBJECT_NULL, 0, FALSE,
+			  VM_PROT_READ|VM_PROT_WRITE,
+			  VM_PROT_READ|VM_PROT_WRITE, VM_INHERIT_NONE);
+	if (kr != KERN_SUCCESS)
+		return kr;
+
+	for (o = start; o < end; o += PAGE_SIZE) {
+		kr = ds_user_page_pin(map, o, &m);
+		if (kr != KERN_SUCCESS) {
+			ds_user_buffer_unmap(start, o - start, kva);
+			vm_map_remove(device_io_map, kva + (o - start),
+				      kva + (end - start));
+			return kr;
+		}
+		pmap_enter(vm_map_pmap(device_io_map), kva + (o - start),
+			   m->phys_addr, VM_PROT_READ|VM_PROT_WRITE, TRUE);
+	}
+
+	*kaddr = kva + (addr - start);
+	return KERN_SUCCESS;
+}
+
+/*
+ * Undo ds_user_buffer_map.
+ */
+void
+ds_user_buffer_unmap(vm_offset_t addr, vm_size_t size, vm_offset_t kaddr)
+{
+	vm_offset_t start, end, kva, o;
+
+	start = trunc_page(addr);
+	end = round_page(addr + size);
+	kva = trunc_page(kaddr);
+
+	for (o = 0; o < end - start; o += PAGE_SIZE)
+		ds_user_page_unpin(vm_page_lookup_pa(
+			pmap_extract(vm_map_pmap(device_io_map), kva + o)));
+
+	pmap_remove(vm_map_pmap(device_io_map), kva, kva + (end - start));
+	vm_map_remove(device_io_map, kva, kva + (end - start));
 }
 
 /*
@@ -1880,6 +2153,95 @@ device_writev_trap (mach_device_t device, dev_mode_t mode,
 	return (result);
 }
 
+/*
+ * Like device_read except that the data is scattered into user
+ * buffers instead of being returned out-of-line.
+ */
+static io_return_t
+device_readv_trap (mach_device_t device, mach_port_name_t rcv_name,
+		   dev_mode_t mode, rpc_recnum_t recnum,
+		   io_buf_vec_t *iovec, unsigned iocount,
+		   vm_size_t *bytes_read)
+{
+	io_req_t ior;
+	io_return_t result;
+	vm_size_t data_count, size_read, amt;
+	vm_offset_t p;
+	unsigned i;
+
+	if (device->state != DEV_STATE_OPEN)
+		return (D_NO_SUCH_DEVICE);
+
+	if (rcv_name != MACH_PORT_NULL)
+		return (KERN_INVALID_RIGHT);
+
+	/* XXX note that a CLOSE may proceed at any point */
+
+	for (data_count = 0, i = 0; i < iocount; i++)
+		data_count += iovec[i].count;
+
+	/*
+	 * Package the read request for the device driver.
+	 * Nobody sets IO_CALL, we wait for it ourselves.
+	 */
+	io_req_alloc(ior, 0);
+
+	ior->io_device		= device;
+	ior->io_unit		= device->dev_number;
+	ior->io_op		= IO_READ;
+	ior->io_mode		= mode;
+	ior->io_recnum		= recnum;
+	ior->io_data		= 0;		/* driver must allocate data */
+	ior->io_count		= data_count;
+	ior->io_alloc_size	= 0;		/* no data allocated yet */
+	ior->io_residual	= 0;
+	ior->io_error		= 0;
+	ior->io_done		= 0;
+	ior->io_reply_port	= IP_NULL;
+	ior->io_reply_port_type	= 0;
+
+	mach_device_reference(device);
+
+	result = (*device->dev_ops->d_read)(device->dev_number, ior);
+	if (result == D_IO_QUEUED) {
+		iowait(ior);
+		result = ior->io_error;
+	}
+
+	mach_device_deallocate(device);
+
+	/*
+	 * Scatter what was read into the user buffers.
+	 */
+	if (result == D_SUCCESS) {
+		size_read = ior->io_count - ior->io_residual;
+		p = (vm_offset_t) ior->io_data;
+		for (i = 0; i < iocount && size_read > 0; i++) {
+			amt = iovec[i].count;
+			if (amt > size_read)
+				amt = size_read;
+			if (copyout((void *) p, (void *) iovec[i].data, amt)) {
+				result = KERN_INVALID_ARGUMENT;
+				break;
+			}
+			p += amt;
+			size_read -= amt;
+			*bytes_read += amt;
+		}
+	}
+
+	if (ior->io_alloc_size > 0) {
+		if (ior->io_op & IO_INBAND)
+			kmem_cache_free(&io_inband_cache,
+					(vm_offset_t) ior->io_data);
+		else
+			kmem_free(kernel_map, (vm_offset_t) ior->io_data,
+				  ior->io_alloc_size);
+	}
+	io_req_free(ior);
+	return (result);
+}
+
 struct device_emulation_ops mach_device_emulation_ops =
 {
   (void*) mach_device_reference,
@@ -1897,5 +2259,6 @@ struct device_emulation_ops mach_device_emulation_ops =
   device_map,
   ds_no_senders,
   (void*) device_write_trap,
-  (void*) device_writev_trap
+  (void*) device_writev_trap,
+  (void*) device_readv_trap
 };
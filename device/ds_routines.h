@@ -43,7 +43,7 @@
  */
 extern vm_map_t		device_io_map;
 
-extern queue_head_t	io_done_list;
+extern void	io_done_wakeup(void);
 
 kern_return_t	device_read_alloc(io_req_t, vm_size_t);
 kern_return_t	device_write_get(io_req_t, boolean_t *);
@@ -83,4 +83,27 @@ io_return_t ds_device_writev_trap(
 	rpc_io_buf_vec_t 	*iovec,
 	rpc_vm_size_t 	count);
 
+io_return_t ds_device_readv_trap(
+	device_t 	dev,
+	mach_port_name_t	rcv_name,
+	dev_mode_t 	mode,
+	rpc_recnum_t 	recnum,
+	rpc_io_buf_vec_t 	*iovec,
+	rpc_vm_size_t 	count,
+	rpc_vm_size_t	*bytes_read);
+
+/*
+ * Wire the pages of a buffer of the current task and map them into
+ * device_io_map, so that a driver can transfer data to it directly.
+ */
+kern_return_t	ds_user_buffer_map(
+	vm_offset_t	addr,
+	vm_size_t	size,
+	vm_offset_t	*kaddr);
+
+void		ds_user_buffer_unmap(
+	vm_offset_t	addr,
+	vm_size_t	size,
+	vm_offset_t	kaddr);
+
 #endif	/* DS_ROUTINES_H */
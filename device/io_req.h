@@ -38,6 +38,8 @@
 #include <kern/slab.h>
 #include <kern/kalloc.h>
 #include <kern/lock.h>
+#include <kern/cpu_number.h>
+#include <kern/mach_clock.h>
 #include <vm/vm_map.h>
 #include <vm/vm_page.h>
 #include <device/device_types.h>
@@ -86,6 +88,9 @@ struct io_req {
 	long            io_physrec;    /* mapping to the physical block
 					   number */
 	long            io_rectotal;   /* total number of blocks to move */
+	int		io_cpu;		/* submitting processor, where
+					   completion is processed */
+	unsigned long	io_start;	/* elapsed_ticks at submission */
 };
 
 /*
@@ -127,13 +132,24 @@ struct io_req {
  */
 void	iodone(io_req_t);
 
+/*
+ * Set up the fields of a newly allocated IOR which its submitter
+ * doesn't fill in.
+ */
+#define	io_req_init(ior)					\
+	MACRO_BEGIN						\
+	simple_lock_init(&(ior)->io_req_lock);			\
+	(ior)->io_cpu = cpu_number();				\
+	(ior)->io_start = elapsed_ticks;			\
+	MACRO_END
+
 /*
  * Macros to allocate and free IORs - will convert to caches later.
  */
 #define	io_req_alloc(ior,size)					\
 	MACRO_BEGIN						\
 	(ior) = (io_req_t)kalloc(sizeof(struct io_req));	\
-	simple_lock_init(&(ior)->io_req_lock);			\
+	io_req_init(ior);					\
 	MACRO_END
 
 #define	io_req_free(ior)					\
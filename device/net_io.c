@@ -47,6 +47,7 @@
 #include <device/if_hdr.h>
 #include <device/io_req.h>
 #include <device/ds_routines.h>
+#include <device/net_ring.h>
 
 #include <mach/boolean.h>
 #include <mach/vm_param.h>
@@ -54,10 +55,14 @@
 #include <ipc/ipc_port.h>
 #include <ipc/ipc_kmsg.h>
 #include <ipc/ipc_mqueue.h>
+#include <ipc/ipc_object.h>
+#include <ipc/ipc_space.h>
 
 #include <kern/counters.h>
 #include <kern/debug.h>
+#include <kern/host.h>
 #include <kern/lock.h>
+#include <kern/mach_debug.server.h>
 #include <kern/printf.h>
 #include <kern/queue.h>
 #include <kern/sched_prim.h>
@@ -65,6 +70,8 @@
 #include <kern/thread.h>
 
 #include <machine/machspl.h>
+#include <machine/locore.h>
+#include <machine/bpf_jit.h>
 
 #if	MACH_TTD
 #include <ttd/ttd_stub.h>
@@ -262,6 +269,17 @@ net_kmsg_more(void)
 	}
 }
 
+/*
+ * A batch filter may hold one more buffer in its pending batch.
+ */
+static void
+net_add_batch_info(int n)
+{
+	simple_lock(&net_kmsg_total_lock);
+	net_kmsg_max += n;
+	simple_unlock(&net_kmsg_total_lock);
+}
+
 /*
  *	Packet Filter Data Structures
  *
@@ -297,6 +315,9 @@ struct net_rcv_port {
 	int		rcv_qlimit;	/* port's qlimit */
 	int		rcv_count;	/* number of packets received */
 	int		priority;	/* priority for filter */
+	bpf_jit_filter_t jit;		/* compiled BPF filter, or NULL */
+	vm_size_t	jit_size;	/* size of its code */
+	struct net_rings *ring;		/* rings of NETF_RING, or 0 */
 	filter_t	*filter_end;	/* pointer to end of filter */
 	filter_t	filter[NET_MAX_FILTER];
 					/* filter operations */
@@ -405,18 +426,223 @@ mach_msg_type_t packet_type = {
 	.msgt_unused = 0
 };
 
+/*
+ *	Send a finished message to its destination port.  Drop it
+ *	if the destination port is over its backlog.
+ */
+static void net_kmsg_send(ipc_kmsg_t kmsg, boolean_t high_priority)
+{
+	if (ipc_mqueue_send(kmsg, MACH_SEND_TIMEOUT, 0) ==
+					    MACH_MSG_SUCCESS) {
+	    if (high_priority)
+		net_kmsg_send_high_hits++;
+	    else
+		net_kmsg_send_low_hits++;
+	    /* the receiver is responsible for the message now */
+	} else {
+	    if (high_priority)
+		net_kmsg_send_high_misses++;
+	    else
+		net_kmsg_send_low_misses++;
+	    ipc_kmsg_destroy(kmsg);
+	}
+}
+
+/*
+ *	Batched delivery.
+ *
+ *	Packets for NETF_BATCH filters are packed into a pending
+ *	net_rcv_batch_msg for their port, which is sent when it is full
+ *	or when there are no more packets to deliver.  A burst then
+ *	costs one message per port instead of one per packet.  The
+ *	buffer of the first packet becomes the batch, the following
+ *	packets are copied into it and their buffers recycled, so each
+ *	batch filter holds at most one more buffer.
+ */
+#define NET_BATCH_SLOTS	8
+
+struct net_batch {
+	ipc_kmsg_t	kmsg;		/* pending message, or IKM_NULL */
+	int		count;		/* packets in it */
+	vm_size_t	size;		/* bytes of entries in it */
+	boolean_t	high_priority;	/* any of them was */
+};
+
+def_simple_lock_data(static,net_batch_lock)
+static struct net_batch	net_batch[NET_BATCH_SLOTS];
+static int	net_batch_pending = 0;	/* slots in use */
+static int	net_batch_evict = 0;	/* next slot to evict */
+
+int		net_batch_max = 32;	/* packets per message */
+
+int		net_batch_sent = 0;	/* for debugging */
+int		net_batch_packets = 0;	/* for debugging */
+int		net_batch_evictions = 0;	/* for debugging */
+
+/*
+ *	Take the message out of batch slot B, ready to be sent.
+ *	Called holding net_batch_lock.
+ */
+static ipc_kmsg_t net_batch_finish(struct net_batch *b)
+{
+	ipc_kmsg_t kmsg = b->kmsg;
+
+	ikm_init_special(kmsg, IKM_SIZE_NETWORK);
+
+	kmsg->ikm_header.msgh_bits =
+		MACH_MSGH_BITS(MACH_MSG_TYPE_PORT_SEND, 0);
+	kmsg->ikm_header.msgh_size =
+		(mach_msg_size_t) P2ROUND(sizeof(struct net_rcv_batch_msg)
+				- NET_RCV_BATCH_MAX + b->size,
+				__alignof__ (uintptr_t));
+	kmsg->ikm_header.msgh_local_port = MACH_PORT_NULL;
+	kmsg->ikm_header.msgh_kind = MACH_MSGH_KIND_NORMAL;
+	kmsg->ikm_header.msgh_id = NET_RCV_BATCH_MSG_ID;
+
+	net_batch_kmsg(kmsg)->packet_type = packet_type;
+	net_batch_kmsg(kmsg)->packet_type.msgt_number = b->size;
+
+	net_batch_sent++;
+	net_batch_packets += b->count;
+
+	b->kmsg = IKM_NULL;
+	net_batch_pending--;
+	return kmsg;
+}
+
+/*
+ *	Add the packet of KMSG, whose header is HSIZE bytes long, to
+ *	the batch of its destination port.
+ */
+static void net_batch_add(
+	ipc_kmsg_t	kmsg,
+	unsigned int	hsize,
+	boolean_t	high_priority)
+{
+	ipc_port_t dest = (ipc_port_t) kmsg->ikm_header.msgh_remote_port;
+	unsigned int psize = net_kmsg(kmsg)->net_rcv_msg_packet_count;
+	vm_size_t size = NET_BATCH_ENTRY_SIZE(hsize, psize);
+	struct net_rcv_batch_entry *entry;
+	struct net_batch *b, *slot;
+	ipc_kmsg_t full = IKM_NULL;
+	boolean_t full_high_priority = FALSE;
+	char *packets;
+	int i;
+
+	simple_lock(&net_batch_lock);
+
+	b = slot = 0;
+	for (i = 0; i < NET_BATCH_SLOTS; i++) {
+	    if (net_batch[i].kmsg == IKM_NULL) {
+		if (slot == 0)
+		    slot = &net_batch[i];
+	    } else if (net_batch[i].kmsg->ikm_header.msgh_remote_port ==
+		       (mach_port_t) dest) {
+		b = &net_batch[i];
+		break;
+	    }
+	}
+
+	if (b != 0 && (b->count >= net_batch_max ||
+		       b->size + size > NET_RCV_BATCH_MAX)) {
+	    /* No room left, send it and start another one.  */
+	    full_high_priority = b->high_priority;
+	    full = net_batch_finish(b);
+	    slot = b;
+	    b = 0;
+	} else if (b == 0 && slot == 0) {
+	    /* Too many ports, send the oldest batch.  */
+	    slot = &net_batch[net_batch_evict];
+	    net_batch_evict = (net_batch_evict + 1) % NET_BATCH_SLOTS;
+	    full_high_priority = slot->high_priority;
+	    full = net_batch_finish(slot);
+	    net_batch_evictions++;
+	}
+
+	if (b == 0) {
+	    /*
+	     * Turn this buffer into a batch: the header and the
+	     * packet move down over header_type and the end of
+	     * header, to follow the entry.
+	     */
+	    packets = net_batch_kmsg(kmsg)->packets;
+	    memmove(packets + sizeof *entry, net_kmsg(kmsg)->header, hsize);
+	    memmove(packets + NET_BATCH_PACKET(hsize),
+		    net_kmsg(kmsg)->packet, psize);
+	    entry = (struct net_rcv_batch_entry *) packets;
+	    entry->header_size = hsize;
+	    entry->packet_size = psize;
+
+	    slot->kmsg = kmsg;
+	    slot->count = 1;
+	    slot->size = size;
+	    slot->high_priority = high_priority;
+	    net_batch_pending++;
+	    kmsg = IKM_NULL;
+	} else {
+	    packets = net_batch_kmsg(b->kmsg)->packets + b->size;
+	    entry = (struct net_rcv_batch_entry *) packets;
+	    entry->header_size = hsize;
+	    entry->packet_size = psize;
+	    memcpy(packets + sizeof *entry, net_kmsg(kmsg)->header, hsize);
+	    memcpy(packets + NET_BATCH_PACKET(hsize),
+		   net_kmsg(kmsg)->packet, psize);
+
+	    b->count++;
+	    b->size += size;
+	    b->high_priority |= high_priority;
+	}
+
+	simple_unlock(&net_batch_lock);
+
+	if (kmsg != IKM_NULL) {
+	    /* Copied into the batch, which holds its own send right.  */
+	    ipc_port_release_send(dest);
+	    net_kmsg_put(kmsg);
+	}
+	if (full != IKM_NULL)
+	    net_kmsg_send(full, full_high_priority);
+}
+
+/*
+ *	Send all the pending batches.
+ */
+static void net_batch_flush(void)
+{
+	struct net_batch *b;
+	ipc_kmsg_t kmsg;
+	boolean_t high_priority;
+
+	for (b = net_batch; b < &net_batch[NET_BATCH_SLOTS]; b++) {
+	    kmsg = IKM_NULL;
+	    high_priority = FALSE;
+
+	    simple_lock(&net_batch_lock);
+	    if (b->kmsg != IKM_NULL) {
+		high_priority = b->high_priority;
+		kmsg = net_batch_finish(b);
+	    }
+	    simple_unlock(&net_batch_lock);
+
+	    if (kmsg != IKM_NULL)
+		net_kmsg_send(kmsg, high_priority);
+	}
+}
+
 /*
  *	net_deliver:
  *
  *	Called and returns holding net_queue_lock, at splimp.
  *	Dequeues a message and delivers it at spl0.
- *	Returns FALSE if no messages.
+ *	Returns FALSE if no messages.  Once the queues are empty,
+ *	the pending batches are sent first.
  */
 static boolean_t net_deliver(boolean_t nonblocking)
 {
 	ipc_kmsg_t kmsg;
 	boolean_t high_priority;
-	struct ipc_kmsg_queue send_list;
+	struct ipc_kmsg_queue send_list, batch_list;
+	unsigned int hsize;
 
 	/*
 	 * Pick up a pending network message and deliver it.
@@ -429,16 +655,29 @@ static boolean_t net_deliver(boolean_t nonblocking)
 	} else if ((kmsg = ipc_kmsg_dequeue(&net_queue_low)) != IKM_NULL) {
 	    net_queue_low_size--;
 	    high_priority = FALSE;
+	} else if (net_batch_pending != 0) {
+	    simple_unlock(&net_queue_lock);
+	    (void) spl0();
+	    net_batch_flush();
+	    (void) splimp();
+	    simple_lock(&net_queue_lock);
+	    return TRUE;
 	} else
 	    return FALSE;
 	simple_unlock(&net_queue_lock);
 	(void) spl0();
 
+	hsize = ((struct ifnet *) kmsg->ikm_header.msgh_remote_port)
+		->if_header_size;
+	if (hsize > NET_HDW_HDR_MAX)
+	    hsize = NET_HDW_HDR_MAX;
+
 	/*
 	 * Run the packet through the filters,
-	 * getting back a queue of packets to send.
+	 * getting back queues of packets to send
+	 * and of packets to batch.
 	 */
-	net_filter(kmsg, &send_list);
+	net_filter(kmsg, &send_list, &batch_list);
 
 	if (!nonblocking) {
 	    /*
@@ -462,6 +701,18 @@ static boolean_t net_deliver(boolean_t nonblocking)
 
 	    ikm_init_special(kmsg, IKM_SIZE_NETWORK);
 
+	    if (count == 0) {
+		/* A wakeup for a mapped ring, see net_filter.  */
+		kmsg->ikm_header.msgh_bits =
+			MACH_MSGH_BITS(MACH_MSG_TYPE_PORT_SEND, 0);
+		kmsg->ikm_header.msgh_size = sizeof(mach_msg_header_t);
+		kmsg->ikm_header.msgh_local_port = MACH_PORT_NULL;
+		kmsg->ikm_header.msgh_kind = MACH_MSGH_KIND_NORMAL;
+		kmsg->ikm_header.msgh_id = NET_RING_MSG_ID;
+		net_kmsg_send(kmsg, high_priority);
+		continue;
+	    }
+
 	    kmsg->ikm_header.msgh_bits =
 		    MACH_MSGH_BITS(MACH_MSG_TYPE_PORT_SEND, 0);
 	    /* remember message sizes must be rounded up */
@@ -478,27 +729,12 @@ static boolean_t net_deliver(boolean_t nonblocking)
 	    net_kmsg(kmsg)->packet_type = packet_type;
 	    net_kmsg(kmsg)->net_rcv_msg_packet_count = count;
 
-	    /*
-	     * Send the packet to the destination port.  Drop it
-	     * if the destination port is over its backlog.
-	     */
-
-	    if (ipc_mqueue_send(kmsg, MACH_SEND_TIMEOUT, 0) ==
-						    MACH_MSG_SUCCESS) {
-		if (high_priority)
-		    net_kmsg_send_high_hits++;
-		else
-		    net_kmsg_send_low_hits++;
-		/* the receiver is responsible for the message now */
-	    } else {
-		if (high_priority)
-		    net_kmsg_send_high_misses++;
-		else
-		    net_kmsg_send_low_misses++;
-		ipc_kmsg_destroy(kmsg);
-	    }
+	    net_kmsg_send(kmsg, high_priority);
 	}
 
+	while ((kmsg = ipc_kmsg_dequeue(&batch_list)) != IKM_NULL)
+	    net_batch_add(kmsg, hsize, high_priority);
+
 	(void) splimp();
 	simple_lock(&net_queue_lock);
 	return TRUE;
@@ -692,7 +928,8 @@ int net_filter_queue_reorder = 0; /* non-zero to enable reordering */
  */
 void
 net_filter(const ipc_kmsg_t	kmsg,
-	ipc_kmsg_queue_t	send_list)
+	ipc_kmsg_queue_t	send_list,
+	ipc_kmsg_queue_t	batch_list)
 {
 	struct ifnet		*ifp;
 	net_rcv_port_t		infp, nextfp;
@@ -703,12 +940,26 @@ net_filter(const ipc_kmsg_t	kmsg,
  	queue_entry_t		dead_infp = (queue_entry_t) 0;
  	queue_entry_t		dead_entp = (queue_entry_t) 0;
  	unsigned int		ret_count;
+	unsigned int		hsize;
 
 	queue_head_t *if_port_list;
 
-	int count = net_kmsg(kmsg)->net_rcv_msg_packet_count;
+	unsigned int count = net_kmsg(kmsg)->net_rcv_msg_packet_count;
 	ifp = (struct ifnet *) kmsg->ikm_header.msgh_remote_port;
+	hsize = ifp->if_header_size;
+	if (hsize > NET_HDW_HDR_MAX)
+	    hsize = NET_HDW_HDR_MAX;
 	ipc_kmsg_queue_init(send_list);
+	ipc_kmsg_queue_init(batch_list);
+
+	/*
+	 * The filters and the rings take the packet header for
+	 * granted: drop packets too short to have one.
+	 */
+	if (count < sizeof(struct packet_header)) {
+	    net_kmsg_put(kmsg);
+	    return;
+	}
 
 	if (net_kmsg(kmsg)->sent)
 	    if_port_list = &ifp->if_snd_port_list;
@@ -784,10 +1035,27 @@ net_filter(const ipc_kmsg_t	kmsg,
  		    }
 		}
 
+		/*
+		 * Copy packets for a mapped ring there, and only
+		 * send a wakeup, without the packet, if the task asked
+		 * for one.
+		 */
+		if (infp->ring != 0) {
+		    if (!net_ring_rx(infp->ring, net_kmsg(kmsg)->header,
+				     hsize, net_kmsg(kmsg)->packet
+					    + sizeof(struct packet_header),
+				     ret_count - sizeof(struct packet_header))) {
+			ipc_port_release_send(dest);
+			goto delivered;
+		    }
+		    ret_count = 0;
+		}
+
 		/*
 		 * Deliver copy of packet to this channel.
 		 */
-		if (ipc_kmsg_queue_empty(send_list)) {
+		if (ipc_kmsg_queue_empty(send_list) &&
+		    ipc_kmsg_queue_empty(batch_list)) {
 		    /*
 		     * Only receiver, so far
 		     */
@@ -813,8 +1081,13 @@ net_filter(const ipc_kmsg_t	kmsg,
 		}
  		net_kmsg(new_kmsg)->net_rcv_msg_packet_count = ret_count;
 		new_kmsg->ikm_header.msgh_remote_port = (mach_port_t) dest;
-		ipc_kmsg_enqueue(send_list, new_kmsg);
+		if ((infp->filter[0] & NETF_BATCH) &&
+		    entp == (net_hash_entry_t) 0)
+		    ipc_kmsg_enqueue(batch_list, new_kmsg);
+		else
+		    ipc_kmsg_enqueue(send_list, new_kmsg);
 
+	    delivered:
 	    {
 		net_rcv_port_t prevfp;
 		int rcount = ++infp->rcv_count;
@@ -864,7 +1137,8 @@ net_filter(const ipc_kmsg_t	kmsg,
  	if (dead_entp != 0)
  		net_free_dead_entp(dead_entp);
 
-	if (ipc_kmsg_queue_empty(send_list)) {
+	if (ipc_kmsg_queue_empty(send_list) &&
+	    ipc_kmsg_queue_empty(batch_list)) {
 	    /* Not sent - recycle */
 	    net_kmsg_put(kmsg);
 	}
@@ -1123,6 +1397,9 @@ net_set_filter(
     int				ret, is_new_infp;
     io_return_t			rval;
     boolean_t			in, out;
+    bpf_jit_filter_t		jit, old_jit;
+    vm_size_t			jit_size, old_jit_size;
+    struct net_rings		*ring;
 
     /* Initialize hash_entp to NULL to quiet GCC
      * warning about uninitialized variable. hash_entp is only
@@ -1142,6 +1419,8 @@ net_set_filter(
 	return (D_INVALID_OPERATION);
     } else if (!((filter[0] & NETF_IN) || (filter[0] & NETF_OUT))) {
 	return (D_INVALID_OPERATION); /* NETF_IN or NETF_OUT required */
+    } else if ((filter[0] & NETF_BATCH) && (filter[0] & NETF_RING)) {
+	return (D_INVALID_OPERATION); /* one way of delivery only */
     } else if ((filter[0] & NETF_TYPE_MASK) == NETF_BPF) {
 	ret = bpf_validate((bpf_insn_t)filter, filter_bytes, &match);
 	if (!ret)
@@ -1153,9 +1432,32 @@ net_set_filter(
 	return (D_INVALID_OPERATION);
     }
 
+    /*
+     * A ring goes to a single port, so it cannot be shared through
+     * the hash entries of a filter, and must have been mapped.
+     */
+    ring = 0;
+    if (filter[0] & NETF_RING) {
+	if (match != (bpf_insn_t) 0)
+	    return (D_INVALID_OPERATION);
+	ring = net_ring_lookup(ifp, NETF_RING_NUMBER(filter[0]));
+	if (ring == 0)
+	    return (D_INVALID_OPERATION);
+    }
+
     rval = D_SUCCESS;			/* default return value */
     dead_infp = dead_entp = 0;
 
+    /*
+     * Compile BPF programs while we can still allocate memory.
+     * The code is left unused if the filter turns out to be
+     * already installed.
+     */
+    jit = NULL;
+    jit_size = 0;
+    if ((filter[0] & NETF_TYPE_MASK) == NETF_BPF)
+	jit = bpf_jit_compile((bpf_insn_t)filter, filter_bytes, &jit_size);
+
     if (match == (bpf_insn_t) 0) {
         /*
 	 * If there is no match instruction, we allocate
@@ -1163,6 +1465,8 @@ net_set_filter(
 	 */
 	my_infp = (net_rcv_port_t) kmem_cache_alloc(&net_rcv_cache);
 	my_infp->rcv_port = rcv_port;
+	my_infp->jit = NULL;
+	my_infp->ring = ring;
 	is_new_infp = TRUE;
     } else {
         /*
@@ -1251,12 +1555,42 @@ net_set_filter(
 	FILTER_ITERATE_END
     }
 
+    /*
+     * Look for a live filter of another port using the same ring.
+     */
+    boolean_t ring_in_use(queue_head_t *if_port_list)
+    {
+	FILTER_ITERATE(if_port_list, infp, nextfp,
+                       (if_port_list == &ifp->if_rcv_port_list)
+                       ? &infp->input : &infp->output)
+	{
+	    if (infp->ring == ring
+		&& infp->rcv_port != rcv_port
+		&& IP_VALID(infp->rcv_port)
+		&& ip_active(infp->rcv_port))
+		return TRUE;
+	}
+	FILTER_ITERATE_END
+	return FALSE;
+    }
+
     in = (filter[0] & NETF_IN) != 0;
     out = (filter[0] & NETF_OUT) != 0;
 
     simple_lock(&ifp->if_rcv_port_list_lock);
     simple_lock(&ifp->if_snd_port_list_lock);
 
+    if (ring != 0
+	&& (ring_in_use(&ifp->if_rcv_port_list)
+	    || ring_in_use(&ifp->if_snd_port_list))) {
+	simple_unlock(&ifp->if_snd_port_list_lock);
+	simple_unlock(&ifp->if_rcv_port_list_lock);
+
+	kmem_cache_free(&net_rcv_cache, (vm_offset_t) my_infp);
+	rval = D_ALREADY_OPEN;
+	goto clean_and_return;
+    }
+
     if (in)
 	check_filter_list(&ifp->if_rcv_port_list);
     if (out)
@@ -1293,6 +1627,7 @@ net_set_filter(
 
 	my_infp = (net_rcv_port_t)hhp;
 	my_infp->rcv_port = MACH_PORT_NULL;	/* indication of dummy */
+	my_infp->ring = 0;
 	is_new_infp = TRUE;
     }
 
@@ -1305,8 +1640,22 @@ net_set_filter(
 	my_infp->filter_end =
 	    (filter_t *)((char *)my_infp->filter + filter_bytes);
 
+	/*
+	 * Install the compiled code.  A hash header may still hold
+	 * the code of its previous use, which nothing can be running
+	 * since it was removed from the lists: free it instead.
+	 */
+	old_jit = my_infp->jit;
+	old_jit_size = my_infp->jit_size;
+	my_infp->jit = jit;
+	my_infp->jit_size = jit_size;
+	jit = old_jit;
+	jit_size = old_jit_size;
+
 	if (match == 0) {
 	    my_infp->rcv_qlimit = net_add_q_info(rcv_port);
+	    if (filter[0] & NETF_BATCH)
+		net_add_batch_info(1);
 	} else {
 	    my_infp->rcv_qlimit = 0;
 	}
@@ -1357,6 +1706,8 @@ net_set_filter(
 clean_and_return:
     /* No locks are held at this point. */
 
+    if (jit != NULL)
+	    bpf_jit_free(jit, jit_size);
     if (dead_infp != 0)
 	    net_free_dead_infp(dead_infp);
     if (dead_entp != 0)
@@ -1427,12 +1778,127 @@ printf ("net_getstat: count: %d, addr_int_count: %d\n",
 		*count = addr_int_count;
 		break;
 	    }
+	    case NET_BPF_JIT:
+		if (*count < 1)
+		    return (D_INVALID_SIZE);
+		status[0] = bpf_jit_enable;
+		*count = 1;
+		break;
 	    default:
 		return (D_INVALID_OPERATION);
 	}
 	return (D_SUCCESS);
 }
 
+/*
+ * Choose whether the BPF filters set from now on are compiled.  This
+ * affects all interfaces, hence requires the privileged host port.
+ */
+kern_return_t
+host_bpf_jit_control(
+	const host_t	host,
+	boolean_t	enable)
+{
+	if (host == HOST_NULL)
+	    return (KERN_INVALID_HOST);
+
+	bpf_jit_enable = (enable != FALSE);
+	return (KERN_SUCCESS);
+}
+
+/*
+ *	net_read_trap:
+ *
+ *	Take the next packet queued by the filters on the port
+ *	named rcv_name in the current task, and scatter its
+ *	header and data into the user buffers described by iovec.
+ *	The message itself is never copied out.  Any other kind
+ *	of message found on the port is discarded.  As for
+ *	mach_msg, MACH_RCV_INTERRUPTED is returned if the wait
+ *	for a packet is interrupted, and the caller retries.
+ */
+io_return_t
+net_read_trap(
+	mach_port_name_t	rcv_name,
+	dev_mode_t		mode,
+	io_buf_vec_t		*iovec,
+	unsigned		iocount,
+	vm_size_t		*bytes_read)
+{
+	ipc_kmsg_t		kmsg;
+	ipc_object_t		object;
+	ipc_mqueue_t		mqueue;
+	mach_port_seqno_t	seqno;
+	mach_msg_return_t	mr;
+	char			*src[2];
+	vm_size_t		len[2], amt, off;
+	unsigned		i, j;
+	io_return_t		err = D_SUCCESS;
+
+	if (rcv_name == MACH_PORT_NULL)
+	    return (D_INVALID_OPERATION);
+
+	mr = ipc_mqueue_copyin(current_space(), rcv_name, &mqueue, &object);
+	if (mr != MACH_MSG_SUCCESS)
+	    return (KERN_INVALID_RIGHT);
+	/* hold ref for object; mqueue is locked */
+
+	mr = ipc_mqueue_receive(mqueue,
+				(mode & D_NOWAIT) ? MACH_RCV_TIMEOUT
+						  : MACH_MSG_OPTION_NONE,
+				MACH_MSG_SIZE_MAX, 0,
+				FALSE, IMQ_NULL_CONTINUE,
+				&kmsg, &seqno);
+	/* mqueue is unlocked */
+	ipc_object_release(object);
+
+	if (mr == MACH_RCV_TIMED_OUT)
+	    return (D_WOULD_BLOCK);
+	if (mr == MACH_RCV_INTERRUPTED)
+	    return (MACH_RCV_INTERRUPTED);
+	if (mr != MACH_MSG_SUCCESS)
+	    return (D_IO_ERROR);
+
+	/*
+	 * Only network buffers can carry packets; anything else
+	 * was sent by a task and cannot be read this way.
+	 */
+	if (kmsg->ikm_size != IKM_SIZE_NETWORK ||
+	    kmsg->ikm_header.msgh_id != NET_RCV_MSG_ID) {
+	    ipc_kmsg_destroy(kmsg);
+	    return (D_INVALID_OPERATION);
+	}
+
+	src[0] = net_kmsg(kmsg)->header;
+	len[0] = NET_HDW_HDR_MAX;
+	src[1] = net_kmsg(kmsg)->packet;
+	len[1] = net_kmsg(kmsg)->net_rcv_msg_packet_count;
+
+	for (i = 0, j = 0, off = 0; i < iocount && j < 2; ) {
+	    amt = len[j];
+	    if (amt > iovec[i].count - off)
+		amt = iovec[i].count - off;
+	    if (amt > 0 &&
+		copyout(src[j], (void *) (iovec[i].data + off), amt)) {
+		err = KERN_INVALID_ARGUMENT;
+		break;
+	    }
+	    *bytes_read += amt;
+	    src[j] += amt;
+	    len[j] -= amt;
+	    off += amt;
+	    if (len[j] == 0)
+		j++;
+	    if (off == iovec[i].count) {
+		i++;
+		off = 0;
+	    }
+	}
+
+	ipc_kmsg_destroy(kmsg);
+	return (err);
+}
+
 io_return_t
 net_write(
 	struct 		ifnet *ifp,
@@ -1500,7 +1966,9 @@ net_io_init(void)
 	kmem_cache_init(&net_hash_entry_cache, "net_hash_entry", size, 0,
 			NULL, 0);
 
-	size = ikm_plus_overhead(sizeof(struct net_rcv_msg));
+	/* Buffers are also used for batches.  */
+	size = ikm_plus_overhead(MAX(sizeof(struct net_rcv_msg),
+				     sizeof(struct net_rcv_batch_msg)));
 	net_kmsg_size = round_page(size);
 
 	/*
@@ -1522,7 +1990,11 @@ net_io_init(void)
 	ipc_kmsg_queue_init(&net_queue_high);
 	ipc_kmsg_queue_init(&net_queue_low);
 
+	simple_lock_init(&net_batch_lock);
+
  	simple_lock_init(&net_hash_header_lock);
+
+	net_ring_init();
 }
 
 
@@ -1568,6 +2040,10 @@ net_io_init(void)
 #define BPF_ALIGN
 #endif
 
+/* Whether SIZE bytes at offset K fit within LEN, without wrapping.  */
+#define BPF_FITS(k, size, len) \
+	((u_int)(k) <= (len) && (len) - (u_int)(k) >= (size))
+
 #ifndef BPF_ALIGN
 #define EXTRACT_SHORT(p)	((u_short)ntohs(*(u_short *)p))
 #define EXTRACT_LONG(p)		(ntohl(*(u_int *)p))
@@ -1615,6 +2091,22 @@ bpf_do_filter(
 	buflen = NET_RCV_MAX;
 	*entpp = 0;			/* default */
 
+	if (infp->jit != NULL) {
+		u_int ret;
+
+		ret = infp->jit(p, wirelen, header, hlen, mem);
+		if (ret & BPF_JIT_MATCH) {
+			if (bpf_match ((net_hash_header_t)infp,
+				       BPF_JIT_KEYS(ret), mem,
+				       hash_headpp, entpp))
+				return BPF_JIT_LEN(ret);
+			return 0;
+		}
+		if (infp->rcv_port == MACH_PORT_NULL)
+			return 0;
+		return ret;
+	}
+
 	A = 0;
 	X = 0;
 
@@ -1655,9 +2147,9 @@ bpf_do_filter(
 			k = pc->k;
 
 		load_word:
-			if ((u_int)k + sizeof(int) <= hlen)
+			if (BPF_FITS(k, sizeof(int), hlen))
 			     data = header;
-			else if ((u_int)k + sizeof(int) <= buflen) {
+			else if (BPF_FITS(k, sizeof(int), buflen)) {
 			     k -= hlen;
 			     data = p;
 			} else
@@ -1675,9 +2167,9 @@ bpf_do_filter(
 			k = pc->k;
 
 		load_half:
-			if ((u_int)k + sizeof(short) <= hlen)
+			if (BPF_FITS(k, sizeof(short), hlen))
 			     data = header;
-			else if ((u_int)k + sizeof(short) <= buflen) {
+			else if (BPF_FITS(k, sizeof(short), buflen)) {
 			     k -= hlen;
 			     data = p;
 			} else
@@ -1915,7 +2407,7 @@ bpf_validate(
 			int from = i + 1;
 
 			if (BPF_OP(p->code) == BPF_JA) {
-				if (from + p->k >= len)
+				if (p->k < 0 || p->k >= len - from)
 					return 0;
 			}
 			else if (from + p->jt >= len || from + p->jf >= len)
@@ -1925,7 +2417,9 @@ bpf_validate(
 		 * Check that memory operations use valid addresses.
 		 */
 		if ((BPF_CLASS(p->code) == BPF_ST ||
-		     (BPF_CLASS(p->code) == BPF_LD && 
+		     BPF_CLASS(p->code) == BPF_STX ||
+		     ((BPF_CLASS(p->code) == BPF_LD ||
+		       BPF_CLASS(p->code) == BPF_LDX) &&
 		      (p->code & 0xe0) == BPF_MEM)) &&
 		    (p->k >= BPF_MEMWORDS || p->k < 0))
 			return 0;
@@ -2125,6 +2619,10 @@ net_free_dead_infp(queue_entry_t dead_infp)
 		nextfp = (net_rcv_port_t) queue_next(&infp->input);
 		ipc_port_release_send(infp->rcv_port);
 		net_del_q_info(infp->rcv_qlimit);
+		if (infp->filter[0] & NETF_BATCH)
+			net_add_batch_info(-1);
+		if (infp->jit != NULL)
+			bpf_jit_free(infp->jit, infp->jit_size);
 		kmem_cache_free(&net_rcv_cache, (vm_offset_t) infp);
 	}	    
 }
@@ -61,6 +61,7 @@ typedef struct net_hash_header *net_hash_header_t;
  */
 
 #define	net_kmsg(kmsg)	((net_rcv_msg_t)&(kmsg)->ikm_header)
+#define	net_batch_kmsg(kmsg)	((net_rcv_batch_msg_t)&(kmsg)->ikm_header)
 
 /*
  * Interrupt routines may allocate and free net_kmsgs with these
@@ -76,12 +77,31 @@ extern void net_kmsg_put(ipc_kmsg_t);
 
 extern void net_ast(void);
 extern void net_packet(struct ifnet *, ipc_kmsg_t, unsigned int, boolean_t);
-extern void net_filter(ipc_kmsg_t, ipc_kmsg_queue_t);
+extern void net_filter(ipc_kmsg_t, ipc_kmsg_queue_t, ipc_kmsg_queue_t);
 extern io_return_t net_getstat(struct ifnet *, dev_flavor_t, dev_status_t,
 			       mach_msg_type_number_t *);
 
 typedef int (*net_write_start_device_fn)(short);
 extern io_return_t net_write(struct ifnet *, net_write_start_device_fn, io_req_t);
+extern io_return_t net_read_trap(mach_port_name_t, dev_mode_t,
+				 io_buf_vec_t *, unsigned, vm_size_t *);
+
+/*
+ * Packet rings mapped by a task, see <device/net_ring.h>.
+ */
+
+struct net_rings;
+
+typedef io_return_t (*net_ring_xmit_fn)(struct ifnet *, const char *,
+					unsigned int);
+extern void net_ring_init(void);
+extern io_return_t net_ring_map(struct ifnet *, vm_prot_t, vm_offset_t,
+				vm_size_t, ipc_port_t *);
+extern struct net_rings *net_ring_lookup(struct ifnet *, unsigned int);
+extern boolean_t net_ring_rx(struct net_rings *, const char *, unsigned int,
+			     const char *, unsigned int);
+extern io_return_t net_ring_txsync(struct ifnet *, unsigned int,
+				   net_ring_xmit_fn);
 
 /*
  * Non-interrupt code may allocate and free net_kmsgs with these functions.
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2026 Free Software Foundation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ *	Packet rings shared with the task that maps a network device.
+ *
+ *	The rings and their buffers are wired kernel memory, which the
+ *	task maps through a device pager, one pair of rings for each
+ *	filter port.  net_filter copies the packets of a NETF_RING
+ *	filter straight into the receive ring of its pair, where the
+ *	task reads them in place instead of receiving a message for each
+ *	one.  The drivers fill buffers of their own, so this replaces
+ *	the copy out of the net_kmsg rather than the one into it.
+ */
+
+#include <string.h>
+
+#include <mach/kern_return.h>
+#include <mach/vm_param.h>
+
+#include <kern/kalloc.h>
+#include <kern/lock.h>
+
+#include <vm/pmap.h>
+#include <vm/vm_kern.h>
+
+#include <device/conf.h>
+#include <device/dev_hdr.h>
+#include <device/ds_routines.h>
+#include <device/net_io.h>
+#include <device/net_ring.h>
+
+#define	NET_RING_MAX	64		/* pairs of rings, all interfaces */
+
+struct net_rings {
+	struct mach_device	device;	/* for the device pager */
+	struct ifnet		*ifp;	/* interface of the rings */
+	unsigned int		index;	/* which pair of the interface */
+	struct net_ring_area	*area;	/* kernel address of the rings */
+	decl_simple_lock_data(,
+			rx_lock)	/* kernel end of the receive ring */
+	struct lock	tx_lock;	/* kernel end of the transmit ring */
+};
+
+def_simple_lock_data(static,net_ring_lock)
+static struct net_rings	*net_ring_table[NET_RING_MAX];
+static int		net_ring_count = 0;
+
+int	net_ring_packets = 0;		/* for debugging */
+int	net_ring_drops = 0;		/* for debugging */
+int	net_ring_wakeups = 0;		/* for debugging */
+int	net_ring_sent = 0;		/* for debugging */
+
+static vm_offset_t
+net_ring_mmap(dev_t dev, vm_offset_t off, vm_prot_t prot)
+{
+	struct net_rings *r = net_ring_table[dev];
+
+	if (off >= NET_RING_SIZE)
+	    return -1;
+
+	return atop(pmap_extract(pmap_kernel(), (vm_offset_t) r->area + off));
+}
+
+static struct dev_ops net_ring_ops = {
+	.d_name = "net_ring",
+	.d_mmap = net_ring_mmap,
+};
+
+void
+net_ring_init(void)
+{
+	simple_lock_init(&net_ring_lock);
+}
+
+/*
+ *	Return pair INDEX of the rings of IFP, or 0 if it was never
+ *	mapped.
+ */
+struct net_rings *
+net_ring_lookup(
+	struct ifnet	*ifp,
+	unsigned int	index)
+{
+	struct net_rings *r = 0;
+	int i;
+
+	simple_lock(&net_ring_lock);
+	for (i = 0; i < net_ring_count; i++)
+	    if (net_ring_table[i]->ifp == ifp
+		&& net_ring_table[i]->index == index) {
+		r = net_ring_table[i];
+		break;
+	    }
+	simple_unlock(&net_ring_lock);
+
+	return r;
+}
+
+/*
+ *	Return a pager for the pair of rings of IFP at OFFSET, which
+ *	are allocated on the first call.  They stay until shutdown,
+ *	like the interface, for the next filter to use them.
+ */
+io_return_t
+net_ring_map(
+	struct ifnet	*ifp,
+	vm_prot_t	prot,
+	vm_offset_t	offset,
+	vm_size_t	size,
+	ipc_port_t	*pager)
+{
+	struct net_rings *r;
+	unsigned int index;
+	vm_offset_t addr;
+	int i;
+
+	if (prot & ~VM_PROT_ALL)
+	    return KERN_INVALID_ARGUMENT;
+	index = offset / NET_RING_SIZE;
+	offset %= NET_RING_SIZE;
+	if (index >= NET_RING_FILTERS || size > NET_RING_SIZE - offset)
+	    return D_INVALID_SIZE;
+
+	r = net_ring_lookup(ifp, index);
+	if (r == 0) {
+	    r = (struct net_rings *) kalloc(sizeof *r);
+	    if (r == 0)
+		return D_NO_MEMORY;
+	    if (kmem_alloc_wired(kernel_map, &addr, round_page(NET_RING_SIZE))
+		!= KERN_SUCCESS) {
+		kfree((vm_offset_t) r, sizeof *r);
+		return D_NO_MEMORY;
+	    }
+	    memset((void *) addr, 0, NET_RING_SIZE);
+
+	    memset(&r->device, 0, sizeof r->device);
+	    simple_lock_init(&r->device.ref_lock);
+	    simple_lock_init(&r->device.lock);
+	    r->device.ref_count = 1;	/* never released */
+	    r->device.state = DEV_STATE_OPEN;
+	    r->device.dev_ops = &net_ring_ops;
+	    r->ifp = ifp;
+	    r->index = index;
+	    r->area = (struct net_ring_area *) addr;
+	    simple_lock_init(&r->rx_lock);
+	    lock_init(&r->tx_lock, TRUE);
+
+	    simple_lock(&net_ring_lock);
+	    for (i = 0; i < net_ring_count; i++)
+		if (net_ring_table[i]->ifp == ifp
+		    && net_ring_table[i]->index == index)
+		    break;
+	    if (i == net_ring_count && net_ring_count < NET_RING_MAX) {
+		r->device.dev_number = net_ring_count;
+		net_ring_table[net_ring_count++] = r;
+		simple_unlock(&net_ring_lock);
+	    } else {
+		/* Lost a race, or out of slots.  */
+		simple_unlock(&net_ring_lock);
+		kmem_free(kernel_map, addr, round_page(NET_RING_SIZE));
+		kfree((vm_offset_t) r, sizeof *r);
+		r = net_ring_lookup(ifp, index);
+		if (r == 0)
+		    return KERN_RESOURCE_SHORTAGE;
+	    }
+	}
+
+	return device_pager_setup(&r->device, prot, offset, size,
+				  (mach_port_t *) pager);
+}
+
+/*
+ *	Copy a packet into the receive ring of R: HSIZE bytes of
+ *	HEADER, then LEN bytes of DATA.  Returns whether the task
+ *	is waiting for a message.  Called from net_filter.
+ */
+boolean_t
+net_ring_rx(
+	struct net_rings	*r,
+	const char		*header,
+	unsigned int		hsize,
+	const char		*data,
+	unsigned int		len)
+{
+	struct net_ring *ring = &r->area->rx;
+	struct net_ring_slot *slot;
+	unsigned int tail;
+	char *buf;
+	boolean_t wakeup;
+
+	if (hsize + len > NET_RING_BUF_SIZE)
+	    len = NET_RING_BUF_SIZE - hsize;
+
+	simple_lock(&r->rx_lock);
+	tail = ring->tail;
+	/* The task owns head, so only trust it modulo the ring size.  */
+	if (tail - ring->head >= NET_RING_SLOTS) {
+	    ring->drops++;
+	    net_ring_drops++;
+	} else {
+	    slot = &ring->slot[tail % NET_RING_SLOTS];
+	    buf = (char *) r->area + NET_RING_RX_BUFFER(tail % NET_RING_SLOTS);
+	    memcpy(buf, header, hsize);
+	    memcpy(buf + hsize, data, len);
+	    slot->length = hsize + len;
+	    slot->flags = 0;
+	    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+	    net_ring_packets++;
+	}
+	wakeup = (__atomic_fetch_and(&ring->flags, ~NET_RING_WAKEUP,
+				     __ATOMIC_SEQ_CST) & NET_RING_WAKEUP) != 0;
+	simple_unlock(&r->rx_lock);
+
+	if (wakeup)
+	    net_ring_wakeups++;
+	return wakeup;
+}
+
+/*
+ *	Send the frames queued on the transmit ring of pair INDEX of
+ *	IFP with XMIT, until it is empty or XMIT fails.  Frames too
+ *	short for a header or too long for the interface are skipped.
+ */
+io_return_t
+net_ring_txsync(
+	struct ifnet		*ifp,
+	unsigned int		index,
+	net_ring_xmit_fn	xmit)
+{
+	struct net_rings *r = net_ring_lookup(ifp, index);
+	struct net_ring *ring;
+	unsigned int head, tail, length, max;
+	io_return_t err = D_SUCCESS;
+
+	if (r == 0)
+	    return D_INVALID_OPERATION;
+	ring = &r->area->tx;
+
+	max = ifp->if_mtu + ifp->if_header_size;
+	if (max > NET_RING_BUF_SIZE)
+	    max = NET_RING_BUF_SIZE;
+
+	lock_write(&r->tx_lock);
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (tail - head > NET_RING_SLOTS) {
+	    lock_done(&r->tx_lock);
+	    return D_INVALID_OPERATION;
+	}
+
+	for (; head != tail; head++) {
+	    length = ring->slot[head % NET_RING_SLOTS].length;
+	    if (length == 0 || length < ifp->if_header_size || length > max)
+		ifp->if_oerrors++;
+	    else {
+		err = (*xmit)(ifp, (char *) r->area
+				   + NET_RING_TX_BUFFER(head % NET_RING_SLOTS),
+			      length);
+		if (err != D_SUCCESS)
+		    break;
+		net_ring_sent++;
+	    }
+	    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	}
+	lock_done(&r->tx_lock);
+
+	return err;
+}
@@ -0,0 +1,554 @@
+/* bpf_jit.c - Compile BPF network filters to x86 code.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNU Mach.
+
+   GNU Mach is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   GNU Mach is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+/*
+ * The generated code follows bpf_do_filter instruction by instruction.
+ * A lives in EAX and X in ECX, EDX is the scratch register.  The
+ * packet, the header and the scratch memory are kept in ESI, EDI and
+ * EBX, the packet and header lengths are read from the stack frame.
+ *
+ * All jumps are forward and every instruction has a fixed encoding,
+ * so the program is emitted twice: once to size the code and record
+ * the offset of each BPF instruction, then into the allocated buffer.
+ */
+
+#include <stddef.h>
+#include <kern/assert.h>
+#include <kern/kalloc.h>
+#include <device/net_status.h>
+#include <device/bpf.h>
+#include <machine/bpf_jit.h>
+
+int bpf_jit_enable = 1;
+
+#define EAX	0
+#define ECX	1
+#define EDX	2
+#define EBX	3
+#define ESI	6
+#define EDI	7
+
+#define REG_A	EAX
+#define REG_X	ECX
+#define REG_P	ESI
+#define REG_HDR	EDI
+
+/* Frame offsets of the wirelen and hlen arguments.  */
+#ifdef __x86_64__
+#define WIRELEN	0xf0		/* -16, saved from ESI */
+#define HLEN	0xe8		/* -24, saved from ECX */
+#else
+#define WIRELEN	12
+#define HLEN	20
+#endif
+
+/* Jcc rel32 second opcode bytes, flip the low bit to negate.  */
+#define JA	0x87
+#define JAE	0x83
+#define JE	0x84
+#define JNE	0x85
+
+struct bpf_jit {
+	unsigned char	*code;		/* NULL while sizing */
+	unsigned int	len;		/* bytes emitted so far */
+	unsigned int	reject;		/* offset of the return 0 path */
+	unsigned int	addrs[NET_MAX_BPF];	/* offset of each insn */
+};
+
+static void
+emit_byte(struct bpf_jit *jit, unsigned int b)
+{
+	if (jit->code != NULL)
+		jit->code[jit->len] = b;
+	jit->len++;
+}
+
+static void
+emit_long(struct bpf_jit *jit, unsigned int l)
+{
+	emit_byte(jit, l & 0xff);
+	emit_byte(jit, (l >> 8) & 0xff);
+	emit_byte(jit, (l >> 16) & 0xff);
+	emit_byte(jit, (l >> 24) & 0xff);
+}
+
+#define EMIT1(b1)	emit_byte(jit, (b1))
+#define EMIT2(b1, b2)	(EMIT1(b1), EMIT1(b2))
+#define EMIT3(b1, b2, b3) (EMIT2(b1, b2), EMIT1(b3))
+
+/*
+ * Jump to the code at offset TARGET, unconditionally when CC is 0.
+ */
+static void
+emit_jump(struct bpf_jit *jit, int cc, unsigned int target)
+{
+	if (cc == 0)
+		EMIT1(0xe9);
+	else
+		EMIT2(0x0f, cc);
+	emit_long(jit, target - (jit->len + 4));
+}
+
+/* Size of the load emitted by emit_load_index.  */
+#define LOAD_LEN(size)	((size) == 4 ? 3 : 4)
+
+/*
+ * Load SIZE bytes at BASE + EDX into REG, bytes are sign-extended
+ * like the char data of bpf_do_filter.
+ */
+static void
+emit_load_index(struct bpf_jit *jit, int reg, int size, int base)
+{
+	if (size == 4)
+		EMIT1(0x8b);			/* mov */
+	else if (size == 2)
+		EMIT2(0x0f, 0xb7);		/* movzwl */
+	else
+		EMIT2(0x0f, 0xbe);		/* movsbl */
+	EMIT2(0x04 | (reg << 3), (EDX << 3) | base);
+}
+
+/*
+ * Load SIZE bytes at offset EDX of the header, or of the packet past
+ * the header, into REG in host order.  EDX has been checked to leave
+ * room for SIZE bytes within NET_RCV_MAX, which is larger than any
+ * header, so one of the two always applies.
+ */
+static void
+emit_load(struct bpf_jit *jit, int reg, int size)
+{
+	int rebase;
+
+	/* lea size(%edx), reg; cmp hlen, reg; ja packet */
+	EMIT3(0x8d, 0x42 | (reg << 3), size);
+	EMIT3(0x3b, 0x45 | (reg << 3), HLEN);
+	EMIT2(0x77, LOAD_LEN(size) + 2);
+	emit_load_index(jit, reg, size, REG_HDR);
+
+	rebase = 3;
+#ifdef __x86_64__
+	rebase += 3;
+#endif
+	EMIT2(0xeb, rebase + LOAD_LEN(size));
+
+	/* packet: sub hlen, %edx */
+	EMIT3(0x2b, 0x55, HLEN);
+#ifdef __x86_64__
+	/* The offset into the packet may be negative.  */
+	EMIT3(0x48, 0x63, 0xd2);		/* movslq %edx, %rdx */
+#endif
+	emit_load_index(jit, reg, size, REG_P);
+
+	if (size == 4)
+		EMIT2(0x0f, 0xc8 | reg);	/* bswap */
+	else if (size == 2)
+		EMIT3(0x66, 0xc1, 0xc0 | reg), EMIT1(8);	/* rolw $8 */
+}
+
+/*
+ * Load from the constant offset K.
+ */
+static void
+emit_load_abs(struct bpf_jit *jit, int reg, int size, unsigned int k)
+{
+	if (k > NET_RCV_MAX - size) {
+		emit_jump(jit, 0, jit->reject);
+		return;
+	}
+	EMIT1(0xb8 | EDX);
+	emit_long(jit, k);
+	emit_load(jit, reg, size);
+}
+
+/*
+ * Load from the offset X + K.
+ */
+static void
+emit_load_ind(struct bpf_jit *jit, int reg, int size, unsigned int k)
+{
+	EMIT2(0x89, 0xca);			/* mov %ecx, %edx */
+	EMIT2(0x81, 0xc2);			/* add $k, %edx */
+	emit_long(jit, k);
+	EMIT2(0x81, 0xfa);			/* cmp $max, %edx */
+	emit_long(jit, NET_RCV_MAX - size);
+	emit_jump(jit, JA, jit->reject);
+	emit_load(jit, reg, size);
+}
+
+/*
+ * Return A, clamped to wirelen, with the MATCH flags.
+ */
+static void
+emit_ret(struct bpf_jit *jit, unsigned int flags)
+{
+	EMIT3(0x3b, 0x45, WIRELEN);		/* cmp wirelen, %eax */
+	EMIT2(0x76, 3);				/* jbe 1f */
+	EMIT3(0x8b, 0x45, WIRELEN);		/* mov wirelen, %eax */
+	if (flags != 0) {
+		EMIT1(0x0d);			/* 1: or $flags, %eax */
+		emit_long(jit, flags);
+	}
+	emit_jump(jit, 0, jit->reject + 2);
+}
+
+/*
+ * Branch on condition CC to the JT or JF instruction following I.
+ */
+static void
+emit_cond(struct bpf_jit *jit, int cc, int i, bpf_insn_t pc)
+{
+	unsigned int jt, jf;
+
+	jt = jit->addrs[i + 1 + pc->jt];
+	jf = jit->addrs[i + 1 + pc->jf];
+
+	if (pc->jt == pc->jf) {
+		if (pc->jt != 0)
+			emit_jump(jit, 0, jt);
+	} else if (pc->jt == 0)
+		emit_jump(jit, cc ^ 1, jf);
+	else {
+		emit_jump(jit, cc, jt);
+		if (pc->jf != 0)
+			emit_jump(jit, 0, jf);
+	}
+}
+
+static void
+emit_prologue(struct bpf_jit *jit)
+{
+#ifdef __x86_64__
+	EMIT1(0x55);				/* push %rbp */
+	EMIT3(0x48, 0x89, 0xe5);		/* mov %rsp, %rbp */
+	EMIT1(0x53);				/* push %rbx */
+	EMIT1(0x56);				/* push %rsi (wirelen) */
+	EMIT1(0x51);				/* push %rcx (hlen) */
+	EMIT3(0x48, 0x89, 0xfe);		/* mov %rdi, %rsi */
+	EMIT3(0x48, 0x89, 0xd7);		/* mov %rdx, %rdi */
+	EMIT3(0x4c, 0x89, 0xc3);		/* mov %r8, %rbx */
+#else
+	EMIT1(0x55);				/* push %ebp */
+	EMIT2(0x89, 0xe5);			/* mov %esp, %ebp */
+	EMIT1(0x53);				/* push %ebx */
+	EMIT1(0x56);				/* push %esi */
+	EMIT1(0x57);				/* push %edi */
+	EMIT3(0x8b, 0x75, 8);			/* mov 8(%ebp), %esi */
+	EMIT3(0x8b, 0x7d, 16);			/* mov 16(%ebp), %edi */
+	EMIT3(0x8b, 0x5d, 24);			/* mov 24(%ebp), %ebx */
+#endif
+	EMIT2(0x31, 0xc0);			/* xor %eax, %eax */
+	EMIT2(0x31, 0xc9);			/* xor %ecx, %ecx */
+}
+
+static void
+emit_epilogue(struct bpf_jit *jit)
+{
+#ifdef __x86_64__
+	EMIT3(0x48, 0x8d, 0x65), EMIT1(0xf8);	/* lea -8(%rbp), %rsp */
+	EMIT1(0x5b);				/* pop %rbx */
+#else
+	EMIT3(0x8d, 0x65, 0xf4);		/* lea -12(%ebp), %esp */
+	EMIT1(0x5f);				/* pop %edi */
+	EMIT1(0x5e);				/* pop %esi */
+	EMIT1(0x5b);				/* pop %ebx */
+#endif
+	EMIT1(0x5d);				/* pop %ebp */
+	EMIT1(0xc3);				/* ret */
+}
+
+static void
+bpf_jit_emit(struct bpf_jit *jit, bpf_insn_t f, int len)
+{
+	bpf_insn_t pc;
+	int i;
+
+	jit->len = 0;
+	emit_prologue(jit);
+
+	/* f[0].code is (NETF_BPF | flags).  */
+	for (i = 1; i < len; i++) {
+		pc = &f[i];
+		jit->addrs[i] = jit->len;
+
+		switch (pc->code) {
+		case BPF_RET|BPF_K:
+			EMIT1(0xb8);			/* mov $k, %eax */
+			emit_long(jit, pc->k);
+			emit_ret(jit, 0);
+			break;
+
+		case BPF_RET|BPF_A:
+			emit_ret(jit, 0);
+			break;
+
+		case BPF_RET|BPF_MATCH_IMM:
+			EMIT1(0xb8);
+			emit_long(jit, pc->k);
+			emit_ret(jit, BPF_JIT_MATCH | (pc->jt << 24));
+			break;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+			emit_load_abs(jit, REG_A, 4, pc->k);
+			break;
+
+		case BPF_LD|BPF_H|BPF_ABS:
+			emit_load_abs(jit, REG_A, 2, pc->k);
+			break;
+
+		case BPF_LD|BPF_B|BPF_ABS:
+			emit_load_abs(jit, REG_A, 1, pc->k);
+			break;
+
+		case BPF_LD|BPF_W|BPF_IND:
+			emit_load_ind(jit, REG_A, 4, pc->k);
+			break;
+
+		case BPF_LD|BPF_H|BPF_IND:
+			emit_load_ind(jit, REG_A, 2, pc->k);
+			break;
+
+		case BPF_LD|BPF_B|BPF_IND:
+			emit_load_ind(jit, REG_A, 1, pc->k);
+			break;
+
+		case BPF_LDX|BPF_MSH|BPF_B:
+			emit_load_abs(jit, REG_X, 1, pc->k);
+			EMIT3(0x83, 0xe1, 0x0f);	/* and $0xf, %ecx */
+			EMIT3(0xc1, 0xe1, 2);		/* shl $2, %ecx */
+			break;
+
+		case BPF_LD|BPF_W|BPF_LEN:
+			EMIT3(0x8b, 0x45, WIRELEN);	/* mov wirelen, %eax */
+			break;
+
+		case BPF_LDX|BPF_W|BPF_LEN:
+			EMIT3(0x8b, 0x4d, WIRELEN);	/* mov wirelen, %ecx */
+			break;
+
+		case BPF_LD|BPF_IMM:
+			EMIT1(0xb8);			/* mov $k, %eax */
+			emit_long(jit, pc->k);
+			break;
+
+		case BPF_LDX|BPF_IMM:
+			EMIT1(0xb9);			/* mov $k, %ecx */
+			emit_long(jit, pc->k);
+			break;
+
+		case BPF_LD|BPF_MEM:
+			EMIT2(0x8b, 0x83);		/* mov k*4(%ebx), %eax */
+			emit_long(jit, pc->k * 4);
+			break;
+
+		case BPF_LDX|BPF_MEM:
+			EMIT2(0x8b, 0x8b);		/* mov k*4(%ebx), %ecx */
+			emit_long(jit, pc->k * 4);
+			break;
+
+		case BPF_ST:
+			EMIT2(0x89, 0x83);		/* mov %eax, k*4(%ebx) */
+			emit_long(jit, pc->k * 4);
+			break;
+
+		case BPF_STX:
+			EMIT2(0x89, 0x8b);		/* mov %ecx, k*4(%ebx) */
+			emit_long(jit, pc->k * 4);
+			break;
+
+		case BPF_JMP|BPF_JA:
+			if (pc->k != 0)
+				emit_jump(jit, 0,
+					  jit->addrs[i + 1 + pc->k]);
+			break;
+
+		case BPF_JMP|BPF_JGT|BPF_K:
+		case BPF_JMP|BPF_JGE|BPF_K:
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			EMIT1(0x3d);			/* cmp $k, %eax */
+			emit_long(jit, pc->k);
+			goto jump;
+
+		case BPF_JMP|BPF_JGT|BPF_X:
+		case BPF_JMP|BPF_JGE|BPF_X:
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			EMIT2(0x39, 0xc8);		/* cmp %ecx, %eax */
+		jump:
+			switch (BPF_OP(pc->code)) {
+			case BPF_JGT:
+				emit_cond(jit, JA, i, pc);
+				break;
+			case BPF_JGE:
+				emit_cond(jit, JAE, i, pc);
+				break;
+			default:
+				emit_cond(jit, JE, i, pc);
+				break;
+			}
+			break;
+
+		case BPF_JMP|BPF_JSET|BPF_K:
+			EMIT1(0xa9);			/* test $k, %eax */
+			emit_long(jit, pc->k);
+			emit_cond(jit, JNE, i, pc);
+			break;
+
+		case BPF_JMP|BPF_JSET|BPF_X:
+			EMIT2(0x85, 0xc8);		/* test %ecx, %eax */
+			emit_cond(jit, JNE, i, pc);
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_X:
+			EMIT2(0x01, 0xc8);		/* add %ecx, %eax */
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_X:
+			EMIT2(0x29, 0xc8);		/* sub %ecx, %eax */
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_X:
+			EMIT3(0x0f, 0xaf, 0xc1);	/* imul %ecx, %eax */
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_X:
+			EMIT2(0x85, 0xc9);		/* test %ecx, %ecx */
+			emit_jump(jit, JE, jit->reject);
+			EMIT2(0x31, 0xd2);		/* xor %edx, %edx */
+			EMIT2(0xf7, 0xf1);		/* div %ecx */
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_X:
+			EMIT2(0x21, 0xc8);		/* and %ecx, %eax */
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_X:
+			EMIT2(0x09, 0xc8);		/* or %ecx, %eax */
+			break;
+
+		case BPF_ALU|BPF_LSH|BPF_X:
+			EMIT2(0xd3, 0xe0);		/* shl %cl, %eax */
+			break;
+
+		case BPF_ALU|BPF_RSH|BPF_X:
+			EMIT2(0xd3, 0xe8);		/* shr %cl, %eax */
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_K:
+			EMIT1(0x05);			/* add $k, %eax */
+			emit_long(jit, pc->k);
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_K:
+			EMIT1(0x2d);			/* sub $k, %eax */
+			emit_long(jit, pc->k);
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_K:
+			EMIT2(0x69, 0xc0);		/* imul $k, %eax */
+			emit_long(jit, pc->k);
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_K:
+			/* bpf_validate rejects division by a constant 0.  */
+			EMIT1(0x51);			/* push %ecx */
+			EMIT1(0xb9);			/* mov $k, %ecx */
+			emit_long(jit, pc->k);
+			EMIT2(0x31, 0xd2);		/* xor %edx, %edx */
+			EMIT2(0xf7, 0xf1);		/* div %ecx */
+			EMIT1(0x59);			/* pop %ecx */
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_K:
+			EMIT1(0x25);			/* and $k, %eax */
+			emit_long(jit, pc->k);
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_K:
+			EMIT1(0x0d);			/* or $k, %eax */
+			emit_long(jit, pc->k);
+			break;
+
+		case BPF_ALU|BPF_LSH|BPF_K:
+			EMIT3(0xc1, 0xe0, pc->k & 0xff);	/* shl $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_RSH|BPF_K:
+			EMIT3(0xc1, 0xe8, pc->k & 0xff);	/* shr $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_NEG:
+			EMIT2(0xf7, 0xd8);		/* neg %eax */
+			break;
+
+		case BPF_MISC|BPF_TAX:
+			EMIT2(0x89, 0xc1);		/* mov %eax, %ecx */
+			break;
+
+		case BPF_MISC|BPF_TXA:
+			EMIT2(0x89, 0xc8);		/* mov %ecx, %eax */
+			break;
+
+		default:
+			/* Including the keys of a MATCH, as the interpreter.  */
+			emit_jump(jit, 0, jit->reject);
+			break;
+		}
+	}
+
+	/* Falling off the end rejects the packet.  */
+	jit->reject = jit->len;
+	EMIT2(0x31, 0xc0);			/* xor %eax, %eax */
+	emit_epilogue(jit);
+}
+
+bpf_jit_filter_t
+bpf_jit_compile(
+	bpf_insn_t	f,
+	int		bytes,
+	vm_size_t	*size)
+{
+	struct bpf_jit jit;
+	int len;
+
+	len = BPF_BYTES2LEN(bytes);
+	if (!bpf_jit_enable || len > NET_MAX_BPF)
+		return NULL;
+
+	/* Size the code, then emit it for real.  */
+	jit.code = NULL;
+	jit.reject = 0;
+	bpf_jit_emit(&jit, f, len);
+
+	*size = jit.len;
+	jit.code = (unsigned char *) kalloc(*size);
+	if (jit.code == NULL)
+		return NULL;
+
+	bpf_jit_emit(&jit, f, len);
+	assert(jit.len == *size);
+
+	return (bpf_jit_filter_t) jit.code;
+}
+
+void
+bpf_jit_free(
+	bpf_jit_filter_t	filter,
+	vm_size_t		size)
+{
+	kfree((vm_offset_t) filter, size);
+}
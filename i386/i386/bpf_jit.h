@@ -0,0 +1,55 @@
+/* bpf_jit.h - Compile BPF network filters to x86 code.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNU Mach.
+
+   GNU Mach is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   GNU Mach is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+#ifndef _I386_BPF_JIT_H_
+#define _I386_BPF_JIT_H_
+
+#include <mach/machine/vm_types.h>
+#include <device/bpf.h>
+
+/*
+ * A compiled filter runs over the packet P of WIRELEN bytes and its
+ * HLEN bytes of HEADER, with MEM as scratch memory, and returns the
+ * number of bytes to deliver like bpf_do_filter does.  The caller
+ * still has to reject packets for dummy filters.  A BPF_MATCH_IMM
+ * return is flagged with BPF_JIT_MATCH along with its number of keys,
+ * the caller then has to look the keys in MEM up with bpf_match.
+ */
+typedef unsigned int (*bpf_jit_filter_t)(char *p, unsigned int wirelen,
+					 char *header, unsigned int hlen,
+					 unsigned int *mem);
+
+#define BPF_JIT_MATCH		0x80000000
+#define BPF_JIT_KEYS(ret)	(((ret) >> 24) & 0x7f)
+#define BPF_JIT_LEN(ret)	((ret) & 0x00ffffff)
+
+/* Whether to compile new filters, or leave them to the interpreter.  */
+extern int bpf_jit_enable;
+
+/*
+ * Compile the filter program F of BYTES bytes, which must have been
+ * accepted by bpf_validate.  Return NULL when the interpreter is to
+ * be used instead, otherwise the code size is stored in SIZE.
+ */
+extern bpf_jit_filter_t bpf_jit_compile(bpf_insn_t f, int bytes,
+					vm_size_t *size);
+
+extern void bpf_jit_free(bpf_jit_filter_t filter, vm_size_t size);
+
+#endif /* _I386_BPF_JIT_H_ */
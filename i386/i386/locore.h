@@ -90,6 +90,7 @@ extern unsigned int cpu_features[2];
 #define CPU_FEATURE_HTT		28
 #define CPU_FEATURE_TM		29
 #define CPU_FEATURE_PBE		31
+#define CPU_FEATURE_MONITOR	(1*32 +  3)
 #define CPU_FEATURE_XSAVE	(1*32 + 26)
 
 #define CPU_HAS_FEATURE(feature) (cpu_features[(feature) / 32] & (1 << ((feature) % 32)))
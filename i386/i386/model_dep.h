@@ -41,6 +41,14 @@ extern void machine_init (void);
 /* Conserve power on processor CPU.  */
 extern void machine_idle (int cpu);
 
+/*
+ * Conserve power on processor CPU until *WORD becomes non-null or an
+ * interrupt arrives.  Only usable if idle_monitor_supported is set.
+ */
+#define MACHINE_IDLE_MONITOR
+extern boolean_t idle_monitor_supported;
+extern void machine_idle_monitor (int cpu, void * volatile *word);
+
 extern void resettodr (void);
 
 extern void startrtclock (void);
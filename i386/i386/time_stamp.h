@@ -28,3 +28,26 @@
  *	need to do anything here.
  */
 
+#ifndef	_I386_TIME_STAMP_H_
+#define	_I386_TIME_STAMP_H_
+
+#include <stdint.h>
+
+/*
+ *	Fine-grained timestamps for kernel statistics, in processor
+ *	cycles.  Only differences taken on the same processor are
+ *	meaningful: the counters of different processors are not
+ *	known to be synchronized, so callers must remember where a
+ *	stamp was taken.
+ */
+static inline uint64_t
+machine_timestamp(void)
+{
+	uint32_t	hi, lo;
+
+	asm volatile("rdtsc" : "=d" (hi), "=a" (lo));
+	return (((uint64_t) hi) << 32) | lo;
+}
+
+#endif	/* _I386_TIME_STAMP_H_ */
+
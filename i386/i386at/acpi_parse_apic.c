@@ -31,8 +31,11 @@
 #include <i386/apic.h>      /* lapic, ioapic... */
 #include <i386at/acpi_parse_apic.h>
 #include <vm/vm_kern.h>
+#include <vm/vm_page.h>
 
 static struct acpi_apic *apic_madt = NULL;
+static phys_addr_t acpi_srat_addr;
+static phys_addr_t acpi_slit_addr;
 unsigned lapic_addr;
 uint32_t *hpet_addr;
 
@@ -321,6 +324,15 @@ acpi_get_apic(struct acpi_rsdt *rsdt, int acpi_rsdt_n)
             hpet_addr = (uint32_t *)kmem_map_aligned_table(map_addr, 1024, VM_PROT_READ | VM_PROT_WRITE);
             printf("HPET at physical address 0x%llx\n", map_addr);
         }
+
+        /* Remember the NUMA tables, parsed once processors are known. */
+        check_signature = acpi_check_signature(descr_header->signature, ACPI_SRAT_SIG, 4*sizeof(uint8_t));
+        if (check_signature == ACPI_SUCCESS)
+            acpi_srat_addr = rsdt->entry[i];
+
+        check_signature = acpi_check_signature(descr_header->signature, ACPI_SLIT_SIG, 4*sizeof(uint8_t));
+        if (check_signature == ACPI_SUCCESS)
+            acpi_slit_addr = rsdt->entry[i];
     }
 
     return madt;
@@ -361,6 +373,15 @@ acpi_get_apic2(struct acpi_xsdt *xsdt, int acpi_xsdt_n)
             hpet_addr = (uint32_t *)kmem_map_aligned_table(map_addr, 1024, VM_PROT_READ | VM_PROT_WRITE);
             printf("HPET at physical address 0x%llx\n", map_addr);
         }
+
+        /* Remember the NUMA tables, parsed once processors are known. */
+        check_signature = acpi_check_signature(descr_header->signature, ACPI_SRAT_SIG, 4*sizeof(uint8_t));
+        if (check_signature == ACPI_SUCCESS)
+            acpi_srat_addr = xsdt->entry[i];
+
+        check_signature = acpi_check_signature(descr_header->signature, ACPI_SLIT_SIG, 4*sizeof(uint8_t));
+        if (check_signature == ACPI_SUCCESS)
+            acpi_slit_addr = xsdt->entry[i];
     }
 
     return madt;
@@ -561,6 +582,180 @@ acpi_apic_setup(struct acpi_apic *apic)
     return ACPI_SUCCESS;
 }
 
+/*
+ * acpi_map_table: map a whole ACPI table and check its checksum.
+ *
+ * Returns a reference to the table if success, NULL if failure.
+ */
+static struct acpi_dhdr*
+acpi_map_table(phys_addr_t addr)
+{
+    struct acpi_dhdr *header;
+    uint32_t length;
+
+    header = (struct acpi_dhdr*) kmem_map_aligned_table(addr, sizeof(struct acpi_dhdr),
+                                                        VM_PROT_READ);
+    if (header == NULL)
+        return NULL;
+
+    length = header->length;
+    header = (struct acpi_dhdr*) kmem_map_aligned_table(addr, length, VM_PROT_READ);
+    if (header == NULL || acpi_checksum((void *)header, length) != 0)
+        return NULL;
+
+    return header;
+}
+
+/*
+ * acpi_numa_node: return the NUMA node of a proximity domain,
+ * allocating node numbers in the order domains are found.
+ *
+ * Returns -1 if there are more domains than supported nodes.
+ */
+static int
+acpi_numa_node(uint32_t *domains, unsigned int *nr_domains, uint32_t domain)
+{
+    unsigned int i;
+
+    for (i = 0; i < *nr_domains; i++)
+        if (domains[i] == domain)
+            return i;
+
+    if (*nr_domains == VM_PAGE_MAX_NODES) {
+        printf("acpi: too many proximity domains, ignoring %u\n", domain);
+        return -1;
+    }
+
+    domains[i] = domain;
+    (*nr_domains)++;
+    return i;
+}
+
+/*
+ * acpi_numa_add_cpu: assign the cpu with the given APIC ID to a node.
+ */
+static void
+acpi_numa_add_cpu(uint32_t apic_id, int node)
+{
+    int i;
+
+    if (node < 0)
+        return;
+
+    for (i = 0; i < apic_get_numcpus(); i++) {
+        if ((uint32_t) apic_get_cpu_apic_id(i) == apic_id) {
+            vm_page_set_cpu_node(i, node);
+            return;
+        }
+    }
+}
+
+/*
+ * acpi_numa_setup: parse the SRAT and SLIT tables, if present, and
+ * report the NUMA nodes of memory and processors to the vm_page module.
+ *
+ * Proximity domains are renumbered from 0, in the order they appear in
+ * the SRAT. Machines without SRAT are handled as a single node.
+ */
+static void
+acpi_numa_setup(void)
+{
+    uint32_t domains[VM_PAGE_MAX_NODES];
+    unsigned int nr_domains = 0;
+    struct acpi_srat *srat;
+    struct acpi_slit *slit;
+    struct acpi_apic_dhdr *entry;
+    struct acpi_srat_lapic *lapic;
+    struct acpi_srat_memory *memory;
+    struct acpi_srat_x2apic *x2apic;
+    vm_offset_t end;
+    uint64_t i, j;
+    uint32_t domain;
+    int node, from, to;
+
+    if (acpi_srat_addr == 0)
+        return;
+
+    srat = (struct acpi_srat*) acpi_map_table(acpi_srat_addr);
+    if (srat == NULL) {
+        printf("acpi: invalid SRAT, ignoring NUMA information\n");
+        return;
+    }
+
+    entry = srat->entry;
+    end = (vm_offset_t) srat + srat->header.length;
+
+    while ((vm_offset_t) entry + sizeof(*entry) <= end
+           && entry->length >= sizeof(*entry)
+           && (vm_offset_t) entry + entry->length <= end) {
+        switch (entry->type) {
+        case ACPI_SRAT_ENTRY_LAPIC:
+            lapic = (struct acpi_srat_lapic*) entry;
+            if (entry->length < sizeof(*lapic) || !(lapic->flags & ACPI_SRAT_ENABLED))
+                break;
+            domain = lapic->domain_lo | (lapic->domain_hi[0] << 8)
+                     | (lapic->domain_hi[1] << 16) | (lapic->domain_hi[2] << 24);
+            acpi_numa_add_cpu(lapic->apic_id, acpi_numa_node(domains, &nr_domains, domain));
+            break;
+
+        case ACPI_SRAT_ENTRY_X2APIC:
+            x2apic = (struct acpi_srat_x2apic*) entry;
+            if (entry->length < sizeof(*x2apic) || !(x2apic->flags & ACPI_SRAT_ENABLED))
+                break;
+            acpi_numa_add_cpu(x2apic->x2apic_id,
+                              acpi_numa_node(domains, &nr_domains, x2apic->domain));
+            break;
+
+        case ACPI_SRAT_ENTRY_MEMORY:
+            memory = (struct acpi_srat_memory*) entry;
+            if (entry->length < sizeof(*memory) || !(memory->flags & ACPI_SRAT_ENABLED)
+                || memory->length == 0)
+                break;
+
+            /* Ignore memory the kernel cannot address. */
+            if (memory->base != (phys_addr_t) memory->base
+                || memory->base + memory->length != (phys_addr_t) (memory->base + memory->length))
+                break;
+
+            node = acpi_numa_node(domains, &nr_domains, memory->domain);
+            if (node >= 0)
+                vm_page_load_node(node, memory->base, memory->base + memory->length);
+            break;
+        }
+
+        entry = (struct acpi_apic_dhdr*)((vm_offset_t) entry + entry->length);
+    }
+
+    if (acpi_slit_addr != 0) {
+        slit = (struct acpi_slit*) acpi_map_table(acpi_slit_addr);
+
+        if (slit == NULL
+            || sizeof(*slit) + slit->nr_localities * slit->nr_localities > slit->header.length) {
+            printf("acpi: invalid SLIT, using default distances\n");
+        } else {
+            for (i = 0; i < slit->nr_localities; i++) {
+                for (j = 0; j < slit->nr_localities; j++) {
+                    from = -1;
+                    to = -1;
+
+                    for (node = 0; node < (int) nr_domains; node++) {
+                        if (domains[node] == i)
+                            from = node;
+                        if (domains[node] == j)
+                            to = node;
+                    }
+
+                    if (from >= 0 && to >= 0)
+                        vm_page_set_node_distance(from, to,
+                            slit->entry[i * slit->nr_localities + j]);
+                }
+            }
+        }
+    }
+
+    vm_page_setup_nodes();
+}
+
 /*
  * acpi_apic_init: find the MADT/APIC table in ACPI tables
  * and parses It to find Local APIC and IOAPIC structures.
@@ -646,5 +841,8 @@ acpi_apic_init(void)
     /* Prints a table with the list of each cpu and each IOAPIC with its APIC ID. */
     apic_print_info();
 
+    /* Find the NUMA node of processors and memory. */
+    acpi_numa_setup();
+
     return ACPI_SUCCESS;
 }
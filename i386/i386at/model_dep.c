@@ -139,6 +139,44 @@ boolean_t	rebootflag = FALSE;	/* exported to kdintr */
 extern void linux_init(void);
 #endif
 
+boolean_t idle_monitor_supported = FALSE;
+
+#ifndef	MACH_HYP
+/* MWAIT hint: C1, in its deepest sub-state if any are enumerated.  */
+static unsigned int idle_mwait_hint;
+
+/*
+ * Use MONITOR/MWAIT for idling if available.  Deeper C-states are
+ * not used, as they add wakeup latency and may stop the local APIC
+ * timer.
+ */
+static void idle_monitor_init (void)
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!CPU_HAS_FEATURE (CPU_FEATURE_MONITOR))
+    return;
+
+  eax = 0;
+  ecx = 0;
+  cpuid (eax, ebx, ecx, edx);
+  if (eax < 5)
+    return;
+
+  eax = 5;
+  ecx = 0;
+  cpuid (eax, ebx, ecx, edx);
+  if ((ebx & 0xffff) == 0)
+    return;
+
+  /* ECX bit 0: EDX enumerates the MWAIT sub-states.  */
+  if ((ecx & 1) && ((edx >> 4) & 0xf) > 0)
+    idle_mwait_hint = ((edx >> 4) & 0xf) - 1;
+
+  idle_monitor_supported = TRUE;
+}
+#endif	/* MACH_HYP */
+
 /*
  * Find devices.  The system is alive.
  */
@@ -160,6 +198,8 @@ void machine_init(void)
 #ifdef MACH_HYP
 	hyp_init();
 #else	/* MACH_HYP */
+	idle_monitor_init();
+
 #if defined(APIC)
 	int err;
 
@@ -241,6 +281,19 @@ void machine_idle (int cpu)
 #endif	/* MACH_HYP */
 }
 
+/* Conserve power on processor CPU until *WORD is set.  */
+void machine_idle_monitor (int cpu, void * volatile *word)
+{
+#ifdef	MACH_HYP
+  hyp_idle();
+#else	/* MACH_HYP */
+  assert (cpu == cpu_number ());
+  asm volatile ("monitor" : : "a" (word), "c" (0), "d" (0) : "memory");
+  if (*word == NULL)
+    asm volatile ("mwait" : : "a" (idle_mwait_hint), "c" (0) : "memory");
+#endif	/* MACH_HYP */
+}
+
 void machine_relax (void)
 {
 	asm volatile ("rep; nop" : : : "memory");
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2026 Free Software Foundation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * 	Status information for the request queue of block devices.
+ */
+
+#ifndef	_DEVICE_BLKIO_STATUS_H_
+#define	_DEVICE_BLKIO_STATUS_H_
+
+/*
+ * Request queue statistics, returned by device_get_status.  Each disk
+ * has its own queue, shared by its partitions.  Latencies are measured
+ * from the time a request is queued until it completes, at the
+ * resolution of the clock tick.
+ */
+struct blkio_status {
+	int	reads;		/* read requests completed */
+	int	writes;		/* write requests completed */
+	int	merges;		/* requests merged into a queued one */
+	int	queued;		/* requests waiting to be started */
+	int	depth;		/* requests the driver is working on */
+	int	max_depth;	/* limit on depth */
+	int	peak_depth;	/* highest depth reached */
+	int	avg_depth;	/* average depth, in hundredths */
+	int	avg_latency;	/* average latency, in microseconds */
+	int	max_latency;	/* highest latency, in microseconds */
+};
+
+#define	BLKIO_STATUS_COUNT	(sizeof(struct blkio_status)/sizeof(int))
+#define	BLKIO_STATUS		(('b'<<16) + 1)
+
+#endif	/* _DEVICE_BLKIO_STATUS_H_ */
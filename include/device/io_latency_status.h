@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2026 Free Software Foundation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * 	Completion latency of device requests.
+ */
+
+#ifndef	_DEVICE_IO_LATENCY_STATUS_H_
+#define	_DEVICE_IO_LATENCY_STATUS_H_
+
+#define	IO_LATENCY_BUCKETS	16
+
+/*
+ * Histogram of the time from the submission of a request until its
+ * completion is processed, returned by device_get_status.  Bucket 0
+ * counts requests completed within the clock tick they were submitted
+ * in, bucket i those that took less than 2^i ticks, and the last
+ * bucket all slower ones.  Completions are processed on the processor
+ * which submitted the request where possible: queues has bit i % 32
+ * set if processor i processed some.
+ */
+struct io_latency_status {
+	int	tick;			/* clock tick, in microseconds */
+	int	count[IO_LATENCY_BUCKETS];
+	int	queues;			/* completion queues used */
+};
+
+#define	IO_LATENCY_STATUS_COUNT	(sizeof(struct io_latency_status)/sizeof(int))
+#define	IO_LATENCY_STATUS	(('l'<<16) + 1)
+
+#endif	/* _DEVICE_IO_LATENCY_STATUS_H_ */
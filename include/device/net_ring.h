@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2026 Free Software Foundation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * 	Packet rings shared with a network device.
+ */
+
+#ifndef	_DEVICE_NET_RING_H_
+#define	_DEVICE_NET_RING_H_
+
+/*
+ * A network device has up to NET_RING_FILTERS pairs of rings, each
+ * used by a single filter port.  device_map at offset
+ * n * NET_RING_SIZE returns a pager for the NET_RING_SIZE bytes of
+ * pair n: a struct net_ring_area, then the packet buffers of the
+ * receive ring, then those of the transmit ring.
+ *
+ * Once pair n is mapped, packets accepted by a filter with
+ * NETF_RING | NETF_RING_INDEX(n) set are copied into its receive
+ * ring, header first, instead of being sent in messages.  Filters of
+ * other ports cannot use the pair as long as that one lives.  The
+ * kernel fills slots at tail, the task frees them by advancing head.
+ * Both only ever grow, the slot is taken modulo NET_RING_SLOTS.  Before
+ * it waits for an empty ring, the task sets NET_RING_WAKEUP in flags
+ * and checks tail again; the next packet then clears it and sends a
+ * bare message with id NET_RING_MSG_ID to the filter port.
+ *
+ * On the transmit ring the task fills slots at tail, and setting the
+ * NET_RING_TXSYNC status to n sends them and advances head.
+ */
+#define	NET_RING_FILTERS	16
+#define	NET_RING_SLOTS		128
+#define	NET_RING_BUF_SIZE	2048
+
+#define	NET_RING_MSG_ID		2997	/* in device.defs reply range */
+
+struct net_ring_slot {
+	unsigned short	length;		/* bytes of frame */
+	unsigned short	flags;		/* unused, zero */
+};
+
+struct net_ring {
+	volatile unsigned int	head;	/* next slot to consume */
+	volatile unsigned int	tail;	/* next slot to fill */
+	volatile unsigned int	flags;
+	unsigned int		drops;	/* packets lost to a full ring */
+	struct net_ring_slot	slot[NET_RING_SLOTS];
+};
+
+#define	NET_RING_WAKEUP		0x1	/* task waits for a message */
+
+struct net_ring_area {
+	struct net_ring	rx;
+	struct net_ring	tx;
+};
+
+#define	NET_RING_BUFFERS	4096	/* offset of the first buffer */
+#define	NET_RING_RX_BUFFER(i)	(NET_RING_BUFFERS + (i) * NET_RING_BUF_SIZE)
+#define	NET_RING_TX_BUFFER(i) \
+	NET_RING_RX_BUFFER(NET_RING_SLOTS + (i))
+#define	NET_RING_SIZE		NET_RING_RX_BUFFER(2 * NET_RING_SLOTS)
+
+#define	NET_RING_TXSYNC		(('n'<<16) + 5)
+
+#endif	/* _DEVICE_NET_RING_H_ */
@@ -74,6 +74,48 @@ struct net_status {
 
 #define	NET_FLAGS		(('n'<<16) + 4)
 
+/*
+ * Receive interrupt mitigation.  Once THRESHOLD received packets wait
+ * for delivery, the interrupt of the device is masked and the device
+ * is polled instead, BUDGET packets at a time, until it is drained.
+ * A threshold of 0 leaves the interrupt alone.
+ */
+struct net_rx_mitigation {
+	int	threshold;		/* waiting packets to start polling */
+	int	budget;			/* packets delivered per poll */
+};
+#define	NET_RX_MITIGATION_COUNT	(sizeof(struct net_rx_mitigation)/sizeof(int))
+#define	NET_RX_MITIGATION	(('n'<<16) + 6)
+
+struct net_rx_stats {
+	int	interrupts;		/* interrupts which received packets */
+	int	intr_packets;		/* packets received by them */
+	int	polls;			/* times the device was polled */
+	int	poll_packets;		/* packets received by polling */
+	int	poll_starts;		/* times the interrupt was masked */
+	int	dropped;		/* packets lost, too many waiting */
+};
+#define	NET_RX_STATS_COUNT	(sizeof(struct net_rx_stats)/sizeof(int))
+#define	NET_RX_STATS		(('n'<<16) + 7)
+
+/*
+ * Checksum offload, a mask of NET_CSUM_* flags.  With NET_CSUM_RX set,
+ * received packets which the device or its backend already validated
+ * are delivered as they are, their TCP and UDP checksums possibly
+ * blank, so the task must not check them again.
+ */
+#define	NET_CSUM_OFFLOAD	(('n'<<16) + 8)
+
+#define	NET_CSUM_RX		0x1	/* trust validated packets */
+
+/*
+ * Whether the BPF filters set from now on are compiled to machine code
+ * or run by the interpreter, as a boolean.  This is global to all
+ * interfaces, and can only be read here: host_bpf_jit_control changes
+ * it.
+ */
+#define	NET_BPF_JIT		(('n'<<16) + 9)
+
 /*
  * Input packet filter definition
  */
@@ -125,6 +167,10 @@ typedef filter_t	*filter_array_t;
 /*  flags  */
 #define NETF_IN		0x1
 #define NETF_OUT	0x2
+#define NETF_BATCH	0x4	/* deliver in net_rcv_batch_msg */
+#define NETF_RING	0x8	/* copy into a mapped ring, see net_ring.h */
+#define NETF_RING_INDEX(n)	((n) << 4)	/* which ring, with NETF_RING */
+#define NETF_RING_NUMBER(f)	(((f) >> 4) & 0xf)
 
 /*  binary operators  */
 #define NETF_NOP	(0<<NETF_NBPA)
@@ -196,6 +242,35 @@ struct net_rcv_msg {
 typedef struct net_rcv_msg 	*net_rcv_msg_t;
 #define	net_rcv_msg_packet_count packet_type.msgt_number
 
+/*
+ * Batched receive message format.
+ *
+ * A filter with NETF_BATCH set gets several packets per message.
+ * Each of them is a net_rcv_batch_entry, followed by the header and
+ * then by the packet with its packet_header, both padded to a
+ * long-word boundary.
+ */
+#define	NET_RCV_BATCH_MSG_ID	2998	/* in device.defs reply range */
+#define	NET_RCV_BATCH_MAX	7680
+
+struct net_rcv_batch_entry {
+	unsigned short	header_size;	/* bytes of header */
+	unsigned short	packet_size;	/* bytes of packet */
+};
+
+#define	NET_BATCH_ALIGN(n)	(((n) + 3) & ~3)
+#define	NET_BATCH_PACKET(hsize) \
+	(sizeof (struct net_rcv_batch_entry) + NET_BATCH_ALIGN(hsize))
+#define	NET_BATCH_ENTRY_SIZE(hsize, psize) \
+	(NET_BATCH_PACKET(hsize) + NET_BATCH_ALIGN(psize))
+
+struct net_rcv_batch_msg {
+	mach_msg_header_t msg_hdr;
+	mach_msg_type_t	packet_type;	/* bytes of all the entries */
+	char		packets[NET_RCV_BATCH_MAX];
+};
+typedef struct net_rcv_batch_msg	*net_rcv_batch_msg_t;
+
 
 
 #endif	/* _DEVICE_NET_STATUS_H_ */
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef	_MACH_GSYNC_H_
+#define	_MACH_GSYNC_H_
+
+#include <mach/machine/vm_types.h>
+
+/*
+ *	Maximum number of addresses for gsync_waitv.
+ *	Remember to update the mig type definition in
+ *	gnumach.defs when changing it.
+ */
+#define GSYNC_WAITV_MAX	64
+
+/*
+ *	An address to wait on with gsync_waitv, and the value
+ *	it must contain for the thread to block.
+ */
+typedef struct gsync_waitv {
+	rpc_vm_offset_t	addr;
+	unsigned int	val;
+} gsync_waitv_t;
+
+typedef gsync_waitv_t	*gsync_waitv_array_t;
+
+#endif	/* _MACH_GSYNC_H_ */
@@ -27,6 +27,8 @@
 #ifndef	_MACH_POLICY_H_
 #define _MACH_POLICY_H_
 
+#include <mach/machine/vm_types.h>
+
 /*
  *	mach/policy.h
  *
@@ -38,8 +40,36 @@
  */
 #define	POLICY_TIMESHARE	1
 #define POLICY_FIXEDPRI		2
-#define POLICY_LAST		2
+#define POLICY_DEADLINE		4
+#define POLICY_LAST		4
+
+#define invalid_policy(policy)	(((policy) <= 0) || ((policy) > POLICY_LAST) \
+				 || ((policy) & ((policy) - 1)))
+
+/*
+ *	Policy parameters for thread_set_policy.
+ */
+typedef integer_t	*policy_param_t;
+
+#define POLICY_PARAM_MAX	(8)	/* max array size */
+
+/*
+ *	POLICY_DEADLINE: the thread is given runtime microseconds of
+ *	processor time in every period, to be used within deadline
+ *	microseconds of the start of the period.  Deadline threads are
+ *	dispatched earliest deadline first, ahead of timesharing
+ *	threads.  A thread that exhausts its runtime has its deadline
+ *	postponed by one period.
+ */
+struct policy_deadline_param {
+	integer_t	runtime;	/* usec of processor time */
+	integer_t	period;		/* usec */
+	integer_t	deadline;	/* usec, relative to period start */
+};
 
-#define invalid_policy(policy)	(((policy) <= 0) || ((policy) > POLICY_LAST))
+typedef struct policy_deadline_param	policy_deadline_param_data_t;
+typedef struct policy_deadline_param	*policy_deadline_param_t;
+#define POLICY_DEADLINE_PARAM_COUNT \
+		(sizeof(policy_deadline_param_data_t) / sizeof(integer_t))
 
 #endif /* _MACH_POLICY_H_ */
@@ -96,6 +96,7 @@ kernel_trap(syscall_mach_port_allocate_name,-75,3)
 kernel_trap(syscall_thread_depress_abort,-76,1)
 
 /* These are screwing up glibc somehow.  */
+/*kernel_trap(syscall_device_readv_request,-38,7)*/
 /*kernel_trap(syscall_device_writev_request,-39,6)*/
 /*kernel_trap(syscall_device_write_request,-40,6)*/
 
@@ -121,4 +121,20 @@ typedef struct thread_sched_info	*thread_sched_info_t;
 #define	THREAD_SCHED_INFO_COUNT	\
 		(sizeof(thread_sched_info_data_t) / sizeof(natural_t))
 
+#define THREAD_DEADLINE_INFO	3
+
+struct thread_deadline_info {
+	integer_t	runtime;	/* usec of processor time per period */
+	integer_t	period;		/* usec */
+	integer_t	deadline;	/* usec, relative to period start */
+	integer_t	budget;		/* usec left in current period */
+	natural_t	periods;	/* periods started */
+	natural_t	misses;		/* deadlines missed */
+};
+
+typedef struct thread_deadline_info	thread_deadline_info_data_t;
+typedef struct thread_deadline_info	*thread_deadline_info_t;
+#define	THREAD_DEADLINE_INFO_COUNT	\
+		(sizeof(thread_deadline_info_data_t) / sizeof(natural_t))
+
 #endif	/* _MACH_THREAD_INFO_H_ */
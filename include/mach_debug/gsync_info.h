@@ -0,0 +1,44 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MACH_DEBUG_GSYNC_INFO_H_
+#define _MACH_DEBUG_GSYNC_INFO_H_
+
+/*
+ *	Remember to update the mig type definitions
+ *	in mach_debug_types.defs when adding/removing fields.
+ */
+
+/*
+ *	State of the hash table of addresses that threads wait on
+ *	with gsync_wait.  The average chain length is
+ *	gsi_nwaiters / gsi_used.  Lock contention is counted
+ *	since boot, across table resizes.
+ */
+typedef struct gsync_info {
+	unsigned int gsi_nbuckets;	/* current number of buckets */
+	unsigned int gsi_resizes;	/* times the table was grown */
+	unsigned int gsi_nwaiters;	/* waiting threads */
+	unsigned int gsi_nkeys;		/* distinct addresses waited on */
+	unsigned int gsi_used;		/* buckets with waiters */
+	unsigned int gsi_max_chain;	/* most waiters in a bucket */
+	unsigned int gsi_max_keys;	/* most addresses in a bucket */
+	unsigned int gsi_lookups;	/* bucket lookups */
+	unsigned int gsi_contended;	/* lookups that found the lock held */
+} gsync_info_t;
+
+#endif	/* _MACH_DEBUG_GSYNC_INFO_H_ */
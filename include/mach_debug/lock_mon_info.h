@@ -0,0 +1,66 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MACH_DEBUG_LOCK_MON_INFO_H_
+#define _MACH_DEBUG_LOCK_MON_INFO_H_
+
+#include <stdint.h>
+#include <mach/machine/vm_types.h>
+
+/*
+ *	Remember to update the mig type definitions
+ *	in mach_debug_types.defs when adding/removing fields.
+ */
+
+/*
+ *	Kinds of locks.
+ */
+#define LOCK_MON_SIMPLE		0	/* simple spin lock */
+#define LOCK_MON_KMUTEX		1	/* sleeping mutex */
+#define LOCK_MON_READ		2	/* complex lock, for read */
+#define LOCK_MON_WRITE		3	/* complex lock, for write or upgrade */
+
+/*
+ *	Flags for host_lock_mon_control.
+ */
+#define LOCK_MON_ON		0x1	/* collect statistics */
+#define LOCK_MON_CLEAR		0x2	/* reset statistics first */
+
+/*
+ *	Statistics of the acquisitions of a class of locks from one
+ *	call site.  The class is the address the locks were
+ *	initialized from, or the address of a statically initialized
+ *	lock.  Times are in timestamp units (processor cycles on x86);
+ *	hold times are not measured for readers.  The maxima are
+ *	approximate.
+ */
+typedef struct lock_mon_info {
+	uint64_t lmi_wait;		/* total time spent waiting */
+	uint64_t lmi_max_wait;		/* longest wait */
+	uint64_t lmi_hold;		/* total time held */
+	uint64_t lmi_max_hold;		/* longest hold */
+	rpc_vm_offset_t lmi_class;	/* lock class */
+	rpc_vm_offset_t lmi_caller;	/* acquisition site */
+	unsigned int lmi_type;		/* kind of lock, LOCK_MON_* */
+	unsigned int lmi_acquired;	/* acquisitions */
+	unsigned int lmi_contended;	/* attempts that found it held */
+	unsigned int lmi_sleeps;	/* attempts that slept */
+} lock_mon_info_t;
+
+typedef lock_mon_info_t *lock_mon_info_array_t;
+
+#endif	/* _MACH_DEBUG_LOCK_MON_INFO_H_ */
@@ -33,6 +33,11 @@
 #include <mach_debug/vm_info.h>
 #include <mach_debug/slab_info.h>
 #include <mach_debug/hash_info.h>
+#include <mach_debug/sched_info.h>
+#include <mach_debug/gsync_info.h>
+#include <mach_debug/lock_mon_info.h>
+#include <mach_debug/slab_trace_info.h>
+#include <mach_debug/numa_info.h>
 
 typedef	char	symtab_name_t[32];
 typedef	const char	*const_symtab_name_t;
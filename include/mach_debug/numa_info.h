@@ -0,0 +1,52 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MACH_DEBUG_NUMA_INFO_H_
+#define _MACH_DEBUG_NUMA_INFO_H_
+
+#include <mach/machine/vm_types.h>
+
+/*
+ *	Remember to update the mig type definitions
+ *	in mach_debug_types.defs when adding/removing fields.
+ */
+
+/*
+ *	Maximum number of nodes returned by host_numa_info.
+ */
+#define NUMA_INFO_MAX_NODES	8
+
+/*
+ *	Memory and page allocation statistics of a NUMA node.
+ *	Counts are in pages.  Local allocations were made by
+ *	processors of the node, remote ones by processors of
+ *	other nodes; fallback allocations are those processors
+ *	of the node had to make from other nodes.
+ */
+typedef struct numa_node_info {
+	unsigned int nni_node;			/* node number */
+	unsigned int nni_ncpus;			/* processors of the node */
+	rpc_long_natural_t nni_pages;		/* pages of the node */
+	rpc_long_natural_t nni_free_pages;	/* ... currently free */
+	rpc_long_natural_t nni_local_allocs;
+	rpc_long_natural_t nni_remote_allocs;
+	rpc_long_natural_t nni_fallback_allocs;
+} numa_node_info_t;
+
+typedef numa_node_info_t *numa_node_info_array_t;
+
+#endif	/* _MACH_DEBUG_NUMA_INFO_H_ */
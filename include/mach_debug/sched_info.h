@@ -0,0 +1,69 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MACH_DEBUG_SCHED_INFO_H_
+#define _MACH_DEBUG_SCHED_INFO_H_
+
+#include <sys/types.h>
+
+/*
+ *	Remember to update the mig type definitions
+ *	in mach_debug_types.defs when adding/removing fields.
+ */
+
+/*
+ *	Reasons for a processor to switch away from a thread.
+ */
+#define SCHED_STATS_BLOCK	0	/* thread blocked */
+#define SCHED_STATS_PREEMPT	1	/* thread was preempted */
+#define SCHED_STATS_YIELD	2	/* thread yielded the processor */
+#define SCHED_STATS_HANDOFF	3	/* thread handed off to another */
+#define SCHED_STATS_NREASONS	4
+
+/*
+ *	Ways an idle processor was made to notice a thread
+ *	dispatched to it by another processor.
+ */
+#define SCHED_STATS_WAKEUP_IPI		0	/* interprocessor interrupt */
+#define SCHED_STATS_WAKEUP_MONITOR	1	/* store to monitored word */
+#define SCHED_STATS_NWAKEUPS		2
+
+/*
+ *	Run queue delays are recorded per priority band, each band
+ *	covering SCHED_STATS_BAND_SIZE consecutive priorities.  Bucket
+ *	i of a histogram counts delays of [2^i, 2^(i+1)) timestamp
+ *	units (processor cycles on x86); the last bucket also counts
+ *	longer delays.  Timestamps of different processors can't be
+ *	compared, so only the threads which became runnable on the
+ *	processor that runs them are recorded; the others are counted
+ *	in remote.
+ */
+#define SCHED_STATS_NBANDS	4
+#define SCHED_STATS_BAND_SIZE	16
+#define SCHED_STATS_NBUCKETS	32
+
+typedef struct sched_stats_info {
+	int cpu;
+	unsigned int csw[SCHED_STATS_NREASONS];
+	unsigned int wakeups[SCHED_STATS_NWAKEUPS];
+	unsigned int remote;
+	unsigned int wait_hist[SCHED_STATS_NBANDS][SCHED_STATS_NBUCKETS];
+} sched_stats_info_t;
+
+typedef sched_stats_info_t *sched_stats_info_array_t;
+
+#endif	/* _MACH_DEBUG_SCHED_INFO_H_ */
@@ -53,4 +53,21 @@ typedef struct cache_info {
 
 typedef cache_info_t *cache_info_array_t;
 
+/*
+ *	Allocation statistics of a cache, returned by host_slab_stats
+ *	in the same order as host_slab_info returns the caches.
+ */
+typedef struct slab_stats_info {
+	char name[CACHE_NAME_MAX_LEN];
+	rpc_long_natural_t cpu_pool_hits;	/* served by CPU pools */
+	rpc_long_natural_t cpu_pool_misses;	/* went to the depot */
+	rpc_long_natural_t depot_hits;		/* ... and got a magazine */
+	rpc_long_natural_t depot_contention;	/* depot found locked */
+	rpc_vm_size_t requested;		/* bytes requested by clients */
+	rpc_vm_size_t allocated;		/* bytes in allocated objects */
+	rpc_long_natural_t reclaimed;		/* pages released to the VM system */
+} slab_stats_info_t;
+
+typedef slab_stats_info_t *slab_stats_info_array_t;
+
 #endif	/* _MACH_DEBUG_SLAB_INFO_H_ */
@@ -0,0 +1,59 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MACH_DEBUG_SLAB_TRACE_INFO_H_
+#define _MACH_DEBUG_SLAB_TRACE_INFO_H_
+
+#include <mach/machine/vm_types.h>
+#include <mach_debug/slab_info.h>
+
+/*
+ *	Remember to update the mig type definitions
+ *	in mach_debug_types.defs when adding/removing fields.
+ */
+
+/*
+ *	Number of return addresses recorded per allocation site.
+ */
+#define SLAB_TRACE_DEPTH	4
+
+/*
+ *	Flags for host_slab_trace_control.
+ */
+#define SLAB_TRACE_STACK	0x1	/* record callers of the caller */
+#define SLAB_TRACE_CLEAR	0x2	/* reset allocation counts first */
+
+/*
+ *	Statistics of the sampled allocations made from one call site.
+ *	The first caller is the function that called the allocator,
+ *	the others are only recorded with SLAB_TRACE_STACK, and are
+ *	zero past the outermost one found.  Live counts include the
+ *	sampled buffers not released yet; multiply them by the sampling
+ *	rate to estimate the real usage.
+ */
+typedef struct slab_trace_info {
+	rpc_vm_offset_t sti_callers[SLAB_TRACE_DEPTH];
+	rpc_vm_size_t sti_live_bytes;		/* bytes requested, still live */
+	rpc_long_natural_t sti_live;		/* buffers still live */
+	rpc_long_natural_t sti_allocs;		/* sampled allocations */
+	rpc_long_natural_t sti_frees;		/* ... released since */
+	char sti_cache[CACHE_NAME_MAX_LEN];	/* cache allocated from */
+} slab_trace_info_t;
+
+typedef slab_trace_info_t *slab_trace_info_array_t;
+
+#endif	/* _MACH_DEBUG_SLAB_TRACE_INFO_H_ */
@@ -1299,12 +1299,13 @@ ipc_kmsg_copyin_body(
 	ipc_object_t dest;
 	vm_offset_t saddr, eaddr;
 	boolean_t complex;
-	boolean_t use_page_lists, steal_pages;
+	boolean_t use_page_lists, steal_pages, move_pages;
 
 	dest = (ipc_object_t) kmsg->ikm_header.msgh_remote_port;
 	complex = FALSE;
 	use_page_lists = ipc_kobject_vm_page_list(ip_kotype((ipc_port_t)dest));
 	steal_pages = ipc_kobject_vm_page_steal(ip_kotype((ipc_port_t)dest));
+	move_pages = ipc_kobject_vm_page_move(ip_kotype((ipc_port_t)dest));
 
 	saddr = (vm_offset_t) (&kmsg->ikm_header + 1);
 	eaddr = (vm_offset_t) &kmsg->ikm_header + kmsg->ikm_header.msgh_size;
@@ -1428,6 +1429,17 @@ ipc_kmsg_copyin_body(
 					kr = vm_map_copyin_page_list(map,
 				        	addr, length, dealloc,
 						steal_pages, &copy, FALSE);
+				} else if (move_pages && dealloc &&
+					   vm_map_copyin_movable(map, addr,
+								 length)) {
+					/*
+					 *	The sender gives the memory
+					 *	up: move its pages, which the
+					 *	receiver gets in a fresh object
+					 *	instead of a shadow.
+					 */
+					kr = vm_map_copyin_page_list_move(map,
+						addr, length, &copy);
 				} else {
 					kr = vm_map_copyin(map, addr, length,
 							   dealloc, &copy);
@@ -105,7 +105,9 @@ ipc_table_init(void)
 /*
  *	Routine:	ipc_table_alloc
  *	Purpose:
- *		Allocate a table.
+ *		Allocate a table.  Tables come straight from kalloc
+ *		and are freed as soon as they are unused, so there
+ *		is nothing to give back when memory is short.
  *	Conditions:
  *		May block.
  */
@@ -172,7 +172,8 @@ ast_check(void)
 		 *	Update lazy evaluated runq->low if only timesharing.
 		 */
 #if	MACH_FIXPRI
-		if (myprocessor->processor_set->policies & POLICY_FIXEDPRI) {
+		if (myprocessor->processor_set->policies &
+		    (POLICY_FIXEDPRI|POLICY_DEADLINE)) {
 		    if (csw_needed(thread,myprocessor)) {
 			ast_on(mycpu, AST_BLOCK);
 			break;
@@ -182,7 +183,7 @@ ast_check(void)
 			 *	For fixed priority threads, set first_quantum
 			 *	so entire new quantum is used.
 			 */
-			if (thread->policy == POLICY_FIXEDPRI)
+			if (thread->policy != POLICY_TIMESHARE)
 			    myprocessor->first_quantum = TRUE;
 		    }
 		}
@@ -16,19 +16,50 @@
    <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
 #include <kern/gsync.h>
+#include <kern/cpu_number.h>
+#include <kern/host.h>
+#include <kern/kalloc.h>
+#include <kern/ipc_kobject.h>
 #include <kern/kmutex.h>
+#include <kern/mach_debug.server.h>
+#include <kern/priority.h>
+#include <kern/sched.h>
 #include <kern/sched_prim.h>
+#include <kern/smp.h>
 #include <kern/thread.h>
 #include <kern/list.h>
+#include <ipc/ipc_port.h>
+#include <machine/machspl.h>
 #include <vm/vm_map.h>
 #include <vm/vm_kern.h>
+#include <vm/vm_page.h>
 
-/* An entry in the global hash table. */
+/* An entry in the global hash table. The counters are only
+ * modified with the bucket lock held. */
 struct gsync_hbucket
 {
   struct list entries;
   struct kmutex lock;
+  unsigned int nwaiters;    /* Number of waiters in the list. */
+  unsigned int nkeys;       /* Number of distinct keys among them. */
+  unsigned int contended;   /* Times the lock was found held. */
+};
+
+/* The global hash table. A table is only ever replaced by a larger
+ * one, with all its buckets locked. The old table is then marked as
+ * moved and retired, but never freed: a thread that loaded the old
+ * pointer may still be about to lock one of its buckets, and will
+ * retry with the new table once it notices the flag. Since tables
+ * grow geometrically up to GSYNC_MAX_NBUCKETS, the retired ones
+ * never take more space than the current one. */
+struct gsync_table
+{
+  unsigned int nbuckets;    /* Always a power of 2. */
+  boolean_t moved;
+  struct gsync_hbucket *buckets;
+  struct gsync_table *retired;
 };
 
 /* A key used to uniquely identify an address that a thread is
@@ -57,12 +88,28 @@ union gsync_key
     } any;
 };
 
-/* A thread that is blocked on an address with 'gsync_wait'. */
+/* A priority-inheritance mutex that threads are blocked on. It
+ * exists for as long as there are waiters, and is linked into its
+ * owner's list of PI mutexes. Changes to that list, and to the
+ * priority below, are made with the owner locked. */
+struct gsync_pi
+{
+  queue_chain_t link;
+  thread_t owner;           /* Holds a reference. */
+  int pri;                  /* Best priority among the waiters. */
+};
+
+/* A thread that is blocked on an address with 'gsync_wait'
+ * or 'gsync_pi_lock'. */
 struct gsync_waiter
 {
   struct list link;
   union gsync_key key;
   thread_t waiter;
+  event_t event;            /* What the thread sleeps on. */
+  struct gsync_pi *pi;      /* Null unless waiting on a PI mutex. */
+  int pri;                  /* Priority at the time of blocking. */
+  mach_port_name_t name;    /* Port name of the waiting thread. */
 };
 
 /* Needed data for temporary mappings. */
@@ -72,17 +119,84 @@ struct vm_args
   vm_offset_t off;
 };
 
-#define GSYNC_NBUCKETS   512
-static struct gsync_hbucket gsync_buckets[GSYNC_NBUCKETS];
-
-void gsync_setup (void)
+/* Per-processor counters, kept apart so that the fast paths
+ * don't all write to the same cache line. */
+struct gsync_cpu_stats
+{
+  unsigned int lookups;
+  unsigned int inserts;
+  unsigned int removes;
+} __attribute__((aligned(CPU_L1_SIZE)));
+
+/* Bounds on the table size. The initial size grows with the
+ * amount of physical memory and the number of processors. */
+#define GSYNC_MIN_NBUCKETS       512
+#define GSYNC_MAX_NBUCKETS       (1 << 16)
+#define GSYNC_PAGES_PER_BUCKET   256
+#define GSYNC_BUCKETS_PER_CPU    128
+
+/* The table is doubled once a bucket holds more than this many
+ * distinct keys while there are more waiters than buckets. */
+#define GSYNC_MAX_KEYS           4
+
+static struct gsync_table *gsync_table;
+static struct gsync_cpu_stats gsync_cpu_stats[NCPUS];
+
+/* Serializes resizes, and protects the fields below. */
+static struct kmutex gsync_resize_lock;
+static unsigned int gsync_resizes;
+static unsigned int gsync_retired_contended;
+
+/* Set when an insertion finds the table overloaded. */
+static boolean_t gsync_resize_needed;
+
+static struct gsync_table*
+gsync_table_alloc (unsigned int nbuckets)
 {
-  int i;
-  for (i = 0; i < GSYNC_NBUCKETS; ++i)
+  struct gsync_table *tp = (struct gsync_table *)kalloc (sizeof (*tp));
+  if (tp == 0)
+    return (0);
+
+  tp->buckets = (struct gsync_hbucket *)kalloc (nbuckets *
+    sizeof (struct gsync_hbucket));
+  if (tp->buckets == 0)
+    {
+      kfree ((vm_offset_t)tp, sizeof (*tp));
+      return (0);
+    }
+
+  tp->nbuckets = nbuckets;
+  tp->moved = FALSE;
+  tp->retired = 0;
+
+  unsigned int i;
+  for (i = 0; i < nbuckets; ++i)
     {
-      list_init (&gsync_buckets[i].entries);
-      kmutex_init (&gsync_buckets[i].lock);
+      struct gsync_hbucket *hbp = &tp->buckets[i];
+      list_init (&hbp->entries);
+      kmutex_init (&hbp->lock);
+      hbp->nwaiters = hbp->nkeys = hbp->contended = 0;
     }
+
+  return (tp);
+}
+
+void gsync_setup (void)
+{
+  unsigned long pages = vm_page_mem_size () / PAGE_SIZE;
+  unsigned int ncpus = smp_get_numcpus ();
+  unsigned int nbuckets = GSYNC_MIN_NBUCKETS;
+
+  while (nbuckets < GSYNC_MAX_NBUCKETS &&
+      (nbuckets < pages / GSYNC_PAGES_PER_BUCKET ||
+       nbuckets < ncpus * GSYNC_BUCKETS_PER_CPU))
+    nbuckets *= 2;
+
+  gsync_table = gsync_table_alloc (nbuckets);
+  if (gsync_table == 0)
+    panic ("gsync: unable to allocate hash table");
+
+  kmutex_init (&gsync_resize_lock);
 }
 
 /* Convenience comparison functions for gsync_key's. */
@@ -148,7 +262,7 @@ probe_address (vm_map_t map, vm_offset_t addr,
 
 /* Initialize the key with its needed members, depending on whether the
  * address is local or shared. Also stores the VM object and offset inside
- * the argument VAP for future use. */
+ * the argument VAP for future use. Returns 0 if successful, -1 otherwise. */
 static int
 gsync_prepare_key (task_t task, vm_offset_t addr, int flags,
   union gsync_key *keyp, struct vm_args *vap)
@@ -170,7 +284,7 @@ gsync_prepare_key (task_t task, vm_offset_t addr, int flags,
       keyp->local.addr = addr;
     }
 
-  return ((int)(gsync_key_hash (keyp) % GSYNC_NBUCKETS));
+  return (0);
 }
 
 static inline struct gsync_waiter*
@@ -203,6 +317,193 @@ gsync_find_key (const struct list *entries,
   return (runp);
 }
 
+/* Return the first waiter on the key KEYP in the bucket HBP,
+ * or null if there are none. */
+static inline struct gsync_waiter*
+gsync_first_waiter (struct gsync_hbucket *hbp, const union gsync_key *keyp)
+{
+  int exact = 0;
+  struct list *runp = gsync_find_key (&hbp->entries, keyp, &exact);
+  return (exact ? node_to_waiter (runp) : 0);
+}
+
+/* Lock the bucket HBP, counting the times it is found held. */
+static inline void
+gsync_bucket_lock (struct gsync_hbucket *hbp)
+{
+  if (kmutex_trylock (&hbp->lock) != KERN_SUCCESS)
+    {
+      kmutex_lock (&hbp->lock, FALSE);
+      hbp->contended++;
+    }
+}
+
+static inline struct gsync_hbucket*
+gsync_table_bucket (struct gsync_table *tp, const union gsync_key *keyp)
+{
+  return (tp->buckets + (gsync_key_hash (keyp) & (tp->nbuckets - 1)));
+}
+
+/* Return the current table. */
+static inline struct gsync_table*
+gsync_current_table (void)
+{
+  return (__atomic_load_n (&gsync_table, __ATOMIC_ACQUIRE));
+}
+
+/* Find and lock the bucket for the key KEYP in the current table,
+ * which is stored in TPP. */
+static struct gsync_hbucket*
+gsync_lock_key_table (const union gsync_key *keyp, struct gsync_table **tpp)
+{
+  gsync_cpu_stats[cpu_number ()].lookups++;
+
+  while (1)
+    {
+      struct gsync_table *tp = gsync_current_table ();
+      struct gsync_hbucket *hbp = gsync_table_bucket (tp, keyp);
+
+      gsync_bucket_lock (hbp);
+      /* The flag is only set with every bucket of the table locked. */
+      if (likely (! tp->moved))
+        {
+          *tpp = tp;
+          return (hbp);
+        }
+
+      kmutex_unlock (&hbp->lock);
+    }
+}
+
+/* Find and lock the bucket for the key KEYP in the current table. */
+static inline struct gsync_hbucket*
+gsync_lock_key (const union gsync_key *keyp)
+{
+  struct gsync_table *tp;
+  return (gsync_lock_key_table (keyp, &tp));
+}
+
+/* Insert the waiter WP into the bucket HBP, after every
+ * waiter with a key that doesn't compare greater. */
+static void
+gsync_insert (struct gsync_hbucket *hbp, struct gsync_waiter *wp)
+{
+  struct list *runp;
+  list_for_each (&hbp->entries, runp)
+    if (gsync_key_lt (&wp->key, &node_to_waiter(runp)->key))
+      break;
+
+  struct list *prevp = list_prev (runp);
+  if (list_end (&hbp->entries, prevp) ||
+      ! gsync_key_eq (&node_to_waiter(prevp)->key, &wp->key))
+    hbp->nkeys++;
+
+  list_add (prevp, runp, &wp->link);
+  hbp->nwaiters++;
+}
+
+/* Remove the node NODEP from the bucket HBP. */
+static void
+gsync_unlink (struct gsync_hbucket *hbp, struct list *nodep)
+{
+  const union gsync_key *keyp = &node_to_waiter(nodep)->key;
+  struct list *prevp = list_prev (nodep);
+  struct list *nextp = list_next (nodep);
+
+  if ((list_end (&hbp->entries, prevp) ||
+       ! gsync_key_eq (&node_to_waiter(prevp)->key, keyp)) &&
+      (list_end (&hbp->entries, nextp) ||
+       ! gsync_key_eq (&node_to_waiter(nextp)->key, keyp)))
+    hbp->nkeys--;
+
+  list_remove (nodep);
+  hbp->nwaiters--;
+}
+
+/* Return the number of threads in 'gsync_wait'. */
+static unsigned int
+gsync_nwaiters (void)
+{
+  unsigned int i, ret = 0;
+  for (i = 0; i < NCPUS; ++i)
+    ret += gsync_cpu_stats[i].inserts - gsync_cpu_stats[i].removes;
+
+  return (ret);
+}
+
+/* Called after inserting into the bucket HBP of the table TP, to
+ * request a resize if the bucket has too many colliding keys and
+ * the table as a whole is loaded. The resize itself is deferred
+ * until a thread enters the module without holding any locks. */
+static inline void
+gsync_check_load (struct gsync_table *tp, struct gsync_hbucket *hbp)
+{
+  if (hbp->nkeys > GSYNC_MAX_KEYS && tp->nbuckets < GSYNC_MAX_NBUCKETS &&
+      ! gsync_resize_needed && gsync_nwaiters () > tp->nbuckets)
+    gsync_resize_needed = TRUE;
+}
+
+/* Replace the current table with one twice as large. */
+static void
+gsync_grow (void)
+{
+  kmutex_lock (&gsync_resize_lock, FALSE);
+  if (! gsync_resize_needed)
+    {
+      kmutex_unlock (&gsync_resize_lock);
+      return;
+    }
+
+  gsync_resize_needed = FALSE;
+
+  struct gsync_table *otp = gsync_table;
+  struct gsync_table *ntp = gsync_table_alloc (otp->nbuckets * 2);
+  if (ntp == 0)
+    {
+      kmutex_unlock (&gsync_resize_lock);
+      return;
+    }
+
+  /* Acquire every bucket lock in address order, which is
+   * consistent with the order used in 'gsync_requeue'. */
+  unsigned int i;
+  for (i = 0; i < otp->nbuckets; ++i)
+    kmutex_lock (&otp->buckets[i].lock, FALSE);
+
+  /* Rehash the waiters. The entries of an old bucket are sorted,
+   * so waiters on the same key keep their relative order. */
+  for (i = 0; i < otp->nbuckets; ++i)
+    {
+      struct gsync_hbucket *obp = &otp->buckets[i];
+      while (! list_empty (&obp->entries))
+        {
+          struct gsync_waiter *wp = node_to_waiter (list_first (&obp->entries));
+          list_remove (&wp->link);
+          gsync_insert (gsync_table_bucket (ntp, &wp->key), wp);
+        }
+
+      obp->nwaiters = obp->nkeys = 0;
+      gsync_retired_contended += obp->contended;
+    }
+
+  ntp->retired = otp;
+  otp->moved = TRUE;
+  __atomic_store_n (&gsync_table, ntp, __ATOMIC_RELEASE);
+  gsync_resizes++;
+
+  for (i = 0; i < otp->nbuckets; ++i)
+    kmutex_unlock (&otp->buckets[i].lock);
+
+  kmutex_unlock (&gsync_resize_lock);
+}
+
+static inline void
+gsync_maybe_grow (void)
+{
+  if (unlikely (gsync_resize_needed))
+    gsync_grow ();
+}
+
 /* Create a temporary mapping in the kernel.*/
 static inline vm_offset_t
 temp_mapping (struct vm_args *vap, vm_offset_t addr, vm_prot_t prot)
@@ -219,6 +520,92 @@ temp_mapping (struct vm_args *vap, vm_offset_t addr, vm_prot_t prot)
   return (paddr);
 }
 
+/* Compare the word at ADDR in TASK, and the next one with GSYNC_QUAD,
+ * with LO and HI. For another task, the words are read through a
+ * temporary mapping of the VM object in VAP, which consumes the
+ * reference held on it. Returns 1 if the values match, 0 if they
+ * don't, and -1 if the mapping failed. */
+static int
+gsync_compare (task_t task, vm_offset_t addr, struct vm_args *vap,
+  unsigned int lo, unsigned int hi, int flags)
+{
+  if (task == current_task ())
+    return (((unsigned int *)addr)[0] == lo &&
+      ((flags & GSYNC_QUAD) == 0 ||
+       ((unsigned int *)addr)[1] == hi));
+
+  vm_offset_t paddr = temp_mapping (vap, addr, VM_PROT_READ);
+  if (unlikely (paddr == 0))
+    {
+      /* Make sure to remove the reference we added. */
+      vm_object_deallocate (vap->obj);
+      return (-1);
+    }
+
+  vm_offset_t off = addr & (PAGE_SIZE - 1);
+  paddr += off;
+
+  int equal = ((unsigned int *)paddr)[0] == lo &&
+    ((flags & GSYNC_QUAD) == 0 ||
+     ((unsigned int *)paddr)[1] == hi);
+
+  paddr -= off;
+
+  /* Note that the call to 'vm_map_remove' will unreference
+   * the VM object, so we don't have to do it ourselves. */
+  vm_map_remove (kernel_map, paddr, paddr + PAGE_SIZE);
+  return (equal);
+}
+
+/* Prepare the current thread to sleep on EVENT, for at most
+ * MSEC milliseconds if FLAGS contains GSYNC_TIMED. Waiters are
+ * woken up through their event rather than directly, so that a
+ * thread that gave up waiting isn't woken up from another sleep. */
+static inline void
+gsync_assert_wait (event_t event, natural_t msec, int flags)
+{
+  assert_wait (event, TRUE);
+  if (flags & GSYNC_TIMED)
+    thread_set_timeout (convert_ipc_timeout_to_ticks (msec));
+}
+
+/* Lock and return the bucket that the waiter WP is in. In the
+ * meantime, it may have been requeued to another key, or the table
+ * resized. The key of a waiter is only modified with the lock of
+ * the bucket it's in held. */
+static struct gsync_hbucket*
+gsync_lock_waiter (struct gsync_waiter *wp)
+{
+  while (1)
+    {
+      union gsync_key key = wp->key;
+      struct gsync_hbucket *hbp = gsync_lock_key (&key);
+
+      if (gsync_key_eq (&key, &wp->key))
+        return (hbp);
+
+      kmutex_unlock (&hbp->lock);
+    }
+}
+
+/* Remove the waiter WP after its thread woke up, unless it was
+ * dequeued already. Returns true if it was. */
+static boolean_t
+gsync_cancel_wait (struct gsync_waiter *wp)
+{
+  struct gsync_hbucket *hbp = gsync_lock_waiter (wp);
+  boolean_t woken = list_node_unlinked (&wp->link);
+
+  if (! woken)
+    {
+      gsync_unlink (hbp, &wp->link);
+      gsync_cpu_stats[cpu_number ()].removes++;
+    }
+
+  kmutex_unlock (&hbp->lock);
+  return (woken);
+}
+
 kern_return_t gsync_wait (task_t task, vm_offset_t addr,
   unsigned int lo, unsigned int hi, natural_t msec, int flags)
 {
@@ -227,19 +614,18 @@ kern_return_t gsync_wait (task_t task, vm_offset_t addr,
   else if (addr % sizeof (int) != 0)
     return (KERN_INVALID_ADDRESS);
 
+  gsync_maybe_grow ();
   vm_map_lock_read (task->map);
 
   struct gsync_waiter w;
   struct vm_args va;
-  boolean_t remote = task != current_task ();
-  int bucket = gsync_prepare_key (task, addr, flags, &w.key, &va);
 
-  if (bucket < 0)
+  if (gsync_prepare_key (task, addr, flags, &w.key, &va) < 0)
     {
       vm_map_unlock_read (task->map);
       return (KERN_INVALID_ADDRESS);
     }
-  else if (remote)
+  else if (task != current_task ())
     /* The VM object is returned locked. However, we are about to acquire
      * a sleeping lock for a bucket, so we must not hold any simple
      * locks. To prevent this object from going away, we add a reference
@@ -249,100 +635,247 @@ kern_return_t gsync_wait (task_t task, vm_offset_t addr,
   /* We no longer need the lock on the VM object. */
   vm_object_unlock (va.obj);
 
-  struct gsync_hbucket *hbp = gsync_buckets + bucket;
-  kmutex_lock (&hbp->lock, FALSE);
+  struct gsync_table *tp;
+  struct gsync_hbucket *hbp = gsync_lock_key_table (&w.key, &tp);
 
   /* Before doing any work, check that the expected value(s)
    * match the contents of the address. Otherwise, the waiting
    * thread could potentially miss a wakeup. */
+  int equal = gsync_compare (task, addr, &va, lo, hi, flags);
 
-  boolean_t equal;
-  if (! remote)
-    equal = ((unsigned int *)addr)[0] == lo &&
-      ((flags & GSYNC_QUAD) == 0 ||
-       ((unsigned int *)addr)[1] == hi);
-  else
+  /* Done with the task's map. */
+  vm_map_unlock_read (task->map);
+
+  if (equal <= 0)
+    {
+      kmutex_unlock (&hbp->lock);
+      return (equal < 0 ? KERN_MEMORY_FAILURE : KERN_INVALID_ARGUMENT);
+    }
+
+  struct gsync_waiter *first = gsync_first_waiter (hbp, &w.key);
+  if (first != 0 && first->pi != 0)
+    {
+      /* PI mutexes must only be waited on with 'gsync_pi_lock'. */
+      kmutex_unlock (&hbp->lock);
+      return (KERN_INVALID_ARGUMENT);
+    }
+
+  /* Finally, add ourselves to the list and go to sleep. */
+  w.waiter = current_thread ();
+  w.event = (event_t)&w;
+  w.pi = 0;
+  gsync_insert (hbp, &w);
+  gsync_cpu_stats[cpu_number ()].inserts++;
+  gsync_check_load (tp, hbp);
+
+  gsync_assert_wait (w.event, msec, flags);
+  kmutex_unlock (&hbp->lock);
+  thread_block (thread_no_continuation);
+
+  /* We're back. */
+  if (current_thread()->wait_result == THREAD_AWAKENED ||
+      gsync_cancel_wait (&w))
+    return (KERN_SUCCESS);
+
+  /* Map the error code. */
+  return (current_thread()->wait_result == THREAD_INTERRUPTED ?
+    KERN_INTERRUPTED : KERN_TIMEDOUT);
+}
+
+/* One of the addresses a thread waits on with 'gsync_waitv'. */
+struct gsync_waitv_slot
+{
+  struct gsync_waiter w;
+  struct vm_args va;
+  struct gsync_hbucket *hbp;
+};
+
+/* Find and lock the buckets of the N keys of the slots in VS, which
+ * must all belong to the same table, stored in TPP. The distinct
+ * buckets are stored in BUCKETS, in the order they were locked, and
+ * their number is returned. The locks are acquired in address order, like everywhere
+ * else, so that this can't deadlock with other lookups. */
+
+static unsigned int
+gsync_lock_slots (struct gsync_waitv_slot *vs, unsigned int n,
+  struct gsync_hbucket **buckets, struct gsync_table **tpp)
+{
+  gsync_cpu_stats[cpu_number ()].lookups += n;
+
+  while (1)
     {
-      vm_offset_t paddr = temp_mapping (&va, addr, VM_PROT_READ);
-      if (unlikely (paddr == 0))
+      struct gsync_table *tp = gsync_current_table ();
+      unsigned int i, j, nb = 0;
+
+      for (i = 0; i < n; ++i)
         {
-          kmutex_unlock (&hbp->lock);
-          vm_map_unlock_read (task->map);
-          /* Make sure to remove the reference we added. */
-          vm_object_deallocate (va.obj);
-          return (KERN_MEMORY_FAILURE);
+          struct gsync_hbucket *hbp = gsync_table_bucket (tp, &vs[i].w.key);
+          vs[i].hbp = hbp;
+
+          /* Insertion sort, skipping duplicates. */
+          for (j = nb; j > 0 && buckets[j - 1] > hbp; --j)
+            ;
+          if (j > 0 && buckets[j - 1] == hbp)
+            continue;
+
+          memmove (&buckets[j + 1], &buckets[j], (nb - j) * sizeof (*buckets));
+          buckets[j] = hbp;
+          ++nb;
+        }
+
+      for (i = 0; i < nb; ++i)
+        gsync_bucket_lock (buckets[i]);
+
+      if (likely (! tp->moved))
+        {
+          *tpp = tp;
+          return (nb);
         }
 
-      vm_offset_t off = addr & (PAGE_SIZE - 1);
-      paddr += off;
+      for (i = 0; i < nb; ++i)
+        kmutex_unlock (&buckets[i]->lock);
+    }
+}
 
-      equal = ((unsigned int *)paddr)[0] == lo &&
-        ((flags & GSYNC_QUAD) == 0 ||
-         ((unsigned int *)paddr)[1] == hi);
+kern_return_t gsync_waitv (task_t task, gsync_waitv_array_t entries,
+  mach_msg_type_number_t count, natural_t msec, int flags, int *indexp)
+{
+  if (task == 0)
+    return (KERN_INVALID_TASK);
+  else if (count == 0 || count > GSYNC_WAITV_MAX || (flags & GSYNC_QUAD))
+    return (KERN_INVALID_ARGUMENT);
+
+  unsigned int i;
+  for (i = 0; i < count; ++i)
+    if (entries[i].addr % sizeof (int) != 0)
+      return (KERN_INVALID_ADDRESS);
 
-      paddr -= off;
+  struct gsync_waitv_slot *vs = (struct gsync_waitv_slot *)
+    kalloc (count * sizeof (*vs));
+  if (vs == 0)
+    return (KERN_RESOURCE_SHORTAGE);
 
-      /* Note that the call to 'vm_map_remove' will unreference
-       * the VM object, so we don't have to do it ourselves. */
-      vm_map_remove (kernel_map, paddr, paddr + PAGE_SIZE);
+  gsync_maybe_grow ();
+  vm_map_lock_read (task->map);
+
+  boolean_t remote = task != current_task ();
+  kern_return_t ret = KERN_SUCCESS;
+
+  for (i = 0; i < count; ++i)
+    {
+      if (gsync_prepare_key (task, entries[i].addr, flags,
+          &vs[i].w.key, &vs[i].va) < 0)
+        {
+          ret = KERN_INVALID_ADDRESS;
+          break;
+        }
+
+      /* See 'gsync_wait' on why we do this. */
+      if (remote)
+        vm_object_reference_locked (vs[i].va.obj);
+      vm_object_unlock (vs[i].va.obj);
     }
 
-  /* Done with the task's map. */
-  vm_map_unlock_read (task->map);
+  if (ret != KERN_SUCCESS)
+    {
+      vm_map_unlock_read (task->map);
+      while (remote && i-- > 0)
+        vm_object_deallocate (vs[i].va.obj);
+      kfree ((vm_offset_t)vs, count * sizeof (*vs));
+      return (ret);
+    }
 
-  if (! equal)
+  struct gsync_hbucket *buckets[GSYNC_WAITV_MAX];
+  struct gsync_table *tp;
+  unsigned int nb = gsync_lock_slots (vs, count, buckets, &tp);
+
+  /* Check every value with all the buckets locked, so that a
+   * wakeup on any of the addresses can't be missed. */
+  for (i = 0; i < count; ++i)
     {
-      kmutex_unlock (&hbp->lock);
-      return (KERN_INVALID_ARGUMENT);
+      struct gsync_waiter *first = gsync_first_waiter (vs[i].hbp,
+        &vs[i].w.key);
+      int equal;
+
+      if (first != 0 && first->pi != 0)
+        {
+          /* PI mutexes must only be waited on with 'gsync_pi_lock'. */
+          if (remote)
+            vm_object_deallocate (vs[i].va.obj);
+          equal = 0;
+        }
+      else
+        equal = gsync_compare (task, entries[i].addr, &vs[i].va,
+          entries[i].val, 0, flags);
+
+      if (equal <= 0)
+        {
+          ret = equal < 0 ? KERN_MEMORY_FAILURE : KERN_INVALID_ARGUMENT;
+          while (remote && ++i < count)
+            vm_object_deallocate (vs[i].va.obj);
+          break;
+        }
     }
 
-  /* Look for the first entry in the hash bucket that
-   * compares strictly greater than this waiter. */
-  struct list *runp;
-  list_for_each (&hbp->entries, runp)
-    if (gsync_key_lt (&w.key, &node_to_waiter(runp)->key))
-      break;
+  vm_map_unlock_read (task->map);
 
-  /* Finally, add ourselves to the list and go to sleep. */
-  list_add (runp->prev, runp, &w.link);
-  w.waiter = current_thread ();
+  if (ret == KERN_SUCCESS)
+    {
+      /* All the waiters share the same event. */
+      for (i = 0; i < count; ++i)
+        {
+          vs[i].w.waiter = current_thread ();
+          vs[i].w.event = (event_t)vs;
+          vs[i].w.pi = 0;
+          gsync_insert (vs[i].hbp, &vs[i].w);
+          gsync_check_load (tp, vs[i].hbp);
+        }
 
-  if (flags & GSYNC_TIMED)
-    thread_will_wait_with_timeout (w.waiter, msec);
-  else
-    thread_will_wait (w.waiter);
+      gsync_cpu_stats[cpu_number ()].inserts += count;
+      gsync_assert_wait ((event_t)vs, msec, flags);
+    }
 
-  kmutex_unlock (&hbp->lock);
-  thread_block (thread_no_continuation);
+  for (i = 0; i < nb; ++i)
+    kmutex_unlock (&buckets[i]->lock);
 
-  /* We're back. */
-  kern_return_t ret = KERN_SUCCESS;
-  if (current_thread()->wait_result != THREAD_AWAKENED)
+  if (ret != KERN_SUCCESS)
     {
-      /* We were interrupted or timed out. */
-      kmutex_lock (&hbp->lock, FALSE);
-      if (!list_node_unlinked (&w.link))
-        list_remove (&w.link);
-      kmutex_unlock (&hbp->lock);
+      kfree ((vm_offset_t)vs, count * sizeof (*vs));
+      return (ret);
+    }
+
+  thread_block (thread_no_continuation);
+
+  /* Remove the waiters that are still queued, and report the
+   * first one that was dequeued by a wakeup. More than one may
+   * have been, so callers should recheck all the addresses. */
+  int fired = -1;
+  for (i = 0; i < count; ++i)
+    if (gsync_cancel_wait (&vs[i].w) && fired < 0)
+      fired = i;
 
-      /* Map the error code. */
-      ret = current_thread()->wait_result == THREAD_INTERRUPTED ?
-        KERN_INTERRUPTED : KERN_TIMEDOUT;
+  kfree ((vm_offset_t)vs, count * sizeof (*vs));
+
+  if (fired >= 0)
+    {
+      *indexp = fired;
+      return (KERN_SUCCESS);
     }
 
-  return (ret);
+  return (current_thread()->wait_result == THREAD_TIMED_OUT ?
+    KERN_TIMEDOUT : KERN_INTERRUPTED);
 }
 
 /* Remove a waiter from the queue, wake it up, and
  * return the next node. */
 static inline struct list*
-dequeue_waiter (struct list *nodep)
+dequeue_waiter (struct gsync_hbucket *hbp, struct list *nodep)
 {
   struct list *nextp = list_next (nodep);
-  list_remove (nodep);
+  gsync_unlink (hbp, nodep);
   list_node_init (nodep);
-  clear_wait (node_to_waiter(nodep)->waiter,
-    THREAD_AWAKENED, FALSE);
+  gsync_cpu_stats[cpu_number ()].removes++;
+  thread_wakeup_one (node_to_waiter(nodep)->event);
   return (nextp);
 }
 
@@ -354,13 +887,13 @@ kern_return_t gsync_wake (task_t task,
   else if (addr % sizeof (int) != 0)
     return (KERN_INVALID_ADDRESS);
 
+  gsync_maybe_grow ();
   vm_map_lock_read (task->map);
 
   union gsync_key key;
   struct vm_args va;
-  int bucket = gsync_prepare_key (task, addr, flags, &key, &va);
 
-  if (bucket < 0)
+  if (gsync_prepare_key (task, addr, flags, &key, &va) < 0)
     {
       vm_map_unlock_read (task->map);
       return (KERN_INVALID_ADDRESS);
@@ -373,9 +906,19 @@ kern_return_t gsync_wake (task_t task,
   vm_object_unlock (va.obj);
 
   kern_return_t ret = KERN_INVALID_ARGUMENT;
-  struct gsync_hbucket *hbp = gsync_buckets + bucket;
+  struct gsync_hbucket *hbp = gsync_lock_key (&key);
 
-  kmutex_lock (&hbp->lock, FALSE);
+  int found = 0;
+  struct list *runp = gsync_find_key (&hbp->entries, &key, &found);
+  if (found && node_to_waiter(runp)->pi != 0)
+    {
+      /* PI mutexes are released with 'gsync_pi_unlock'. */
+      kmutex_unlock (&hbp->lock);
+      vm_map_unlock_read (task->map);
+      if (current_task () != task && (flags & GSYNC_MUTATE) != 0)
+        vm_object_deallocate (va.obj);
+      return (ret);
+    }
 
   if (flags & GSYNC_MUTATE)
     {
@@ -406,12 +949,10 @@ kern_return_t gsync_wake (task_t task,
 
   vm_map_unlock_read (task->map);
 
-  int found = 0;
-  struct list *runp = gsync_find_key (&hbp->entries, &key, &found);
   if (found)
     {
       do
-        runp = dequeue_waiter (runp);
+        runp = dequeue_waiter (hbp, runp);
       while ((flags & GSYNC_BROADCAST) &&
         !list_end (&hbp->entries, runp) &&
         gsync_key_eq (&node_to_waiter(runp)->key, &key));
@@ -431,80 +972,89 @@ kern_return_t gsync_requeue (task_t task, vm_offset_t src,
   else if (src % sizeof (int) != 0 || dst % sizeof (int) != 0)
     return (KERN_INVALID_ADDRESS);
 
+  gsync_maybe_grow ();
+
   union gsync_key src_k, dst_k;
   struct vm_args va;
 
-  int src_bkt = gsync_prepare_key (task, src, flags, &src_k, &va);
-  if (src_bkt < 0)
+  if (gsync_prepare_key (task, src, flags, &src_k, &va) < 0)
     return (KERN_INVALID_ADDRESS);
 
   /* Unlock the VM object before the second lookup. */
   vm_object_unlock (va.obj);
 
-  int dst_bkt = gsync_prepare_key (task, dst, flags, &dst_k, &va);
-  if (dst_bkt < 0)
+  if (gsync_prepare_key (task, dst, flags, &dst_k, &va) < 0)
     return (KERN_INVALID_ADDRESS);
 
   /* We never create any temporary mappings in 'requeue', so we
    * can unlock the VM object right now. */
   vm_object_unlock (va.obj);
 
-  /* If we're asked to unconditionally wake up a waiter, then
-   * we need to remove a maximum of two threads from the queue. */
-  unsigned int nw = 1 + wake_one;
-  struct gsync_hbucket *bp1 = gsync_buckets + src_bkt;
-  struct gsync_hbucket *bp2 = gsync_buckets + dst_bkt;
+  struct gsync_hbucket *bp1, *bp2;
+  gsync_cpu_stats[cpu_number ()].lookups++;
 
-  /* Acquire the locks in order, to prevent any potential deadlock. */
-  if (bp1 == bp2)
-    kmutex_lock (&bp1->lock, FALSE);
-  else if ((unsigned long)bp1 < (unsigned long)bp2)
-    {
-      kmutex_lock (&bp1->lock, FALSE);
-      kmutex_lock (&bp2->lock, FALSE);
-    }
-  else
+  /* Both buckets must belong to the same table. */
+  while (1)
     {
-      kmutex_lock (&bp2->lock, FALSE);
-      kmutex_lock (&bp1->lock, FALSE);
+      struct gsync_table *tp = gsync_current_table ();
+      bp1 = gsync_table_bucket (tp, &src_k);
+      bp2 = gsync_table_bucket (tp, &dst_k);
+
+      /* Acquire the locks in order, to prevent any potential deadlock. */
+      if (bp1 == bp2)
+        gsync_bucket_lock (bp1);
+      else if ((unsigned long)bp1 < (unsigned long)bp2)
+        {
+          gsync_bucket_lock (bp1);
+          gsync_bucket_lock (bp2);
+        }
+      else
+        {
+          gsync_bucket_lock (bp2);
+          gsync_bucket_lock (bp1);
+        }
+
+      if (likely (! tp->moved))
+        break;
+
+      kmutex_unlock (&bp1->lock);
+      if (bp1 != bp2)
+        kmutex_unlock (&bp2->lock);
     }
 
   kern_return_t ret = KERN_SUCCESS;
-  int exact;
-  struct list *inp = gsync_find_key (&bp1->entries, &src_k, &exact);
+  int exact = 0;
+  struct list *runp = gsync_find_key (&bp1->entries, &src_k, &exact);
+
+  struct gsync_waiter *dst_first = gsync_first_waiter (bp2, &dst_k);
 
   if (! exact)
     /* There are no waiters in the source queue. */
     ret = KERN_INVALID_ARGUMENT;
+  else if (node_to_waiter(runp)->pi != 0 ||
+      (dst_first != 0 && dst_first->pi != 0))
+    /* Waiters can't be moved from or to a PI mutex. */
+    ret = KERN_INVALID_ARGUMENT;
   else
     {
-      struct list *outp = gsync_find_key (&bp2->entries, &dst_k, 0);
-
-      /* We're going to need a node that points one past the
-       * end of the waiters in the source queue. */
-      struct list *endp = inp;
+      if (wake_one)
+        runp = dequeue_waiter (bp1, runp);
 
-      do
+      /* Move the waiters one at a time, so that they end up
+       * after any waiters already on the destination key. */
+      while (! list_end (&bp1->entries, runp) &&
+        gsync_key_eq (&node_to_waiter(runp)->key, &src_k))
         {
-          /* Modify the keys while iterating. */
-          node_to_waiter(endp)->key = dst_k;
-          endp = list_next (endp);
-        }
-      while (((flags & GSYNC_BROADCAST) || --nw != 0) &&
-        !list_end (&bp1->entries, endp) &&
-        gsync_key_eq (&node_to_waiter(endp)->key, &src_k));
-
-      /* Splice the list by removing waiters from the source queue
-       * and inserting them into the destination queue. */
-      inp->prev->next = endp;
-      endp->prev->next = outp->next;
-      endp->prev = inp->prev;
+          struct gsync_waiter *wp = node_to_waiter (runp);
+          runp = list_next (runp);
 
-      outp->next = inp;
-      inp->prev = outp;
+          gsync_unlink (bp1, &wp->link);
+          wp->key = dst_k;
+          gsync_insert (bp2, wp);
 
-      if (wake_one)
-        (void)dequeue_waiter (inp);
+          if (! (flags & GSYNC_BROADCAST))
+            break;
+        }
     }
 
   /* Release the locks and we're done.*/
@@ -515,3 +1065,445 @@ kern_return_t gsync_requeue (task_t task, vm_offset_t src,
   return (ret);
 }
 
+kern_return_t host_gsync_info (const host_t host, gsync_info_t *infop)
+{
+  if (host == HOST_NULL)
+    return (KERN_INVALID_HOST);
+
+  /* The counters are read without synchronization. Retired
+   * tables are never freed, so this is safe even if the
+   * table is replaced in the meantime. */
+  struct gsync_table *tp = gsync_current_table ();
+  unsigned int i;
+
+  memset (infop, 0, sizeof (*infop));
+  infop->gsi_nbuckets = tp->nbuckets;
+  infop->gsi_resizes = gsync_resizes;
+  infop->gsi_contended = gsync_retired_contended;
+
+  for (i = 0; i < tp->nbuckets; ++i)
+    {
+      const struct gsync_hbucket *hbp = &tp->buckets[i];
+      unsigned int nwaiters = hbp->nwaiters;
+
+      if (nwaiters != 0)
+        infop->gsi_used++;
+      if (nwaiters > infop->gsi_max_chain)
+        infop->gsi_max_chain = nwaiters;
+      if (hbp->nkeys > infop->gsi_max_keys)
+        infop->gsi_max_keys = hbp->nkeys;
+
+      infop->gsi_nwaiters += nwaiters;
+      infop->gsi_nkeys += hbp->nkeys;
+      infop->gsi_contended += hbp->contended;
+    }
+
+  for (i = 0; i < NCPUS; ++i)
+    infop->gsi_lookups += gsync_cpu_stats[i].lookups;
+
+  return (KERN_SUCCESS);
+}
+
+/* Priority-inheritance mutexes. The user word is 0 when the mutex
+ * is free, and otherwise holds the port name of the owning thread,
+ * with GSYNC_PI_WAITERS set once a thread is blocked on it. Only
+ * the unlocked and uncontended states are handled in user space. */
+
+/* Return a reference to the thread named NAME in TASK. */
+static thread_t
+gsync_name_to_thread (task_t task, mach_port_name_t name)
+{
+  ipc_port_t port;
+  thread_t thread = THREAD_NULL;
+
+  if (ipc_port_translate_send (task->itk_space, name, &port) != KERN_SUCCESS)
+    return (thread);
+
+  /* The port is locked. */
+  if (ip_active (port) && ip_kotype (port) == IKOT_THREAD)
+    {
+      thread = (thread_t)port->ip_kobject;
+      thread_reference (thread);
+    }
+
+  ip_unlock (port);
+  return (thread);
+}
+
+/* Check the arguments common to the PI mutex calls. The
+ * word is accessed directly, so it must belong to the
+ * current task, and SELF must name the current thread. */
+static kern_return_t
+gsync_pi_check (task_t task, vm_offset_t addr,
+  mach_port_name_t self, int flags)
+{
+  if (task == 0)
+    return (KERN_INVALID_TASK);
+  else if (addr % sizeof (int) != 0)
+    return (KERN_INVALID_ADDRESS);
+  else if (task != current_task () || (flags & GSYNC_SHARED) ||
+      self == 0 || (self & GSYNC_PI_WAITERS))
+    return (KERN_INVALID_ARGUMENT);
+
+  thread_t thread = gsync_name_to_thread (task, self);
+  if (thread == THREAD_NULL)
+    return (KERN_INVALID_ARGUMENT);
+
+  thread_deallocate (thread);
+  return (thread == current_thread () ? KERN_SUCCESS : KERN_INVALID_ARGUMENT);
+}
+
+/* Set the priority of the PI mutex PI from the waiters on the key
+ * KEYP in the bucket HBP. The owner must be locked. */
+static void
+gsync_pi_update (struct gsync_hbucket *hbp, struct gsync_pi *pi,
+  const union gsync_key *keyp)
+{
+  int pri = NRQS;
+  struct list *runp;
+
+  for (runp = gsync_find_key (&hbp->entries, keyp, 0);
+      ! list_end (&hbp->entries, runp) &&
+      gsync_key_eq (&node_to_waiter(runp)->key, keyp);
+      runp = list_next (runp))
+    if (node_to_waiter(runp)->pri < pri)
+      pri = node_to_waiter(runp)->pri;
+
+  pi->pri = pri;
+}
+
+/* Recompute the priority that THREAD inherits from the PI mutexes
+ * it holds. The thread must be locked. */
+static void
+gsync_pi_propagate (thread_t thread)
+{
+  struct gsync_pi *pi;
+  int pri = NRQS;
+
+  queue_iterate (&thread->pi_mutexes, pi, struct gsync_pi *, link)
+    if (pi->pri < pri)
+      pri = pi->pri;
+
+  thread_set_inherited_priority (thread, pri);
+}
+
+/* Remove the waiter WP, which gave up on its PI mutex, from the
+ * bucket HBP. Returns a thread reference that the caller must
+ * release once the bucket is unlocked, or null. */
+static thread_t
+gsync_pi_remove (struct gsync_hbucket *hbp, struct gsync_waiter *wp)
+{
+  struct gsync_pi *pi = wp->pi;
+  thread_t owner = pi->owner;
+  spl_t s;
+
+  gsync_unlink (hbp, &wp->link);
+  gsync_cpu_stats[cpu_number ()].removes++;
+
+  /* Leave GSYNC_PI_WAITERS set in the word if we were the last
+   * waiter. The owner then simply releases the mutex through
+   * 'gsync_pi_unlock', and we don't touch user memory here. */
+  boolean_t last = gsync_first_waiter (hbp, &wp->key) == 0;
+
+  s = splsched ();
+  thread_lock (owner);
+  if (last)
+    {
+      queue_remove (&owner->pi_mutexes, pi, struct gsync_pi *, link);
+    }
+  else
+    gsync_pi_update (hbp, pi, &wp->key);
+  gsync_pi_propagate (owner);
+  thread_unlock (owner);
+  splx (s);
+
+  if (! last)
+    return (THREAD_NULL);
+
+  kfree ((vm_offset_t)pi, sizeof (*pi));
+  return (owner);
+}
+
+kern_return_t gsync_pi_lock (task_t task, vm_offset_t addr,
+  mach_port_name_t self, natural_t msec, int flags)
+{
+  kern_return_t ret = gsync_pi_check (task, addr, self, flags);
+  if (ret != KERN_SUCCESS)
+    return (ret);
+
+  gsync_maybe_grow ();
+  vm_map_lock_read (task->map);
+
+  struct gsync_waiter w;
+  struct vm_args va;
+
+  if (gsync_prepare_key (task, addr, flags | GSYNC_MUTATE, &w.key, &va) < 0)
+    {
+      vm_map_unlock_read (task->map);
+      return (KERN_INVALID_ADDRESS);
+    }
+
+  vm_object_unlock (va.obj);
+
+  struct gsync_table *tp;
+  struct gsync_hbucket *hbp = gsync_lock_key_table (&w.key, &tp);
+  struct gsync_waiter *first = gsync_first_waiter (hbp, &w.key);
+
+  if (first != 0 && first->pi == 0)
+    {
+      /* Threads are blocked on this address with 'gsync_wait'. */
+      kmutex_unlock (&hbp->lock);
+      vm_map_unlock_read (task->map);
+      return (KERN_INVALID_ARGUMENT);
+    }
+
+  /* Take the mutex if it's free. Otherwise, make sure that
+   * the owner will call into the kernel to release it. */
+  unsigned int *wordp = (unsigned int *)addr;
+  unsigned int val = __atomic_load_n (wordp, __ATOMIC_RELAXED);
+
+  while (1)
+    {
+      if (val == 0)
+        {
+          if (__atomic_compare_exchange_n (wordp, &val, self, FALSE,
+              __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        }
+      else if ((val & ~GSYNC_PI_WAITERS) == self)
+        /* We already own it. */
+        break;
+      else if ((val & GSYNC_PI_WAITERS) ||
+          __atomic_compare_exchange_n (wordp, &val, val | GSYNC_PI_WAITERS,
+            FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+
+  vm_map_unlock_read (task->map);
+
+  if (val == 0 || (val & ~GSYNC_PI_WAITERS) == self)
+    {
+      kmutex_unlock (&hbp->lock);
+      return (val == 0 ? KERN_SUCCESS : KERN_INVALID_ARGUMENT);
+    }
+
+  struct gsync_pi *pi;
+  spl_t s;
+
+  if (first != 0)
+    pi = first->pi;
+  else
+    {
+      thread_t owner = gsync_name_to_thread (task, val & ~GSYNC_PI_WAITERS);
+      if (owner == THREAD_NULL)
+        {
+          kmutex_unlock (&hbp->lock);
+
+          /* Clear GSYNC_PI_WAITERS again if we set it, so that the
+           * unlocks don't all take the slow path. If the word has
+           * changed since, someone else handles it. */
+          if (! (val & GSYNC_PI_WAITERS))
+            {
+              unsigned int waiters = val | GSYNC_PI_WAITERS;
+
+              vm_map_lock_read (task->map);
+              if (gsync_prepare_key (task, addr, flags | GSYNC_MUTATE,
+                  &w.key, &va) >= 0)
+                {
+                  vm_object_unlock (va.obj);
+                  __atomic_compare_exchange_n (wordp, &waiters, val, FALSE,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+                }
+              vm_map_unlock_read (task->map);
+            }
+
+          return (KERN_INVALID_ARGUMENT);
+        }
+
+      pi = (struct gsync_pi *)kalloc (sizeof (*pi));
+      if (pi == 0)
+        {
+          kmutex_unlock (&hbp->lock);
+          thread_deallocate (owner);
+          return (KERN_RESOURCE_SHORTAGE);
+        }
+
+      pi->owner = owner;
+      pi->pri = NRQS;
+
+      s = splsched ();
+      thread_lock (owner);
+      queue_enter (&owner->pi_mutexes, pi, struct gsync_pi *, link);
+      thread_unlock (owner);
+      splx (s);
+    }
+
+  w.waiter = current_thread ();
+  w.event = (event_t)&w;
+  w.pi = pi;
+  w.pri = w.waiter->sched_pri;
+  w.name = self;
+  gsync_insert (hbp, &w);
+  gsync_cpu_stats[cpu_number ()].inserts++;
+  gsync_check_load (tp, hbp);
+
+  /* Pass our priority on to the owner. */
+  s = splsched ();
+  thread_lock (pi->owner);
+  if (w.pri < pi->pri)
+    {
+      pi->pri = w.pri;
+      gsync_pi_propagate (pi->owner);
+    }
+  thread_unlock (pi->owner);
+  splx (s);
+
+  gsync_assert_wait (w.event, msec, flags);
+  kmutex_unlock (&hbp->lock);
+  thread_block (thread_no_continuation);
+
+  /* When woken up normally, the mutex was handed over to us. */
+  if (current_thread()->wait_result == THREAD_AWAKENED)
+    return (KERN_SUCCESS);
+
+  hbp = gsync_lock_waiter (&w);
+  if (list_node_unlinked (&w.link))
+    {
+      /* We were handed the mutex as we gave up. */
+      kmutex_unlock (&hbp->lock);
+      return (KERN_SUCCESS);
+    }
+
+  thread_t owner = gsync_pi_remove (hbp, &w);
+  kmutex_unlock (&hbp->lock);
+  if (owner != THREAD_NULL)
+    thread_deallocate (owner);
+
+  return (current_thread()->wait_result == THREAD_INTERRUPTED ?
+    KERN_INTERRUPTED : KERN_TIMEDOUT);
+}
+
+kern_return_t gsync_pi_trylock (task_t task, vm_offset_t addr,
+  mach_port_name_t self, int flags)
+{
+  kern_return_t ret = gsync_pi_check (task, addr, self, flags);
+  if (ret != KERN_SUCCESS)
+    return (ret);
+
+  union gsync_key key;
+  struct vm_args va;
+
+  vm_map_lock_read (task->map);
+  if (gsync_prepare_key (task, addr, flags | GSYNC_MUTATE, &key, &va) < 0)
+    {
+      vm_map_unlock_read (task->map);
+      return (KERN_INVALID_ADDRESS);
+    }
+
+  vm_object_unlock (va.obj);
+
+  unsigned int val = 0;
+  if (! __atomic_compare_exchange_n ((unsigned int *)addr, &val, self,
+      FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    ret = KERN_FAILURE;
+
+  vm_map_unlock_read (task->map);
+  return (ret);
+}
+
+kern_return_t gsync_pi_unlock (task_t task, vm_offset_t addr,
+  mach_port_name_t self, int flags)
+{
+  kern_return_t ret = gsync_pi_check (task, addr, self, flags);
+  if (ret != KERN_SUCCESS)
+    return (ret);
+
+  gsync_maybe_grow ();
+  vm_map_lock_read (task->map);
+
+  union gsync_key key;
+  struct vm_args va;
+
+  if (gsync_prepare_key (task, addr, flags | GSYNC_MUTATE, &key, &va) < 0)
+    {
+      vm_map_unlock_read (task->map);
+      return (KERN_INVALID_ADDRESS);
+    }
+
+  vm_object_unlock (va.obj);
+
+  struct gsync_hbucket *hbp = gsync_lock_key (&key);
+  struct gsync_waiter *first = gsync_first_waiter (hbp, &key);
+  unsigned int *wordp = (unsigned int *)addr;
+
+  if ((__atomic_load_n (wordp, __ATOMIC_RELAXED) & ~GSYNC_PI_WAITERS) != self ||
+      (first != 0 && first->pi == 0))
+    {
+      kmutex_unlock (&hbp->lock);
+      vm_map_unlock_read (task->map);
+      return (KERN_INVALID_ARGUMENT);
+    }
+  else if (first == 0)
+    {
+      __atomic_store_n (wordp, 0, __ATOMIC_RELEASE);
+      kmutex_unlock (&hbp->lock);
+      vm_map_unlock_read (task->map);
+      return (KERN_SUCCESS);
+    }
+
+  /* Hand the mutex over to the waiter with the best priority,
+   * or the one that has waited the longest among those. */
+  struct gsync_waiter *next = first;
+  struct list *runp;
+
+  for (runp = list_next (&first->link);
+      ! list_end (&hbp->entries, runp) &&
+      gsync_key_eq (&node_to_waiter(runp)->key, &key);
+      runp = list_next (runp))
+    if (node_to_waiter(runp)->pri < next->pri)
+      next = node_to_waiter (runp);
+
+  gsync_unlink (hbp, &next->link);
+  list_node_init (&next->link);
+  gsync_cpu_stats[cpu_number ()].removes++;
+
+  boolean_t more = gsync_first_waiter (hbp, &key) != 0;
+  __atomic_store_n (wordp, next->name | (more ? GSYNC_PI_WAITERS : 0),
+    __ATOMIC_RELEASE);
+  vm_map_unlock_read (task->map);
+
+  /* Unwind the boost of the previous owner, and move it over
+   * to the new one if there are waiters left. */
+  struct gsync_pi *pi = next->pi;
+  thread_t old_owner = pi->owner;
+  spl_t s;
+
+  s = splsched ();
+  thread_lock (old_owner);
+  queue_remove (&old_owner->pi_mutexes, pi, struct gsync_pi *, link);
+  gsync_pi_propagate (old_owner);
+  thread_unlock (old_owner);
+  splx (s);
+
+  if (more)
+    {
+      thread_reference (next->waiter);
+      pi->owner = next->waiter;
+
+      s = splsched ();
+      thread_lock (pi->owner);
+      gsync_pi_update (hbp, pi, &key);
+      queue_enter (&pi->owner->pi_mutexes, pi, struct gsync_pi *, link);
+      gsync_pi_propagate (pi->owner);
+      thread_unlock (pi->owner);
+      splx (s);
+    }
+  else
+    kfree ((vm_offset_t)pi, sizeof (*pi));
+
+  thread_wakeup_one (next->event);
+  kmutex_unlock (&hbp->lock);
+  thread_deallocate (old_owner);
+
+  return (KERN_SUCCESS);
+}
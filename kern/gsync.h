@@ -25,7 +25,12 @@
 #define GSYNC_BROADCAST   0x08
 #define GSYNC_MUTATE      0x10
 
+/* Set in the word of a PI mutex when threads are blocked on it. */
+#define GSYNC_PI_WAITERS  0x80000000U
+
+#include <mach/gsync.h>
 #include <mach/mach_types.h>
+#include <mach/message.h>
 
 void gsync_setup (void);
 
@@ -38,4 +43,16 @@ kern_return_t gsync_wake (task_t task,
 kern_return_t gsync_requeue (task_t task, vm_offset_t src_addr,
   vm_offset_t dst_addr, boolean_t wake_one, int flags);
 
+kern_return_t gsync_waitv (task_t task, gsync_waitv_array_t entries,
+  mach_msg_type_number_t count, natural_t msec, int flags, int *indexp);
+
+kern_return_t gsync_pi_lock (task_t task, vm_offset_t addr,
+  mach_port_name_t self, natural_t msec, int flags);
+
+kern_return_t gsync_pi_trylock (task_t task, vm_offset_t addr,
+  mach_port_name_t self, int flags);
+
+kern_return_t gsync_pi_unlock (task_t task, vm_offset_t addr,
+  mach_port_name_t self, int flags);
+
 #endif
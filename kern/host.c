@@ -256,7 +256,7 @@ host_processor_sets(
 	size = 0; addr = 0;
 
 	for (;;) {
-		simple_lock(&all_psets_lock);
+		lock_read(&all_psets_lock);
 		actual = all_psets_count;
 
 		/* do we have the memory we need? */
@@ -266,7 +266,7 @@ host_processor_sets(
 			break;
 
 		/* unlock and allocate more memory */
-		simple_unlock(&all_psets_lock);
+		lock_read_done(&all_psets_lock);
 
 		if (size != 0)
 			kfree(addr, size);
@@ -293,7 +293,7 @@ host_processor_sets(
 	assert(queue_end(&all_psets, (queue_entry_t) pset));
 
 	/* can unlock now that we've got the pset refs */
-	simple_unlock(&all_psets_lock);
+	lock_read_done(&all_psets_lock);
 
 	/*
 	 *	Always have default port.
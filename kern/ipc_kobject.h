@@ -94,6 +94,15 @@ typedef unsigned int ipc_kobject_type_t;
 
 #define ipc_kobject_vm_page_steal(ikot)	(ikot == IKOT_PAGING_REQUEST)
 
+/*
+ *	Memory given up by the sender of a message to a port that
+ *	is not a kernel object may be moved as a stolen page list,
+ *	when vm_map_copyin_movable says it is worth it.  Kernel
+ *	objects handle the copy objects they get themselves, and
+ *	may not expect page lists.
+ */
+#define ipc_kobject_vm_page_move(ikot)	(ikot == IKOT_NONE)
+
 /* Initialize kernel server dispatch table */
 /* XXX
 extern void mig_init(void);
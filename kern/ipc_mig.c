@@ -982,3 +982,41 @@ syscall_device_writev_request(mach_port_name_t	device_name,
 	device_deallocate(dev);
 	return res;
 }
+
+io_return_t
+syscall_device_readv_request(mach_port_name_t	device_name,
+			     mach_port_name_t	rcv_name,
+			     dev_mode_t		mode,
+			     rpc_recnum_t	recnum,
+			     rpc_io_buf_vec_t	*iovec,
+			     rpc_vm_size_t	iocount,
+			     rpc_vm_size_t	*bytes_read)
+{
+	device_t	dev;
+	io_return_t	res;
+
+	/*
+	 * First try to translate the device name.
+	 *
+	 * If this fails, return KERN_INVALID_CAPABILITY,
+	 * as for the write traps.
+	 */
+	dev = port_name_to_device(device_name);
+	if (dev == DEVICE_NULL)
+		return KERN_INVALID_CAPABILITY;
+
+	/*
+	 * Unlike the reply port of the write traps, rcv_name is
+	 * a receive right of the caller: network devices take the
+	 * next packet queued on it by their filters.  Others
+	 * require MACH_PORT_NULL.
+	 */
+	res = ds_device_readv_trap(dev, rcv_name, mode, recnum,
+				   iovec, iocount, bytes_read);
+
+	/*
+	 * Give up reference from port_name_to_device.
+	 */
+	device_deallocate(dev);
+	return res;
+}
@@ -140,4 +140,13 @@ io_return_t syscall_device_writev_request(
 			rpc_io_buf_vec_t	*iovec,
 			rpc_vm_size_t	iocount);
 
+io_return_t syscall_device_readv_request(
+			mach_port_name_t	device_name,
+			mach_port_name_t	rcv_name,
+			dev_mode_t	mode,
+			rpc_recnum_t	recnum,
+			rpc_io_buf_vec_t	*iovec,
+			rpc_vm_size_t	iocount,
+			rpc_vm_size_t	*bytes_read);
+
 #endif /* _IPC_MIG_H_ */
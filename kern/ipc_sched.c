@@ -32,6 +32,7 @@
 #include <kern/mach_clock.h>
 #include <kern/thread.h>
 #include <kern/sched_prim.h>
+#include <kern/sched_stats.h>
 #include <kern/processor.h>
 #include <kern/thread_swap.h>
 #include <kern/ipc_sched.h>
@@ -229,6 +230,8 @@ thread_handoff(
 
 	ast_context(new, cpu_number());
 	timer_switch(&new->system_timer);
+	sched_stats_hint(SCHED_STATS_HANDOFF);
+	sched_stats_switch(old, new);
 
 	/*
 	 *	stack_handoff is machine-dependent.  It does the
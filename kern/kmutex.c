@@ -18,22 +18,103 @@
 
 #include <kern/kmutex.h>
 #include <kern/atomic.h>
+#include <kern/cpu_number.h>
+#include <kern/lock_mon.h>
+#include <kern/processor.h>
 #include <kern/sched_prim.h>
 #include <kern/thread.h>
+#include <machine/smp.h>
+
+struct kmutex_stats kmutex_stats;
+
+#define KMUTEX_STAT_INC(field)   \
+  __atomic_add_fetch (&kmutex_stats.field, 1, __ATOMIC_RELAXED)
+
+#if NCPUS > 1
+/* Each poll is a pause instruction and a load, so this bounds
+ * spinning to some tens of microseconds.  */
+unsigned int kmutex_spin_max = 1000;
+#else
+unsigned int kmutex_spin_max = 0;
+#endif
+
+static inline void kmutex_set_owner (struct kmutex *mtxp)
+{
+  mtxp->owner_cpu = cpu_number ();
+  mtxp->owner = current_thread ();
+}
 
 void kmutex_init (struct kmutex *mtxp)
 {
   mtxp->state = KMUTEX_AVAIL;
   simple_lock_init (&mtxp->lock);
+  mtxp->owner = NULL;
+  mtxp->owner_cpu = 0;
+  lock_mon_init (&mtxp->mon, __builtin_return_address (0));
+}
+
+#if NCPUS > 1
+/* Spin while the owner of the mutex is running on another processor,
+ * as it is then likely to release it before we could go to sleep and
+ * be woken up again.  Give up as soon as the owner is unknown or not
+ * running, as when the mutex was handed off to a sleeping thread.
+ * Return true if the mutex was acquired. */
+static boolean_t kmutex_spin (struct kmutex *mtxp)
+{
+  struct thread *owner;
+  unsigned int i;
+  int cpu;
+
+  for (i = 0; i < kmutex_spin_max; i++)
+    {
+      if (__atomic_load_n (&mtxp->state, __ATOMIC_RELAXED) == KMUTEX_AVAIL
+          && atomic_cas_acq (&mtxp->state, KMUTEX_AVAIL, KMUTEX_LOCKED))
+        return (TRUE);
+
+      owner = __atomic_load_n (&mtxp->owner, __ATOMIC_RELAXED);
+      cpu = __atomic_load_n (&mtxp->owner_cpu, __ATOMIC_RELAXED);
+      if (owner == NULL || owner == current_thread () ||
+          percpu_array[cpu].active_thread != owner)
+        break;
+
+      cpu_pause ();
+    }
+
+  return (FALSE);
 }
+#endif
+
+/* Account for an acquisition for the lock profiler.  */
+#define KMUTEX_MON_END(mtxp, how)   \
+  lock_mon_end (&(mtxp)->mon, (mtxp), LOCK_MON_KMUTEX, (how))
 
 kern_return_t kmutex_lock (struct kmutex *mtxp, boolean_t interruptible)
 {
+  lock_mon_begin ();
+
   check_simple_locks ();
 
   if (atomic_cas_acq (&mtxp->state, KMUTEX_AVAIL, KMUTEX_LOCKED))
-    /* Unowned mutex - We're done. */
-    return (KERN_SUCCESS);
+    {
+      /* Unowned mutex - We're done. */
+      kmutex_set_owner (mtxp);
+      KMUTEX_MON_END (mtxp, LOCK_MON_HOLD);
+      return (KERN_SUCCESS);
+    }
+
+  KMUTEX_STAT_INC (contended);
+  lock_mon_note (LOCK_MON_CONTENDED);
+
+#if NCPUS > 1
+  if (kmutex_spin (mtxp))
+    {
+      /* The owner released it while we were spinning. */
+      KMUTEX_STAT_INC (spin_acquired);
+      kmutex_set_owner (mtxp);
+      KMUTEX_MON_END (mtxp, LOCK_MON_HOLD);
+      return (KERN_SUCCESS);
+    }
+#endif
 
   /* The mutex is locked. We may have to sleep. */
   simple_lock (&mtxp->lock);
@@ -41,26 +122,52 @@ kern_return_t kmutex_lock (struct kmutex *mtxp, boolean_t interruptible)
     {
       /* The mutex was released in-between. */
       simple_unlock (&mtxp->lock);
+      kmutex_set_owner (mtxp);
+      KMUTEX_MON_END (mtxp, LOCK_MON_HOLD);
       return (KERN_SUCCESS);
     }
 
+  KMUTEX_STAT_INC (sleeps);
+  lock_mon_note (LOCK_MON_SLEPT);
+
   /* Sleep and check the result value of the waiting, in order to
    * inform our caller if we were interrupted or not. Note that
    * we don't need to set again the mutex state. The owner will
    * handle that in every case. */
   thread_sleep ((event_t)mtxp, (simple_lock_t)&mtxp->lock, interruptible);
-  return (current_thread()->wait_result == THREAD_AWAKENED ?
-    KERN_SUCCESS : KERN_INTERRUPTED);
+  if (current_thread()->wait_result != THREAD_AWAKENED)
+    {
+      KMUTEX_MON_END (mtxp, LOCK_MON_FAILED);
+      return (KERN_INTERRUPTED);
+    }
+
+  kmutex_set_owner (mtxp);
+  KMUTEX_MON_END (mtxp, LOCK_MON_HOLD);
+  return (KERN_SUCCESS);
 }
 
 kern_return_t kmutex_trylock (struct kmutex *mtxp)
 {
-  return (atomic_cas_acq (&mtxp->state, KMUTEX_AVAIL, KMUTEX_LOCKED) ?
-    KERN_SUCCESS : KERN_FAILURE);
+  lock_mon_begin ();
+
+  if (!atomic_cas_acq (&mtxp->state, KMUTEX_AVAIL, KMUTEX_LOCKED))
+    {
+      KMUTEX_MON_END (mtxp, LOCK_MON_FAILED);
+      return (KERN_FAILURE);
+    }
+
+  kmutex_set_owner (mtxp);
+  KMUTEX_MON_END (mtxp, LOCK_MON_HOLD);
+  return (KERN_SUCCESS);
 }
 
 void kmutex_unlock (struct kmutex *mtxp)
 {
+  lock_mon_released (&mtxp->mon);
+
+  /* Stop spinners before the mutex can change hands. */
+  mtxp->owner = NULL;
+
   if (atomic_cas_rel (&mtxp->state, KMUTEX_LOCKED, KMUTEX_AVAIL))
     /* No waiters - We're done. */
     return;
@@ -74,3 +181,15 @@ void kmutex_unlock (struct kmutex *mtxp)
 
   simple_unlock (&mtxp->lock);
 }
+
+#if MACH_KDB
+#include <ddb/db_output.h>
+
+void db_show_kmutex_stats (void)
+{
+  db_printf ("contended      %u\n", kmutex_stats.contended);
+  db_printf ("spin acquired  %u\n", kmutex_stats.spin_acquired);
+  db_printf ("sleeps         %u\n", kmutex_stats.sleeps);
+  db_printf ("spin limit     %u\n", kmutex_spin_max);
+}
+#endif /* MACH_KDB */
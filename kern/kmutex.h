@@ -22,10 +22,17 @@
 #include <kern/lock.h>
 #include <mach/kern_return.h>
 
+struct thread;
+
 struct kmutex
 {
   unsigned int state;
   decl_simple_lock_data (, lock)
+  /* Holder and the processor it acquired the mutex on, as hints
+   * for adaptive spinning.  */
+  struct thread *owner;
+  int owner_cpu;
+  decl_lock_mon_data (mon)
 };
 
 /* Possible values for the mutex state. */
@@ -49,4 +56,21 @@ extern kern_return_t kmutex_trylock (struct kmutex *mtxp);
 /* Unlock the mutex MTXP. */
 extern void kmutex_unlock (struct kmutex *mtxp);
 
+/* Contention statistics, for tuning kmutex_spin_max.  */
+struct kmutex_stats
+{
+  unsigned int contended;       /* lock attempts that found it held */
+  unsigned int spin_acquired;   /* ... and got it by spinning */
+  unsigned int sleeps;          /* ... and had to sleep */
+};
+
+extern struct kmutex_stats kmutex_stats;
+
+/* Maximum number of times to poll a held mutex before sleeping.  */
+extern unsigned int kmutex_spin_max;
+
+#if MACH_KDB
+extern void db_show_kmutex_stats (void);
+#endif
+
 #endif
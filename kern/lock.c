@@ -39,9 +39,12 @@
 #include <machine/smp.h>
 
 #include <kern/debug.h>
+#include <kern/kalloc.h>
 #include <kern/lock.h>
+#include <kern/lock_mon.h>
 #include <kern/thread.h>
 #include <kern/sched_prim.h>
+#include <kern/smp.h>
 #if	MACH_KDB
 #include <machine/db_machdep.h>
 #include <ddb/db_output.h>
@@ -250,6 +253,7 @@ void lock_init(
 	l->can_sleep = can_sleep;
 	l->thread = (struct thread *)-1;	/* XXX */
 	l->recursion_depth = 0;
+	lock_mon_init(&l->mon, __builtin_return_address(0));
 }
 
 void lock_sleepable(
@@ -262,6 +266,126 @@ void lock_sleepable(
 }
 
 
+/*
+ *	Per-processor readers.
+ *
+ *	A reader raises the count of its processor before looking
+ *	for writers, and a writer raises want_write (or want_upgrade)
+ *	before summing the counts, with a full barrier in between on
+ *	both sides, so that at least one of them sees the other.
+ */
+
+/*
+ *	Whether readers may be counted per processor: no readers
+ *	are in read_count, and no thread may recurse.  This cannot
+ *	change under a per-processor reader.
+ */
+#define	lock_readers_ok(l)						\
+	((l)->read_count == 0 && (l)->thread == (struct thread *)-1)
+
+#define	lock_readers_add(l, n)						\
+	__atomic_add_fetch(&(l)->readers[cpu_number()].count, (n),	\
+			   __ATOMIC_RELAXED)
+
+static boolean_t lock_readers_busy(
+	lock_t	l)
+{
+	int	i, count;
+
+	if (l->readers == NULL)
+		return FALSE;
+
+	count = 0;
+	for (i = 0; i < smp_get_numcpus(); i++)
+		count += __atomic_load_n(&l->readers[i].count,
+					 __ATOMIC_RELAXED);
+	return count != 0;
+}
+
+/*
+ *	Account for a reader accepted with the interlock held,
+ *	in the counter lock_done will release it from.
+ */
+static void lock_reader_enter(
+	lock_t	l)
+{
+	if (l->readers != NULL && lock_readers_ok(l))
+		lock_readers_add(l, 1);
+	else
+		l->read_count++;
+}
+
+/*
+ *	Try to become a per-processor reader without the interlock.
+ */
+static boolean_t lock_read_fast(
+	lock_t	l)
+{
+	lock_readers_add(l, 1);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (!l->want_write && !l->want_upgrade && lock_readers_ok(l))
+		return TRUE;
+
+	lock_readers_add(l, -1);
+	return FALSE;
+}
+
+/*
+ *	Let a writer waiting for per-processor readers to drain
+ *	know that one of them left.
+ */
+static void lock_readers_wakeup(
+	lock_t	l)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (l->want_write || l->want_upgrade) {
+		simple_lock(&l->interlock);
+		if (l->waiting) {
+			l->waiting = FALSE;
+			thread_wakeup(l);
+		}
+		simple_unlock(&l->interlock);
+	}
+}
+
+/*
+ *	Routine:	lock_set_readers
+ *	Function:
+ *		Make a free lock count its readers per processor,
+ *		in the given zeroed counts, one for each processor.
+ *		Suited to locks that are seldom taken for write.
+ */
+void lock_set_readers(
+	lock_t			l,
+	struct lock_reader	*readers)
+{
+	simple_lock(&l->interlock);
+	assert(l->read_count == 0 && !l->want_write && !l->want_upgrade);
+	l->readers = readers;
+	simple_unlock(&l->interlock);
+}
+
+struct lock_reader *lock_readers_alloc(void)
+{
+	struct lock_reader	*readers;
+	vm_size_t		size;
+
+	size = smp_get_numcpus() * sizeof(struct lock_reader);
+	readers = (struct lock_reader *) kalloc(size);
+	if (readers != NULL)
+		memset(readers, 0, size);
+	return readers;
+}
+
+void lock_readers_free(
+	struct lock_reader	*readers)
+{
+	kfree((vm_offset_t) readers,
+	      smp_get_numcpus() * sizeof(struct lock_reader));
+}
+
 /*
  *	Sleep locks.  These use the same data structure and algorithm
  *	as the spin locks, but the process sleeps while it is waiting
@@ -272,6 +396,7 @@ void lock_write(
 	lock_t	l)
 {
 	int	i;
+	lock_mon_begin();
 
 	check_simple_locks();
 	simple_lock(&l->interlock);
@@ -289,6 +414,7 @@ void lock_write(
 	 *	Try to acquire the want_write bit.
 	 */
 	while (l->want_write) {
+		lock_mon_note(LOCK_MON_CONTENDED);
 		if ((i = lock_wait_time) > 0) {
 			simple_unlock(&l->interlock);
 			while (--i > 0 && l->want_write)
@@ -298,40 +424,59 @@ void lock_write(
 
 		if (l->can_sleep && l->want_write) {
 			l->waiting = TRUE;
+			lock_mon_note(LOCK_MON_SLEPT);
 			thread_sleep(l,
 				simple_lock_addr(l->interlock), FALSE);
 			simple_lock(&l->interlock);
 		}
 	}
 	l->want_write = TRUE;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
 
 	/* Wait for readers (and upgrades) to finish */
 
-	while ((l->read_count != 0) || l->want_upgrade) {
+	while ((l->read_count != 0) || l->want_upgrade ||
+	       lock_readers_busy(l)) {
+		lock_mon_note(LOCK_MON_CONTENDED);
 		if ((i = lock_wait_time) > 0) {
 			simple_unlock(&l->interlock);
 			while (--i > 0 && (l->read_count != 0 ||
-					l->want_upgrade))
+					l->want_upgrade ||
+					lock_readers_busy(l)))
 				cpu_pause();
 			simple_lock(&l->interlock);
 		}
 
-		if (l->can_sleep && (l->read_count != 0 || l->want_upgrade)) {
+		if (l->can_sleep && (l->read_count != 0 || l->want_upgrade ||
+				     lock_readers_busy(l))) {
 			l->waiting = TRUE;
+			lock_mon_note(LOCK_MON_SLEPT);
 			thread_sleep(l,
 				simple_lock_addr(l->interlock), FALSE);
 			simple_lock(&l->interlock);
 		}
 	}
+	l->write_held = TRUE;
 #if MACH_LDEBUG
 	l->writer = current_thread();
 #endif	/* MACH_LDEBUG */
+	lock_mon_end(&l->mon, l, LOCK_MON_WRITE, LOCK_MON_HOLD);
 	simple_unlock(&l->interlock);
 }
 
 void lock_done(
 	lock_t	l)
 {
+	/*
+	 *	A per-processor reader is the only holder to find the
+	 *	lock neither held for write nor using read_count.
+	 */
+	if (l->readers != NULL && !l->write_held && lock_readers_ok(l)) {
+		lock_readers_add(l, -1);
+		lock_readers_wakeup(l);
+		return;
+	}
+
 	simple_lock(&l->interlock);
 
 	if (l->read_count != 0)
@@ -341,13 +486,17 @@ void lock_done(
 		l->recursion_depth--;
 	else
 	if (l->want_upgrade) {
+		lock_mon_released(&l->mon);
 	 	l->want_upgrade = FALSE;
+		l->write_held = FALSE;
 #if MACH_LDEBUG
 		assert(l->writer == current_thread());
 		l->writer = THREAD_NULL;
 #endif	/* MACH_LDEBUG */
 	} else {
+		lock_mon_released(&l->mon);
 	 	l->want_write = FALSE;
+		l->write_held = FALSE;
 #if MACH_LDEBUG
 		assert(l->writer == current_thread());
 		l->writer = THREAD_NULL;
@@ -374,8 +523,18 @@ void lock_read(
 	lock_t	l)
 {
 	int	i;
+	lock_mon_begin();
 
 	check_simple_locks();
+
+	if (l->readers != NULL && l->thread != current_thread()) {
+		if (lock_read_fast(l)) {
+			lock_mon_end(&l->mon, l, LOCK_MON_READ, 0);
+			return;
+		}
+		lock_readers_wakeup(l);
+	}
+
 	simple_lock(&l->interlock);
 
 	if (l->thread == current_thread()) {
@@ -388,6 +547,7 @@ void lock_read(
 	}
 
 	while (l->want_write || l->want_upgrade) {
+		lock_mon_note(LOCK_MON_CONTENDED);
 		if ((i = lock_wait_time) > 0) {
 			simple_unlock(&l->interlock);
 			while (--i > 0 && (l->want_write || l->want_upgrade))
@@ -397,13 +557,15 @@ void lock_read(
 
 		if (l->can_sleep && (l->want_write || l->want_upgrade)) {
 			l->waiting = TRUE;
+			lock_mon_note(LOCK_MON_SLEPT);
 			thread_sleep(l,
 				simple_lock_addr(l->interlock), FALSE);
 			simple_lock(&l->interlock);
 		}
 	}
 
-	l->read_count++;
+	lock_reader_enter(l);
+	lock_mon_end(&l->mon, l, LOCK_MON_READ, 0);
 	simple_unlock(&l->interlock);
 }
 
@@ -421,11 +583,15 @@ boolean_t lock_read_to_write(
 	lock_t	l)
 {
 	int	i;
+	lock_mon_begin();
 
 	check_simple_locks();
 	simple_lock(&l->interlock);
 
-	l->read_count--;
+	if (l->readers != NULL && lock_readers_ok(l))
+		lock_readers_add(l, -1);
+	else
+		l->read_count--;
 
 	if (l->thread == current_thread()) {
 		/*
@@ -452,26 +618,33 @@ boolean_t lock_read_to_write(
 	}
 
 	l->want_upgrade = TRUE;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-	while (l->read_count != 0) {
+	while (l->read_count != 0 || lock_readers_busy(l)) {
+		lock_mon_note(LOCK_MON_CONTENDED);
 		if ((i = lock_wait_time) > 0) {
 			simple_unlock(&l->interlock);
-			while (--i > 0 && l->read_count != 0)
+			while (--i > 0 && (l->read_count != 0 ||
+					lock_readers_busy(l)))
 				cpu_pause();
 			simple_lock(&l->interlock);
 		}
 
-		if (l->can_sleep && l->read_count != 0) {
+		if (l->can_sleep && (l->read_count != 0 ||
+				     lock_readers_busy(l))) {
 			l->waiting = TRUE;
+			lock_mon_note(LOCK_MON_SLEPT);
 			thread_sleep(l,
 				simple_lock_addr(l->interlock), FALSE);
 			simple_lock(&l->interlock);
 		}
 	}
 
+	l->write_held = TRUE;
 #if MACH_LDEBUG
 	l->writer = current_thread();
 #endif	/* MACH_LDEBUG */
+	lock_mon_end(&l->mon, l, LOCK_MON_WRITE, LOCK_MON_HOLD);
 	simple_unlock(&l->interlock);
 	return FALSE;
 }
@@ -484,14 +657,18 @@ void lock_write_to_read(
 	assert(l->writer == current_thread());
 #endif	/* MACH_LDEBUG */
 
-	l->read_count++;
-	if (l->recursion_depth != 0)
+	if (l->recursion_depth != 0) {
+		l->read_count++;
 		l->recursion_depth--;
-	else
-	if (l->want_upgrade)
-		l->want_upgrade = FALSE;
-	else
-	 	l->want_write = FALSE;
+	} else {
+		lock_mon_released(&l->mon);
+		lock_reader_enter(l);
+		if (l->want_upgrade)
+			l->want_upgrade = FALSE;
+		else
+			l->want_write = FALSE;
+		l->write_held = FALSE;
+	}
 
 	if (l->waiting) {
 		l->waiting = FALSE;
@@ -517,6 +694,8 @@ void lock_write_to_read(
 boolean_t lock_try_write(
 	lock_t	l)
 {
+	lock_mon_begin();
+
 	simple_lock(&l->interlock);
 
 	if (l->thread == current_thread()) {
@@ -532,6 +711,25 @@ boolean_t lock_try_write(
 		/*
 		 *	Can't get lock.
 		 */
+		lock_mon_end(&l->mon, l, LOCK_MON_WRITE, LOCK_MON_FAILED);
+		simple_unlock(&l->interlock);
+		return FALSE;
+	}
+
+	l->want_write = TRUE;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (lock_readers_busy(l)) {
+		/*
+		 *	Readers got in without the interlock.  Back off,
+		 *	and wake up those which saw want_write meanwhile.
+		 */
+		l->want_write = FALSE;
+		if (l->waiting) {
+			l->waiting = FALSE;
+			thread_wakeup(l);
+		}
+		lock_mon_end(&l->mon, l, LOCK_MON_WRITE, LOCK_MON_FAILED);
 		simple_unlock(&l->interlock);
 		return FALSE;
 	}
@@ -540,10 +738,11 @@ boolean_t lock_try_write(
 	 *	Have lock.
 	 */
 
-	l->want_write = TRUE;
+	l->write_held = TRUE;
 #if MACH_LDEBUG
 	l->writer = current_thread();
 #endif	/* MACH_LDEBUG */
+	lock_mon_end(&l->mon, l, LOCK_MON_WRITE, LOCK_MON_HOLD);
 	simple_unlock(&l->interlock);
 	return TRUE;
 }
@@ -559,6 +758,16 @@ boolean_t lock_try_write(
 boolean_t lock_try_read(
 	lock_t	l)
 {
+	lock_mon_begin();
+
+	if (l->readers != NULL && l->thread != current_thread()) {
+		if (lock_read_fast(l)) {
+			lock_mon_end(&l->mon, l, LOCK_MON_READ, 0);
+			return TRUE;
+		}
+		lock_readers_wakeup(l);
+	}
+
 	simple_lock(&l->interlock);
 
 	if (l->thread == current_thread()) {
@@ -571,11 +780,13 @@ boolean_t lock_try_read(
 	}
 
 	if (l->want_write || l->want_upgrade) {
+		lock_mon_end(&l->mon, l, LOCK_MON_READ, LOCK_MON_FAILED);
 		simple_unlock(&l->interlock);
 		return FALSE;
 	}
 
-	l->read_count++;
+	lock_reader_enter(l);
+	lock_mon_end(&l->mon, l, LOCK_MON_READ, 0);
 	simple_unlock(&l->interlock);
 	return TRUE;
 }
@@ -593,6 +804,8 @@ boolean_t lock_try_read(
 boolean_t lock_try_read_to_write(
 	lock_t	l)
 {
+	lock_mon_begin();
+
 	check_simple_locks();
 	simple_lock(&l->interlock);
 
@@ -607,22 +820,30 @@ boolean_t lock_try_read_to_write(
 	}
 
 	if (l->want_upgrade) {
+		lock_mon_end(&l->mon, l, LOCK_MON_WRITE, LOCK_MON_FAILED);
 		simple_unlock(&l->interlock);
 		return FALSE;
 	}
 	l->want_upgrade = TRUE;
-	l->read_count--;
+	if (l->readers != NULL && lock_readers_ok(l))
+		lock_readers_add(l, -1);
+	else
+		l->read_count--;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-	while (l->read_count != 0) {
+	while (l->read_count != 0 || lock_readers_busy(l)) {
+		lock_mon_note(LOCK_MON_CONTENDED | LOCK_MON_SLEPT);
 		l->waiting = TRUE;
 		thread_sleep(l,
 			simple_lock_addr(l->interlock), FALSE);
 		simple_lock(&l->interlock);
 	}
 
+	l->write_held = TRUE;
 #if MACH_LDEBUG
 	l->writer = current_thread();
 #endif	/* MACH_LDEBUG */
+	lock_mon_end(&l->mon, l, LOCK_MON_WRITE, LOCK_MON_HOLD);
 	simple_unlock(&l->interlock);
 	return TRUE;
 }
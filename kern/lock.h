@@ -34,6 +34,7 @@
 #ifndef	_KERN_LOCK_H_
 #define	_KERN_LOCK_H_
 
+#include <cache.h>
 #include <mach/boolean.h>
 #include <mach/machine/vm_types.h>
 #include <machine/spl.h>
@@ -64,17 +65,45 @@
 #define simple_lock_nocheck	_simple_lock
 #define simple_lock_try_nocheck	_simple_lock_try
 #define simple_unlock_nocheck	_simple_unlock
-#endif
+#else	/* MACH_LOCK_MON */
+#undef simple_lock_init
+#define simple_lock_init	lock_mon_simple_lock_init
+#define simple_lock_nocheck	lock_mon_simple_lock
+#define simple_lock_try_nocheck	lock_mon_simple_lock_try
+#define simple_unlock_nocheck	lock_mon_simple_unlock
+#endif	/* MACH_LOCK_MON */
 #endif
 
 #define MACH_SLOCKS	NCPUS > 1
 
+#if	MACH_LOCK_MON
+/*
+ *	Profiling state of a lock, see kern/lock_mon.c.  The class
+ *	tells locks of the same kind apart from others: it is where
+ *	the lock was initialized, or the lock itself for statically
+ *	initialized locks.  The record and stamp describe the current
+ *	holder, when its hold time is being measured.
+ */
+struct lock_mon {
+	const void		*class;
+	struct lock_mon_record	*record;
+	uint64_t		stamp;
+};
+
+#define	decl_lock_mon_data(name)	struct lock_mon name;
+#else	/* MACH_LOCK_MON */
+#define	decl_lock_mon_data(name)
+#endif	/* MACH_LOCK_MON */
+
 /*
  *	A simple spin lock.
  */
 
 struct slock {
 	volatile natural_t lock_data;	/* in general 1 bit is sufficient */
+#if	NCPUS > 1
+	decl_lock_mon_data(mon)
+#endif	/* NCPUS > 1 */
 	struct {} is_a_simple_lock;
 };
 
@@ -106,6 +135,13 @@ class	simple_lock_irq_data_t	name = { SIMPLE_LOCK_INITIALIZER(&name.lock) };
 
 #if	(NCPUS > 1)
 
+#if	MACH_LOCK_MON
+extern void		lock_mon_simple_lock_init(simple_lock_t);
+extern void		lock_mon_simple_lock(simple_lock_t);
+extern boolean_t	lock_mon_simple_lock_try(simple_lock_t);
+extern void		lock_mon_simple_unlock(simple_lock_t);
+#endif	/* MACH_LOCK_MON */
+
 /*
  *	The single-CPU debugging routines are not valid
  *	on a multiprocessor.
@@ -207,17 +243,22 @@ class struct simple_lock_irq_data_empty name;
 struct lock {
 	struct thread	*thread;	/* Thread that has lock, if
 					   recursive locking allowed */
+	struct lock_reader *readers;	/* Per-processor reader counts,
+					   if any */
 	unsigned int	read_count:16,	/* Number of accepted readers */
 	/* boolean_t */	want_upgrade:1,	/* Read-to-write upgrade waiting */
 	/* boolean_t */	want_write:1,	/* Writer is waiting, or
 					   locked for write */
 	/* boolean_t */	waiting:1,	/* Someone is sleeping on lock */
 	/* boolean_t */	can_sleep:1,	/* Can attempts to lock go to sleep? */
-			recursion_depth:12, /* Depth of recursion */
+	/* boolean_t */	write_held:1,	/* Locked for write or upgraded
+					   (per-processor readers only) */
+			recursion_depth:11, /* Depth of recursion */
 			:0; 
 #if MACH_LDEBUG
 	struct thread	*writer;
 #endif	/* MACH_LDEBUG */
+	decl_lock_mon_data(mon)		/* Writer hold time */
 	decl_simple_lock_data(,interlock)
 					/* Hardware interlock field.
 					   Last in the structure so that
@@ -228,6 +269,25 @@ struct lock {
 typedef struct lock	lock_data_t;
 typedef struct lock	*lock_t;
 
+/*
+ *	Per-processor reader counts, for read-mostly locks.
+ *
+ *	A lock given such counts with lock_set_readers lets a reader
+ *	in by bumping the count of the processor it runs on, without
+ *	touching the interlock, as long as no writer or upgrade is
+ *	pending.  A writer raises want_write as usual and then waits
+ *	for the counts to drain, so readers never starve writers.
+ *	A reader that blocks may release the lock from another
+ *	processor; only the sum of the counts is meaningful.
+ *
+ *	While a thread may recurse on the lock, readers are counted
+ *	in read_count as usual, so that a release is always accounted
+ *	to the right counter.
+ */
+struct lock_reader {
+	int		count;
+} __cacheline_aligned;
+
 /* Sleep locks must work even if no multiprocessing */
 
 extern void		lock_init(lock_t, boolean_t);
@@ -247,6 +307,10 @@ extern boolean_t	lock_try_read_to_write(lock_t);
 extern void		lock_set_recursive(lock_t);
 extern void		lock_clear_recursive(lock_t);
 
+extern void		lock_set_readers(lock_t, struct lock_reader *);
+extern struct lock_reader *lock_readers_alloc(void);
+extern void		lock_readers_free(struct lock_reader *);
+
 /* Lock debugging support.  */
 #if	! MACH_LDEBUG
 #define have_read_lock(l)	1
@@ -254,7 +318,7 @@ extern void		lock_clear_recursive(lock_t);
 #define lock_check_no_interrupts()
 #else	/* MACH_LDEBUG */
 /* XXX: We don't keep track of readers, so this is an approximation.  */
-#define have_read_lock(l)	((l)->read_count > 0)
+#define have_read_lock(l)	((l)->read_count > 0 || (l)->readers != NULL)
 #define have_write_lock(l)	((l)->writer == current_thread())
 extern unsigned long in_interrupt[NCPUS];
 #define lock_check_no_interrupts()	assert(!in_interrupt[cpu_number()])
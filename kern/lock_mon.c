@@ -45,283 +45,422 @@
 #include <mach/boolean.h>
 #include <kern/thread.h>
 #include <kern/lock.h>
+#include <kern/lock_mon.h>
 #include <kern/printf.h>
 #include <kern/mach_clock.h>
 #include <machine/ipl.h>
 #include <ddb/db_sym.h>
 #include <ddb/db_output.h>
-
-static void lis(int arg, int abs, int count);
+#if	MACH_LOCK_MON
+#include <kern/host.h>
+#include <kern/mach_debug.server.h>
+#include <kern/stat_table.h>
+#include <machine/time_stamp.h>
+#include <vm/vm_kern.h>
+#include <vm/vm_map.h>
+#endif	/* MACH_LOCK_MON */
 
 def_simple_lock_data(, kdb_lock)
 def_simple_lock_data(, printf_lock)
 
-#if	NCPUS > 1 && MACH_LOCK_MON
-#define TIME_STAMP 1
-typedef unsigned int time_stamp_t;
-/* in milliseconds */
-#define	time_stamp (elapsed_ticks * 1000 / hz)
-
-#define LOCK_INFO_MAX	     (1024*32)
-#define LOCK_INFO_HASH_COUNT 1024
-#define LOCK_INFO_PER_BUCKET	(LOCK_INFO_MAX/LOCK_INFO_HASH_COUNT)
-
-#define HASH_LOCK(lock)	((long)lock>>5 & (LOCK_INFO_HASH_COUNT-1))
-
-struct lock_info {
-	unsigned int	success;
-	unsigned int	fail;
-	unsigned int	masked;
-	unsigned int	stack;
-	time_stamp_t	time;
-	decl_simple_lock_data(, *lock)
+#if	MACH_LOCK_MON
+
+/*
+ *	Statistics are kept in a statistics table of records keyed by
+ *	lock class, acquisition site and kind of lock, so that locks
+ *	can point to the record of their holder.
+ */
+#define	LOCK_MON_NRECORDS	4096
+
+struct lock_mon_record {
+	const void	*class;
 	vm_offset_t	caller;
+	unsigned int	type;
+	unsigned int	acquired;
+	unsigned int	contended;
+	unsigned int	sleeps;
+	uint64_t	wait;
+	uint64_t	max_wait;
+	uint64_t	hold;
+	uint64_t	max_hold;
 };
 
-struct lock_info_bucket {
-	struct lock_info info[LOCK_INFO_PER_BUCKET];
+struct lock_mon_key {
+	const void	*class;
+	vm_offset_t	caller;
+	unsigned int	type;
 };
 
-static void print_lock_info(struct lock_info *li);
+boolean_t lock_mon_enabled = FALSE;
 
-struct lock_info_bucket lock_info[LOCK_INFO_HASH_COUNT];
-struct lock_info default_lock_info;
-unsigned default_lock_stack = 0;
+static struct lock_mon_record lock_mon_records[LOCK_MON_NRECORDS];
+static struct lock_mon_record lock_mon_overflow;
+static unsigned char lock_mon_records_used[LOCK_MON_NRECORDS];
+static struct stat_table lock_mon_table =
+	STAT_TABLE_INITIALIZER(lock_mon_records_used);
 
-extern spl_t curr_ipl[];
+static unsigned long lock_mon_hash(
+	const struct lock_mon_key *key)
+{
+	unsigned long h;
 
+	h = ((unsigned long) key->class ^ (key->caller << 7) ^ key->type)
+	    * 0x9e3779b1UL;
+	return h >> 12;
+}
 
+static int lock_mon_match(
+	unsigned int	slot,
+	const void	*arg)
+{
+	const struct lock_mon_key *key = arg;
+	const struct lock_mon_record *r = &lock_mon_records[slot];
 
-struct lock_info *
-locate_lock_info(lock)
-decl_simple_lock_data(, **lock)
+	return r->class == key->class && r->caller == key->caller &&
+	       r->type == key->type;
+}
+
+static void lock_mon_fill(
+	unsigned int	slot,
+	const void	*arg)
 {
-	struct lock_info *li =  &(lock_info[HASH_LOCK(*lock)].info[0]);
-	int i;
-
-	for (i=0; i < LOCK_INFO_PER_BUCKET; i++, li++)
-		if (li->lock) {
-			if (li->lock == *lock)
-				return(li);
-		} else {
-			li->lock = *lock;
-			li->caller = *((vm_offset_t *)lock - 1);
-			return(li);
-		}
-	db_printf("out of lock_info slots\n");
-	li = &default_lock_info;
-	return(li);
+	const struct lock_mon_key *key = arg;
+	struct lock_mon_record *r = &lock_mon_records[slot];
+
+	r->class = key->class;
+	r->caller = key->caller;
+	r->type = key->type;
 }
 
+static struct lock_mon_record *lock_mon_lookup(
+	const void	*class,
+	vm_offset_t	caller,
+	unsigned int	type)
+{
+	struct lock_mon_key key;
+	int		slot;
+
+	key.class = class;
+	key.caller = caller;
+	key.type = type;
+	slot = stat_table_lookup(&lock_mon_table, lock_mon_hash(&key),
+				 lock_mon_match, lock_mon_fill, &key);
+	return slot < 0 ? &lock_mon_overflow : &lock_mon_records[slot];
+}
 
-void simple_lock(lock)
-decl_simple_lock_data(, *lock)
+static void lock_mon_max(
+	uint64_t	*max,
+	uint64_t	value)
 {
-	struct lock_info *li = locate_lock_info(&lock);
-	int my_cpu = cpu_number();
-
-	if (current_thread())
-		li->stack = current_thread()->lock_stack++;
-	if (curr_ipl[my_cpu])
-		li->masked++;
-	if (_simple_lock_try(lock))
-		li->success++;
-	else {
-		_simple_lock(lock);
-		li->fail++;
-	}
-	li->time = time_stamp - li->time;
+	/* Racy, hence approximate.  */
+	if (value > *max)
+		*max = value;
 }
 
-int simple_lock_try(lock)
-decl_simple_lock_data(, *lock)
+void lock_mon_init(
+	struct lock_mon	*mon,
+	const void	*class)
 {
-	struct lock_info *li = locate_lock_info(&lock);
-	int my_cpu = cpu_number();
-
-	if (curr_ipl[my_cpu])
-		li->masked++;
-	if (_simple_lock_try(lock)) {
-		li->success++;
-		li->time = time_stamp - li->time;
-		if (current_thread())
-			li->stack = current_thread()->lock_stack++;
-		return(1);
-	} else {
-		li->fail++;
-		return(0);
+	mon->class = class;
+	mon->record = NULL;
+	mon->stamp = 0;
+}
+
+uint64_t lock_mon_start(void)
+{
+	return lock_mon_enabled ? machine_timestamp() : 0;
+}
+
+/*
+ *	Account for an attempt to take the lock containing mon from
+ *	caller, which started at the given time stamp.
+ */
+void lock_mon_acquired(
+	struct lock_mon	*mon,
+	const void	*lock,
+	unsigned int	type,
+	vm_offset_t	caller,
+	uint64_t	start,
+	unsigned int	how)
+{
+	struct lock_mon_record *r;
+	uint64_t	now, wait;
+
+	if (start == 0 || !lock_mon_enabled)
+		return;
+
+	r = lock_mon_lookup(mon->class != NULL ? mon->class : lock,
+			    caller, type);
+
+	if (how & LOCK_MON_FAILED) {
+		__atomic_add_fetch(&r->contended, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	now = machine_timestamp();
+	__atomic_add_fetch(&r->acquired, 1, __ATOMIC_RELAXED);
+
+	if (how & LOCK_MON_CONTENDED) {
+		wait = now - start;
+		__atomic_add_fetch(&r->contended, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&r->wait, wait, __ATOMIC_RELAXED);
+		lock_mon_max(&r->max_wait, wait);
+	}
+
+	if (how & LOCK_MON_SLEPT)
+		__atomic_add_fetch(&r->sleeps, 1, __ATOMIC_RELAXED);
+
+	if (how & LOCK_MON_HOLD) {
+		mon->record = r;
+		mon->stamp = now;
 	}
 }
 
-void simple_unlock(lock)
-decl_simple_lock_data(, *lock)
+/*
+ *	Account for the release of a lock by a holder whose hold
+ *	time is measured.  Called with the lock still held.
+ */
+void lock_mon_released(
+	struct lock_mon	*mon)
 {
-	time_stamp_t stamp = time_stamp;
-	time_stamp_t *time = &locate_lock_info(&lock)->time;
-	unsigned *lock_stack;
-
-	*time = stamp - *time;
-	_simple_unlock(lock);
-	if (current_thread()) {
-		lock_stack = &current_thread()->lock_stack;
-		if (*lock_stack)
-			(*lock_stack)--;
+	struct lock_mon_record *r = mon->record;
+	uint64_t	hold;
+
+	if (r == NULL)
+		return;
+
+	mon->record = NULL;
+	hold = machine_timestamp() - mon->stamp;
+	__atomic_add_fetch(&r->hold, hold, __ATOMIC_RELAXED);
+	lock_mon_max(&r->max_hold, hold);
+}
+
+static void lock_mon_clear(void)
+{
+	struct lock_mon_record *r;
+	int	i;
+
+	for (i = 0; i <= LOCK_MON_NRECORDS; i++) {
+		r = (i < LOCK_MON_NRECORDS) ? &lock_mon_records[i]
+					    : &lock_mon_overflow;
+		r->acquired = 0;
+		r->contended = 0;
+		r->sleeps = 0;
+		r->wait = 0;
+		r->max_wait = 0;
+		r->hold = 0;
+		r->max_hold = 0;
 	}
 }
 
-void lip(void) {
-	lis(4, 1, 0);
+#if	NCPUS > 1
+
+/*
+ *	Simple lock operations, called in place of the machine
+ *	dependent ones.
+ */
+
+void lock_mon_simple_lock_init(
+	simple_lock_t	l)
+{
+	l->lock_data = 0;
+	lock_mon_init(&l->mon, __builtin_return_address(0));
 }
 
-#define lock_info_sort lis
+void lock_mon_simple_lock(
+	simple_lock_t	l)
+{
+	lock_mon_begin();
+
+	if (!_simple_lock_try(l)) {
+		lock_mon_note(LOCK_MON_CONTENDED);
+		_simple_lock(l);
+	}
+
+	lock_mon_end(&l->mon, l, LOCK_MON_SIMPLE, LOCK_MON_HOLD);
+}
 
-static void lock_info_sort(int arg, int abs, int count)
+boolean_t lock_mon_simple_lock_try(
+	simple_lock_t	l)
 {
-	struct lock_info *li, mean;
-	int bucket = 0;
-	int i;
-	unsigned max_val;
-	unsigned old_val = (unsigned)-1;
-	struct lock_info *target_li = &lock_info[0].info[0];
-	unsigned sum;
-	unsigned empty, total;
-	unsigned curval;
-
-	printf("\nSUCCESS	FAIL	MASKED	STACK	TIME	LOCK/CALLER\n");
-	if (!count)
-		count = 8 ;
-	while (count && target_li) {
-		empty = LOCK_INFO_HASH_COUNT;
-		target_li = 0;
-		total = 0;
-		max_val = 0;
-		mean.success = 0;
-		mean.fail = 0;
-		mean.masked = 0;
-		mean.stack = 0;
-		mean.time = 0;
-		mean.lock = (simple_lock_data_t *) &lock_info;
-		mean.caller = (vm_offset_t) &lock_info;
-		for (bucket = 0; bucket < LOCK_INFO_HASH_COUNT; bucket++) {
-			li = &lock_info[bucket].info[0];
-			if (li->lock)
-				empty--;
-			for (i= 0; i< LOCK_INFO_PER_BUCKET && li->lock; i++, li++) {
-				if (li->lock == &kdb_lock || li->lock == &printf_lock)
-					continue;
-				total++;
-				curval = *((int *)li + arg);
-				sum = li->success + li->fail;
-				if(!sum && !abs)
-					continue;
-				if (!abs) switch(arg) {
-				case 0:
-					break;
-				case 1:
-				case 2:
-					curval = (curval*100) / sum;
-					break;
-				case 3:
-				case 4:
-					curval = curval / sum;
-					break;
-				}
-				if (curval > max_val && curval < old_val) {
-					max_val = curval;
-					target_li = li;
-				}
-				if (curval == old_val && count != 0) {
-					print_lock_info(li);
-					count--;
-				}
-				mean.success += li->success;
-				mean.fail += li->fail;
-				mean.masked += li->masked;
-				mean.stack += li->stack;
-				mean.time += li->time;
-			}
-		}
-		if (target_li)
-		        old_val = max_val;
+	lock_mon_begin();
+
+	if (!_simple_lock_try(l)) {
+		lock_mon_end(&l->mon, l, LOCK_MON_SIMPLE, LOCK_MON_FAILED);
+		return FALSE;
 	}
-	db_printf("\n%d total locks, %d empty buckets", total, empty );
-	if (default_lock_info.success)
-		db_printf(", default: %d", default_lock_info.success + default_lock_info.fail);
-	db_printf("\n");
-	print_lock_info(&mean);
+
+	lock_mon_end(&l->mon, l, LOCK_MON_SIMPLE, LOCK_MON_HOLD);
+	return TRUE;
 }
 
-#define lock_info_clear lic
+void lock_mon_simple_unlock(
+	simple_lock_t	l)
+{
+	lock_mon_released(&l->mon);
+	_simple_unlock(l);
+}
 
-void lock_info_clear(void)
+#endif	/* NCPUS > 1 */
+
+static void lock_mon_copy(
+	lock_mon_info_t			*info,
+	const struct lock_mon_record	*r)
+{
+	info->lmi_wait = r->wait;
+	info->lmi_max_wait = r->max_wait;
+	info->lmi_hold = r->hold;
+	info->lmi_max_hold = r->max_hold;
+	info->lmi_class = (rpc_vm_offset_t) (vm_offset_t) r->class;
+	info->lmi_caller = r->caller;
+	info->lmi_type = r->type;
+	info->lmi_acquired = r->acquired;
+	info->lmi_contended = r->contended;
+	info->lmi_sleeps = r->sleeps;
+}
+
+/*
+ *	host_lock_mon_info:
+ *
+ *	Return the statistics of every lock class and acquisition
+ *	site seen so far, followed by the overflow record, if used,
+ *	with a null class and caller.  The counters are read without
+ *	synchronization.
+ */
+kern_return_t host_lock_mon_info(
+	const host_t		host,
+	lock_mon_info_array_t	*infop,
+	natural_t		*infoCntp)
 {
-	struct lock_info *li;
-	int bucket = 0;
-	int i;
-	for (bucket = 0; bucket < LOCK_INFO_HASH_COUNT; bucket++) {
-		li = &lock_info[bucket].info[0];
-		for (i= 0; i< LOCK_INFO_PER_BUCKET; i++, li++) {
-			memset(li, 0, sizeof(struct lock_info));
+	lock_mon_info_t		*info;
+	vm_offset_t		addr;
+	vm_size_t		size, used;
+	vm_map_copy_t		copy;
+	kern_return_t		kr;
+	unsigned int		i, n, max;
+
+	if (host == HOST_NULL)
+		return KERN_INVALID_HOST;
+
+	max = stat_table_nr_used(&lock_mon_table) + 1;
+	size = max * sizeof(*info);
+
+	if (*infoCntp >= max) {
+		info = *infop;
+		addr = 0;
+	} else {
+		kr = kmem_alloc_pageable(ipc_kernel_map, &addr,
+					 round_page(size));
+		if (kr != KERN_SUCCESS)
+			return kr;
+
+		info = (lock_mon_info_t *) addr;
+		memset(info, 0, round_page(size));
+	}
+
+	n = 0;
+	for (i = 0; i < LOCK_MON_NRECORDS && n < max; i++)
+		if (stat_table_used(&lock_mon_table, i))
+			lock_mon_copy(&info[n++], &lock_mon_records[i]);
+	if (n < max && (lock_mon_overflow.acquired != 0 ||
+			lock_mon_overflow.contended != 0))
+		lock_mon_copy(&info[n++], &lock_mon_overflow);
+
+	if (addr != 0) {
+		used = round_page(n * sizeof(*info));
+		if (used < round_page(size))
+			kmem_free(ipc_kernel_map, addr + used,
+				  round_page(size) - used);
+
+		if (n == 0)
+			*infop = NULL;
+		else {
+			kr = vm_map_copyin(ipc_kernel_map, addr,
+					   n * sizeof(*info), TRUE, &copy);
+			assert(kr == KERN_SUCCESS);
+			*infop = (lock_mon_info_t *) copy;
 		}
 	}
-	memset(&default_lock_info, 0, sizeof(struct lock_info));
+
+	*infoCntp = n;
+	return KERN_SUCCESS;
 }
 
-static void print_lock_info(struct lock_info *li)
+/*
+ *	host_lock_mon_control:
+ *
+ *	Turn lock monitoring on or off, clearing the statistics
+ *	first if asked to.
+ */
+kern_return_t host_lock_mon_control(
+	const host_t	host,
+	int		flags)
 {
-	db_addr_t off;
-	int sum = li->success + li->fail;
-	db_printf("%d	%d/%d	%d/%d	%d/%d	%d/%d	", li->success,
-		   li->fail, (li->fail*100)/sum,
-		   li->masked, (li->masked*100)/sum,
-		   li->stack, li->stack/sum,
-		   li->time, li->time/sum);
-	db_free_symbol(db_search_symbol((db_addr_t) li->lock, 0, &off));
-	if (off < 1024)
-		db_printsym((db_addr_t) li->lock, 0);
-	else {
-		db_printsym(li->caller, 0);
-		db_printf("(%X)", li->lock);
-	}
-	db_printf("\n");
+	if (host == HOST_NULL)
+		return KERN_INVALID_HOST;
+
+	if (flags & LOCK_MON_CLEAR)
+		lock_mon_clear();
+
+	lock_mon_enabled = (flags & LOCK_MON_ON) ? TRUE : FALSE;
+	return KERN_SUCCESS;
 }
 
-#endif	/* NCPUS > 1 && MACH_LOCK_MON */
+#if	MACH_KDB
 
-#if	TIME_STAMP
+static const char *lock_mon_types[] = {
+	"simple", "kmutex", "read", "write"
+};
 
 /*
- *	Measure lock/unlock operations
+ *	Print the records with the most time spent waiting, ordered
+ *	by wait time, then by slot.
  */
-
-void time_lock(int loops)
+void lip(void)
 {
-	decl_simple_lock_data(, lock)
-	time_stamp_t stamp;
-	int i;
-
-
-	if (!loops)
-		loops = 1000;
-	simple_lock_init(&lock);
-	stamp = time_stamp;
-	for (i = 0; i < loops; i++) {
-		simple_lock(&lock);
-		simple_unlock(&lock);
+	struct lock_mon_record *r, *top;
+	uint64_t	limit;
+	unsigned int	i, count, last;
+
+	db_printf("ACQUIRED CONTENDED SLEEPS   WAIT/MAX             "
+		  "HOLD/MAX             TYPE   CLASS/CALLER\n");
+
+	limit = (uint64_t) -1;
+	last = LOCK_MON_NRECORDS;
+	for (count = 0; count < 16; count++) {
+		top = NULL;
+		for (i = 0; i < LOCK_MON_NRECORDS; i++) {
+			r = &lock_mon_records[i];
+			if (!stat_table_used(&lock_mon_table, i) ||
+			    r->wait > limit || (r->wait == limit && i <= last))
+				continue;
+			if (top == NULL || r->wait > top->wait)
+				top = r;
+		}
+		if (top == NULL || top->wait == 0)
+			break;
+		limit = top->wait;
+		last = top - lock_mon_records;
+
+		db_printf("%8u %9u %6u   %llu/%llu   %llu/%llu   %-6s ",
+			  top->acquired, top->contended, top->sleeps,
+			  top->wait, top->max_wait, top->hold, top->max_hold,
+			  lock_mon_types[top->type]);
+		db_printsym((db_addr_t) top->class, DB_STGY_ANY);
+		db_printf(" ");
+		db_printsym((db_addr_t) top->caller, DB_STGY_PROC);
+		db_printf("\n");
 	}
-	stamp = time_stamp - stamp;
-	db_printf("%d stamps for simple_locks\n", stamp/loops);
-#if	MACH_LOCK_MON
-	stamp = time_stamp;
-	for (i = 0; i < loops; i++) {
-		_simple_lock(&lock);
-		_simple_unlock(&lock);
-        }
-	stamp = time_stamp - stamp;
-	db_printf("%d stamps for _simple_locks\n", stamp/loops);
-#endif	/* MACH_LOCK_MON */
+
+	db_printf("%u records, %u acquisitions in overflow, monitoring %s\n",
+		  stat_table_nr_used(&lock_mon_table),
+		  lock_mon_overflow.acquired,
+		  lock_mon_enabled ? "on" : "off");
 }
-#endif	/* TIME_STAMP */
+
+#endif	/* MACH_KDB */
+
+#endif	/* MACH_LOCK_MON */
 
 #if	MACH_MP_DEBUG
 
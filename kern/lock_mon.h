@@ -0,0 +1,82 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ *	Lock profiling: acquisition counts, contention, wait and
+ *	hold times of simple locks, kmutexes and complex locks,
+ *	per lock class and acquisition site.  Collection is turned
+ *	on and off at run time with host_lock_mon_control.
+ *
+ *	All hooks compile to nothing unless MACH_LOCK_MON is set.
+ */
+
+#ifndef _KERN_LOCK_MON_H_
+#define _KERN_LOCK_MON_H_
+
+#include <kern/lock.h>
+
+#if	MACH_LOCK_MON
+
+#include <mach_debug/lock_mon_info.h>
+
+/*
+ *	How a lock was acquired, for lock_mon_acquired.
+ */
+#define LOCK_MON_CONTENDED	0x1	/* found held */
+#define LOCK_MON_SLEPT		0x2	/* had to sleep */
+#define LOCK_MON_FAILED		0x4	/* try failed, not acquired */
+#define LOCK_MON_HOLD		0x8	/* measure hold time */
+
+extern boolean_t lock_mon_enabled;
+
+extern void lock_mon_init(struct lock_mon *mon, const void *class);
+
+/*
+ *	Return the time stamp an acquisition starts at, or 0 when
+ *	profiling is off.
+ */
+extern uint64_t lock_mon_start(void);
+
+extern void lock_mon_acquired(struct lock_mon *mon, const void *lock,
+			      unsigned int type, vm_offset_t caller,
+			      uint64_t start, unsigned int how);
+extern void lock_mon_released(struct lock_mon *mon);
+
+/*
+ *	Hooks for the lock implementations, which keep the state
+ *	of an acquisition in local variables.
+ */
+#define lock_mon_begin()						\
+	uint64_t lock_mon_stamp = lock_mon_start();			\
+	unsigned int lock_mon_how = 0
+#define lock_mon_note(how)	(lock_mon_how |= (how))
+#define lock_mon_end(mon, lock, type, how)				\
+	lock_mon_acquired((mon), (lock), (type),			\
+			  (vm_offset_t) __builtin_return_address(0),	\
+			  lock_mon_stamp, lock_mon_how | (how))
+
+#else	/* MACH_LOCK_MON */
+
+#define lock_mon_init(mon, class)
+#define lock_mon_released(mon)
+#define lock_mon_begin()
+#define lock_mon_note(how)
+#define lock_mon_end(mon, lock, type, how)
+
+#endif	/* MACH_LOCK_MON */
+
+#endif	/* _KERN_LOCK_MON_H_ */
@@ -63,7 +63,7 @@ void compute_mach_factor(void)
 	long		average_now;
 	long		load_now;
 
-	simple_lock(&all_psets_lock);
+	lock_read(&all_psets_lock);
 	pset = (processor_set_t) queue_first(&all_psets);
 	while (!queue_end(&all_psets, (queue_entry_t)pset)) {
 
@@ -146,5 +146,5 @@ void compute_mach_factor(void)
 	    pset = (processor_set_t) queue_next(&pset->all_psets);
 	}
 
-	simple_unlock(&all_psets_lock);
+	lock_read_done(&all_psets_lock);
 }
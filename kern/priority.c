@@ -64,6 +64,84 @@
 #define USAGE_THRESHOLD	(1 << (PRI_SHIFT + 2 + SCHED_SHIFT))
 #endif	/* PRI_SHIFT_2 */
 
+#if	MACH_FIXPRI
+/*
+ *	deadline_charge:
+ *
+ *	Charge nticks of execution to a POLICY_DEADLINE thread.  A
+ *	thread still running past its absolute deadline has missed it
+ *	and starts a new period.  A thread that exhausts its budget
+ *	early is throttled: it drops to the lowest priority until
+ *	deadline_replenish starts its next period, so it cannot take
+ *	more than its reserved share from other threads.  Time used
+ *	while throttled is not charged.
+ */
+static void deadline_charge(
+	thread_t		thread,
+	int			nticks)
+{
+	unsigned long		next;
+	spl_t			s;
+
+	s = splsched();
+	thread_lock(thread);
+	if (thread->policy == POLICY_DEADLINE && !thread->dl_throttled) {
+		thread->dl_budget -= nticks;
+		if (elapsed_ticks > thread->dl_abs_deadline) {
+			thread->dl_misses++;
+			thread->dl_periods++;
+			thread->dl_abs_deadline = elapsed_ticks +
+				thread->dl_deadline;
+			thread->dl_budget = thread->dl_runtime;
+		}
+		else if (thread->dl_budget <= 0) {
+			next = thread->dl_abs_deadline - thread->dl_deadline +
+				thread->dl_period;
+			thread->dl_throttled = TRUE;
+			compute_priority(thread, FALSE);
+			set_timeout(&thread->dl_timer,
+				    (next > elapsed_ticks) ?
+				    next - elapsed_ticks : 1);
+		}
+	}
+	thread_unlock(thread);
+	(void) splx(s);
+}
+
+/*
+ *	deadline_replenish:
+ *
+ *	Timeout routine starting the next period of a throttled
+ *	POLICY_DEADLINE thread.  If the thread still wants to run, it
+ *	could not finish within its budget and has missed its deadline.
+ */
+void deadline_replenish(
+	thread_t		thread)
+{
+	spl_t			s;
+
+	s = splsched();
+	thread_lock(thread);
+
+	/*
+	 *	If we lose a race with a policy change, the thread
+	 *	is not throttled anymore.
+	 */
+	if (thread->dl_throttled) {
+		if (thread->state & TH_RUN)
+			thread->dl_misses++;
+		thread->dl_throttled = FALSE;
+		thread->dl_periods++;
+		thread->dl_abs_deadline = elapsed_ticks + thread->dl_deadline;
+		thread->dl_budget = thread->dl_runtime;
+		compute_priority(thread, FALSE);
+	}
+
+	thread_unlock(thread);
+	(void) splx(s);
+}
+#endif	/* MACH_FIXPRI */
+
 /*
  *	thread_quantum_update:
  *
@@ -128,6 +206,10 @@ void thread_quantum_update(
 	 */
 
 	if (state != CPU_STATE_IDLE) {
+#if	MACH_FIXPRI
+		if (thread->policy == POLICY_DEADLINE)
+			deadline_charge(thread, nticks);
+#endif	/* MACH_FIXPRI */
 		myprocessor->quantum -= nticks;
 #if	NCPUS > 1
 		/*
@@ -221,3 +303,20 @@ void thread_quantum_update(
 	}
 }
 
+/*
+ *	thread_set_inherited_priority:
+ *
+ *	Set the priority that the thread inherits from threads
+ *	blocked on resources it holds, NRQS meaning none, and
+ *	recompute its scheduled priority.  Thread must be locked.
+ */
+void thread_set_inherited_priority(
+	thread_t	thread,
+	int		pri)
+{
+	if (thread->pi_priority == pri)
+		return;
+
+	thread->pi_priority = pri;
+	compute_priority(thread, TRUE);
+}
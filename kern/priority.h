@@ -25,4 +25,11 @@ extern void thread_quantum_update(
 	int			nticks,
 	int			state);
 
+extern void deadline_replenish(
+	thread_t		thread);
+
+extern void thread_set_inherited_priority(
+	thread_t		thread,
+	int			pri);
+
 #endif /* _KERN_PRIORITY_H_ */
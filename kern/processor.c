@@ -64,7 +64,10 @@ struct processor_set default_pset;
 
 queue_head_t		all_psets;
 int			all_psets_count;
-def_simple_lock_data(, all_psets_lock);
+lock_data_t		all_psets_lock;
+#if	NCPUS > 1
+static struct lock_reader all_psets_readers[NCPUS];
+#endif	/* NCPUS > 1 */
 
 processor_t	master_processor;
 
@@ -86,7 +89,14 @@ void pset_sys_bootstrap(void)
 	}
 	master_processor = cpu_to_processor(master_cpu);
 	queue_init(&all_psets);
-	simple_lock_init(&all_psets_lock);
+	/*
+	 *	The list only changes when processor sets are
+	 *	created or destroyed, and is scanned periodically.
+	 */
+	lock_init(&all_psets_lock, FALSE);
+#if	NCPUS > 1
+	lock_set_readers(&all_psets_lock, all_psets_readers);
+#endif	/* NCPUS > 1 */
 	queue_enter(&all_psets, &default_pset, processor_set_t, all_psets);
 	all_psets_count = 1;
 	default_pset.active = TRUE;
@@ -165,6 +175,8 @@ void pset_init(
 	pset->max_priority = BASEPRI_USER;
 #if	MACH_FIXPRI
 	pset->policies = POLICY_TIMESHARE;
+	pset->deadline_util = 0;
+	simple_lock_init(&pset->deadline_lock);
 #endif	/* MACH_FIXPRI */
 	pset->set_quantum = min_quantum;
 #if	NCPUS > 1
@@ -200,6 +212,7 @@ void processor_init(
 	queue_init(&pr->processor_queue);
 	pr->state = PROCESSOR_OFF_LINE;
 	pr->next_thread = THREAD_NULL;
+	pr->idle_monitor = FALSE;
 	pr->idle_thread = THREAD_NULL;
 	pr->quantum = 0;
 	pr->first_quantum = FALSE;
@@ -295,6 +308,15 @@ void pset_remove_thread(
 	queue_remove(&pset->threads, thread, thread_t, pset_threads);
 	thread->processor_set = PROCESSOR_SET_NULL;
 	pset->thread_count--;
+#if	MACH_FIXPRI
+	if (thread->policy == POLICY_DEADLINE) {
+		spl_t	s;
+
+		s = splsched();
+		pset_deadline_release(pset, thread->dl_util);
+		splx(s);
+	}
+#endif	/* MACH_FIXPRI */
 }
 
 /*
@@ -330,6 +352,46 @@ void thread_change_psets(
 	new_pset->thread_count++;
 }
 
+#if	MACH_FIXPRI
+/*
+ *	pset_deadline_admit() replaces a reservation of old_util with
+ *	one of new_util in the deadline load of pset, if the result
+ *	still fits within DEADLINE_UTIL_MAX per processor.  Returns
+ *	whether the reservation was made.  Called at splsched.
+ */
+
+boolean_t pset_deadline_admit(
+	processor_set_t	pset,
+	int		new_util,
+	int		old_util)
+{
+	boolean_t	admitted;
+
+	simple_lock(&pset->deadline_lock);
+	admitted = (pset->deadline_util - old_util + new_util <=
+		    pset->processor_count * DEADLINE_UTIL_MAX);
+	if (admitted)
+		pset->deadline_util += new_util - old_util;
+	simple_unlock(&pset->deadline_lock);
+	return admitted;
+}
+
+/*
+ *	pset_deadline_release() drops a reservation made by
+ *	pset_deadline_admit().  Called at splsched.
+ */
+
+void pset_deadline_release(
+	processor_set_t	pset,
+	int		util)
+{
+	simple_lock(&pset->deadline_lock);
+	pset->deadline_util -= util;
+	assert(pset->deadline_util >= 0);
+	simple_unlock(&pset->deadline_lock);
+}
+#endif	/* MACH_FIXPRI */
+
 /*
  *	pset_deallocate:
  *
@@ -362,14 +424,14 @@ void pset_deallocate(
 	pset->ref_count = 1;
 	pset_ref_unlock(pset);
 
-	simple_lock(&all_psets_lock);
+	lock_write(&all_psets_lock);
 	pset_ref_lock(pset);
 	if (--pset->ref_count > 0) {
 		/*
 		 *	Made an extra reference.
 		 */
 		pset_ref_unlock(pset);
-		simple_unlock(&all_psets_lock);
+		lock_write_done(&all_psets_lock);
 		return;
 	}
 
@@ -388,7 +450,7 @@ void pset_deallocate(
 	all_psets_count--;
 
 	pset_ref_unlock(pset);
-	simple_unlock(&all_psets_lock);
+	lock_write_done(&all_psets_lock);
 
 	/*
 	 *	That's it, free data structure.
@@ -544,10 +606,10 @@ processor_set_create(
 	ipc_pset_init(pset);
 	pset->active = TRUE;
 
-	simple_lock(&all_psets_lock);
+	lock_write(&all_psets_lock);
 	queue_enter(&all_psets, pset, processor_set_t, all_psets);
 	all_psets_count++;
-	simple_unlock(&all_psets_lock);
+	lock_write_done(&all_psets_lock);
 
 	ipc_pset_enable(pset);
 
@@ -73,6 +73,8 @@ struct processor_set {
 	int			max_priority;	/* maximum priority */
 #if	MACH_FIXPRI
 	int			policies;	/* bit vector for policies */
+	int			deadline_util;	/* admitted deadline load */
+	decl_simple_lock_data(,	deadline_lock)	/* lock for above, shall be taken at splsched only */
 #endif	/* MACH_FIXPRI */
 	int			set_quantum;	/* current default quantum */
 #if	NCPUS > 1
@@ -95,6 +97,7 @@ struct processor {
 	queue_chain_t	processor_queue; /* idle/assign/shutdown queue link */
 	int		state;		/* See below */
 	struct thread	*next_thread;	/* next thread to run if dispatched */
+	boolean_t	idle_monitor;	/* idle, monitoring next_thread */
 	struct thread	*idle_thread;	/* this processor's idle thread. */
 	int		quantum;	/* quantum for current thread */
 	boolean_t	first_quantum;	/* first quantum in succession */
@@ -122,7 +125,7 @@ extern struct processor	processor_array[NCPUS];
  */
 extern queue_head_t		all_psets;
 extern int			all_psets_count;
-decl_simple_lock_data(extern, all_psets_lock);
+extern lock_data_t		all_psets_lock;
 
 /*
  *	The lock ordering is:
@@ -251,6 +254,10 @@ extern void	pset_remove_thread(processor_set_t, struct thread *);
 extern void	pset_add_thread(processor_set_t, struct thread *);
 extern void	thread_change_psets(struct thread *,
 				processor_set_t, processor_set_t);
+#if	MACH_FIXPRI
+extern boolean_t pset_deadline_admit(processor_set_t, int, int);
+extern void	pset_deadline_release(processor_set_t, int);
+#endif	/* MACH_FIXPRI */
 
 /* Processor interface */
 
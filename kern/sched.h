@@ -109,7 +109,9 @@ typedef struct run_queue	*run_queue_t;
 		  ((processor)->processor_set->runq.low <=		\
 			(thread)->sched_pri)) ||			\
 		 ((processor)->processor_set->runq.low <		\
-			(thread)->sched_pri))))
+			(thread)->sched_pri))) ||			\
+	((thread)->policy == POLICY_DEADLINE &&				\
+		deadline_csw_needed((thread), (processor))))
 
 #else	/* MACH_FIXPRI */
 #define csw_needed(thread, processor) ((thread)->state & TH_SUSP ||	\
@@ -125,6 +127,9 @@ typedef struct run_queue	*run_queue_t;
  */
 
 extern struct run_queue	*rem_runq(thread_t);
+#if	MACH_FIXPRI
+extern boolean_t	deadline_csw_needed(thread_t, processor_t);
+#endif	/* MACH_FIXPRI */
 extern struct thread	*choose_thread(processor_t);
 extern queue_head_t	action_queue;	/* assign/shutdown queue */
 decl_simple_lock_data(extern,action_lock);
@@ -138,6 +143,18 @@ extern int		min_quantum;	/* defines max context switch rate */
 #define BASEPRI_SYSTEM	6
 #define BASEPRI_USER	25
 
+#if	MACH_FIXPRI
+/*
+ *	POLICY_DEADLINE threads all run at this priority, ordered by
+ *	absolute deadline within its run queue.  Utilization is kept
+ *	in units of DEADLINE_UTIL_SCALE per processor, and admission
+ *	control reserves at most DEADLINE_UTIL_MAX of each processor.
+ */
+#define BASEPRI_DEADLINE	(BASEPRI_SYSTEM + 1)
+#define DEADLINE_UTIL_SCALE	1000
+#define DEADLINE_UTIL_MAX	950
+#endif	/* MACH_FIXPRI */
+
 /*
  *	Macro to check for invalid priorities.
  */
@@ -45,10 +45,12 @@
 #include <kern/mach_clock.h>
 #include <kern/mach_factor.h>
 #include <kern/macros.h>
+#include <kern/priority.h>
 #include <kern/processor.h>
 #include <kern/queue.h>
 #include <kern/sched.h>
 #include <kern/sched_prim.h>
+#include <kern/sched_stats.h>
 #include <kern/smp.h>
 #include <kern/syscall_subr.h>
 #include <kern/thread.h>
@@ -221,6 +223,10 @@ void thread_timeout_setup(
 	thread->timer.param = thread;
 	thread->depress_timer.fcn = (void (*)(void*))thread_depress_timeout;
 	thread->depress_timer.param = thread;
+#if	MACH_FIXPRI
+	thread->dl_timer.fcn = (void (*)(void*))deadline_replenish;
+	thread->dl_timer.param = thread;
+#endif	/* MACH_FIXPRI */
 }
 
 /*
@@ -580,7 +586,8 @@ static thread_t thread_select(
 				 *	fixed priority policy
 				 */
 				if ((pset->runq.count > 0) &&
-				    (pset->policies & POLICY_FIXEDPRI)) {
+				    (pset->policies &
+				     (POLICY_FIXEDPRI|POLICY_DEADLINE))) {
 					    while (queue_empty(q)) {
 						pset->runq.low++;
 						q++;
@@ -633,6 +640,7 @@ boolean_t thread_invoke(
 	     *	Mark thread interruptible.
 	     *	Run continuation if there is one.
 	     */
+	    sched_stats_hint(SCHED_STATS_PREEMPT);
 	    thread_lock(new_thread);
 	    new_thread->state &= ~TH_UNINT;
 	    thread_unlock(new_thread);
@@ -670,6 +678,7 @@ boolean_t thread_invoke(
 		     */
 		    ast_context(new_thread, cpu_number());
 		    timer_switch(&new_thread->system_timer);
+		    sched_stats_switch(old_thread, new_thread);
 
 		    stack_handoff(old_thread, new_thread);
 
@@ -802,6 +811,7 @@ boolean_t thread_invoke(
 	 */
 	ast_context(new_thread, cpu_number());
 	timer_switch(&new_thread->system_timer);
+	sched_stats_switch(old_thread, new_thread);
 
 	/*
 	 *	switch_context is machine-dependent.  It does the
@@ -915,6 +925,7 @@ void thread_run(
 
 	s = splsched();
 
+	sched_stats_hint(SCHED_STATS_HANDOFF);
 	while (!thread_invoke(thread, continuation, new_thread))
 		new_thread = thread_select(myprocessor);
 
@@ -1039,6 +1050,15 @@ shift_data_t	wait_shift[32] = {
 	MACRO_END
 #endif	/* defined(PRI_SHIFT_2) */
 
+/*
+ *	A thread holding gsync PI mutexes runs at no worse than the
+ *	priority it inherited from the threads waiting on them.
+ */
+#define inherit_priority(th, pri)					\
+	MACRO_BEGIN							\
+	if ((pri) > (th)->pi_priority) (pri) = (th)->pi_priority;	\
+	MACRO_END
+
 /*
  *	compute_priority:
  *
@@ -1061,6 +1081,7 @@ void compute_priority(
 	if (thread->policy == POLICY_TIMESHARE) {
 #endif	/* MACH_FIXPRI */
 	    do_priority_computation(thread, pri);
+	    inherit_priority(thread, pri);
 	    if (thread->depress_priority < 0)
 		set_pri(thread, pri, resched);
 	    else
@@ -1068,7 +1089,12 @@ void compute_priority(
 #if	MACH_FIXPRI
 	}
 	else {
-	    set_pri(thread, thread->priority, resched);
+	    if (thread->policy == POLICY_DEADLINE)
+		pri = thread->dl_throttled ? NRQS-1 : BASEPRI_DEADLINE;
+	    else
+		pri = thread->priority;
+	    inherit_priority(thread, pri);
+	    set_pri(thread, pri, resched);
 	}
 #endif	/* MACH_FIXPRI */
 }
@@ -1089,6 +1115,7 @@ void compute_my_priority(
 	int temp_pri;
 
 	do_priority_computation(thread,temp_pri);
+	inherit_priority(thread, temp_pri);
 	thread->sched_pri = temp_pri;
 }
 
@@ -1172,10 +1199,125 @@ void update_priority(
 #endif	/* MACH_FIXPRI */
 	    (thread->depress_priority < 0)) {
 		do_priority_computation(thread, temp_pri);
+		inherit_priority(thread, temp_pri);
 		thread->sched_pri = temp_pri;
 	}
 }
 
+#if	MACH_FIXPRI
+/*
+ *	runq_enqueue:
+ *
+ *	Put th at the tail of run queue q, except that POLICY_DEADLINE
+ *	threads are kept in earliest deadline first order ahead of
+ *	any other thread at the same priority.
+ */
+static inline void runq_enqueue(
+	queue_t		q,
+	thread_t	th)
+{
+	queue_entry_t	qe;
+	thread_t	t;
+
+	if (th->policy != POLICY_DEADLINE) {
+		enqueue_tail(q, &th->links);
+		return;
+	}
+
+	for (qe = queue_first(q); !queue_end(q, qe); qe = queue_next(qe)) {
+		t = (thread_t) qe;
+		if (t->policy != POLICY_DEADLINE ||
+		    t->dl_abs_deadline > th->dl_abs_deadline)
+			break;
+	}
+	insque(&th->links, queue_prev(qe));
+}
+
+/*
+ *	deadline_wakeup:
+ *
+ *	Constant bandwidth server rule for a POLICY_DEADLINE thread
+ *	becoming runnable: if its remaining budget cannot be consumed
+ *	before its current deadline without exceeding its reserved
+ *	bandwidth, start a new period.  A thread woken up past its
+ *	deadline but before its next period was blocked when it should
+ *	have completed, and has missed the deadline; waking up at or
+ *	after the start of the next period is normal for periodic
+ *	threads.  Throttled threads wait for deadline_replenish.
+ *	Caller must have lock on thread.
+ */
+static void deadline_wakeup(
+	thread_t	th)
+{
+	unsigned long	now = elapsed_ticks;
+
+	if (th->dl_throttled)
+		return;
+
+	if (now > th->dl_abs_deadline &&
+	    now < th->dl_abs_deadline - th->dl_deadline + th->dl_period)
+		th->dl_misses++;
+
+	if (now >= th->dl_abs_deadline ||
+	    (unsigned long long) th->dl_budget * th->dl_period >
+	    (unsigned long long) (th->dl_abs_deadline - now) * th->dl_runtime) {
+		th->dl_abs_deadline = now + th->dl_deadline;
+		th->dl_budget = th->dl_runtime;
+		th->dl_periods++;
+	}
+}
+
+/*
+ *	deadline_preempts:
+ *
+ *	Whether the newly runnable thread th should preempt cur,
+ *	both running at the same priority.
+ */
+#define deadline_preempts(th, cur)					\
+	((th)->policy == POLICY_DEADLINE &&				\
+	 (cur)->policy == POLICY_DEADLINE &&				\
+	 (th)->sched_pri == (cur)->sched_pri &&				\
+	 (th)->dl_abs_deadline < (cur)->dl_abs_deadline)
+
+/*
+ *	deadline_csw_needed:
+ *
+ *	Context switch check for a running POLICY_DEADLINE thread, used
+ *	by csw_needed.  Such a thread yields to any higher priority
+ *	thread, and to a deadline thread with an earlier deadline at
+ *	the head of its own run queue.  Assumes runq.low is accurate,
+ *	which the pset guarantees while POLICY_DEADLINE is enabled.
+ */
+boolean_t deadline_csw_needed(
+	thread_t	thread,
+	processor_t	processor)
+{
+	run_queue_t	rq;
+	thread_t	th;
+	boolean_t	result;
+	spl_t		s;
+
+	rq = &processor->processor_set->runq;
+	if (rq->count == 0 || rq->low > thread->sched_pri)
+		return FALSE;
+	if (rq->low < thread->sched_pri)
+		return TRUE;
+
+	s = splsched();
+	simple_lock(&rq->lock);
+	result = FALSE;
+	if (!queue_empty(&rq->runq[thread->sched_pri])) {
+		th = (thread_t) queue_first(&rq->runq[thread->sched_pri]);
+		result = deadline_preempts(th, thread);
+	}
+	simple_unlock(&rq->lock);
+	splx(s);
+	return result;
+}
+#else	/* MACH_FIXPRI */
+#define runq_enqueue(q, th)	enqueue_tail((q), &((th)->links))
+#endif	/* MACH_FIXPRI */
+
 /*
  *	run_queue_enqueue macro for thread_setrun().
  */
@@ -1192,7 +1334,7 @@ void update_priority(
 									\
 	    runq_lock(rq);	/* lock the run queue */	\
 	    checkrq((rq), "thread_setrun: before adding thread");	\
-	    enqueue_tail(&(rq)->runq[whichq], &((th)->links));		\
+	    runq_enqueue(&(rq)->runq[whichq], (th));			\
 									\
 	    if (whichq < (rq)->low || (rq)->count == 0) 		\
 		 (rq)->low = whichq;	/* minimize */			\
@@ -1215,7 +1357,7 @@ void update_priority(
 	    }								\
 									\
 	    runq_lock(rq);	/* lock the run queue */	\
-	    enqueue_tail(&(rq)->runq[whichq], &((th)->links));		\
+	    runq_enqueue(&(rq)->runq[whichq], (th));			\
 									\
 	    if (whichq < (rq)->low || (rq)->count == 0) 		\
 		 (rq)->low = whichq;	/* minimize */			\
@@ -1225,6 +1367,37 @@ void update_priority(
 	    runq_unlock(rq);						\
 	MACRO_END
 #endif	/* DEBUG */
+#if	NCPUS > 1
+/*
+ *	dispatch_wakeup:
+ *
+ *	Make an idle processor notice the thread just dispatched to it
+ *	through its next_thread.  A processor waiting in
+ *	machine_idle_monitor is woken by that store alone; any other
+ *	needs an interprocessor interrupt.  Called at splsched.
+ */
+static void dispatch_wakeup(
+	processor_t	processor)
+{
+	if (processor == current_processor())
+		return;
+
+	/*
+	 *	Order the store to next_thread before the load of
+	 *	idle_monitor; the idle loop orders them the other
+	 *	way round, so one of us sees the other.
+	 */
+	__sync_synchronize();
+	if (processor->idle_monitor) {
+		sched_stats_wakeup(SCHED_STATS_WAKEUP_MONITOR);
+		return;
+	}
+
+	sched_stats_wakeup(SCHED_STATS_WAKEUP_IPI);
+	cause_ast_check(processor);
+}
+#endif	/* NCPUS > 1 */
+
 /*
  *	thread_setrun:
  *
@@ -1253,6 +1426,13 @@ void thread_setrun(
 
 	assert(th->runq == RUN_QUEUE_NULL);
 
+#if	MACH_FIXPRI
+	if (may_preempt && th->policy == POLICY_DEADLINE)
+		deadline_wakeup(th);
+#endif	/* MACH_FIXPRI */
+
+	sched_stats_enqueue(th);
+
 #if	NCPUS > 1
 	/*
 	 *	Try to dispatch the thread directly onto an idle processor.
@@ -1282,8 +1462,7 @@ void thread_setrun(
 			    processor->state = PROCESSOR_DISPATCHING;
 			    simple_unlock(&pset->idle_lock);
 			    processor_unlock(processor);
-			    if (processor != current_processor())
-				cause_ast_check(processor);
+			    dispatch_wakeup(processor);
 		            return;
 		    }
 		    simple_unlock(&pset->idle_lock);
@@ -1301,8 +1480,7 @@ void thread_setrun(
 		    processor->next_thread = th;
 		    processor->state = PROCESSOR_DISPATCHING;
 		    simple_unlock(&pset->idle_lock);
-		    if (processor != current_processor())
-			cause_ast_check(processor);
+		    dispatch_wakeup(processor);
 		    return;
 		}
 		simple_unlock(&pset->idle_lock);
@@ -1316,7 +1494,11 @@ void thread_setrun(
 #if	MACH_HOST
 		(pset == current_processor()->processor_set) &&
 #endif	/* MACH_HOST */
-		(current_thread()->sched_pri > th->sched_pri)) {
+		((current_thread()->sched_pri > th->sched_pri)
+#if	MACH_FIXPRI
+		 || deadline_preempts(th, current_thread())
+#endif	/* MACH_FIXPRI */
+		)) {
 			/*
 			 *	Turn off first_quantum to allow csw.
 			 */
@@ -1341,8 +1523,7 @@ void thread_setrun(
 		    processor->state = PROCESSOR_DISPATCHING;
 		    simple_unlock(&pset->idle_lock);
 		    processor_unlock(processor);
-		    if (processor != current_processor())
-			cause_ast_check(processor);
+		    dispatch_wakeup(processor);
 		    return;
 		}
 		simple_unlock(&pset->idle_lock);
@@ -1386,7 +1567,12 @@ void thread_setrun(
 	/*
 	 * Preempt check
 	 */
-	if (may_preempt && (current_thread()->sched_pri > th->sched_pri)) {
+	if (may_preempt &&
+	    ((current_thread()->sched_pri > th->sched_pri)
+#if	MACH_FIXPRI
+	     || deadline_preempts(th, current_thread())
+#endif	/* MACH_FIXPRI */
+	    )) {
 		/*
 		 *	Turn off first_quantum to allow context switch.
 		 */
@@ -1568,7 +1754,8 @@ thread_t choose_pset_thread(
 		     */
 #if	MACH_FIXPRI
 		    if ((runq->count > 0) &&
-			(pset->policies & POLICY_FIXEDPRI)) {
+			(pset->policies &
+			 (POLICY_FIXEDPRI|POLICY_DEADLINE))) {
 			    while (queue_empty(q)) {
 				q++;
 				i++;
@@ -1674,9 +1861,21 @@ static void __attribute__((noreturn)) idle_thread_continue(void)
 
 			/*
 			 * machine_idle is a machine dependent function,
-			 * to conserve power.
+			 * to conserve power.  If the machine can wait
+			 * for a store to next_thread, let thread_setrun
+			 * know it need not interrupt us.
 			 */
 #if	POWER_SAVE
+#ifdef	MACHINE_IDLE_MONITOR
+			if (idle_monitor_supported) {
+				myprocessor->idle_monitor = TRUE;
+				__sync_synchronize();
+				machine_idle_monitor(mycpu,
+					(void * volatile *) threadp);
+				myprocessor->idle_monitor = FALSE;
+			}
+			else
+#endif	/* MACHINE_IDLE_MONITOR */
 			machine_idle(mycpu);
 #endif /* POWER_SAVE */
 		}
@@ -1963,12 +2162,12 @@ void do_thread_scan(void)
 
 	do {
 #if	MACH_HOST
-	    simple_lock(&all_psets_lock);
+	    lock_read(&all_psets_lock);
 	    queue_iterate(&all_psets, pset, processor_set_t, all_psets) {
 		if (restart_needed = do_runq_scan(&pset->runq))
 			break;
 	    }
-	    simple_unlock(&all_psets_lock);
+	    lock_read_done(&all_psets_lock);
 #else	/* MACH_HOST */
 	    restart_needed = do_runq_scan(&default_pset.runq);
 #endif	/* MACH_HOST */
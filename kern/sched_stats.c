@@ -0,0 +1,148 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#if	MACH_SCHED_STATS
+
+#include <string.h>
+#include <kern/host.h>
+#include <kern/log2.h>
+#include <kern/mach_debug.server.h>
+#include <kern/sched.h>
+#include <kern/sched_stats.h>
+#include <kern/thread.h>
+#include <mach/vm_param.h>
+#include <vm/vm_kern.h>
+#include <vm/vm_map.h>
+
+struct sched_stats sched_stats[NCPUS];
+
+void sched_stats_switch(
+	thread_t	old_thread,
+	thread_t	new_thread)
+{
+	struct sched_stats *stats = &sched_stats[cpu_number()];
+	unsigned int	reason;
+	uint64_t	delay;
+	unsigned int	band, bucket;
+
+	reason = stats->hint;
+	stats->hint = SCHED_STATS_PREEMPT;
+
+	/*
+	 *	Leaving the idle thread is not a context switch
+	 *	in any interesting sense.
+	 */
+	if (!(old_thread->state & TH_IDLE)) {
+		if (old_thread->state & TH_WAIT)
+			reason = SCHED_STATS_BLOCK;
+		stats->csw[reason]++;
+	}
+
+	/*
+	 *	Threads handed a stack directly (see thread_handoff)
+	 *	were never put on a run queue.
+	 */
+	if (new_thread->runq_stamp == 0)
+		return;
+
+	/*
+	 *	The timestamps of different processors can't be
+	 *	compared: only count the threads made runnable here.
+	 */
+	if (new_thread->runq_stamp_cpu != cpu_number()) {
+		new_thread->runq_stamp = 0;
+		stats->remote++;
+		return;
+	}
+
+	delay = machine_timestamp() - new_thread->runq_stamp;
+	new_thread->runq_stamp = 0;
+
+	band = new_thread->sched_pri / SCHED_STATS_BAND_SIZE;
+	if (band >= SCHED_STATS_NBANDS)
+		band = SCHED_STATS_NBANDS - 1;
+
+	if (delay <= 1)
+		bucket = 0;
+	else if (delay >> 32)
+		bucket = SCHED_STATS_NBUCKETS - 1;
+	else
+		bucket = ilog2((unsigned long) delay);
+	if (bucket >= SCHED_STATS_NBUCKETS)
+		bucket = SCHED_STATS_NBUCKETS - 1;
+
+	stats->wait_hist[band][bucket]++;
+}
+
+/*
+ *	host_sched_stats:
+ *
+ *	Return the scheduler statistics of every processor.  The
+ *	counters are read without synchronization.
+ */
+kern_return_t host_sched_stats(
+	const host_t		host,
+	sched_stats_info_array_t *infop,
+	natural_t		*infoCntp)
+{
+	sched_stats_info_t	*info;
+	vm_offset_t		addr;
+	vm_size_t		size;
+	vm_map_copy_t		copy;
+	kern_return_t		kr;
+	int			i;
+
+	if (host == HOST_NULL)
+		return KERN_INVALID_HOST;
+
+	size = NCPUS * sizeof(*info);
+
+	if (*infoCntp >= NCPUS) {
+		info = *infop;
+		addr = 0;
+	} else {
+		kr = kmem_alloc_pageable(ipc_kernel_map, &addr,
+					 round_page(size));
+		if (kr != KERN_SUCCESS)
+			return kr;
+
+		info = (sched_stats_info_t *) addr;
+		memset(info, 0, round_page(size));
+	}
+
+	for (i = 0; i < NCPUS; i++) {
+		info[i].cpu = i;
+		memcpy(info[i].csw, sched_stats[i].csw,
+		       sizeof(info[i].csw));
+		memcpy(info[i].wakeups, sched_stats[i].wakeups,
+		       sizeof(info[i].wakeups));
+		info[i].remote = sched_stats[i].remote;
+		memcpy(info[i].wait_hist, sched_stats[i].wait_hist,
+		       sizeof(info[i].wait_hist));
+	}
+
+	if (addr != 0) {
+		kr = vm_map_copyin(ipc_kernel_map, addr, size, TRUE, &copy);
+		assert(kr == KERN_SUCCESS);
+		*infop = (sched_stats_info_t *) copy;
+	}
+
+	*infoCntp = NCPUS;
+	return KERN_SUCCESS;
+}
+
+#endif	/* MACH_SCHED_STATS */
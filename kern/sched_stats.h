@@ -0,0 +1,84 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ *	Scheduler latency statistics: context switch counts by reason
+ *	and per-priority-band histograms of the time runnable threads
+ *	spend on a run queue before being dispatched.
+ *
+ *	All hooks compile to nothing unless MACH_SCHED_STATS is set.
+ */
+
+#ifndef _KERN_SCHED_STATS_H_
+#define _KERN_SCHED_STATS_H_
+
+#if	MACH_SCHED_STATS
+
+#include <kern/cpu_number.h>
+#include <kern/kern_types.h>
+#include <kern/macros.h>
+#include <mach_debug/sched_info.h>
+#include <machine/time_stamp.h>
+
+struct sched_stats {
+	unsigned int	hint;		/* reason for the next switch */
+	unsigned int	csw[SCHED_STATS_NREASONS];
+	unsigned int	wakeups[SCHED_STATS_NWAKEUPS];
+	unsigned int	remote;		/* delays not measured */
+	unsigned int	wait_hist[SCHED_STATS_NBANDS][SCHED_STATS_NBUCKETS];
+} __attribute__((aligned(64)));
+
+extern struct sched_stats sched_stats[NCPUS];
+
+/*
+ *	Record that a switch away from the current thread is about
+ *	to happen for the given reason, unless the thread blocks.
+ */
+#define sched_stats_hint(reason)				\
+	(sched_stats[cpu_number()].hint = (reason))
+
+/*
+ *	Timestamp a thread as it becomes runnable.  Called with the
+ *	thread locked, at splsched.
+ */
+#define sched_stats_enqueue(th)					\
+	((th)->runq_stamp = machine_timestamp(),		\
+	 (th)->runq_stamp_cpu = cpu_number())
+
+/*
+ *	Count the wakeup of a dispatched idle processor by the
+ *	given method, on behalf of the current processor.
+ */
+#define sched_stats_wakeup(how)					\
+	(sched_stats[cpu_number()].wakeups[(how)]++)
+
+/*
+ *	Account for a switch from old_thread to new_thread on the
+ *	current processor.  Called at splsched.
+ */
+extern void sched_stats_switch(thread_t old_thread, thread_t new_thread);
+
+#else	/* MACH_SCHED_STATS */
+
+#define sched_stats_hint(reason)
+#define sched_stats_enqueue(th)
+#define sched_stats_wakeup(how)
+#define sched_stats_switch(old_thread, new_thread)
+
+#endif	/* MACH_SCHED_STATS */
+
+#endif	/* _KERN_SCHED_STATS_H_ */
@@ -77,6 +77,7 @@
 #include <kern/macros.h>
 #include <kern/printf.h>
 #include <kern/slab.h>
+#include <kern/slab_trace.h>
 #include <kern/kalloc.h>
 #include <kern/cpu_number.h>
 #include <kern/mach_debug.server.h>
@@ -119,10 +120,12 @@
 #define KMEM_GC_INTERVAL (5 * hz)
 
 /*
- * The transfer size of a CPU pool is computed by dividing the pool size by
- * this value.
+ * Minimum time (in ticks) between two depot updates, and number of times
+ * the depot must have been found locked in between for its cache to move
+ * to larger magazines.
  */
-#define KMEM_CPU_POOL_TRANSFER_RATIO 2
+#define KMEM_DEPOT_UPDATE_INTERVAL hz
+#define KMEM_DEPOT_CONTENTION_THRESHOLD 3
 
 /*
  * Redzone guard word.
@@ -151,10 +154,23 @@
  */
 #define KALLOC_FIRST_SHIFT 5
 
+/*
+ * Shift for the last power of two kalloc cache size.
+ */
+#define KALLOC_LAST_SHIFT 17
+
+/*
+ * Between two powers of two, kalloc caches are spaced by a fraction of the
+ * lower one: there are (1 << KALLOC_CLASS_SHIFT) caches per power of two,
+ * e.g. 1.25, 1.5, 1.75 and 2 times the lower power of two.
+ */
+#define KALLOC_CLASS_SHIFT 2
+
 /*
  * Number of caches backing general purpose allocations.
  */
-#define KALLOC_NR_CACHES 13
+#define KALLOC_NR_CACHES \
+    (1 + ((KALLOC_LAST_SHIFT - KALLOC_FIRST_SHIFT) << KALLOC_CLASS_SHIFT))
 
 /*
  * Values the buftag state member can take.
@@ -207,6 +223,7 @@
                                            and KMEM_CF_PHYSMEM) */
 #define KMEM_CF_VERIFY          0x20    /* Debugging facilities enabled
                                            (implies KMEM_CF_USE_TREE) */
+#define KMEM_CF_NO_CPU_POOL     0x40    /* CPU pool layer disabled */
 
 /*
  * Options for kmem_cache_alloc_verify().
@@ -225,22 +242,28 @@
 
 #if SLAB_USE_CPU_POOLS
 /*
- * Available CPU pool types.
+ * Available CPU pool types, by increasing magazine size.
  *
- * For each entry, the CPU pool size applies from the entry buf_size
- * (excluded) up to (and including) the buf_size of the preceding entry.
+ * A cache starts with the first entry whose buf_size is lower than or equal
+ * to its own, and may grow to the next entry as long as its buffer size is
+ * lower than the max_buf_size of its current entry.
  *
  * See struct kmem_cpu_pool_type for a description of the values.
  */
 static struct kmem_cpu_pool_type kmem_cpu_pool_types[] = {
-    {  32768,   1, 0,           NULL },
-    {   4096,   8, CPU_L1_SIZE, NULL },
-    {    256,  64, CPU_L1_SIZE, NULL },
-    {      0, 128, CPU_L1_SIZE, NULL }
+    {   3200, 65536,   1, 0,           NULL },
+    {    256, 32768,   3, 0,           NULL },
+    {     64, 16384,   7, CPU_L1_SIZE, NULL },
+    {      0,  8192,  15, CPU_L1_SIZE, NULL },
+    {      0,  4096,  31, CPU_L1_SIZE, NULL },
+    {      0,  2048,  47, CPU_L1_SIZE, NULL },
+    {      0,  1024,  63, CPU_L1_SIZE, NULL },
+    {      0,   512,  95, CPU_L1_SIZE, NULL },
+    {      0,     0, 143, CPU_L1_SIZE, NULL }
 };
 
 /*
- * Caches where CPU pool arrays are allocated from.
+ * Caches where magazines are allocated from.
  */
 static struct kmem_cache kmem_cpu_array_caches[ARRAY_SIZE(kmem_cpu_pool_types)];
 #endif /* SLAB_USE_CPU_POOLS */
@@ -255,6 +278,23 @@ static struct kmem_cache kmem_slab_cache;
  */
 static struct kmem_cache kalloc_caches[KALLOC_NR_CACHES];
 
+/*
+ * Bytes requested by the clients of each general purpose cache, and bytes
+ * handed out to them, to measure internal fragmentation. They are updated
+ * by kalloc and kfree whether the object goes through a CPU pool or not,
+ * and so cover exactly the objects currently held by clients.
+ *
+ * The counters are kept per processor so that kalloc and kfree don't share
+ * cache lines. An object may be freed on another processor than the one
+ * it was allocated on, so only the sum over all processors is meaningful.
+ * Atomic operations are still needed, as threads can be preempted and
+ * migrate, and interrupt handlers allocate too, but they stay local.
+ */
+static struct kalloc_cpu_stats {
+    vm_size_t requested[KALLOC_NR_CACHES];
+    vm_size_t allocated[KALLOC_NR_CACHES];
+} __attribute__((aligned(CPU_L1_SIZE))) kalloc_stats[NCPUS];
+
 /*
  * List of all caches managed by the allocator.
  */
@@ -610,10 +650,10 @@ static void kmem_cpu_pool_init(struct kmem_cpu_pool *cpu_pool,
 {
     simple_lock_init(&cpu_pool->lock);
     cpu_pool->flags = cache->flags;
-    cpu_pool->size = 0;
-    cpu_pool->transfer_size = 0;
-    cpu_pool->nr_objs = 0;
-    cpu_pool->array = NULL;
+    cpu_pool->loaded = NULL;
+    cpu_pool->previous = NULL;
+    cpu_pool->nr_hits = 0;
+    cpu_pool->nr_misses = 0;
 }
 
 /*
@@ -631,70 +671,196 @@ static inline struct kmem_cpu_pool * kmem_cpu_pool_get(struct kmem_cache *cache)
     return &cache->cpu_pools[cpu_number()];
 }
 
-static inline void kmem_cpu_pool_build(struct kmem_cpu_pool *cpu_pool,
-                                       struct kmem_cache *cache, void **array)
+static inline void kmem_cpu_pool_swap(struct kmem_cpu_pool *cpu_pool)
 {
-    cpu_pool->size = cache->cpu_pool_type->array_size;
-    cpu_pool->transfer_size = (cpu_pool->size
-                               + KMEM_CPU_POOL_TRANSFER_RATIO - 1)
-                              / KMEM_CPU_POOL_TRANSFER_RATIO;
-    cpu_pool->array = array;
+    struct kmem_magazine *magazine;
+
+    magazine = cpu_pool->loaded;
+    cpu_pool->loaded = cpu_pool->previous;
+    cpu_pool->previous = magazine;
 }
 
-static inline void * kmem_cpu_pool_pop(struct kmem_cpu_pool *cpu_pool)
+static struct kmem_magazine * kmem_magazine_create(
+    struct kmem_cpu_pool_type *type)
 {
-    cpu_pool->nr_objs--;
-    return cpu_pool->array[cpu_pool->nr_objs];
+    struct kmem_magazine *magazine;
+
+    magazine = (struct kmem_magazine *)kmem_cache_alloc(type->array_cache);
+
+    if (magazine == NULL)
+        return NULL;
+
+    magazine->type = type;
+    magazine->nr_objs = 0;
+    return magazine;
 }
 
-static inline void kmem_cpu_pool_push(struct kmem_cpu_pool *cpu_pool, void *obj)
+static void kmem_magazine_destroy(struct kmem_magazine *magazine)
 {
-    cpu_pool->array[cpu_pool->nr_objs] = obj;
-    cpu_pool->nr_objs++;
+    assert(magazine->nr_objs == 0);
+    kmem_cache_free(magazine->type->array_cache, (vm_offset_t)magazine);
 }
 
-static int kmem_cpu_pool_fill(struct kmem_cpu_pool *cpu_pool,
-                              struct kmem_cache *cache)
+static inline int kmem_magazine_full(const struct kmem_magazine *magazine)
 {
-    kmem_cache_ctor_t ctor;
-    void *buf;
-    int i;
+    return magazine->nr_objs == magazine->type->array_size;
+}
 
-    ctor = (cpu_pool->flags & KMEM_CF_VERIFY) ? NULL : cache->ctor;
+static inline void * kmem_magazine_pop(struct kmem_magazine *magazine)
+{
+    magazine->nr_objs--;
+    return magazine->objs[magazine->nr_objs];
+}
 
-    simple_lock(&cache->lock);
+static inline void kmem_magazine_push(struct kmem_magazine *magazine,
+                                      void *obj)
+{
+    magazine->objs[magazine->nr_objs] = obj;
+    magazine->nr_objs++;
+}
+
+/*
+ * Lock the depot of a cache, accounting for contention.
+ */
+static void kmem_depot_lock(struct kmem_cache *cache)
+{
+    if (likely(simple_lock_try(&cache->depot_lock)))
+        return;
 
-    for (i = 0; i < cpu_pool->transfer_size; i++) {
-        buf = kmem_cache_alloc_from_slab(cache);
+    simple_lock(&cache->depot_lock);
+    cache->depot_contention++;
+}
 
-        if (buf == NULL)
-            break;
+/*
+ * Take a full (or an empty) magazine from the depot.
+ *
+ * The depot must be locked before calling this function.
+ */
+static struct kmem_magazine * kmem_depot_get(struct kmem_cache *cache,
+                                             int full)
+{
+    struct kmem_magazine *magazine;
+    struct list *list;
+    long_natural_t *nr, *min;
+
+    if (full) {
+        list = &cache->full_magazines;
+        nr = &cache->nr_full_magazines;
+        min = &cache->min_full_magazines;
+    } else {
+        list = &cache->empty_magazines;
+        nr = &cache->nr_empty_magazines;
+        min = &cache->min_empty_magazines;
+    }
+
+    if (list_empty(list))
+        return NULL;
+
+    magazine = list_first_entry(list, struct kmem_magazine, node);
+    list_remove(&magazine->node);
+    (*nr)--;
 
-        if (ctor != NULL)
-            ctor(buf);
+    if (*nr < *min)
+        *min = *nr;
+
+    return magazine;
+}
 
-        kmem_cpu_pool_push(cpu_pool, buf);
+/*
+ * Give a full or empty magazine to the depot.
+ *
+ * The depot must be locked before calling this function.
+ */
+static void kmem_depot_put(struct kmem_cache *cache,
+                           struct kmem_magazine *magazine)
+{
+    if (magazine->nr_objs == 0) {
+        list_insert_head(&cache->empty_magazines, &magazine->node);
+        cache->nr_empty_magazines++;
+    } else {
+        list_insert_head(&cache->full_magazines, &magazine->node);
+        cache->nr_full_magazines++;
     }
+}
 
-    simple_unlock(&cache->lock);
+/*
+ * Move a cache to larger magazines if its depot has been contended since
+ * the last update. Empty magazines of the previous size are destroyed
+ * right away, the others when they become empty.
+ *
+ * The depot must be locked before calling this function.
+ */
+static void kmem_depot_update(struct kmem_cache *cache)
+{
+    struct kmem_cpu_pool_type *type;
+    struct kmem_magazine *magazine;
+
+    if ((elapsed_ticks - cache->depot_update_tick)
+        < KMEM_DEPOT_UPDATE_INTERVAL)
+        return;
+
+    cache->depot_update_tick = elapsed_ticks;
+    type = cache->cpu_pool_type;
+
+    if (((cache->depot_contention - cache->depot_contention_prev)
+         > KMEM_DEPOT_CONTENTION_THRESHOLD)
+        && (cache->buf_size < type->max_buf_size)) {
+        cache->cpu_pool_type = type + 1;
+
+        while ((magazine = kmem_depot_get(cache, 0)) != NULL)
+            kmem_magazine_destroy(magazine);
+    }
 
-    return i;
+    cache->depot_contention_prev = cache->depot_contention;
 }
 
-static void kmem_cpu_pool_drain(struct kmem_cpu_pool *cpu_pool,
-                                struct kmem_cache *cache)
+/*
+ * Release the magazines the depot of a cache kept unused since the last
+ * call, along with their objects.
+ */
+static void kmem_depot_reap(struct kmem_cache *cache)
 {
-    void *obj;
-    int i;
+    struct kmem_magazine *magazine;
+    struct list magazines;
+    long_natural_t nr_full, nr_empty;
 
-    simple_lock(&cache->lock);
+    list_init(&magazines);
 
-    for (i = cpu_pool->transfer_size; i > 0; i--) {
-        obj = kmem_cpu_pool_pop(cpu_pool);
-        kmem_cache_free_to_slab(cache, obj);
+    simple_lock(&cache->depot_lock);
+
+    nr_full = cache->min_full_magazines;
+    nr_empty = cache->min_empty_magazines;
+
+    while (nr_full-- > 0) {
+        magazine = kmem_depot_get(cache, 1);
+        list_insert_tail(&magazines, &magazine->node);
     }
 
-    simple_unlock(&cache->lock);
+    while (nr_empty-- > 0) {
+        magazine = kmem_depot_get(cache, 0);
+        list_insert_tail(&magazines, &magazine->node);
+    }
+
+    cache->min_full_magazines = cache->nr_full_magazines;
+    cache->min_empty_magazines = cache->nr_empty_magazines;
+
+    simple_unlock(&cache->depot_lock);
+
+    while (!list_empty(&magazines)) {
+        magazine = list_first_entry(&magazines, struct kmem_magazine, node);
+        list_remove(&magazine->node);
+
+        if (magazine->nr_objs != 0) {
+            simple_lock(&cache->lock);
+
+            while (magazine->nr_objs != 0)
+                kmem_cache_free_to_slab(cache, kmem_magazine_pop(magazine));
+
+            simple_unlock(&cache->lock);
+        }
+
+        kmem_magazine_destroy(magazine);
+    }
 }
 #endif /* SLAB_USE_CPU_POOLS */
 
@@ -826,6 +992,9 @@ void kmem_cache_init(struct kmem_cache *cache, const char *name,
     if (flags & KMEM_CACHE_VERIFY)
         cache->flags |= KMEM_CF_VERIFY;
 
+    if (flags & KMEM_CACHE_NOCPUPOOL)
+        cache->flags |= KMEM_CF_NO_CPU_POOL;
+
     if (align < KMEM_ALIGN_MIN)
         align = KMEM_ALIGN_MIN;
 
@@ -853,6 +1022,8 @@ void kmem_cache_init(struct kmem_cache *cache, const char *name,
     cache->name[sizeof(cache->name) - 1] = '\0';
     cache->buftag_dist = 0;
     cache->redzone_pad = 0;
+    cache->reclaim = NULL;
+    cache->nr_reclaimed_pages = 0;
 
     if (cache->flags & KMEM_CF_VERIFY) {
         cache->bufctl_dist = buf_size;
@@ -867,10 +1038,21 @@ void kmem_cache_init(struct kmem_cache *cache, const char *name,
 
 #if SLAB_USE_CPU_POOLS
     for (cpu_pool_type = kmem_cpu_pool_types;
-         buf_size <= cpu_pool_type->buf_size;
+         buf_size < cpu_pool_type->buf_size;
          cpu_pool_type++);
 
+    simple_lock_init(&cache->depot_lock);
     cache->cpu_pool_type = cpu_pool_type;
+    list_init(&cache->full_magazines);
+    list_init(&cache->empty_magazines);
+    cache->nr_full_magazines = 0;
+    cache->nr_empty_magazines = 0;
+    cache->min_full_magazines = 0;
+    cache->min_empty_magazines = 0;
+    cache->depot_hits = 0;
+    cache->depot_contention = 0;
+    cache->depot_contention_prev = 0;
+    cache->depot_update_tick = elapsed_ticks;
 
     for (i = 0; i < ARRAY_SIZE(cache->cpu_pools); i++)
         kmem_cpu_pool_init(&cache->cpu_pools[i], cache);
@@ -882,6 +1064,12 @@ void kmem_cache_init(struct kmem_cache *cache, const char *name,
     simple_unlock(&kmem_cache_list_lock);
 }
 
+void kmem_cache_set_reclaim(struct kmem_cache *cache,
+                            kmem_cache_reclaim_t reclaim)
+{
+    cache->reclaim = reclaim;
+}
+
 static inline int kmem_cache_empty(struct kmem_cache *cache)
 {
     return cache->nr_objs == cache->nr_bufs;
@@ -930,17 +1118,42 @@ static int kmem_cache_grow(struct kmem_cache *cache)
     return !empty;
 }
 
-static void kmem_cache_reap(struct kmem_cache *cache, struct list *dead_slabs)
+/*
+ * Move at most max_slabs free slabs of a cache to the dead_slabs list,
+ * and return the number of pages they use.
+ */
+static unsigned long kmem_cache_reap(struct kmem_cache *cache,
+                                     struct list *dead_slabs,
+                                     unsigned long max_slabs)
 {
+    struct kmem_slab *slab;
+    unsigned long nr_slabs, nr_pages;
+
     simple_lock(&cache->lock);
 
-    list_concat(dead_slabs, &cache->free_slabs);
-    list_init(&cache->free_slabs);
-    cache->nr_bufs -= cache->bufs_per_slab * cache->nr_free_slabs;
-    cache->nr_slabs -= cache->nr_free_slabs;
-    cache->nr_free_slabs = 0;
+    if (max_slabs >= cache->nr_free_slabs) {
+        nr_slabs = cache->nr_free_slabs;
+        list_concat(dead_slabs, &cache->free_slabs);
+        list_init(&cache->free_slabs);
+    } else {
+        /* Free slabs are inserted at the head, release the oldest ones */
+        for (nr_slabs = 0; nr_slabs < max_slabs; nr_slabs++) {
+            slab = list_last_entry(&cache->free_slabs, struct kmem_slab,
+                                   list_node);
+            list_remove(&slab->list_node);
+            list_insert_tail(dead_slabs, &slab->list_node);
+        }
+    }
+
+    cache->nr_bufs -= cache->bufs_per_slab * nr_slabs;
+    cache->nr_slabs -= nr_slabs;
+    cache->nr_free_slabs -= nr_slabs;
+    nr_pages = nr_slabs * (cache->slab_size >> PAGE_SHIFT);
+    cache->nr_reclaimed_pages += nr_pages;
 
     simple_unlock(&cache->lock);
+
+    return nr_pages;
 }
 
 /*
@@ -1079,13 +1292,18 @@ static void kmem_cache_alloc_verify(struct kmem_cache *cache, void *buf,
         cache->ctor(buf);
 }
 
-vm_offset_t kmem_cache_alloc(struct kmem_cache *cache)
+/*
+ * Allocate an object from a cache, without accounting for it in
+ * allocation traces.
+ */
+static inline vm_offset_t kmem_cache_alloc_untraced(struct kmem_cache *cache)
 {
     int filled;
     void *buf;
 
 #if SLAB_USE_CPU_POOLS
     struct kmem_cpu_pool *cpu_pool;
+    struct kmem_magazine *magazine, *stale;
 
     cpu_pool = kmem_cpu_pool_get(cache);
 
@@ -1095,8 +1313,10 @@ vm_offset_t kmem_cache_alloc(struct kmem_cache *cache)
     simple_lock(&cpu_pool->lock);
 
 fast_alloc:
-    if (likely(cpu_pool->nr_objs > 0)) {
-        buf = kmem_cpu_pool_pop(cpu_pool);
+    if (likely((cpu_pool->loaded != NULL)
+               && (cpu_pool->loaded->nr_objs > 0))) {
+        buf = kmem_magazine_pop(cpu_pool->loaded);
+        cpu_pool->nr_hits++;
         simple_unlock(&cpu_pool->lock);
 
         if (cpu_pool->flags & KMEM_CF_VERIFY)
@@ -1105,23 +1325,44 @@ fast_alloc:
         return (vm_offset_t)buf;
     }
 
-    if (cpu_pool->array != NULL) {
-        filled = kmem_cpu_pool_fill(cpu_pool, cache);
+    if ((cpu_pool->previous != NULL) && (cpu_pool->previous->nr_objs > 0)) {
+        kmem_cpu_pool_swap(cpu_pool);
+        goto fast_alloc;
+    }
 
-        if (!filled) {
-            simple_unlock(&cpu_pool->lock);
+    /*
+     * Both magazines are empty (or missing). Exchange the previous one
+     * for a full magazine from the depot, if any.
+     */
+    cpu_pool->nr_misses++;
+    stale = NULL;
 
-            filled = kmem_cache_grow(cache);
+    kmem_depot_lock(cache);
+    kmem_depot_update(cache);
+    magazine = kmem_depot_get(cache, 1);
 
-            if (!filled)
-                return 0;
+    if (magazine != NULL) {
+        cache->depot_hits++;
 
-            simple_lock(&cpu_pool->lock);
+        if (cpu_pool->previous != NULL) {
+            if (cpu_pool->previous->type == cache->cpu_pool_type)
+                kmem_depot_put(cache, cpu_pool->previous);
+            else
+                stale = cpu_pool->previous;
         }
 
-        goto fast_alloc;
+        cpu_pool->previous = cpu_pool->loaded;
+        cpu_pool->loaded = magazine;
     }
 
+    simple_unlock(&cache->depot_lock);
+
+    if (stale != NULL)
+        kmem_magazine_destroy(stale);
+
+    if (magazine != NULL)
+        goto fast_alloc;
+
     simple_unlock(&cpu_pool->lock);
 #endif /* SLAB_USE_CPU_POOLS */
 
@@ -1148,6 +1389,19 @@ slab_alloc:
     return (vm_offset_t)buf;
 }
 
+vm_offset_t kmem_cache_alloc(struct kmem_cache *cache)
+{
+    vm_offset_t obj;
+
+    obj = kmem_cache_alloc_untraced(cache);
+
+    if (obj != 0)
+        slab_trace_alloc(cache, obj, cache->obj_size,
+                         __builtin_frame_address(0));
+
+    return obj;
+}
+
 static void kmem_cache_free_verify(struct kmem_cache *cache, void *buf)
 {
     struct rbtree_node *node;
@@ -1216,7 +1470,9 @@ void kmem_cache_free(struct kmem_cache *cache, vm_offset_t obj)
 {
 #if SLAB_USE_CPU_POOLS
     struct kmem_cpu_pool *cpu_pool;
-    void **array;
+    struct kmem_cpu_pool_type *type;
+    struct kmem_magazine *magazine;
+    int missed;
 
     cpu_pool = kmem_cpu_pool_get(cache);
 
@@ -1227,47 +1483,73 @@ void kmem_cache_free(struct kmem_cache *cache, vm_offset_t obj)
         kmem_cache_free_verify(cache, (void *)obj);
     }
 
+    slab_trace_free(obj);
+
 #if SLAB_USE_CPU_POOLS
     if (cpu_pool->flags & KMEM_CF_NO_CPU_POOL)
         goto slab_free;
 
+    missed = 0;
     simple_lock(&cpu_pool->lock);
 
 fast_free:
-    if (likely(cpu_pool->nr_objs < cpu_pool->size)) {
-        kmem_cpu_pool_push(cpu_pool, (void *)obj);
+    if (likely((cpu_pool->loaded != NULL)
+               && !kmem_magazine_full(cpu_pool->loaded))) {
+        kmem_magazine_push(cpu_pool->loaded, (void *)obj);
+        cpu_pool->nr_hits++;
         simple_unlock(&cpu_pool->lock);
         return;
     }
 
-    if (cpu_pool->array != NULL) {
-        kmem_cpu_pool_drain(cpu_pool, cache);
+    if ((cpu_pool->previous != NULL) && (cpu_pool->previous->nr_objs == 0)) {
+        kmem_cpu_pool_swap(cpu_pool);
         goto fast_free;
     }
 
-    simple_unlock(&cpu_pool->lock);
+    /*
+     * Both magazines are full (or missing). Exchange the previous one
+     * for an empty magazine from the depot, or create one.
+     */
+    if (!missed) {
+        cpu_pool->nr_misses++;
+        missed = 1;
+    }
 
-    array = (void *)kmem_cache_alloc(cache->cpu_pool_type->array_cache);
+    kmem_depot_lock(cache);
+    kmem_depot_update(cache);
+    magazine = kmem_depot_get(cache, 0);
 
-    if (array != NULL) {
-        simple_lock(&cpu_pool->lock);
+    if (magazine != NULL) {
+        cache->depot_hits++;
 
-        /*
-         * Another thread may have built the CPU pool while the lock was
-         * dropped.
-         */
-        if (cpu_pool->array != NULL) {
-            simple_unlock(&cpu_pool->lock);
-            kmem_cache_free(cache->cpu_pool_type->array_cache,
-                            (vm_offset_t)array);
-            simple_lock(&cpu_pool->lock);
-            goto fast_free;
-        }
+        if (cpu_pool->previous != NULL)
+            kmem_depot_put(cache, cpu_pool->previous);
 
-        kmem_cpu_pool_build(cpu_pool, cache, array);
+        cpu_pool->previous = cpu_pool->loaded;
+        cpu_pool->loaded = magazine;
+        simple_unlock(&cache->depot_lock);
         goto fast_free;
     }
 
+    type = cache->cpu_pool_type;
+    simple_unlock(&cache->depot_lock);
+    simple_unlock(&cpu_pool->lock);
+
+    /* Magazine caches don't exist until slab_init */
+    if (type->array_cache == NULL)
+        goto slab_free;
+
+    magazine = kmem_magazine_create(type);
+
+    if (magazine == NULL)
+        goto slab_free;
+
+    simple_lock(&cpu_pool->lock);
+    kmem_depot_lock(cache);
+    kmem_depot_put(cache, magazine);
+    simple_unlock(&cache->depot_lock);
+    goto fast_free;
+
 slab_free:
 #endif /* SLAB_USE_CPU_POOLS */
 
@@ -1276,23 +1558,78 @@ slab_free:
     simple_unlock(&cache->lock);
 }
 
-void slab_collect(void)
+/*
+ * Call the reclaim functions of all caches.
+ */
+static void kmem_reclaim_callbacks(void)
+{
+    struct kmem_cache *cache;
+    kmem_cache_reclaim_t reclaim;
+
+    simple_lock(&kmem_cache_list_lock);
+
+    /* Caches are never destroyed, so their list nodes remain valid */
+    list_for_each_entry(&kmem_cache_list, cache, node) {
+        reclaim = cache->reclaim;
+
+        if (reclaim == NULL)
+            continue;
+
+        simple_unlock(&kmem_cache_list_lock);
+        reclaim();
+        simple_lock(&kmem_cache_list_lock);
+    }
+
+    simple_unlock(&kmem_cache_list_lock);
+}
+
+static inline unsigned long kmem_cache_free_pages(struct kmem_cache *cache)
+{
+    return cache->nr_free_slabs * (cache->slab_size >> PAGE_SHIFT);
+}
+
+static unsigned long kmem_reclaim(unsigned long nr_pages, int reap_depots)
 {
     struct kmem_cache *cache;
     struct kmem_slab *slab;
     struct list dead_slabs;
+    unsigned long long total, share;
+    unsigned long nr_reclaimed, max_slabs, slab_pages;
 
-    if (elapsed_ticks <= (kmem_gc_last_tick + KMEM_GC_INTERVAL))
-        return;
-
-    kmem_gc_last_tick = elapsed_ticks;
+    kmem_reclaim_callbacks();
 
     list_init(&dead_slabs);
+    nr_reclaimed = 0;
+    total = 0;
 
     simple_lock(&kmem_cache_list_lock);
 
-    list_for_each_entry(&kmem_cache_list, cache, node)
-        kmem_cache_reap(cache, &dead_slabs);
+    /* Counters are read unlocked, the result is only used as a hint */
+    list_for_each_entry(&kmem_cache_list, cache, node) {
+#if SLAB_USE_CPU_POOLS
+        if (reap_depots)
+            kmem_depot_reap(cache);
+#else /* SLAB_USE_CPU_POOLS */
+        (void)reap_depots;
+#endif /* SLAB_USE_CPU_POOLS */
+
+        total += kmem_cache_free_pages(cache);
+    }
+
+    list_for_each_entry(&kmem_cache_list, cache, node) {
+        if (total <= nr_pages)
+            max_slabs = (unsigned long)-1;
+        else {
+            /* Rounded up so that small caches contribute too */
+            share = ((unsigned long long)nr_pages * kmem_cache_free_pages(cache)
+                     + total - 1) / total;
+            slab_pages = cache->slab_size >> PAGE_SHIFT;
+            max_slabs = (share + slab_pages - 1) / slab_pages;
+        }
+
+        if (max_slabs != 0)
+            nr_reclaimed += kmem_cache_reap(cache, &dead_slabs, max_slabs);
+    }
 
     simple_unlock(&kmem_cache_list_lock);
 
@@ -1301,6 +1638,42 @@ void slab_collect(void)
         list_remove(&slab->list_node);
         kmem_slab_destroy(slab, slab->cache);
     }
+
+    return nr_reclaimed;
+}
+
+void slab_collect(void)
+{
+    if (elapsed_ticks <= (kmem_gc_last_tick + KMEM_GC_INTERVAL))
+        return;
+
+    kmem_gc_last_tick = elapsed_ticks;
+    kmem_reclaim((unsigned long)-1, 1);
+}
+
+unsigned long slab_reclaim(unsigned long nr_pages)
+{
+    int reap_depots;
+
+    /*
+     * Reclaim functions release memory held outside of slabs, e.g. thread
+     * stacks, and used to be called on every pageout scan.
+     */
+    if (nr_pages == 0) {
+        kmem_reclaim_callbacks();
+        return 0;
+    }
+
+    /*
+     * Depots are trimmed to their working set, which is only meaningful
+     * if it was measured over a long enough period.
+     */
+    reap_depots = (elapsed_ticks > (kmem_gc_last_tick + KMEM_GC_INTERVAL));
+
+    if (reap_depots)
+        kmem_gc_last_tick = elapsed_ticks;
+
+    return kmem_reclaim(nr_pages, reap_depots);
 }
 
 void slab_bootstrap(void)
@@ -1324,13 +1697,17 @@ void slab_init(void)
     for (i = 0; i < ARRAY_SIZE(kmem_cpu_pool_types); i++) {
         cpu_pool_type = &kmem_cpu_pool_types[i];
         cpu_pool_type->array_cache = &kmem_cpu_array_caches[i];
-        sprintf(name, "kmem_cpu_array_%d", cpu_pool_type->array_size);
-        size = sizeof(void *) * cpu_pool_type->array_size;
+        sprintf(name, "kmem_magazine_%d", cpu_pool_type->array_size);
+        size = sizeof(struct kmem_magazine)
+               + sizeof(void *) * cpu_pool_type->array_size;
         kmem_cache_init(cpu_pool_type->array_cache, name, size,
-                        cpu_pool_type->array_align, NULL, 0);
+                        cpu_pool_type->array_align, NULL,
+                        KMEM_CACHE_NOCPUPOOL);
     }
 #endif /* SLAB_USE_CPU_POOLS */
 
+    slab_trace_init();
+
     /*
      * Prevent off slab data for the slab cache to avoid infinite recursion.
      */
@@ -1338,34 +1715,57 @@ void slab_init(void)
                     0, NULL, KMEM_CACHE_NOOFFSLAB);
 }
 
+/*
+ * Return the size of the kalloc cache of the given index.
+ */
+static size_t kalloc_get_size(size_t index)
+{
+    unsigned int shift, class;
+
+    if (index == 0)
+        return 1 << KALLOC_FIRST_SHIFT;
+
+    index--;
+    shift = (index >> KALLOC_CLASS_SHIFT) + KALLOC_FIRST_SHIFT;
+    class = index & ((1 << KALLOC_CLASS_SHIFT) - 1);
+    return ((1 << KALLOC_CLASS_SHIFT) + class + 1)
+           << (shift - KALLOC_CLASS_SHIFT);
+}
+
 void kalloc_init(void)
 {
     char name[KMEM_CACHE_NAME_SIZE];
     size_t i, size;
 
-    size = 1 << KALLOC_FIRST_SHIFT;
-
     for (i = 0; i < ARRAY_SIZE(kalloc_caches); i++) {
+        size = kalloc_get_size(i);
         sprintf(name, "kalloc_%lu", size);
         kmem_cache_init(&kalloc_caches[i], name, size, 0, NULL, 0);
-        size <<= 1;
     }
 }
 
 /*
  * Return the kalloc cache index matching the given allocation size, which
  * must be strictly greater than 0.
+ *
+ * The size is rounded up to the next multiple of the power of two that
+ * spaces the caches of its range, found from its most significant bit.
  */
 static inline size_t kalloc_get_index(unsigned long size)
 {
-    assert(size != 0);
+    unsigned int shift;
 
-    size = (size - 1) >> KALLOC_FIRST_SHIFT;
+    assert(size != 0);
 
-    if (size == 0)
+    if (size <= (1 << KALLOC_FIRST_SHIFT))
         return 0;
-    else
-        return (sizeof(long) * 8) - __builtin_clzl(size);
+
+    size--;
+    shift = (sizeof(long) * 8 - 1) - __builtin_clzl(size);
+    return ((shift - KALLOC_FIRST_SHIFT) << KALLOC_CLASS_SHIFT)
+           + ((size >> (shift - KALLOC_CLASS_SHIFT))
+              & ((1 << KALLOC_CLASS_SHIFT) - 1))
+           + 1;
 }
 
 static void kalloc_verify(struct kmem_cache *cache, void *buf, size_t size)
@@ -1394,14 +1794,31 @@ vm_offset_t kalloc(vm_size_t size)
         struct kmem_cache *cache;
 
         cache = &kalloc_caches[index];
-        buf = (void *)kmem_cache_alloc(cache);
+        buf = (void *)kmem_cache_alloc_untraced(cache);
 
-        if ((buf != 0) && (cache->flags & KMEM_CF_VERIFY))
-            kalloc_verify(cache, buf, size);
-    } else if (size <= PAGE_SIZE) {
-        buf = (void *)kmem_pagealloc_physmem(PAGE_SIZE);
+        if (buf != 0) {
+            struct kalloc_cpu_stats *stats = &kalloc_stats[cpu_number()];
+
+            __atomic_add_fetch(&stats->requested[index], size,
+                               __ATOMIC_RELAXED);
+            __atomic_add_fetch(&stats->allocated[index], cache->obj_size,
+                               __ATOMIC_RELAXED);
+
+            if (cache->flags & KMEM_CF_VERIFY)
+                kalloc_verify(cache, buf, size);
+
+            slab_trace_alloc(cache, (vm_offset_t)buf, size,
+                             __builtin_frame_address(0));
+        }
     } else {
-        buf = (void *)kmem_pagealloc_virtual(size, 0);
+        if (size <= PAGE_SIZE)
+            buf = (void *)kmem_pagealloc_physmem(PAGE_SIZE);
+        else
+            buf = (void *)kmem_pagealloc_virtual(size, 0);
+
+        if (buf != NULL)
+            slab_trace_alloc(NULL, (vm_offset_t)buf, size,
+                             __builtin_frame_address(0));
     }
 
     return (vm_offset_t)buf;
@@ -1434,6 +1851,7 @@ void kfree(vm_offset_t data, vm_size_t size)
     index = kalloc_get_index(size);
 
     if (index < ARRAY_SIZE(kalloc_caches)) {
+        struct kalloc_cpu_stats *stats;
         struct kmem_cache *cache;
 
         cache = &kalloc_caches[index];
@@ -1441,11 +1859,18 @@ void kfree(vm_offset_t data, vm_size_t size)
         if (cache->flags & KMEM_CF_VERIFY)
             kfree_verify(cache, (void *)data, size);
 
+        stats = &kalloc_stats[cpu_number()];
+        __atomic_sub_fetch(&stats->requested[index], size, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&stats->allocated[index], cache->obj_size,
+                           __ATOMIC_RELAXED);
         kmem_cache_free(cache, data);
-    } else if (size <= PAGE_SIZE) {
-        kmem_pagefree_physmem(data, PAGE_SIZE);
     } else {
-        kmem_pagefree_virtual(data, size);
+        slab_trace_free(data);
+
+        if (size <= PAGE_SIZE)
+            kmem_pagefree_physmem(data, PAGE_SIZE);
+        else
+            kmem_pagefree_virtual(data, size);
     }
 }
 
@@ -1587,30 +2012,101 @@ out_cache:
 
 out:
     simple_unlock(&kmem_cache_list_lock);
+
+#if MACH_SLAB_TRACE
+    db_whatis_slab_trace(a);
+#endif /* MACH_SLAB_TRACE */
 }
 
 #endif /* MACH_KDB */
 
 #if MACH_DEBUG
-kern_return_t host_slab_info(host_t host, cache_info_array_t *infop,
-                             unsigned int *infoCntp)
+static void host_slab_fill_info(struct kmem_cache *cache, void *data)
+{
+    cache_info_t *info = data;
+
+    info->flags = cache->flags;
+#if SLAB_USE_CPU_POOLS
+    if (cache->flags & KMEM_CF_NO_CPU_POOL)
+        info->cpu_pool_size = 0;
+    else
+        info->cpu_pool_size = cache->cpu_pool_type->array_size;
+#else /* SLAB_USE_CPU_POOLS */
+    info->cpu_pool_size = 0;
+#endif /* SLAB_USE_CPU_POOLS */
+    info->obj_size = cache->obj_size;
+    info->align = cache->align;
+    info->buf_size = cache->buf_size;
+    info->slab_size = cache->slab_size;
+    info->bufs_per_slab = cache->bufs_per_slab;
+    info->nr_objs = cache->nr_objs;
+    info->nr_bufs = cache->nr_bufs;
+    info->nr_slabs = cache->nr_slabs;
+    info->nr_free_slabs = cache->nr_free_slabs;
+    strncpy(info->name, cache->name, sizeof(info->name));
+    info->name[sizeof(info->name) - 1] = '\0';
+}
+
+static void host_slab_fill_stats(struct kmem_cache *cache, void *data)
+{
+    slab_stats_info_t *info = data;
+    unsigned int i;
+
+    strncpy(info->name, cache->name, sizeof(info->name));
+    info->name[sizeof(info->name) - 1] = '\0';
+    info->cpu_pool_hits = 0;
+    info->cpu_pool_misses = 0;
+#if SLAB_USE_CPU_POOLS
+    for (i = 0; i < ARRAY_SIZE(cache->cpu_pools); i++) {
+        info->cpu_pool_hits += cache->cpu_pools[i].nr_hits;
+        info->cpu_pool_misses += cache->cpu_pools[i].nr_misses;
+    }
+
+    info->depot_hits = cache->depot_hits;
+    info->depot_contention = cache->depot_contention;
+#else /* SLAB_USE_CPU_POOLS */
+    info->depot_hits = 0;
+    info->depot_contention = 0;
+#endif /* SLAB_USE_CPU_POOLS */
+
+    if ((cache >= kalloc_caches)
+        && (cache < &kalloc_caches[ARRAY_SIZE(kalloc_caches)])) {
+        info->requested = 0;
+        info->allocated = 0;
+
+        for (i = 0; i < ARRAY_SIZE(kalloc_stats); i++) {
+            info->requested += kalloc_stats[i].requested[cache - kalloc_caches];
+            info->allocated += kalloc_stats[i].allocated[cache - kalloc_caches];
+        }
+    } else {
+        info->requested = cache->nr_objs * cache->obj_size;
+        info->allocated = info->requested;
+    }
+    info->reclaimed = cache->nr_reclaimed_pages;
+}
+
+/*
+ * Return an array with an element of the given size for each cache, filled
+ * by the given function with the cache locked.
+ */
+static kern_return_t host_slab_collect(void **infop, unsigned int *infoCntp,
+                                       vm_size_t elt_size,
+                                       void (*fill)(struct kmem_cache *,
+                                                    void *))
 {
     struct kmem_cache *cache;
-    cache_info_t *info;
+    char *info;
     unsigned int i, nr_caches;
     vm_size_t info_size;
     kern_return_t kr;
 
-    if (host == HOST_NULL)
-        return KERN_INVALID_HOST;
-
     /* Assume the cache list is mostly unaltered once the kernel is ready */
 
 retry:
     /* Harmless unsynchronized access, real value checked later */
     nr_caches = kmem_nr_caches;
-    info_size = nr_caches * sizeof(*info);
-    info = (cache_info_t *)kalloc(info_size);
+    info_size = nr_caches * elt_size;
+    info = (char *)kalloc(info_size);
 
     if (info == NULL)
         return KERN_RESOURCE_SHORTAGE;
@@ -1627,23 +2123,7 @@ retry:
 
     list_for_each_entry(&kmem_cache_list, cache, node) {
         simple_lock(&cache->lock);
-        info[i].flags = cache->flags;
-#if SLAB_USE_CPU_POOLS
-        info[i].cpu_pool_size = cache->cpu_pool_type->array_size;
-#else /* SLAB_USE_CPU_POOLS */
-        info[i].cpu_pool_size = 0;
-#endif /* SLAB_USE_CPU_POOLS */
-        info[i].obj_size = cache->obj_size;
-        info[i].align = cache->align;
-        info[i].buf_size = cache->buf_size;
-        info[i].slab_size = cache->slab_size;
-        info[i].bufs_per_slab = cache->bufs_per_slab;
-        info[i].nr_objs = cache->nr_objs;
-        info[i].nr_bufs = cache->nr_bufs;
-        info[i].nr_slabs = cache->nr_slabs;
-        info[i].nr_free_slabs = cache->nr_free_slabs;
-        strncpy(info[i].name, cache->name, sizeof(info[i].name));
-        info[i].name[sizeof(info[i].name) - 1] = '\0';
+        fill(cache, info + i * elt_size);
         simple_unlock(&cache->lock);
 
         i++;
@@ -1672,7 +2152,7 @@ retry:
 
         kr = vm_map_copyin(ipc_kernel_map, info_addr, info_size, TRUE, &copy);
         assert(kr == KERN_SUCCESS);
-        *infop = (cache_info_t *)copy;
+        *infop = copy;
     }
 
     *infoCntp = nr_caches;
@@ -1683,4 +2163,24 @@ out:
 
     return kr;
 }
+
+kern_return_t host_slab_info(host_t host, cache_info_array_t *infop,
+                             unsigned int *infoCntp)
+{
+    if (host == HOST_NULL)
+        return KERN_INVALID_HOST;
+
+    return host_slab_collect((void **)infop, infoCntp, sizeof(cache_info_t),
+                             host_slab_fill_info);
+}
+
+kern_return_t host_slab_stats(host_t host, slab_stats_info_array_t *infop,
+                              unsigned int *infoCntp)
+{
+    if (host == HOST_NULL)
+        return KERN_INVALID_HOST;
+
+    return host_slab_collect((void **)infop, infoCntp,
+                             sizeof(slab_stats_info_t), host_slab_fill_stats);
+}
 #endif /* MACH_DEBUG */
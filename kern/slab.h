@@ -60,28 +60,50 @@ struct kmem_cache;
 
 #if SLAB_USE_CPU_POOLS
 
+/*
+ * Magazine, i.e. array of pre-constructed objects.
+ *
+ * Magazines move as a whole between CPU pools and the depot of their cache.
+ * The type gives the capacity of the magazine.
+ */
+struct kmem_magazine {
+    struct list node;   /* Depot linkage */
+    struct kmem_cpu_pool_type *type;
+    int nr_objs;
+    void *objs[];
+};
+
 /*
  * Per-processor cache of pre-constructed objects.
  *
+ * A CPU pool holds two magazines. Objects are allocated from and released
+ * to the loaded magazine. The previous magazine is either full or empty, and
+ * is exchanged with the loaded one when that runs empty or full, so that
+ * the depot is only visited every other magazine in the worst case.
+ *
  * The flags member is a read-only CPU-local copy of the parent cache flags.
  */
 struct kmem_cpu_pool {
     simple_lock_data_t lock;
     int flags;
-    int size;
-    int transfer_size;
-    int nr_objs;
-    void **array;
+    struct kmem_magazine *loaded;
+    struct kmem_magazine *previous;
+    long_natural_t nr_hits;     /* Operations served by the magazines */
+    long_natural_t nr_misses;   /* Operations that went to the depot */
 } __attribute__((aligned(CPU_L1_SIZE)));
 
 /*
- * When a cache is created, its CPU pool type is determined from the buffer
- * size. For small buffer sizes, many objects can be cached in a CPU pool.
+ * Magazine types, i.e. magazine sizes.
+ *
+ * When a cache is created, its magazine type is determined from the buffer
+ * size. For small buffer sizes, many objects can be cached in a magazine.
  * Conversely, for large buffer sizes, this would incur much overhead, so only
- * a few objects are stored in a CPU pool.
+ * a few objects are stored in a magazine. Caches whose depot is contended
+ * move to larger magazines, up to a size that depends on the buffer size.
  */
 struct kmem_cpu_pool_type {
-    size_t buf_size;
+    size_t buf_size;        /* Smallest buffer size to start with this type */
+    size_t max_buf_size;    /* Largest buffer size to grow past this type */
     int array_size;
     size_t array_align;
     struct kmem_cache *array_cache;
@@ -139,6 +161,15 @@ struct kmem_slab {
  */
 typedef void (*kmem_cache_ctor_t)(void *obj);
 
+/*
+ * Type for reclaim functions.
+ *
+ * A reclaim function releases objects a subsystem keeps cached on its own
+ * back to their cache, so that the slabs they use can be returned to the
+ * VM system. It is called without any lock held, and may block.
+ */
+typedef void (*kmem_cache_reclaim_t)(void);
+
 /*
  * Cache name buffer size.  The size is chosen so that struct
  * kmem_cache fits into two cache lines.  The size of a cache line on
@@ -149,17 +180,31 @@ typedef void (*kmem_cache_ctor_t)(void *obj);
 /*
  * Cache of objects.
  *
- * Locking order : cpu_pool -> cache. CPU pools locking is ordered by CPU ID.
+ * Locking order : cpu_pool -> depot -> cache. CPU pools locking is ordered
+ * by CPU ID.
  *
- * Currently, SLAB_USE_CPU_POOLS is not defined.  KMEM_CACHE_NAME_SIZE
- * is chosen so that the struct fits into two cache lines.  The first
- * cache line contains all hot fields.
+ * SLAB_USE_CPU_POOLS is only defined on multiprocessors.  Without it,
+ * KMEM_CACHE_NAME_SIZE is chosen so that the struct fits into two cache
+ * lines.  The first cache line contains all hot fields.
  */
 struct kmem_cache {
 #if SLAB_USE_CPU_POOLS
     /* CPU pool layer */
     struct kmem_cpu_pool cpu_pools[NCPUS];
-    struct kmem_cpu_pool_type *cpu_pool_type;
+
+    /* Depot layer */
+    simple_lock_data_t depot_lock;
+    struct kmem_cpu_pool_type *cpu_pool_type;  /* Type of new magazines */
+    struct list full_magazines;
+    struct list empty_magazines;
+    long_natural_t nr_full_magazines;
+    long_natural_t nr_empty_magazines;
+    long_natural_t min_full_magazines;  /* Unused since the last update */
+    long_natural_t min_empty_magazines;
+    long_natural_t depot_hits;
+    long_natural_t depot_contention;    /* Times the depot was found locked */
+    long_natural_t depot_contention_prev;
+    unsigned long depot_update_tick;
 #endif /* SLAB_USE_CPU_POOLS */
 
     /* Slab layer */
@@ -187,6 +232,8 @@ struct kmem_cache {
     char name[KMEM_CACHE_NAME_SIZE];
     size_t buftag_dist; /* Distance from buffer to buftag */
     size_t redzone_pad; /* Bytes from end of object to redzone word */
+    kmem_cache_reclaim_t reclaim;
+    long_natural_t nr_reclaimed_pages;  /* Pages released under pressure */
 } __cacheline_aligned;
 
 /*
@@ -201,6 +248,7 @@ typedef struct kmem_cache *kmem_cache_t;
 #define KMEM_CACHE_NOOFFSLAB    0x1 /* Don't allocate external slab data */
 #define KMEM_CACHE_PHYSMEM      0x2 /* Allocate from physical memory */
 #define KMEM_CACHE_VERIFY       0x4 /* Use debugging facilities */
+#define KMEM_CACHE_NOCPUPOOL    0x8 /* Don't use the CPU pool layer */
 
 /*
  * Initialize a cache.
@@ -209,6 +257,12 @@ void kmem_cache_init(struct kmem_cache *cache, const char *name,
                      size_t obj_size, size_t align,
                      kmem_cache_ctor_t ctor, int flags);
 
+/*
+ * Set the function called before the free slabs of a cache are reclaimed.
+ */
+void kmem_cache_set_reclaim(struct kmem_cache *cache,
+                            kmem_cache_reclaim_t reclaim);
+
 /*
  * Allocate an object from a cache.
  */
@@ -230,6 +284,15 @@ void slab_init(void);
  */
 void slab_collect(void);
 
+/*
+ * Try to release nr_pages pages to the VM system.
+ *
+ * Reclaim functions are called first, then free slabs are taken from
+ * all caches, each contributing in proportion to the memory held in its
+ * free slabs. Return the number of pages actually released.
+ */
+unsigned long slab_reclaim(unsigned long nr_pages);
+
 /*
  * Display a summary of all kernel caches.
  */
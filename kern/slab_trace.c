@@ -0,0 +1,515 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <kern/slab_trace.h>
+
+#if MACH_SLAB_TRACE
+
+#include <kern/cpu_number.h>
+#include <kern/host.h>
+#include <kern/lock.h>
+#include <kern/mach_debug.server.h>
+#include <kern/stat_table.h>
+#include <machine/machspl.h>
+#include <machine/vm_param.h>
+#include <vm/vm_kern.h>
+#include <vm/vm_map.h>
+
+#if MACH_KDB
+#include <ddb/db_output.h>
+#include <ddb/db_sym.h>
+#endif /* MACH_KDB */
+
+/*
+ * Allocation sites are kept in a statistics table, so that traced buffers
+ * can point to the site they were allocated from.
+ */
+#define SLAB_TRACE_NSITES 1024
+
+/*
+ * Traced buffers are taken from a fixed pool, and hashed by address in
+ * buckets with their own lock. Allocations sampled while the pool is
+ * exhausted are only counted.
+ */
+#define SLAB_TRACE_NBUFS    16384
+#define SLAB_TRACE_NBUCKETS 4096
+
+struct slab_trace_site {
+    vm_offset_t callers[SLAB_TRACE_DEPTH];
+    struct kmem_cache *cache;
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long live;
+    unsigned long live_bytes;
+};
+
+struct slab_trace_key {
+    struct kmem_cache *cache;
+    const vm_offset_t *callers;
+};
+
+struct slab_trace_buf {
+    struct slab_trace_buf *next;
+    vm_offset_t addr;
+    vm_size_t size;
+    struct slab_trace_site *site;
+};
+
+struct slab_trace_bucket {
+    simple_lock_data_t lock;
+    struct slab_trace_buf *bufs;
+};
+
+unsigned int slab_trace_rate;
+unsigned int slab_trace_nr_live;
+
+static unsigned int slab_trace_flags;
+static unsigned int slab_trace_countdown[NCPUS];
+static unsigned long slab_trace_dropped;
+
+static struct slab_trace_site slab_trace_sites[SLAB_TRACE_NSITES];
+static struct slab_trace_site slab_trace_overflow;
+static unsigned char slab_trace_sites_used[SLAB_TRACE_NSITES];
+static struct stat_table slab_trace_table
+    = STAT_TABLE_INITIALIZER(slab_trace_sites_used);
+
+static struct slab_trace_buf slab_trace_bufs[SLAB_TRACE_NBUFS];
+static struct slab_trace_buf *slab_trace_free_bufs;
+def_simple_lock_data(static, slab_trace_bufs_lock)
+
+static struct slab_trace_bucket slab_trace_buckets[SLAB_TRACE_NBUCKETS];
+
+void slab_trace_init(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < SLAB_TRACE_NBUCKETS; i++) {
+        simple_lock_init(&slab_trace_buckets[i].lock);
+        slab_trace_buckets[i].bufs = NULL;
+    }
+
+    slab_trace_free_bufs = NULL;
+
+    for (i = 0; i < SLAB_TRACE_NBUFS; i++) {
+        slab_trace_bufs[i].next = slab_trace_free_bufs;
+        slab_trace_free_bufs = &slab_trace_bufs[i];
+    }
+}
+
+static inline struct slab_trace_bucket * slab_trace_bucket(vm_offset_t addr)
+{
+    unsigned long h;
+
+    h = (addr >> 3) * 0x9e3779b1UL;
+    return &slab_trace_buckets[(h >> 12) & (SLAB_TRACE_NBUCKETS - 1)];
+}
+
+static unsigned long slab_trace_site_hash(const struct slab_trace_key *key)
+{
+    unsigned long h;
+    unsigned int i;
+
+    h = (unsigned long)key->cache;
+
+    for (i = 0; i < SLAB_TRACE_DEPTH; i++)
+        h = (h ^ key->callers[i]) * 0x9e3779b1UL;
+
+    return h >> 12;
+}
+
+static int slab_trace_site_match(unsigned int slot, const void *arg)
+{
+    const struct slab_trace_key *key = arg;
+    const struct slab_trace_site *site = &slab_trace_sites[slot];
+
+    return (site->cache == key->cache)
+           && (memcmp(site->callers, key->callers,
+                      sizeof(site->callers)) == 0);
+}
+
+static void slab_trace_site_fill(unsigned int slot, const void *arg)
+{
+    const struct slab_trace_key *key = arg;
+    struct slab_trace_site *site = &slab_trace_sites[slot];
+
+    site->cache = key->cache;
+    memcpy(site->callers, key->callers, sizeof(site->callers));
+}
+
+static struct slab_trace_site * slab_trace_site_lookup(
+    struct kmem_cache *cache,
+    const vm_offset_t *callers)
+{
+    struct slab_trace_key key;
+    int slot;
+
+    key.cache = cache;
+    key.callers = callers;
+    slot = stat_table_lookup(&slab_trace_table, slab_trace_site_hash(&key),
+                             slab_trace_site_match, slab_trace_site_fill,
+                             &key);
+    return (slot < 0) ? &slab_trace_overflow : &slab_trace_sites[slot];
+}
+
+/*
+ * Find the callers of the allocator entry point whose frame is given.
+ * Frames are followed by their saved frame pointers, as long as they
+ * remain on the same kernel stack.
+ */
+static void slab_trace_callers(void *frame, vm_offset_t *callers)
+{
+    vm_offset_t *fp, *next;
+    unsigned int i;
+
+    memset(callers, 0, sizeof(*callers) * SLAB_TRACE_DEPTH);
+    fp = frame;
+    callers[0] = fp[1];
+
+    if (!(slab_trace_flags & SLAB_TRACE_STACK))
+        return;
+
+    for (i = 1; i < SLAB_TRACE_DEPTH; i++) {
+        next = (vm_offset_t *)fp[0];
+
+        if ((next <= fp)
+            || (((vm_offset_t)next ^ (vm_offset_t)fp) >= KERNEL_STACK_SIZE))
+            break;
+
+        fp = next;
+        callers[i] = fp[1];
+    }
+}
+
+void slab_trace_sample(struct kmem_cache *cache, vm_offset_t addr,
+                       vm_size_t size, void *frame)
+{
+    vm_offset_t callers[SLAB_TRACE_DEPTH];
+    struct slab_trace_bucket *bucket;
+    struct slab_trace_site *site;
+    struct slab_trace_buf *buf;
+    unsigned int *countdown;
+    spl_t s;
+
+    s = splhigh();
+
+    countdown = &slab_trace_countdown[cpu_number()];
+
+    if (*countdown > 1) {
+        (*countdown)--;
+        splx(s);
+        return;
+    }
+
+    *countdown = slab_trace_rate;
+
+    simple_lock(&slab_trace_bufs_lock);
+    buf = slab_trace_free_bufs;
+
+    if (buf != NULL)
+        slab_trace_free_bufs = buf->next;
+
+    simple_unlock(&slab_trace_bufs_lock);
+
+    if (buf == NULL) {
+        __atomic_add_fetch(&slab_trace_dropped, 1, __ATOMIC_RELAXED);
+        splx(s);
+        return;
+    }
+
+    slab_trace_callers(frame, callers);
+    site = slab_trace_site_lookup(cache, callers);
+    __atomic_add_fetch(&site->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&site->live, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&site->live_bytes, size, __ATOMIC_RELAXED);
+
+    buf->addr = addr;
+    buf->size = size;
+    buf->site = site;
+
+    bucket = slab_trace_bucket(addr);
+    simple_lock(&bucket->lock);
+    buf->next = bucket->bufs;
+    bucket->bufs = buf;
+    simple_unlock(&bucket->lock);
+
+    __atomic_add_fetch(&slab_trace_nr_live, 1, __ATOMIC_RELAXED);
+    splx(s);
+}
+
+void slab_trace_forget(vm_offset_t addr)
+{
+    struct slab_trace_bucket *bucket;
+    struct slab_trace_buf *buf, **prevp;
+    struct slab_trace_site *site;
+    spl_t s;
+
+    bucket = slab_trace_bucket(addr);
+
+    s = splhigh();
+    simple_lock(&bucket->lock);
+
+    for (prevp = &bucket->bufs; (buf = *prevp) != NULL; prevp = &buf->next)
+        if (buf->addr == addr) {
+            *prevp = buf->next;
+            break;
+        }
+
+    simple_unlock(&bucket->lock);
+
+    if (buf == NULL) {
+        splx(s);
+        return;
+    }
+
+    site = buf->site;
+    __atomic_add_fetch(&site->frees, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&site->live, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&site->live_bytes, buf->size, __ATOMIC_RELAXED);
+
+    simple_lock(&slab_trace_bufs_lock);
+    buf->next = slab_trace_free_bufs;
+    slab_trace_free_bufs = buf;
+    simple_unlock(&slab_trace_bufs_lock);
+
+    __atomic_sub_fetch(&slab_trace_nr_live, 1, __ATOMIC_RELAXED);
+    splx(s);
+}
+
+/*
+ * Live counts are left alone, since they describe buffers that still
+ * exist.
+ */
+static void slab_trace_clear(void)
+{
+    struct slab_trace_site *site;
+    unsigned int i;
+
+    for (i = 0; i <= SLAB_TRACE_NSITES; i++) {
+        site = (i < SLAB_TRACE_NSITES) ? &slab_trace_sites[i]
+                                       : &slab_trace_overflow;
+        site->allocs = 0;
+        site->frees = 0;
+    }
+
+    slab_trace_dropped = 0;
+}
+
+static void slab_trace_copy(slab_trace_info_t *info,
+                            const struct slab_trace_site *site)
+{
+    unsigned int i;
+
+    for (i = 0; i < SLAB_TRACE_DEPTH; i++)
+        info->sti_callers[i] = site->callers[i];
+
+    info->sti_live_bytes = site->live_bytes;
+    info->sti_live = site->live;
+    info->sti_allocs = site->allocs;
+    info->sti_frees = site->frees;
+
+    if (site->cache == NULL)
+        strncpy(info->sti_cache, "kalloc", sizeof(info->sti_cache));
+    else
+        strncpy(info->sti_cache, site->cache->name, sizeof(info->sti_cache));
+
+    info->sti_cache[sizeof(info->sti_cache) - 1] = '\0';
+}
+
+/*
+ * Return the statistics of every allocation site seen so far, followed
+ * by the overflow site, if used, with null callers. The counters are
+ * read without synchronization.
+ */
+kern_return_t host_slab_trace_info(const host_t host,
+                                   slab_trace_info_array_t *infop,
+                                   natural_t *infoCntp)
+{
+    slab_trace_info_t *info;
+    vm_offset_t addr;
+    vm_size_t size, used;
+    vm_map_copy_t copy;
+    kern_return_t kr;
+    unsigned int i, n, max;
+
+    if (host == HOST_NULL)
+        return KERN_INVALID_HOST;
+
+    max = stat_table_nr_used(&slab_trace_table) + 1;
+    size = max * sizeof(*info);
+
+    if (*infoCntp >= max) {
+        info = *infop;
+        addr = 0;
+    } else {
+        kr = kmem_alloc_pageable(ipc_kernel_map, &addr, round_page(size));
+
+        if (kr != KERN_SUCCESS)
+            return kr;
+
+        info = (slab_trace_info_t *)addr;
+        memset(info, 0, round_page(size));
+    }
+
+    n = 0;
+
+    for (i = 0; (i < SLAB_TRACE_NSITES) && (n < max); i++)
+        if (stat_table_used(&slab_trace_table, i))
+            slab_trace_copy(&info[n++], &slab_trace_sites[i]);
+
+    if ((n < max) && ((slab_trace_overflow.allocs != 0)
+                      || (slab_trace_overflow.live != 0)))
+        slab_trace_copy(&info[n++], &slab_trace_overflow);
+
+    if (addr != 0) {
+        used = round_page(n * sizeof(*info));
+
+        if (used < round_page(size))
+            kmem_free(ipc_kernel_map, addr + used, round_page(size) - used);
+
+        if (n == 0)
+            *infop = NULL;
+        else {
+            kr = vm_map_copyin(ipc_kernel_map, addr, n * sizeof(*info),
+                               TRUE, &copy);
+            assert(kr == KERN_SUCCESS);
+            *infop = (slab_trace_info_t *)copy;
+        }
+    }
+
+    *infoCntp = n;
+    return KERN_SUCCESS;
+}
+
+/*
+ * Set the sampling rate, zero to stop tracing new allocations. Buffers
+ * already traced are still accounted for when released.
+ */
+kern_return_t host_slab_trace_control(const host_t host, int rate, int flags)
+{
+    unsigned int i;
+
+    if (host == HOST_NULL)
+        return KERN_INVALID_HOST;
+
+    if (rate < 0)
+        return KERN_INVALID_ARGUMENT;
+
+    if (flags & SLAB_TRACE_CLEAR)
+        slab_trace_clear();
+
+    slab_trace_flags = flags & SLAB_TRACE_STACK;
+
+    for (i = 0; i < NCPUS; i++)
+        slab_trace_countdown[i] = 0;
+
+    __atomic_store_n(&slab_trace_rate, rate, __ATOMIC_RELEASE);
+    return KERN_SUCCESS;
+}
+
+#if MACH_KDB
+
+static void db_print_slab_trace_site(const struct slab_trace_site *site)
+{
+    unsigned int i;
+
+    db_printf("%-20s %6lu %8lu %8lu %8lu ",
+              (site->cache == NULL) ? "kalloc" : site->cache->name,
+              site->live, site->live_bytes, site->allocs, site->frees);
+
+    for (i = 0; (i < SLAB_TRACE_DEPTH) && (site->callers[i] != 0); i++) {
+        if (i != 0)
+            db_printf(" < ");
+
+        db_printsym((db_addr_t)site->callers[i], DB_STGY_PROC);
+    }
+
+    db_printf("\n");
+}
+
+/*
+ * Print the sites with the most live bytes. Sites are ordered by live
+ * bytes, then by slot, so that sites with the same number of live bytes
+ * are all printed.
+ */
+void db_show_slab_trace(void)
+{
+    struct slab_trace_site *site;
+    unsigned long limit, bytes;
+    unsigned int i, count, last, top;
+
+    db_printf("cache                  live    bytes   allocs    frees callers\n");
+
+    limit = (unsigned long)-1;
+    last = SLAB_TRACE_NSITES;
+
+    for (count = 0; count < 16; count++) {
+        top = SLAB_TRACE_NSITES;
+
+        for (i = 0; i < SLAB_TRACE_NSITES; i++) {
+            if (!stat_table_used(&slab_trace_table, i))
+                continue;
+
+            bytes = slab_trace_sites[i].live_bytes;
+
+            if ((bytes > limit) || ((bytes == limit) && (i <= last)))
+                continue;
+
+            if ((top == SLAB_TRACE_NSITES)
+                || (bytes > slab_trace_sites[top].live_bytes))
+                top = i;
+        }
+
+        if (top == SLAB_TRACE_NSITES)
+            break;
+
+        site = &slab_trace_sites[top];
+
+        if (site->live_bytes == 0)
+            break;
+
+        limit = site->live_bytes;
+        last = top;
+        db_print_slab_trace_site(site);
+    }
+
+    db_printf("%u sites, %u live buffers, %lu dropped, sampling 1/%u\n",
+              stat_table_nr_used(&slab_trace_table), slab_trace_nr_live,
+              slab_trace_dropped, slab_trace_rate);
+}
+
+/*
+ * Print where the traced buffer containing an address was allocated.
+ */
+void db_whatis_slab_trace(vm_offset_t addr)
+{
+    struct slab_trace_buf *buf;
+    unsigned int i;
+
+    for (i = 0; i < SLAB_TRACE_NBUCKETS; i++)
+        for (buf = slab_trace_buckets[i].bufs; buf != NULL; buf = buf->next)
+            if ((addr >= buf->addr) && (addr < buf->addr + buf->size)) {
+                db_printf("Traced buffer %p, %lu bytes, allocated by\n",
+                          (void *)buf->addr, (unsigned long)buf->size);
+                db_print_slab_trace_site(buf->site);
+                return;
+            }
+}
+
+#endif /* MACH_KDB */
+
+#endif /* MACH_SLAB_TRACE */
@@ -0,0 +1,88 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Allocation tracing: record the call site of sampled slab and kalloc
+ * allocations in a table keyed by buffer address, and aggregate the
+ * number and size of live buffers per call site. Sampling is turned on
+ * and off at run time with host_slab_trace_control.
+ *
+ * All hooks compile to nothing unless MACH_SLAB_TRACE is set.
+ */
+
+#ifndef _KERN_SLAB_TRACE_H
+#define _KERN_SLAB_TRACE_H
+
+#include <kern/slab.h>
+
+#if MACH_SLAB_TRACE
+
+#include <mach_debug/slab_trace_info.h>
+
+/*
+ * One allocation in slab_trace_rate is traced, none if zero.
+ */
+extern unsigned int slab_trace_rate;
+
+/*
+ * Number of traced buffers not released yet.
+ */
+extern unsigned int slab_trace_nr_live;
+
+void slab_trace_init(void);
+
+/*
+ * Account for an allocation. The frame is the one of the allocator entry
+ * point, from which callers are found. The cache is NULL for allocations
+ * made directly from the VM system.
+ */
+void slab_trace_sample(struct kmem_cache *cache, vm_offset_t addr,
+                       vm_size_t size, void *frame);
+
+/*
+ * Forget a buffer about to be released, if it was traced.
+ */
+void slab_trace_forget(vm_offset_t addr);
+
+static inline void slab_trace_alloc(struct kmem_cache *cache,
+                                    vm_offset_t addr, vm_size_t size,
+                                    void *frame)
+{
+    if (__builtin_expect(slab_trace_rate != 0, 0))
+        slab_trace_sample(cache, addr, size, frame);
+}
+
+static inline void slab_trace_free(vm_offset_t addr)
+{
+    if (__builtin_expect(slab_trace_nr_live != 0, 0))
+        slab_trace_forget(addr);
+}
+
+#if MACH_KDB
+void db_show_slab_trace(void);
+void db_whatis_slab_trace(vm_offset_t addr);
+#endif /* MACH_KDB */
+
+#else /* MACH_SLAB_TRACE */
+
+#define slab_trace_init()
+#define slab_trace_alloc(cache, addr, size, frame)
+#define slab_trace_free(addr)
+
+#endif /* MACH_SLAB_TRACE */
+
+#endif /* _KERN_SLAB_TRACE_H */
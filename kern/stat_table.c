@@ -0,0 +1,62 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include <kern/stat_table.h>
+#include <machine/machspl.h>
+#include <machine/smp.h>
+
+int stat_table_insert(struct stat_table *table, unsigned long hash,
+                      stat_table_match_fn_t match, stat_table_fill_fn_t fill,
+                      const void *key)
+{
+    unsigned int slot;
+    int result;
+    spl_t s;
+
+    s = splhigh();
+
+    while (__atomic_exchange_n(&table->busy, 1, __ATOMIC_ACQUIRE))
+        cpu_pause();
+
+    result = -1;
+
+    if (table->nr_used < table->size / 4 * 3) {
+        slot = hash & (table->size - 1);
+
+        for (;;) {
+            if (!table->used[slot]) {
+                fill(slot, key);
+                __atomic_store_n(&table->used[slot], 1, __ATOMIC_RELEASE);
+                __atomic_store_n(&table->nr_used, table->nr_used + 1,
+                                 __ATOMIC_RELEASE);
+                result = slot;
+                break;
+            }
+
+            if (match(slot, key)) {
+                result = slot;
+                break;
+            }
+
+            slot = (slot + 1) & (table->size - 1);
+        }
+    }
+
+    __atomic_store_n(&table->busy, 0, __ATOMIC_RELEASE);
+    splx(s);
+    return result;
+}
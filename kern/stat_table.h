@@ -0,0 +1,98 @@
+/* Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either
+   version 2 of the license, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Insert-only hash tables of statistics records.
+ *
+ * A table is a fixed, open addressed array of slots, whose records live
+ * in an array of the same size owned by the user. Records are never
+ * removed, so that users can keep pointers to them. Lookups run without
+ * locking; insertions are serialized, and publish a slot by marking it
+ * used once its record is filled. Once the table is three quarters full,
+ * new keys are no longer inserted, and users account for them in an
+ * overflow record of their own.
+ *
+ * Insertions do not take simple locks, so that the lock monitor can use
+ * a table to account for them.
+ */
+
+#ifndef _KERN_STAT_TABLE_H
+#define _KERN_STAT_TABLE_H
+
+#include <kern/macros.h>
+
+struct stat_table {
+    unsigned char *used;
+    unsigned int size;
+    unsigned int nr_used;
+    unsigned int busy;
+};
+
+/*
+ * Initialize a table using the given array of slot markers, whose
+ * size must be a power of two.
+ */
+#define STAT_TABLE_INITIALIZER(used) { (used), ARRAY_SIZE(used), 0, 0 }
+
+/*
+ * Compare the record of a used slot with a key, or fill the record of a
+ * free slot from a key.
+ */
+typedef int (*stat_table_match_fn_t)(unsigned int slot, const void *key);
+typedef void (*stat_table_fill_fn_t)(unsigned int slot, const void *key);
+
+int stat_table_insert(struct stat_table *table, unsigned long hash,
+                      stat_table_match_fn_t match, stat_table_fill_fn_t fill,
+                      const void *key);
+
+static inline int stat_table_used(const struct stat_table *table,
+                                  unsigned int slot)
+{
+    return __atomic_load_n(&table->used[slot], __ATOMIC_ACQUIRE);
+}
+
+static inline unsigned int stat_table_nr_used(const struct stat_table *table)
+{
+    return __atomic_load_n(&table->nr_used, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Return the slot of the record matching a key, inserting it if needed,
+ * or -1 if the table is full.
+ */
+static inline int stat_table_lookup(struct stat_table *table,
+                                    unsigned long hash,
+                                    stat_table_match_fn_t match,
+                                    stat_table_fill_fn_t fill,
+                                    const void *key)
+{
+    unsigned int slot;
+
+    slot = hash & (table->size - 1);
+
+    for (;;) {
+        if (!stat_table_used(table, slot))
+            return stat_table_insert(table, hash, match, fill, key);
+
+        if (match(slot, key))
+            return slot;
+
+        slot = (slot + 1) & (table->size - 1);
+    }
+}
+
+#endif /* _KERN_STAT_TABLE_H */
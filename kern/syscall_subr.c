@@ -38,6 +38,7 @@
 #include <kern/processor.h>
 #include <kern/sched.h>
 #include <kern/sched_prim.h>
+#include <kern/sched_stats.h>
 #include <kern/syscall_subr.h>
 #include <kern/ipc_sched.h>
 #include <kern/task.h>
@@ -83,6 +84,7 @@ boolean_t swtch(void)
 #endif	/* NCPUS > 1 */
 
 	counter(c_swtch_block++);
+	sched_stats_hint(SCHED_STATS_YIELD);
 	thread_block(swtch_continue);
 	myprocessor = current_processor();
 	return(myprocessor->runq.count > 0 ||
@@ -121,6 +123,7 @@ boolean_t  swtch_pri(int pri)
 	thread_depress_priority(thread, min_quantum);
 
 	counter(c_swtch_pri_block++);
+	sched_stats_hint(SCHED_STATS_YIELD);
 	thread_block(swtch_pri_continue);
 
 	if (thread->depress_priority >= 0)
@@ -257,6 +260,7 @@ kern_return_t thread_switch(
 #endif	/* NCPUS > 1 */
     {
 	counter(c_thread_switch_block++);
+	sched_stats_hint(SCHED_STATS_YIELD);
 	thread_block(thread_switch_continue);
     }
 
@@ -116,7 +116,7 @@ mach_trap_t	mach_trap_table[] = {
 	MACH_TRAP(kern_invalid, 0),		/* 35 */
 	MACH_TRAP(kern_invalid, 0),		/* 36 */
 	MACH_TRAP(kern_invalid, 0),		/* 37 */
-	MACH_TRAP(kern_invalid, 0),		/* 38 */
+ 	MACH_TRAP(syscall_device_readv_request, 7),	/* 38 */
 
  	MACH_TRAP(syscall_device_writev_request, 6),	/* 39 */
  	MACH_TRAP(syscall_device_write_request, 6),	/* 40 */
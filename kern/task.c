@@ -1199,14 +1199,14 @@ static void task_collect_scan(void)
 	prev_task = TASK_NULL;
 	prev_pset = PROCESSOR_SET_NULL;
 
-	simple_lock(&all_psets_lock);
+	lock_read(&all_psets_lock);
 	queue_iterate(&all_psets, pset, processor_set_t, all_psets) {
 		pset_lock(pset);
 		queue_iterate(&pset->tasks, task, task_t, pset_tasks) {
 			task_reference(task);
 			pset_reference(pset);
 			pset_unlock(pset);
-			simple_unlock(&all_psets_lock);
+			lock_read_done(&all_psets_lock);
 
 			machine_task_collect (task);
 			pmap_collect(task->map->pmap);
@@ -1219,12 +1219,12 @@ static void task_collect_scan(void)
 				pset_deallocate(prev_pset);
 			prev_pset = pset;
 
-			simple_lock(&all_psets_lock);
+			lock_read(&all_psets_lock);
 			pset_lock(pset);
 		}
 		pset_unlock(pset);
 	}
-	simple_unlock(&all_psets_lock);
+	lock_read_done(&all_psets_lock);
 
 	if (prev_task != TASK_NULL)
 		task_deallocate(prev_task);
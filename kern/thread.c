@@ -305,6 +305,7 @@ void thread_init(void)
 	kmem_cache_init(&thread_stack_cache, "thread_stack",
 			KERNEL_STACK_SIZE, KERNEL_STACK_SIZE,
 			NULL, 0);
+	kmem_cache_set_reclaim(&thread_stack_cache, stack_collect);
 
 	/*
 	 *	Fill in a template thread for fast initialization.
@@ -342,9 +343,14 @@ void thread_init(void)
 	thread_template.policy = POLICY_TIMESHARE;
 #endif	/* MACH_FIXPRI */
 	thread_template.depress_priority = -1;
+	thread_template.pi_priority = NRQS;
 	thread_template.cpu_usage = 0;
 	thread_template.sched_usage = 0;
 	/* thread_template.sched_stamp (later) */
+#if	MACH_SCHED_STATS
+	thread_template.runq_stamp = 0;
+	thread_template.runq_stamp_cpu = 0;
+#endif	/* MACH_SCHED_STATS */
 
 	thread_template.recover = (vm_offset_t) 0;
 	thread_template.vm_privilege = 0;
@@ -429,6 +435,7 @@ kern_return_t thread_create(
 
 	new_thread->task = parent_task;
 	simple_lock_init(&new_thread->lock);
+	queue_init(&new_thread->pi_mutexes);
 	new_thread->sched_stamp = sched_tick;
 	thread_timeout_setup(new_thread);
 
@@ -671,6 +678,9 @@ void thread_deallocate(
 
 	reset_timeout_check(&thread->depress_timer);
 	thread->depress_priority = -1;
+#if	MACH_FIXPRI
+	reset_timeout_check(&thread->dl_timer);
+#endif	/* MACH_FIXPRI */
 
 	/*
 	 *	Accumulate times for dead threads in task.
@@ -1644,6 +1654,38 @@ kern_return_t thread_info(
 	    *thread_info_count = THREAD_SCHED_INFO_COUNT;
 	    return KERN_SUCCESS;
 	}
+#if	MACH_FIXPRI
+	else if (flavor == THREAD_DEADLINE_INFO) {
+	    thread_deadline_info_t	dl_info;
+
+	    if (*thread_info_count < THREAD_DEADLINE_INFO_COUNT)
+		    return KERN_INVALID_ARGUMENT;
+
+	    dl_info = (thread_deadline_info_t) thread_info_out;
+
+	    s = splsched();
+	    thread_lock(thread);
+
+	    if (thread->policy != POLICY_DEADLINE) {
+		thread_unlock(thread);
+		splx(s);
+		return KERN_FAILURE;
+	    }
+
+	    dl_info->runtime = thread->dl_runtime * tick;
+	    dl_info->period = thread->dl_period * tick;
+	    dl_info->deadline = thread->dl_deadline * tick;
+	    dl_info->budget = thread->dl_budget * tick;
+	    dl_info->periods = thread->dl_periods;
+	    dl_info->misses = thread->dl_misses;
+
+	    thread_unlock(thread);
+	    splx(s);
+
+	    *thread_info_count = THREAD_DEADLINE_INFO_COUNT;
+	    return KERN_SUCCESS;
+	}
+#endif	/* MACH_FIXPRI */
 
 	return KERN_INVALID_ARGUMENT;
 }
@@ -1930,6 +1972,21 @@ Restart:
 	 *	Reset policy and priorities if needed.
 	 */
 #if	MACH_FIXPRI
+	if (thread->policy == POLICY_DEADLINE) {
+	    /*
+	     *	Move the reservation; fall back to timesharing
+	     *	if the new pset cannot admit it.
+	     */
+	    pset_deadline_release(pset, thread->dl_util);
+	    if ((new_pset->policies & POLICY_DEADLINE) == 0 ||
+		!pset_deadline_admit(new_pset, thread->dl_util, 0)) {
+		thread->policy = POLICY_TIMESHARE;
+		thread->sched_data = 0;
+		reset_timeout_check(&thread->dl_timer);
+		thread->dl_throttled = FALSE;
+		recompute_pri = TRUE;
+	    }
+	}
 	if ((thread->policy & new_pset->policies) == 0) {
 	    thread->policy = POLICY_TIMESHARE;
 	    recompute_pri = TRUE;
@@ -2178,6 +2235,12 @@ thread_policy(
 	if ((thread == THREAD_NULL) || invalid_policy(policy))
 		return KERN_INVALID_ARGUMENT;
 
+	/*
+	 *	POLICY_DEADLINE needs parameters; see thread_set_policy.
+	 */
+	if (policy == POLICY_DEADLINE)
+		return KERN_INVALID_ARGUMENT;
+
 #if	MACH_FIXPRI
 	s = splsched();
 	thread_lock(thread);
@@ -2209,6 +2272,12 @@ thread_policy(
 		 *	Changing policy.  Save data and calculate new
 		 *	priority.
 		 */
+		if (thread->policy == POLICY_DEADLINE) {
+			pset_deadline_release(thread->processor_set,
+					      thread->dl_util);
+			reset_timeout_check(&thread->dl_timer);
+			thread->dl_throttled = FALSE;
+		}
 		thread->policy = policy;
 		if (policy == POLICY_FIXEDPRI) {
 			temp = data * 1000;
@@ -2231,6 +2300,97 @@ thread_policy(
 #endif	/* MACH_FIXPRI */
 }
 
+#if	MACH_FIXPRI
+/*
+ *	Convert microseconds to ticks, rounding up.
+ */
+#define usec_to_ticks(usec)	((usec) / tick + ((usec) % tick != 0))
+#endif	/* MACH_FIXPRI */
+
+/*
+ *	thread_set_policy:
+ *
+ *	Set scheduling policy for thread, with policy specific
+ *	parameters.  POLICY_DEADLINE takes a policy_deadline_param
+ *	and is admitted only if the processor set can still meet the
+ *	deadlines of all its deadline threads.  Other policies take
+ *	the single datum of thread_policy.
+ */
+kern_return_t
+thread_set_policy(
+	thread_t	thread,
+	int		policy,
+	policy_param_t	param,
+	natural_t	count)
+{
+#if	MACH_FIXPRI
+	policy_deadline_param_t	dl;
+	processor_set_t	pset;
+	int		runtime, period, deadline, util;
+	kern_return_t	ret = KERN_SUCCESS;
+	spl_t		s;
+#endif	/* MACH_FIXPRI */
+
+	if ((thread == THREAD_NULL) || invalid_policy(policy))
+		return KERN_INVALID_ARGUMENT;
+
+	if (policy != POLICY_DEADLINE)
+		return thread_policy(thread, policy, count > 0 ? param[0] : 0);
+
+#if	MACH_FIXPRI
+	if (count < POLICY_DEADLINE_PARAM_COUNT)
+		return KERN_INVALID_ARGUMENT;
+
+	dl = (policy_deadline_param_t) param;
+	if ((dl->runtime <= 0) || (dl->runtime > dl->deadline) ||
+	    (dl->deadline > dl->period))
+		return KERN_INVALID_ARGUMENT;
+
+	/*
+	 *	Scheduling is tick based, so round everything up to
+	 *	ticks; the utilization is what admission control sees.
+	 */
+	runtime = usec_to_ticks(dl->runtime);
+	deadline = usec_to_ticks(dl->deadline);
+	period = usec_to_ticks(dl->period);
+	util = ((unsigned long long) runtime * DEADLINE_UTIL_SCALE +
+		period - 1) / period;
+
+	s = splsched();
+	thread_lock(thread);
+
+	pset = thread->processor_set;
+	if ((pset->policies & POLICY_DEADLINE) == 0)
+		ret = KERN_FAILURE;
+	else if (!pset_deadline_admit(pset, util,
+			(thread->policy == POLICY_DEADLINE) ?
+			thread->dl_util : 0))
+		ret = KERN_RESOURCE_SHORTAGE;
+	else {
+		thread->dl_runtime = runtime;
+		thread->dl_period = period;
+		thread->dl_deadline = deadline;
+		thread->dl_util = util;
+		thread->dl_budget = runtime;
+		thread->dl_abs_deadline = elapsed_ticks + deadline;
+		thread->dl_periods = 1;
+		thread->dl_misses = 0;
+		reset_timeout_check(&thread->dl_timer);
+		thread->dl_throttled = FALSE;
+		thread->sched_data = runtime;
+		thread->policy = POLICY_DEADLINE;
+		compute_priority(thread, TRUE);
+	}
+
+	thread_unlock(thread);
+	(void) splx(s);
+
+	return ret;
+#else	/* MACH_FIXPRI */
+	return KERN_FAILURE;
+#endif	/* MACH_FIXPRI */
+}
+
 /*
  *	thread_wire:
  *
@@ -2292,7 +2452,7 @@ static void thread_collect_scan(void)
 	prev_thread = THREAD_NULL;
 	prev_pset = PROCESSOR_SET_NULL;
 
-	simple_lock(&all_psets_lock);
+	lock_read(&all_psets_lock);
 	queue_iterate(&all_psets, pset, processor_set_t, all_psets) {
 		pset_lock(pset);
 		queue_iterate(&pset->threads, thread, thread_t, pset_threads) {
@@ -2311,7 +2471,7 @@ static void thread_collect_scan(void)
 				(void) splx(s);
 				pset->ref_count++;
 				pset_unlock(pset);
-				simple_unlock(&all_psets_lock);
+				lock_read_done(&all_psets_lock);
 
 				pcb_collect(thread);
 
@@ -2323,7 +2483,7 @@ static void thread_collect_scan(void)
 					pset_deallocate(prev_pset);
 				prev_pset = pset;
 
-				simple_lock(&all_psets_lock);
+				lock_read(&all_psets_lock);
 				pset_lock(pset);
 			} else {
 				thread_unlock(thread);
@@ -2332,7 +2492,7 @@ static void thread_collect_scan(void)
 		}
 		pset_unlock(pset);
 	}
-	simple_unlock(&all_psets_lock);
+	lock_read_done(&all_psets_lock);
 
 	if (prev_thread != THREAD_NULL)
 		thread_deallocate(prev_thread);
@@ -40,6 +40,7 @@
 #include <mach/machine/vm_types.h>
 #include <mach/message.h>
 #include <mach/port.h>
+#include <mach/policy.h>
 #include <mach/vm_prot.h>
 #include <kern/ast.h>
 #include <kern/mach_clock.h>
@@ -141,11 +142,28 @@ struct thread {
 #if	MACH_FIXPRI
 	int		sched_data;	/* for use by policy */
 	int		policy;		/* scheduling policy */
+	/* POLICY_DEADLINE parameters and state, in ticks */
+	int		dl_runtime;	/* processor time per period */
+	int		dl_period;
+	int		dl_deadline;	/* relative to period start */
+	int		dl_util;	/* admitted utilization */
+	int		dl_budget;	/* time left in current period */
+	unsigned long	dl_abs_deadline; /* absolute deadline */
+	unsigned int	dl_periods;	/* periods started */
+	unsigned int	dl_misses;	/* deadlines missed */
+	boolean_t	dl_throttled;	/* out of budget until next period */
+	timer_elt_data_t dl_timer;	/* starts the next period */
 #endif	/* MACH_FIXPRI */
 	int		depress_priority; /* depressed from this priority */
+	int		pi_priority;	/* inherited from gsync PI waiters */
+	queue_head_t	pi_mutexes;	/* gsync PI mutexes with waiters */
 	unsigned int	cpu_usage;	/* exp. decaying cpu usage [%cpu] */
 	unsigned int	sched_usage;	/* load-weighted cpu usage [sched] */
 	unsigned int	sched_stamp;	/* last time priority was updated */
+#if	MACH_SCHED_STATS
+	uint64_t	runq_stamp;	/* when thread became runnable */
+	int		runq_stamp_cpu;	/* processor runq_stamp comes from */
+#endif	/* MACH_SCHED_STATS */
 
 	/* VM global variables */
 
@@ -320,6 +338,11 @@ extern kern_return_t	thread_policy(
 	thread_t	thread,
 	int		policy,
 	int		data);
+extern kern_return_t	thread_set_policy(
+	thread_t	thread,
+	int		policy,
+	policy_param_t	param,
+	natural_t	count);
 extern void		consider_thread_collect(
 	void);
 extern void		stack_privilege(
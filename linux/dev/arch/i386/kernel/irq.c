@@ -139,6 +139,56 @@ linux_intr (int irq)
   intr_count--;
 }
 
+/*
+ * Run the Linux handlers of IRQ as if it had fired, for drivers
+ * polled while their interrupt is masked.  User handlers are only
+ * given real interrupts, so lines which have some are not polled.
+ */
+void
+linux_poll_irq (unsigned int irq)
+{
+  struct pt_regs regs;
+  struct linux_action *action;
+  unsigned long flags;
+
+  intr_count++;
+
+  save_flags (flags);
+  if (irq_action[irq] && (irq_action[irq]->flags & SA_INTERRUPT))
+    cli ();
+
+  for (action = irq_action[irq]; action; action = action->next)
+    if (!action->user_intr && action->handler)
+      action->handler (irq, action->dev_id, &regs);
+
+  restore_flags (flags);
+
+  intr_count--;
+}
+
+/*
+ * Return whether a user handler shares IRQ.
+ */
+int
+linux_irq_user_intr (unsigned int irq)
+{
+  struct linux_action *action;
+  unsigned long flags;
+  int found = 0;
+
+  save_flags (flags);
+  cli ();
+  for (action = irq_action[irq]; action; action = action->next)
+    if (action->user_intr)
+      {
+	found = 1;
+	break;
+      }
+  restore_flags (flags);
+
+  return found;
+}
+
 /* IRQ mask according to Linux drivers */
 static unsigned linux_pic_mask;
 
@@ -26,6 +26,7 @@
 #include <linux/major.h>
 #include <linux/hdreg.h>
 #include <linux/genhd.h>
+#include <linux/delay.h>
 #include <asm/io.h>
 
 #define MAJOR_NR SCSI_DISK_MAJOR
@@ -40,12 +41,28 @@
 #define PARTN_BITS 5
 #define PARTN_MASK ((1<<PARTN_BITS)-1)
 
-/* We need to use one DMA scatter element per physical page.
- * ll_rw_block creates at most 8 buffer heads */
-/* See MAX_BUF */
-#define PRDTL_SIZE 8
+/* One DMA scatter element per buffer head, which the block glue merges
+ * over physically contiguous pages.  This makes a command table exactly
+ * 1KiB, so that it never crosses a page of our vmalloc'ed memory */
+#define PRDTL_SIZE 56
+#define MAX_SECTORS 2048 /* 1MiB per request */
+#define MAX_SECTORS_LBA28 256
 
 #define WAIT_MAX (1*HZ) /* Wait at most 1s for requests completion */
+#define CMD_TIMEOUT (10*HZ) /* Reset the port if a command doesn't complete within 10s */
+#define MAX_RETRIES 3 /* Fail requests after this many errors */
+#define RESET_WAIT_MS 500 /* Wait at most 500ms for the port to stop */
+#define RESET_WAIT ((RESET_WAIT_MS * HZ + 999) / 1000 + 1) /* Same, in jiffies */
+
+/* NCQ commands, from ATA8-ACS */
+#define ATA_CMD_FPDMA_READ	0x60
+#define ATA_CMD_FPDMA_WRITE	0x61
+#define ATA_CMD_READ_LOG_EXT	0x2f
+
+/* NCQ Command Error log page, which tells the tag of the failed command */
+#define ATA_LOG_NCQ_ERROR	0x10
+#define ATA_LOG_NCQ_NQ		0x80	/* The error is not for an NCQ command */
+#define ATA_LOG_NCQ_TAG		0x1f
 
 /* AHCI standard structures */
 
@@ -243,25 +260,61 @@ static struct port {
 	unsigned is_cd;
 	unsigned long long capacity;	/* Nr of sectors */
 	u32 status;			/* interrupt status */
-	unsigned cls;			/* Command list maximum size.
-					   We currently only use 1. */
+	unsigned cls;			/* Command list maximum size */
+	unsigned depth;			/* Number of command slots we use */
+	unsigned ncq;			/* Whether we use NCQ commands */
 	struct wait_queue *q;		/* IRQ wait queue */
 	struct hd_struct *part;		/* drive partition table */
 	unsigned lba48;			/* Whether LBA48 is supported */
 	unsigned identify;		/* Whether we are just identifying
 					   at boot */
 	struct gendisk *gd;
+
+	/* Requests waiting for a command slot, linked by their next field */
+	struct request *queue_head;
+	struct request *queue_tail;
+
+	u32 busy;			/* Command slots in use */
+	struct request *slots[AHCI_MAX_CMDS];	/* Request of each slot */
+	unsigned long issued[AHCI_MAX_CMDS];	/* When each slot was issued */
+	struct timer_list timer;	/* Timeout of the oldest command, or
+					   next step of the recovery */
+	u8 *log;			/* NCQ Command Error log buffer */
+
+	/* Error recovery, see ahci_port_recover */
+	unsigned recovery;		/* Current step */
+	unsigned long deadline;		/* When the current step gives up */
+	unsigned reset;			/* Whether we reset the link */
+	u32 failed;			/* Command slots which failed */
+	u32 recovery_status;		/* Interrupt status seen meanwhile */
 } ports[MAX_PORTS];
 
+/* Steps of the error recovery */
+enum {
+	RECOVERY_NONE,		/* Not recovering */
+	RECOVERY_STOP,		/* Waiting for the command list to stop */
+	RECOVERY_COMRESET,	/* Sending COMRESET */
+	RECOVERY_LINK,		/* Waiting for the link to come back */
+	RECOVERY_READY,		/* Waiting for the device to be ready */
+	RECOVERY_CLO,		/* Waiting for the busy state to be cleared */
+	RECOVERY_NCQ_LOG,	/* Reading the NCQ Command Error log */
+};
 
-/* do_request() gets called by the block layer to push a request to the disk.
-   We just push one, and when an interrupt tells it's over, we call do_request()
-   ourself again to push the next request, etc. */
+
+/* do_request() gets called by the block layer to push requests to the disks.
+   We move them to the queue of their port, and issue as many of them as the
+   port has free command slots.  When an interrupt tells some are over, we
+   issue the next ones, etc. */
+
+/* Set while we complete requests: the block scheduler may then start the
+   next ones and call do_request, which must not run again in the middle of
+   ahci_start_port or of the interrupt handler.  Our callers look at CURRENT
+   once they are done instead. */
+static int ahci_completing;
 
 /* Request completed, either successfully or with an error */
-static void ahci_end_request(int uptodate)
+static void ahci_end_request(struct request *rq, int uptodate)
 {
-	struct request *rq = CURRENT;
 	struct buffer_head *bh;
 
 	rq->errors = 0;
@@ -280,32 +333,52 @@ static void ahci_end_request(int uptodate)
 		bh = next;
 	}
 
-	CURRENT = rq->next;
 	if (rq->sem != NULL)
 		up(rq->sem);
 	rq->rq_status = RQ_INACTIVE;
+	ahci_completing++;
+	blk_request_done(rq);
+	ahci_completing--;
 	wake_up(&wait_for_request);
 }
 
-/* Push the request to the controler port */
-static int ahci_do_port_request(struct port *port, unsigned long long sector, struct request *rq)
+/* Append the request to the queue of the port */
+static void ahci_queue_request(struct port *port, struct request *rq)
+{
+	rq->next = NULL;
+	if (port->queue_tail)
+		port->queue_tail->next = rq;
+	else
+		port->queue_head = rq;
+	port->queue_tail = rq;
+}
+
+/* Push the request to the given command slot of the controler port */
+static int ahci_do_port_request(struct port *port, unsigned slot, unsigned long long sector, struct request *rq)
 {
 	struct ahci_command *command = port->command;
 	struct ahci_cmd_tbl *prdtl = port->prdtl;
 	struct ahci_fis_h2d *fis_h2d;
-	unsigned slot = 0;
 	struct buffer_head *bh;
 	unsigned i;
 
-	rq->rq_status = RQ_SCSI_BUSY;
-
-	/* Shouldn't ever happen: the block glue is limited at 8 blocks */
-	assert(rq->nr_sectors < 0x10000);
+	/* Shouldn't ever happen: the block glue is limited at max_sectors */
+	assert(rq->nr_sectors <= MAX_SECTORS);
 
 	fis_h2d = (void*) &prdtl[slot].cfis;
+	memset(fis_h2d, 0, sizeof(*fis_h2d));
 	fis_h2d->fis_type = FIS_TYPE_REG_H2D;
 	fis_h2d->flags = 128;
-	if (port->lba48) {
+	if (port->ncq) {
+		if (sector >= 1ULL << 48) {
+			printk("sector %llu beyond LBA48\n", sector);
+			return -EOVERFLOW;
+		}
+		if (rq->cmd == READ)
+			fis_h2d->command = ATA_CMD_FPDMA_READ;
+		else
+			fis_h2d->command = ATA_CMD_FPDMA_WRITE;
+	} else if (port->lba48) {
 		if (sector >= 1ULL << 48) {
 			printk("sector %llu beyond LBA48\n", sector);
 			return -EOVERFLOW;
@@ -335,10 +408,19 @@ static int ahci_do_port_request(struct port *port, unsigned long long sector, st
 	fis_h2d->lba4 = sector >> 32;
 	fis_h2d->lba5 = sector >> 40;
 
-	fis_h2d->countl = rq->nr_sectors;
-	fis_h2d->counth = rq->nr_sectors >> 8;
+	if (port->ncq) {
+		/* The sector count moves to the feature field,
+		 * the count field holds the tag. */
+		fis_h2d->featurel = rq->nr_sectors;
+		fis_h2d->featureh = rq->nr_sectors >> 8;
+		fis_h2d->countl = slot << 3;
+	} else {
+		fis_h2d->countl = rq->nr_sectors;
+		fis_h2d->counth = rq->nr_sectors >> 8;
+	}
 
 	command[slot].opts = sizeof(*fis_h2d) / sizeof(u32);
+	command[slot].prdbc = 0;
 
 	if (rq->cmd == WRITE)
 		command[slot].opts |= AHCI_CMD_WRITE;
@@ -346,8 +428,6 @@ static int ahci_do_port_request(struct port *port, unsigned long long sector, st
 	for (i = 0, bh = rq->bh; bh; i++, bh = bh->b_reqnext)
 	{
 		assert(i < PRDTL_SIZE);
-		assert((((unsigned long) bh->b_data) & ~PAGE_MASK) ==
-			(((unsigned long) bh->b_data + bh->b_size - 1) & ~PAGE_MASK));
 		prdtl[slot].prdtl[i].dbau = 0;
 		prdtl[slot].prdtl[i].dba = vmtophys(bh->b_data);
 		prdtl[slot].prdtl[i].dbc = bh->b_size - 1;
@@ -359,44 +439,19 @@ static int ahci_do_port_request(struct port *port, unsigned long long sector, st
 	mb();
 
 	/* Issue command */
+	if (port->ncq)
+		writel(1 << slot, &port->ahci_port->sact);
 	writel(1 << slot, &port->ahci_port->ci);
 
-	/* TODO: IRQ timeout handler */
 	return 0;
 }
 
-/* Called by block core to push a request */
-/* TODO: ideally, would have one request queue per port */
-/* TODO: ideally, would use tags to process several requests at a time */
-static void ahci_do_request()	/* invoked with cli() */
+/* Check the request against the partition, and return its start sector
+ * on the disk, or -1 if it is invalid */
+static long long ahci_request_sector(struct port *port, struct request *rq)
 {
-	struct request *rq;
-	unsigned minor, unit;
+	unsigned minor = MINOR(rq->rq_dev);
 	unsigned long long block, blockend;
-	struct port *port;
-
-	rq = CURRENT;
-	if (!rq)
-		return;
-
-	if (rq->rq_status != RQ_ACTIVE)
-		/* Current one is already ongoing, let the interrupt handler
-		 * push the new one when the current one is finished. */
-		return;
-
-	if (MAJOR(rq->rq_dev) != MAJOR_NR) {
-		printk("bad ahci major %u\n", MAJOR(rq->rq_dev));
-		goto kill_rq;
-	}
-
-	minor = MINOR(rq->rq_dev);
-	unit = minor >> PARTN_BITS;
-	if (unit >= MAX_PORTS) {
-		printk("bad ahci unit %u\n", unit);
-		goto kill_rq;
-	}
-
-	port = &ports[unit];
 
 	/* Compute start sector */
 	block = rq->sector;
@@ -407,7 +462,7 @@ static void ahci_do_request()	/* invoked with cli() */
 	if (blockend < block) {
 		if (!rq->quiet)
 			printk("bad blockend %lu vs %lu\n", (unsigned long) blockend, (unsigned long) block);
-		goto kill_rq;
+		return -1;
 	}
 	if (blockend > port->capacity) {
 		if (!rq->quiet)
@@ -415,46 +470,451 @@ static void ahci_do_request()	/* invoked with cli() */
 			printk("offset for %u was %lu\n", minor, port->part[minor & PARTN_MASK].start_sect);
 			printk("bad access: block %lu, count= %lu\n", (unsigned long) blockend, (unsigned long) port->capacity);
 		}
-		goto kill_rq;
+		return -1;
 	}
 
-	/* Push this to the port */
-	if (ahci_do_port_request(port, block, rq))
-		goto kill_rq;
-	return;
+	return block;
+}
+
+/* Arm the command timer of the port for the oldest running command, if any */
+static void ahci_port_timer(struct port *port)
+{
+	unsigned long expires = 0;
+	unsigned slot;
 
-kill_rq:
-	ahci_end_request(0);
+	del_timer(&port->timer);
+	if (!port->busy)
+		return;
+
+	for (slot = 0; slot < AHCI_MAX_CMDS; slot++) {
+		if (!(port->busy & (1U << slot)))
+			continue;
+		if (!expires || (long) (port->issued[slot] + CMD_TIMEOUT - expires) < 0)
+			expires = port->issued[slot] + CMD_TIMEOUT;
+	}
+
+	port->timer.expires = expires;
+	add_timer(&port->timer);
 }
 
-/* The given port got an interrupt, terminate the current request if any */
-static void ahci_port_interrupt(struct port *port, u32 status)
+/* Issue queued requests of the port while it has free command slots */
+static void ahci_start_port(struct port *port)	/* invoked with cli() */
 {
-	unsigned slot = 0;
+	struct request *rq;
+	long long sector;
+	u32 busy = port->busy;
+	unsigned slot;
 
-	if (readl(&port->ahci_port->ci) & (1 << slot)) {
-		/* Command still pending */
+	if (port->recovery)
+		/* The recovery will issue them when done */
 		return;
+
+	while ((rq = port->queue_head)) {
+		if (busy == ((port->depth == 32) ? ~0U : (1U << port->depth) - 1))
+			/* No free slot, the interrupt handler will
+			 * issue it when a command completes. */
+			break;
+
+		port->queue_head = rq->next;
+		if (!port->queue_head)
+			port->queue_tail = NULL;
+		rq->next = NULL;
+
+		sector = ahci_request_sector(port, rq);
+		if (sector < 0) {
+			ahci_end_request(rq, 0);
+			continue;
+		}
+
+		slot = ffz(busy);
+		rq->rq_status = RQ_SCSI_BUSY;
+		if (ahci_do_port_request(port, slot, sector, rq)) {
+			ahci_end_request(rq, 0);
+			continue;
+		}
+
+		port->slots[slot] = rq;
+		port->issued[slot] = jiffies;
+		busy |= 1U << slot;
 	}
 
+	if (busy != port->busy) {
+		u32 was_busy = port->busy;
+
+		port->busy = busy;
+		if (!was_busy)
+			/* Otherwise, the timer is already armed for an
+			 * older command. */
+			ahci_port_timer(port);
+	}
+}
+
+/* Called by block core to push requests */
+static void ahci_do_request()	/* invoked with cli() */
+{
+	struct request *rq;
+	unsigned minor, unit;
+	struct port *port;
+
+	if (ahci_completing)
+		/* We will pick the new requests up when done */
+		return;
+
+again:
+	/* Move all requests to the queue of their port */
+	while ((rq = CURRENT)) {
+		CURRENT = rq->next;
+		rq->next = NULL;
+
+		if (MAJOR(rq->rq_dev) != MAJOR_NR) {
+			printk("bad ahci major %u\n", MAJOR(rq->rq_dev));
+			ahci_end_request(rq, 0);
+			continue;
+		}
+
+		minor = MINOR(rq->rq_dev);
+		unit = minor >> PARTN_BITS;
+		if (unit >= MAX_PORTS || !ports[unit].ahci_port) {
+			printk("bad ahci unit %u\n", unit);
+			ahci_end_request(rq, 0);
+			continue;
+		}
+
+		ahci_queue_request(&ports[unit], rq);
+	}
+
+	for (port = &ports[0]; port < &ports[MAX_PORTS]; port++)
+		if (port->queue_head)
+			ahci_start_port(port);
+
+	/* Completing requests may have started others */
+	if (CURRENT)
+		goto again;
+}
+
+/* Requeue the requests of all running commands at the head of the queue,
+ * after the command engine was stopped.  Only the requests of the FAILED
+ * slots count an error, and are terminated after too many of them. */
+static void ahci_port_requeue(struct port *port, u32 failed)	/* invoked with cli() */
+{
+	struct request *rq;
+	unsigned slot;
+
+	for (slot = AHCI_MAX_CMDS; slot-- > 0; ) {
+		if (!(port->busy & (1U << slot)))
+			continue;
+
+		rq = port->slots[slot];
+		port->slots[slot] = NULL;
+		if ((failed & (1U << slot)) && ++rq->errors > MAX_RETRIES) {
+			ahci_end_request(rq, 0);
+			continue;
+		}
+
+		rq->rq_status = RQ_ACTIVE;
+		rq->next = port->queue_head;
+		port->queue_head = rq;
+		if (!port->queue_tail)
+			port->queue_tail = rq;
+	}
+
+	port->busy = 0;
+	del_timer(&port->timer);
+}
+
+/* Start the given step of the recovery, which gives up after RESET_WAIT */
+static void ahci_port_step(struct port *port, unsigned step)
+{
+	port->recovery = step;
+	port->deadline = jiffies + RESET_WAIT;
+}
+
+/* Whether the current step of the recovery should give up */
+static int ahci_port_expired(struct port *port)
+{
+	return (long) (jiffies - port->deadline) >= 0;
+}
+
+/* Stop the command engine of the port, which clears all running commands */
+static void ahci_port_stop(struct port *port)	/* invoked with cli() */
+{
+	const volatile struct ahci_port *ahci_port = port->ahci_port;
+
+	writel(readl(&ahci_port->cmd) & ~PORT_CMD_START, &ahci_port->cmd);
+	ahci_port_step(port, RECOVERY_STOP);
+}
+
+/* Clear errors, and the busy state left by the device if needed, before
+ * restarting the stopped command engine of the port */
+static void ahci_port_start(struct port *port)	/* invoked with cli() */
+{
+	const volatile struct ahci_port *ahci_port = port->ahci_port;
+
+	writel(readl(&ahci_port->serr), &ahci_port->serr);
+	writel(readl(&ahci_port->is), &ahci_port->is);
+	if (readl(&ahci_port->tfd) & (BUSY_STAT | DRQ_STAT))
+		writel(readl(&ahci_port->cmd) | PORT_CMD_CLO, &ahci_port->cmd);
+	ahci_port_step(port, RECOVERY_CLO);
+}
+
+/* Reset the link of the stopped port, which also resets the device */
+static void ahci_port_comreset(struct port *port)	/* invoked with cli() */
+{
+	const volatile struct ahci_port *ahci_port = port->ahci_port;
+
+	printk("sd%u: resetting link\n", (unsigned) (port-ports));
+
+	/* DET=1 for at least 1ms sends COMRESET: keep it for a whole tick */
+	writel((readl(&ahci_port->sctl) & ~0xf) | 1, &ahci_port->sctl);
+	port->recovery = RECOVERY_COMRESET;
+	port->deadline = jiffies + 2;
+}
+
+/* Read the NCQ Command Error log of the idle port, which also gets the device
+ * out of its error state */
+static void ahci_port_read_ncq_log(struct port *port)	/* invoked with cli() */
+{
+	const volatile struct ahci_port *ahci_port = port->ahci_port;
+	struct ahci_command *command = port->command;
+	struct ahci_cmd_tbl *prdtl = port->prdtl;
+	struct ahci_fis_h2d *fis_h2d;
+	unsigned slot = 0;
+
+	fis_h2d = (void*) &prdtl[slot].cfis;
+	memset(fis_h2d, 0, sizeof(*fis_h2d));
+	fis_h2d->fis_type = FIS_TYPE_REG_H2D;
+	fis_h2d->flags = 128;
+	fis_h2d->command = ATA_CMD_READ_LOG_EXT;
+	fis_h2d->lba0 = ATA_LOG_NCQ_ERROR;
+	fis_h2d->countl = 1;
+
+	command[slot].opts = sizeof(*fis_h2d) / sizeof(u32) | (1 << 16);
+	command[slot].prdbc = 0;
+	prdtl[slot].prdtl[0].dbau = 0;
+	prdtl[slot].prdtl[0].dba = vmtophys(port->log);
+	prdtl[slot].prdtl[0].dbc = 512 - 1;
+
+	port->recovery_status = 0;
+	mb();
+	writel(1 << slot, &ahci_port->ci);
+	ahci_port_step(port, RECOVERY_NCQ_LOG);
+}
+
+/* Return the tag of the failed command from the NCQ Command Error log which
+ * was just read, or -1 */
+static int ahci_port_ncq_log_tag(struct port *port)
+{
+	const volatile struct ahci_port *ahci_port = port->ahci_port;
+
+	if (readl(&ahci_port->tfd) & ERR_STAT || port->log[0] & ATA_LOG_NCQ_NQ)
+		return -1;
+
+	return port->log[0] & ATA_LOG_NCQ_TAG;
+}
+
+/* Run the error recovery of the port as far as it can go without waiting for
+ * the device.  Steps which have to wait are polled again by the port timer on
+ * the next tick, or by the interrupt handler, so that we never busy-wait with
+ * interrupts disabled.  Meanwhile, the running commands stay in their slots
+ * and new requests stay queued.
+ *
+ * After an error, the command engine is restarted, and if we use NCQ we read
+ * the NCQ Command Error log to find which command failed.  If that does not
+ * work, or after a timeout, the link is also reset. */
+static void ahci_port_recover(struct port *port)	/* invoked with cli() */
+{
+	const volatile struct ahci_port *ahci_port = port->ahci_port;
+	unsigned unit = port - ports;
+	int tag;
+
+	for (;;) {
+		switch (port->recovery) {
+		case RECOVERY_STOP:
+			if (readl(&ahci_port->cmd) & PORT_CMD_LIST_ON) {
+				if (!ahci_port_expired(port))
+					goto wait;
+				printk("sd%u: timeout waiting for list completion\n", unit);
+			}
+			if (port->reset)
+				ahci_port_comreset(port);
+			else
+				ahci_port_start(port);
+			break;
+
+		case RECOVERY_COMRESET:
+			if (!ahci_port_expired(port))
+				goto wait;
+			writel(readl(&ahci_port->sctl) & ~0xf, &ahci_port->sctl);
+			ahci_port_step(port, RECOVERY_LINK);
+			break;
+
+		case RECOVERY_LINK:
+			if ((readl(&ahci_port->ssts) & 0xf) != 0x3) {
+				if (!ahci_port_expired(port))
+					goto wait;
+				printk("sd%u: link did not come back\n", unit);
+				ahci_port_start(port);
+				break;
+			}
+			ahci_port_step(port, RECOVERY_READY);
+			break;
+
+		case RECOVERY_READY:
+			if (readl(&ahci_port->tfd) & (BUSY_STAT | DRQ_STAT)) {
+				if (!ahci_port_expired(port))
+					goto wait;
+				printk("sd%u: timeout waiting for ready after reset\n", unit);
+			}
+			ahci_port_start(port);
+			break;
+
+		case RECOVERY_CLO:
+			if ((readl(&ahci_port->cmd) & PORT_CMD_CLO)
+			    && !ahci_port_expired(port))
+				goto wait;
+			writel(readl(&ahci_port->cmd) | PORT_CMD_START, &ahci_port->cmd);
+
+			if (port->ncq && !port->reset) {
+				ahci_port_read_ncq_log(port);
+				break;
+			}
+			goto done;
+
+		case RECOVERY_NCQ_LOG:
+			if (readl(&ahci_port->ci) & 1) {
+				if (!((port->recovery_status | readl(&ahci_port->is)) & PORT_IRQ_TF_ERR)
+				    && !ahci_port_expired(port))
+					goto wait;
+				printk("sd%u: could not read the NCQ error log\n", unit);
+				tag = -1;
+			} else {
+				/* The interrupt handler will find no command running */
+				writel(readl(&ahci_port->is), &ahci_port->is);
+				tag = ahci_port_ncq_log_tag(port);
+			}
+
+			if (tag >= 0 && (port->busy & (1U << tag))) {
+				port->failed = 1U << tag;
+				goto done;
+			}
+
+			port->reset = 1;
+			ahci_port_stop(port);
+			break;
+
+		default:
+			return;
+		}
+	}
+
+wait:
+	del_timer(&port->timer);
+	port->timer.expires = jiffies + 1;
+	add_timer(&port->timer);
+	return;
+
+done:
+	port->recovery = RECOVERY_NONE;
+	ahci_port_requeue(port, port->failed);
+	ahci_start_port(port);
+}
+
+/* Start the error recovery of the port, requeueing the FAILED running commands
+ * with an error, and resetting the link if RESET */
+static void ahci_port_error(struct port *port, u32 failed, unsigned reset)	/* invoked with cli() */
+{
+	port->failed = failed;
+	port->reset = reset;
+	port->recovery_status = 0;
+	ahci_port_stop(port);
+	ahci_port_recover(port);
+}
+
+/* The oldest command of the port did not complete in time, or the current
+ * step of the recovery has to be polled again */
+static void ahci_port_timeout(unsigned long data)
+{
+	struct port *port = (void*) data;
+	unsigned long flags;
+	u32 expired = 0;
+	unsigned slot;
+
+	save_flags(flags);
+	cli();
+
+	if (port->recovery)
+		ahci_port_recover(port);
+	else {
+		for (slot = 0; slot < AHCI_MAX_CMDS; slot++)
+			if ((port->busy & (1U << slot))
+			    && (long) (jiffies - port->issued[slot] - CMD_TIMEOUT) >= 0)
+				expired |= 1U << slot;
+
+		if (expired) {
+			printk("sd%u: timeout, commands %x still running\n", (unsigned) (port-ports), expired);
+			/* The device is stuck, NCQ or not */
+			ahci_port_error(port, expired, 1);
+		} else
+			ahci_port_timer(port);
+	}
+
+	/* Pick up the requests the block scheduler started meanwhile */
+	if (CURRENT)
+		ahci_do_request();
+
+	restore_flags(flags);
+}
+
+/* The given port got an interrupt, terminate the completed requests if any */
+static void ahci_port_interrupt(struct port *port, u32 status)
+{
+	u32 active, done;
+	unsigned slot;
+
 	if (port->identify) {
+		if (readl(&port->ahci_port->ci) & 1) {
+			/* Command still pending */
+			return;
+		}
 		port->status = status;
 		wake_up(&port->q);
 		return;
 	}
 
-	if (!CURRENT || CURRENT->rq_status != RQ_SCSI_BUSY) {
+	if (port->recovery) {
+		port->recovery_status |= status;
+		ahci_port_recover(port);
+		return;
+	}
+
+	if (!port->busy) {
 		/* No request currently running */
 		return;
 	}
 
+	/* Commands which completed before an error did succeed */
+	active = readl(&port->ahci_port->ci);
+	if (port->ncq)
+		active |= readl(&port->ahci_port->sact);
+	done = port->busy & ~active;
+
+	for (slot = 0; slot < AHCI_MAX_CMDS; slot++) {
+		if (!(done & (1U << slot)))
+			continue;
+		ahci_end_request(port->slots[slot], 1);
+		port->slots[slot] = NULL;
+	}
+	port->busy &= ~done;
+
 	if (status & (PORT_IRQ_TF_ERR | PORT_IRQ_HBUS_ERR | PORT_IRQ_HBUS_DATA_ERR | PORT_IRQ_IF_ERR | PORT_IRQ_IF_NONFATAL)) {
 		printk("ahci error %x %x\n", status, readl(&port->ahci_port->tfd));
-		ahci_end_request(0);
+		/* The port stopped processing commands anyway */
+		ahci_port_error(port, port->busy, 0);
 		return;
 	}
 
-	ahci_end_request(1);
+	if (done)
+		ahci_port_timer(port);
 }
 
 /* Start of IRQ handler. Iterate over all ports for this host */
@@ -476,16 +936,20 @@ static void ahci_interrupt (int irq, void *host, struct pt_regs *regs)
 			/* Clear interrupt before possibly triggering others */
 			writel(status, &port->ahci_port->is);
 			ahci_port_interrupt (port, status);
+
+			if (port->queue_head)
+				/* Still some requests, issue more */
+				ahci_start_port(port);
 		}
 	}
 
-	if (CURRENT)
-		/* Still some requests, queue another one */
-		ahci_do_request();
-
 	/* Clear host after clearing ports */
 	writel(irq_mask, &ahci_host->is);
 
+	/* Pick up the requests the block scheduler started meanwhile */
+	if (CURRENT)
+		ahci_do_request();
+
 	/* unlock */
 }
 
@@ -712,10 +1176,21 @@ static int ahci_identify(const volatile struct ahci_host *ahci_host, const volat
 				printk("Warning: truncating disk size to 128GiB\n");
 			}
 		}
+		if (port->lba48 && (readl(&ahci_host->cap) & HOST_CAP_NCQ) && (id.word76 & (1U<<8)))
+		{
+			/* Word 75 holds the maximum queue depth - 1 */
+			port->ncq = 1;
+			port->depth = (id.word75 & 0x1f) + 1;
+			if (port->depth > port->cls)
+				port->depth = port->cls;
+		}
 		if (port->capacity/2048 >= 10240)
-			printk("sd%u: %s, %uGB w/%dkB Cache\n", (unsigned) (port - ports), id.model, (unsigned) (port->capacity/(2048*1024)), id.buf_size/2);
+			printk("sd%u: %s, %uGB w/%dkB Cache", (unsigned) (port - ports), id.model, (unsigned) (port->capacity/(2048*1024)), id.buf_size/2);
 		else
-			printk("sd%u: %s, %uMB w/%dkB Cache\n", (unsigned) (port - ports), id.model, (unsigned) (port->capacity/2048), id.buf_size/2);
+			printk("sd%u: %s, %uMB w/%dkB Cache", (unsigned) (port - ports), id.model, (unsigned) (port->capacity/2048), id.buf_size/2);
+		if (port->ncq)
+			printk(", NCQ depth %u", port->depth);
+		printk("\n");
 	}
 	port->identify = 0;
 
@@ -731,10 +1206,14 @@ static void ahci_probe_port(const volatile struct ahci_host *ahci_host, const vo
 	struct ahci_command *command;
 	struct ahci_fis *fis;
 	struct ahci_cmd_tbl *prdtl;
+	/* The command tables come first, so that none of them crosses a
+	 * page, then the 1K-aligned command list, then the received FIS,
+	 * and the NCQ error log, which thus fits in the same 1K block */
 	vm_size_t size =
-		  cls * sizeof(*command)
+		  cls * sizeof(*prdtl)
+		+ 1024
 		+ sizeof(*fis)
-		+ cls * sizeof(*prdtl);
+		+ 512;
 	unsigned i;
 	unsigned long long timeout;
 
@@ -756,10 +1235,16 @@ static void ahci_probe_port(const volatile struct ahci_host *ahci_host, const vo
 	port->ahci_host = ahci_host;
 	port->ahci_port = ahci_port;
 	port->cls = cls;
+	port->depth = 1;
+	port->ncq = 0;
+	init_timer(&port->timer);
+	port->timer.function = ahci_port_timeout;
+	port->timer.data = (unsigned long) port;
 
-	port->command = command = mem;
-	port->fis = fis = (void*) command + cls * sizeof(*command);
-	port->prdtl = prdtl = (void*) fis + sizeof(*fis);
+	port->prdtl = prdtl = mem;
+	port->command = command = (void*) prdtl + cls * sizeof(*prdtl);
+	port->fis = fis = (void*) command + 1024;
+	port->log = (void*) fis + sizeof(*fis);
 
 	/* Stop commands */
 	writel(readl(&ahci_port->cmd) & ~PORT_CMD_START, &ahci_port->cmd);
@@ -1014,6 +1499,13 @@ void ahci_probe_pci(void)
 		/* We prefer to transfer whole pages */
 		*bs++ = PAGE_SIZE;
 
+	/* Let the block glue merge pages into large requests */
+	max_segments[MAJOR_NR] = PRDTL_SIZE;
+	max_sectors[MAJOR_NR] = MAX_SECTORS;
+	for (unit = 0; unit < nports; unit++)
+		if (!ports[unit].lba48)
+			max_sectors[MAJOR_NR] = MAX_SECTORS_LBA28;
+
 	memset(gd->part, 0, nminors * sizeof(*gd->part));
 
 	for (unit = 0; unit < nports; unit++) {
@@ -1035,4 +1527,13 @@ void ahci_probe_pci(void)
 	*gdp = gd;
 
 	blk_dev[MAJOR_NR].request_fn = ahci_do_request;
+
+	/* Keep enough requests in flight to fill the command slots of
+	 * each port */
+	if (nports) {
+		blk_queue_init(MAJOR_NR, 1);
+		for (unit = 0; unit < nports; unit++)
+			if (ports[unit].depth)
+				blk_queue_depth(MAJOR_NR, unit, ports[unit].depth);
+	}
 }
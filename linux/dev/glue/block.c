@@ -51,6 +51,7 @@
 
 #include <kern/kalloc.h>
 #include <kern/list.h>
+#include <kern/slab.h>
 
 #include <ipc/ipc_port.h>
 #include <ipc/ipc_space.h>
@@ -59,6 +60,7 @@
 #include <vm/vm_kern.h>
 #include <vm/vm_page.h>
 
+#include <device/blkio.h>
 #include <device/device_types.h>
 #include <device/device_port.h>
 #include <device/disk_status.h>
@@ -193,10 +195,60 @@ int *blksize_size[MAX_BLKDEV] = { NULL, NULL, };
  */
 int *hardsect_size[MAX_BLKDEV] = { NULL, NULL, };
 
+/*
+ * max_segments contains the number of scatter-gather segments a driver
+ * accepts in one request:
+ *
+ * max_segments[MAJOR]
+ *
+ * if (!max_segments[MAJOR]) then requests are made of at most MAX_SEG
+ * buffers which never cross a page boundary, which every driver
+ * handles.  Otherwise a buffer may span several physically contiguous
+ * pages.
+ */
+int max_segments[MAX_BLKDEV] = {0, };
+
+#define MAX_SEG		8	/* buffers per request, by default */
+
+/*
+ * max_sectors contains the largest request a driver accepts, in sectors:
+ *
+ * max_sectors[MAJOR]
+ *
+ * if (!max_sectors[MAJOR]) then only the number of segments is limited.
+ */
+int max_sectors[MAX_BLKDEV] = {0, };
+
 /* This specifies how many sectors to read ahead on the disk.
    This is unused in Mach.  It is here to make drivers compile.  */
 int read_ahead[MAX_BLKDEV] = {0, };
 
+/* Request queues of the drivers which use the block scheduler, one
+   for each unit of their gendisk, see blk_queue_init.  The unit of
+   a device is its minor number shifted right by blk_queue_shift.  */
+static struct blkio_queue *blk_queue[MAX_BLKDEV];
+static int blk_queue_shift[MAX_BLKDEV];
+static int blk_queue_units[MAX_BLKDEV];
+
+/* A request queued through the block scheduler.  */
+struct blk_request
+{
+  struct request req;
+  struct blkio_req breq;
+};
+
+static struct kmem_cache blk_request_cache;
+
+/* Requests of the block scheduler are released from interrupt context,
+   where the slab allocator can't be called: they are kept in this free
+   list instead, linked by their next field, and protected by cli.  */
+static struct request *blk_free_requests;
+
+/* Set while a completed request starts the next ones, so that
+   the driver, which is still handling its interrupt, isn't entered
+   again.  It will look at its request list on its own.  */
+static int blk_completing;
+
 /* Use to wait on when there are no free requests.
    This is unused in Mach.  It is here to make drivers compile.  */
 struct wait_queue *wait_for_request = NULL;
@@ -205,6 +257,8 @@ struct wait_queue *wait_for_request = NULL;
 int
 blk_dev_init ()
 {
+  kmem_cache_init (&blk_request_cache, "linux_blk_request",
+		   sizeof (struct blk_request), 0, NULL, 0);
 #ifdef CONFIG_BLK_DEV_IDE
   extern char *kernel_cmdline;
   if (strncmp(kernel_cmdline, "noide", 5) &&
@@ -469,29 +523,16 @@ check_rw_block (int nr, struct buffer_head **bh)
   return 0;
 }
 
-/* Perform the I/O operation RW on the buffer list BH
+/* Fill request R for the I/O operation RW on the buffer list BH
    containing NR buffers.  */
-void
-ll_rw_block (int rw, int nr, struct buffer_head **bh, int quiet)
+static void
+setup_request (struct request *r, int rw, int nr,
+	       struct buffer_head **bh, int quiet)
 {
   int i, bshift, bsize;
-  unsigned major;
-  struct request *r;
-  static struct request req;
-
-  major = MAJOR (bh[0]->b_dev);
-  assert (major < MAX_BLKDEV);
 
   get_block_size (bh[0]->b_dev, &bsize, &bshift);
 
-  if (! linux_auto_config)
-    {
-      assert (current_thread ()->pcb->data);
-      r = &((struct temp_data *) current_thread ()->pcb->data)->req;
-    }
-  else
-    r = &req;
-
   for (i = 0, r->nr_sectors = 0; i < nr - 1; i++)
     {
       r->nr_sectors += bh[i]->b_size >> 9;
@@ -512,10 +553,299 @@ ll_rw_block (int rw, int nr, struct buffer_head **bh, int quiet)
   r->bhtail = bh[nr - 1];
   r->sem = NULL;
   r->next = NULL;
+}
+
+/* Return the first sector of the partition of device DEV on its disk.  */
+static unsigned long
+start_sect (kdev_t dev)
+{
+  struct gendisk *gd;
+
+  for (gd = gendisk_head; gd; gd = gd->next)
+    if (gd->major == MAJOR (dev) && gd->part)
+      return gd->part[MINOR (dev)].start_sect;
+  return 0;
+}
+
+/* Allocate a request for the block scheduler.  */
+static struct blk_request *
+blk_request_alloc (void)
+{
+  struct request *req;
+  unsigned long flags;
+
+  save_flags (flags);
+  cli ();
+  req = blk_free_requests;
+  if (req)
+    blk_free_requests = req->next;
+  restore_flags (flags);
+
+  if (req)
+    return structof (req, struct blk_request, req);
+  return (struct blk_request *) kmem_cache_alloc (&blk_request_cache);
+}
+
+/* Release request REQ of the block scheduler.  This can be called from
+   interrupt context.  */
+static void
+blk_request_free (struct request *req)
+{
+  unsigned long flags;
+
+  save_flags (flags);
+  cli ();
+  req->next = blk_free_requests;
+  blk_free_requests = req;
+  restore_flags (flags);
+}
+
+/* Put NR requests in the free list, so that the block scheduler does
+   not have to allocate them while running.  */
+static void
+blk_request_reserve (int nr)
+{
+  struct blk_request *br;
+
+  while (nr-- > 0)
+    {
+      br = (struct blk_request *) kmem_cache_alloc (&blk_request_cache);
+      if (! br)
+	return;
+      blk_request_free (&br->req);
+    }
+}
+
+/* Return the block scheduler queue of device DEV, if any.  */
+static struct blkio_queue *
+blk_dev_queue (kdev_t dev)
+{
+  unsigned major = MAJOR (dev), unit;
+
+  if (major >= MAX_BLKDEV || ! blk_queue[major])
+    return NULL;
+  unit = MINOR (dev) >> blk_queue_shift[major];
+  if (unit >= blk_queue_units[major])
+    return NULL;
+  return &blk_queue[major][unit];
+}
+
+/* Pass the scheduled request BREQ to the driver of queue Q.  */
+static void
+blk_start_request (struct blkio_queue *q, struct blkio_req *breq)
+{
+  struct request *req = breq->private, *tmp;
+  struct blk_dev_struct *dev = q->private;
+
+  req->next = NULL;
+  tmp = dev->current_request;
+  if (! tmp)
+    {
+      dev->current_request = req;
+      if (! blk_completing)
+	(*dev->request_fn) ();
+      return;
+    }
+  while (tmp->next)
+    tmp = tmp->next;
+  tmp->next = req;
+}
+
+/* Merge the scheduled request BREQ into INTO, in front
+   of it if FRONT, behind it otherwise.  */
+static boolean_t
+blk_merge_request (struct blkio_queue *q, struct blkio_req *into,
+		   struct blkio_req *breq, boolean_t front)
+{
+  struct request *r = into->private, *req = breq->private;
+  struct buffer_head *bh;
+  int nr, maxseg;
+
+  if (r->rq_dev != req->rq_dev || r->cmd != req->cmd)
+    return FALSE;
+
+  maxseg = max_segments[MAJOR (r->rq_dev)];
+  if (! maxseg)
+    maxseg = MAX_SEG;
+  for (nr = 0, bh = r->bh; bh; bh = bh->b_reqnext)
+    nr++;
+  for (bh = req->bh; bh; bh = bh->b_reqnext)
+    nr++;
+  if (nr > maxseg)
+    return FALSE;
+
+  if (front)
+    {
+      req->bhtail->b_reqnext = r->bh;
+      r->bh = req->bh;
+      r->sector = req->sector;
+      r->current_nr_sectors = req->current_nr_sectors;
+      r->buffer = req->buffer;
+    }
+  else
+    {
+      r->bhtail->b_reqnext = req->bh;
+      r->bhtail = req->bhtail;
+    }
+  r->nr_sectors += req->nr_sectors;
+  r->quiet = r->quiet && req->quiet;
+
+  blk_request_free (req);
+  return TRUE;
+}
+
+/* Make requests to the driver of major number MAJOR go through the
+   block scheduler, which merges and orders them, and keeps at most
+   MAX_DEPTH of them for each unit on the driver's request list.  The
+   units are those of the gendisk of the driver, which must be
+   registered already; without one, the driver has a single unit.
+   The driver must call blk_request_done when it completes a
+   request.  */
+void
+blk_queue_init (int major, int max_depth)
+{
+  struct blkio_queue *q;
+  struct gendisk *gd;
+  unsigned long max_sect;
+  int shift, units, unit;
+
+  assert (major < MAX_BLKDEV);
+  if (blk_queue[major])
+    return;
+
+  shift = MINORBITS;
+  units = 1;
+  for (gd = gendisk_head; gd; gd = gd->next)
+    if (gd->major == major)
+      {
+	shift = gd->minor_shift;
+	units = gd->max_nr;
+	break;
+      }
+  if (units <= 0)
+    return;
+
+  q = (struct blkio_queue *) kalloc (units * sizeof (*q));
+  if (! q)
+    return;
+
+  max_sect = max_sectors[major];
+  if (! max_sect)
+    max_sect = (max_segments[major] ? max_segments[major] : MAX_SEG)
+	       * (PAGE_SIZE >> 9);
+  for (unit = 0; unit < units; unit++)
+    blkio_queue_init (&q[unit], blk_start_request, blk_merge_request,
+		      max_depth, max_sect, blk_dev + major);
+  blk_request_reserve (units * max_depth);
+
+  blk_queue_shift[major] = shift;
+  blk_queue_units[major] = units;
+  blk_queue[major] = q;
+}
+
+/* Let the block scheduler keep up to MAX_DEPTH requests of unit UNIT
+   of major number MAJOR on the driver's request list.  */
+void
+blk_queue_depth (int major, int unit, int max_depth)
+{
+  struct blkio_queue *q;
+
+  assert (major < MAX_BLKDEV);
+  if (! blk_queue[major] || unit >= blk_queue_units[major])
+    return;
+
+  q = &blk_queue[major][unit];
+  if (max_depth > q->max_depth)
+    blk_request_reserve (max_depth - q->max_depth);
+  q->max_depth = max_depth;
+}
+
+/* Note that the driver completed request REQ.  Requests which didn't
+   go through the block scheduler are ignored.  */
+void
+blk_request_done (struct request *req)
+{
+  struct blkio_queue *q;
+  struct blkio_req *breq;
+  unsigned long flags;
+
+  q = blk_dev_queue (req->rq_dev);
+  if (! q)
+    return;
+
+  save_flags (flags);
+  cli ();
+  breq = blkio_lookup (q, req);
+  if (! breq)
+    {
+      restore_flags (flags);
+      return;
+    }
+  blk_completing++;
+  blkio_done (q, breq);
+  blk_completing--;
+  restore_flags (flags);
+
+  blk_request_free (req);
+}
+
+/* Queue the I/O operation RW on the buffer list BH containing NR
+   buffers, through the block scheduler of the driver if it has one,
+   or else directly with request R.  */
+static void
+submit_request (struct request *r, int rw, int nr,
+		struct buffer_head **bh, int quiet)
+{
+  struct blkio_queue *q;
+  struct blk_request *br;
+  unsigned long flags;
+
+  q = blk_dev_queue (bh[0]->b_dev);
+  if (q)
+    {
+      br = blk_request_alloc ();
+      if (br)
+	{
+	  setup_request (&br->req, rw, nr, bh, quiet);
+	  br->breq.sector = start_sect (br->req.rq_dev) + br->req.sector;
+	  br->breq.nr_sectors = br->req.nr_sectors;
+	  br->breq.write = rw == WRITE;
+	  br->breq.private = &br->req;
+	  save_flags (flags);
+	  cli ();
+	  blkio_submit (q, &br->breq);
+	  restore_flags (flags);
+	  return;
+	}
+    }
 
+  setup_request (r, rw, nr, bh, quiet);
   enqueue_request (r);
 }
 
+/* Perform the I/O operation RW on the buffer list BH
+   containing NR buffers.  */
+void
+ll_rw_block (int rw, int nr, struct buffer_head **bh, int quiet)
+{
+  unsigned major;
+  struct request *r;
+  static struct request req;
+
+  major = MAJOR (bh[0]->b_dev);
+  assert (major < MAX_BLKDEV);
+
+  if (! linux_auto_config)
+    {
+      assert (current_thread ()->pcb->data);
+      r = &((struct temp_data *) current_thread ()->pcb->data)->req;
+    }
+  else
+    r = &req;
+
+  submit_request (r, rw, nr, bh, quiet);
+}
+
 #define BSIZE	(1 << bshift)
 #define BMASK	(BSIZE - 1)
 
@@ -603,21 +933,39 @@ out:
 }
 
 #define BH_Bounce	16
-#define MAX_BUF		8
+#define MAX_BUF		64	/* buffers per call to rdwr_full */
+#define MAX_REQ		4	/* requests per call to rdwr_full */
+
+/* Buffers and requests of one call to rdwr_full, too large
+   for the stack.  */
+struct rdwr_data
+{
+  struct buffer_head bhead[MAX_BUF];
+  struct buffer_head *bhp[MAX_BUF];
+  struct request req[MAX_REQ];
+  int first[MAX_REQ];		/* index of the first buffer of each request */
+};
 
 /* Perform read/write operation RW on device DEV
    starting at *off to/from buffer *BUF of size *RESID.
    The device block size is given by BSHIFT.  *OFF and
    *RESID must be multiples of the block size.
    *OFF, *BUF and *RESID are updated if the operation
-   completed successfully.  */
+   completed successfully.
+
+   Up to MAX_REQ requests are queued before waiting for any of them.
+   If the driver sets max_segments, physically contiguous pages are
+   merged into a single buffer and each request has as many buffers
+   as the driver accepts, instead of MAX_SEG.  */
 static int
 rdwr_full (int rw, kdev_t dev, loff_t *off, char **buf, int *resid, int bshift)
 {
-  int cc, err = 0, i, j, nb, nbuf;
+  int bounce, cc, err = 0, i, j, nb, nbuf, nreq, nsect, maxseg, maxsect;
+  unsigned major = MAJOR (dev);
   loff_t blkl;
   long blk, newblk;
-  struct buffer_head bhead[MAX_BUF], *bh, *bhp[MAX_BUF];
+  struct buffer_head *bh, *prev;
+  struct rdwr_data *d;
   phys_addr_t pa;
 
   assert ((*off & BMASK) == 0);
@@ -627,42 +975,82 @@ rdwr_full (int rw, kdev_t dev, loff_t *off, char **buf, int *resid, int bshift)
   blk = blkl;
   if (blk != blkl)
     return -EOVERFLOW;
-  for (i = nb = 0, bh = bhead; nb < nbuf; bh++)
+
+  d = (struct rdwr_data *) kalloc (sizeof (*d));
+  if (! d)
+    return -ENOMEM;
+
+  maxseg = max_segments[major] ? max_segments[major] : MAX_SEG;
+  maxsect = max_sectors[major];
+
+  for (i = nb = nreq = nsect = 0, prev = NULL; nb < nbuf; )
     {
-      memset (bh, 0, sizeof (*bh));
-      bh->b_dev = dev;
-      bh->b_blocknr = blk;
-      set_bit (BH_Lock, &bh->b_state);
-      if (rw == WRITE)
-	set_bit (BH_Dirty, &bh->b_state);
       cc = PAGE_SIZE - (((int) *buf + (nb << bshift)) & PAGE_MASK);
       pa = pmap_extract (vm_map_pmap (device_io_map),
 			 (((vm_offset_t) *buf) + (nb << bshift)));
+      bounce = 0;
       if (cc >= BSIZE && (((int) *buf + (nb << bshift)) & 511) == 0
 	  && pa + cc <= VM_PAGE_DIRECTMAP_LIMIT)
 	cc &= ~BMASK;
       else
 	{
 	  cc = PAGE_SIZE;
-	  set_bit (BH_Bounce, &bh->b_state);
+	  bounce = 1;
 	}
       if (cc > ((nbuf - nb) << bshift))
 	cc = (nbuf - nb) << bshift;
-      if (! test_bit (BH_Bounce, &bh->b_state))
-	bh->b_data = (char *) phystokv(pa);
+
+      if (max_segments[major] && ! bounce && prev
+	  && ! test_bit (BH_Bounce, &prev->b_state)
+	  && prev->b_data + prev->b_size == (char *) phystokv (pa)
+	  && (! maxsect || nsect + (cc >> 9) <= maxsect))
+	{
+	  /* Extend the previous buffer.  */
+	  prev->b_size += cc;
+	  nsect += cc >> 9;
+	}
       else
 	{
-	  bh->b_data = alloc_buffer (cc);
-	  if (! bh->b_data)
+	  if (i == MAX_BUF)
+	    break;
+
+	  /* Start a new request when the current one is full.  */
+	  if (nreq == 0 || i - d->first[nreq - 1] == maxseg
+	      || (maxsect && nsect + (cc >> 9) > maxsect))
 	    {
-	      err = -ENOMEM;
-	      break;
+	      if (nreq == MAX_REQ)
+		break;
+	      d->first[nreq++] = i;
+	      nsect = 0;
 	    }
+
+	  bh = &d->bhead[i];
+	  memset (bh, 0, sizeof (*bh));
+	  bh->b_dev = dev;
+	  bh->b_blocknr = blk;
+	  set_bit (BH_Lock, &bh->b_state);
 	  if (rw == WRITE)
-	    memcpy (bh->b_data, *buf + (nb << bshift), cc);
+	    set_bit (BH_Dirty, &bh->b_state);
+	  if (! bounce)
+	    bh->b_data = (char *) phystokv(pa);
+	  else
+	    {
+	      set_bit (BH_Bounce, &bh->b_state);
+	      bh->b_data = alloc_buffer (cc);
+	      if (! bh->b_data)
+		{
+		  err = -ENOMEM;
+		  break;
+		}
+	      if (rw == WRITE)
+		memcpy (bh->b_data, *buf + (nb << bshift), cc);
+	    }
+	  bh->b_size = cc;
+	  d->bhp[i++] = bh;
+	  prev = bh;
+	  nsect += cc >> 9;
 	}
-      bh->b_size = cc;
-      bhp[i] = bh;
+
       nb += cc >> bshift;
       newblk = blk + (cc >> bshift);
       if (newblk < blk)
@@ -671,18 +1059,21 @@ rdwr_full (int rw, kdev_t dev, loff_t *off, char **buf, int *resid, int bshift)
 	  break;
 	}
       blk = newblk;
-      if (++i == MAX_BUF)
-	break;
     }
   if (! err)
-    err = check_rw_block (i, bhp);
+    err = check_rw_block (i, d->bhp);
   if (! err)
     {
       assert (i > 0);
-      ll_rw_block (rw, i, bhp, 0);
-      wait_on_buffer (bhp[i - 1]);
+      for (j = 0; j < nreq; j++)
+	{
+	  nb = (j + 1 < nreq ? d->first[j + 1] : i) - d->first[j];
+	  submit_request (&d->req[j], rw, nb, d->bhp + d->first[j], 0);
+	}
+      for (j = 0; j < i; j++)
+	wait_on_buffer (d->bhp[j]);
     }
-  for (bh = bhead, cc = 0, j = 0; j < i; cc += bh->b_size, bh++, j++)
+  for (bh = d->bhead, cc = 0, j = 0; j < i; cc += bh->b_size, bh++, j++)
     {
       if (! err && buffer_uptodate (bh)
 	  && rw == READ && test_bit (BH_Bounce, &bh->b_state))
@@ -692,6 +1083,7 @@ rdwr_full (int rw, kdev_t dev, loff_t *off, char **buf, int *resid, int bshift)
       if (test_bit (BH_Bounce, &bh->b_state))
 	free_buffer (bh->b_data, bh->b_size);
     }
+  kfree ((vm_offset_t) d, sizeof (*d));
   if (! err)
     {
       *buf += cc;
@@ -1628,6 +2020,91 @@ out:
   return err;
 }
 
+/* Read into the user buffers described by IOVEC without going
+   through a VM copy.  Each buffer is wired and mapped into
+   device_io_map in turn, so that rdwr_full transfers directly
+   to the user pages.  */
+static io_return_t
+device_readv_trap (void *d, mach_port_name_t rcv_name, dev_mode_t mode,
+		   rpc_recnum_t bn, io_buf_vec_t *iovec, unsigned iocount,
+		   vm_size_t *bytes_read)
+{
+  int count, resid, amt;
+  unsigned i;
+  io_return_t err = 0;
+  vm_offset_t uaddr, kaddr;
+  vm_size_t len, size;
+  struct block_data *bd = d;
+  DECL_DATA;
+
+  INIT_DATA ();
+
+  if (rcv_name != MACH_PORT_NULL)
+    return KERN_INVALID_RIGHT;
+  if (! bd->ds->fops->read)
+    return D_INVALID_OPERATION;
+  for (count = 0, i = 0; i < iocount; i++)
+    {
+      if (iovec[i].count > INT_MAX - count)
+	return D_INVALID_SIZE;
+      count += iovec[i].count;
+    }
+  count = check_limit (bd, &td.file.f_pos, bn, count);
+  if (count < 0)
+    return D_INVALID_SIZE;
+  if (count == 0)
+    return 0;
+
+  resid = count;
+  for (i = 0; i < iocount && resid > 0; i++)
+    {
+      uaddr = iovec[i].data;
+      len = iovec[i].count;
+      if (len > resid)
+	len = resid;
+
+      while (len > 0)
+	{
+	  /* Determine size of I/O this time around.  */
+	  size = round_page (uaddr + len) - trunc_page (uaddr);
+	  if (size > MAX_COPY)
+	    size = MAX_COPY;
+	  size -= uaddr & PAGE_MASK;
+	  if (size > len)
+	    size = len;
+
+	  err = ds_user_buffer_map (uaddr, size, &kaddr);
+	  if (err)
+	    goto out;
+
+	  /* Do the read.  */
+	  amt = (*bd->ds->fops->read) (&td.inode, &td.file,
+				       (char *) kaddr, size);
+
+	  ds_user_buffer_unmap (uaddr, size, kaddr);
+
+	  if (amt <= 0)
+	    {
+	      if (amt < 0)
+		err = linux_to_mach_error (amt);
+	      goto out;
+	    }
+	  *bytes_read += amt;
+	  resid -= amt;
+	  uaddr += amt;
+	  len -= amt;
+	}
+    }
+
+out:
+  if (--bd->iocount == 0 && bd->want)
+    {
+      bd->want = 0;
+      thread_wakeup ((event_t) bd);
+    }
+  return err;
+}
+
 static io_return_t
 device_get_status (void *d, dev_flavor_t flavor, dev_status_t status,
 		   mach_msg_type_number_t *status_count)
@@ -1712,6 +2189,15 @@ device_get_status (void *d, dev_flavor_t flavor, dev_status_t status,
       *status_count = DEV_GET_RECORDS_COUNT;
       break;
 
+    case BLKIO_STATUS:
+      {
+	struct blkio_queue *q = blk_dev_queue (bd->dev);
+
+	if (! q)
+	  return D_INVALID_OPERATION;
+	return blkio_get_status (q, status, status_count);
+      }
+
     default:
       return D_INVALID_OPERATION;
     }
@@ -1766,5 +2252,6 @@ struct device_emulation_ops linux_block_emulation_ops =
   NULL,
   device_no_senders,
   NULL,
-  NULL
+  NULL,
+  device_readv_trap
 };
@@ -28,6 +28,8 @@ extern unsigned long alloc_contig_mem (unsigned, unsigned, unsigned, vm_page_t *
 extern void free_contig_mem (vm_page_t, unsigned);
 extern void init_IRQ (void);
 extern void restore_IRQ (void);
+extern void linux_poll_irq (unsigned int irq);
+extern int linux_irq_user_intr (unsigned int irq);
 extern void linux_kmem_init (void);
 extern void linux_net_emulation_init (void);
 extern void device_setup (void);
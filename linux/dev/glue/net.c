@@ -86,6 +86,7 @@
 #include <device/if_ether.h>
 #include <device/if_hdr.h>
 #include <device/net_io.h>
+#include <device/net_ring.h>
 #include <device/device_reply.user.h>
 #include <device/device_emul.h>
 #include <device/ds_routines.h>
@@ -97,6 +98,7 @@
 #include <linux/errno.h>
 #include <linux/delay.h>
 #include <linux/interrupt.h>
+#include <linux/kernel_stat.h>
 #include <linux/malloc.h>
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
@@ -111,8 +113,22 @@ struct net_data
   struct ifnet ifnet;		/* Mach ifnet structure (needed for filters) */
   struct device device;		/* generic device structure */
   struct linux_device *dev;	/* Linux network device structure */
+  struct sk_buff_head rx_queue;	/* received, waiting for net_bh */
+  int polling;			/* interrupt masked, net_bh polls */
+  int in_poll;			/* in the handler, called by net_bh */
+  unsigned int last_intr;	/* interrupt count at the last packet */
+  struct net_rx_mitigation rx_mitigation;
+  struct net_rx_stats rx_stats;
 };
 
+/* Default receive interrupt mitigation of new devices.  */
+static int net_rx_threshold = 16;
+static int net_rx_budget = 64;
+
+/* Packets waiting for net_bh on a device, beyond which they are
+   dropped.  */
+#define NET_RX_BACKLOG	256
+
 /* List of sk_buffs waiting to be freed.  */
 static struct sk_buff_head skb_done_list;
 
@@ -122,6 +138,8 @@ extern struct device_emulation_ops linux_net_emulation_ops;
 
 static int print_packet_size = 0;
 
+static void net_rx_poll (struct net_data *nd);
+
 /* Linux kernel network support routines.  */
 
 /* Requeue packet SKB for transmission after the interface DEV
@@ -171,6 +189,11 @@ net_bh (void)
 	      break;
 	  }
     }
+
+  /* Deliver received packets, polling devices which need it.  */
+  for (dev = dev_base; dev; dev = dev->next)
+    if (dev->net_data)
+      net_rx_poll (dev->net_data);
 }
 
 /* Free all sk_buffs on the done list.
@@ -261,26 +284,20 @@ dev_kfree_skb (struct sk_buff *skb, int mode)
     {
       skb_queue_tail (&skb_done_list, skb);
       save_flags (flags);
-      thread_wakeup ((event_t) & io_done_list);
+      io_done_wakeup ();
       restore_flags (flags);
       return;
     }
   linux_kfree (skb);
 }
 
-/* Accept packet SKB received on an interface.  */
-void
-netif_rx (struct sk_buff *skb)
+/* Pass packet SKB received on ND up to the microkernel.  */
+static void
+net_rx_deliver (struct net_data *nd, struct sk_buff *skb)
 {
   ipc_kmsg_t kmsg;
   struct ether_header *eh;
   struct packet_header *ph;
-  struct linux_device *dev = skb->dev;
-
-  assert (skb != NULL);
-
-  if (print_packet_size)
-    printf ("netif_rx: length %ld\n", skb->len);
 
   /* Allocate a kernel message buffer.  */
   kmsg = net_kmsg_get ();
@@ -308,8 +325,150 @@ netif_rx (struct sk_buff *skb)
   net_kmsg(kmsg)->sent = FALSE; /* Mark packet as received.  */
 
   /* Pass packet up to the microkernel.  */
-  net_packet (&dev->net_data->ifnet, kmsg,
-	      ph->length, ethernet_priority (kmsg));
+  net_packet (&nd->ifnet, kmsg, ph->length, ethernet_priority (kmsg));
+}
+
+/* Accept packet SKB received on an interface.  It is only queued here,
+   for net_bh to deliver.  Once enough packets are waiting, the
+   interrupt of the device is masked, and net_bh polls the device
+   until it has drained it.  Polling only runs the Linux handlers, so
+   lines shared with user handlers keep taking interrupts.  */
+void
+netif_rx (struct sk_buff *skb)
+{
+  struct linux_device *dev;
+  struct net_data *nd;
+
+  assert (skb != NULL);
+  dev = skb->dev;
+  nd = dev->net_data;
+
+  if (print_packet_size)
+    printf ("netif_rx: length %ld\n", skb->len);
+
+  if (nd->in_poll)
+    nd->rx_stats.poll_packets++;
+  else
+    {
+      if (nd->last_intr != kstat.interrupts[dev->irq])
+	{
+	  nd->last_intr = kstat.interrupts[dev->irq];
+	  nd->rx_stats.interrupts++;
+	}
+      nd->rx_stats.intr_packets++;
+    }
+
+  if (skb_queue_len (&nd->rx_queue) >= NET_RX_BACKLOG)
+    {
+      nd->rx_stats.dropped++;
+      dev_kfree_skb (skb, FREE_READ);
+      return;
+    }
+  skb_queue_tail (&nd->rx_queue, skb);
+
+  if (!nd->polling && dev->irq
+      && nd->rx_mitigation.threshold > 0
+      && skb_queue_len (&nd->rx_queue) >= nd->rx_mitigation.threshold
+      && !linux_irq_user_intr (dev->irq))
+    {
+      disable_irq (dev->irq);
+      nd->polling = 1;
+      nd->rx_stats.poll_starts++;
+    }
+
+  mark_bh (NET_BH);
+}
+
+/* Run the interrupt handler of the device of ND from net_bh.  */
+static void
+net_rx_poll_device (struct net_data *nd)
+{
+  int s;
+
+  nd->rx_stats.polls++;
+  nd->in_poll = 1;
+  s = splimp ();
+  linux_poll_irq (nd->dev->irq);
+  splx (s);
+  nd->in_poll = 0;
+}
+
+/* Deliver the packets received on ND, at most its budget of them per
+   call.  While the device is in polling mode, poll it for more, and
+   unmask its interrupt once it has no more to give.  */
+static void
+net_rx_poll (struct net_data *nd)
+{
+  struct sk_buff *skb;
+  int budget = nd->rx_mitigation.budget;
+  int s;
+
+  while (1)
+    {
+      while (budget > 0 && (skb = skb_dequeue (&nd->rx_queue)))
+	{
+	  s = splimp ();
+	  net_rx_deliver (nd, skb);
+	  splx (s);
+	  budget--;
+	}
+
+      if (budget == 0)
+	{
+	  /* Let the rest of the system run before going on.  */
+	  if (nd->polling || !skb_queue_empty (&nd->rx_queue))
+	    mark_bh (NET_BH);
+	  return;
+	}
+
+      if (!nd->polling)
+	return;
+
+      net_rx_poll_device (nd);
+      if (skb_queue_empty (&nd->rx_queue)
+	  || linux_irq_user_intr (nd->dev->irq))
+	{
+	  /* Drained, or a user handler was added to the line since:
+	     back to interrupts, and poll once more for a packet which
+	     came in before the interrupt was unmasked.  */
+	  nd->polling = 0;
+	  enable_irq (nd->dev->irq);
+	  net_rx_poll_device (nd);
+	}
+    }
+}
+
+/* Pass the frame DATA of LEN bytes just sent on DEV to the filters.  */
+static void
+net_echo (struct linux_device *dev, const unsigned char *data, int len)
+{
+  struct packet_header *packet;
+  struct ether_header *header;
+  ipc_kmsg_t kmsg;
+  int s;
+
+  kmsg = net_kmsg_get ();
+
+  if (kmsg != IKM_NULL)
+    {
+      /* Suitable for Ethernet only.  */
+      header = (struct ether_header *) (net_kmsg (kmsg)->header);
+      packet = (struct packet_header *) (net_kmsg (kmsg)->packet);
+      memcpy (header, data, sizeof (struct ether_header));
+
+      /* packet is prefixed with a struct packet_header,
+         see include/device/net_status.h.  */
+      memcpy (packet + 1, data + sizeof (struct ether_header),
+              len - sizeof (struct ether_header));
+      packet->length = len - sizeof (struct ether_header)
+                       + sizeof (struct packet_header);
+      packet->type = header->ether_type;
+      net_kmsg (kmsg)->sent = TRUE; /* Mark packet as sent.  */
+      s = splimp ();
+      net_packet (&dev->net_data->ifnet, kmsg, packet->length,
+                  ethernet_priority (kmsg));
+      splx (s);
+    }
 }
 
 /* Mach device interface routines.  */
@@ -346,8 +505,7 @@ device_open (ipc_port_t reply_port, mach_msg_type_name_t reply_port_type,
   nd = dev->net_data;
   if (!nd)
     {
-      dev->net_data = nd = ((struct net_data *)
-			    kalloc (sizeof (struct net_data)));
+      nd = (struct net_data *) kalloc (sizeof (struct net_data));
       if (!nd)
 	{
 	  err = D_NO_MEMORY;
@@ -356,6 +514,9 @@ device_open (ipc_port_t reply_port, mach_msg_type_name_t reply_port_type,
       nd->dev = dev;
       nd->device.emul_data = nd;
       nd->device.emul_ops = &linux_net_emulation_ops;
+      skb_queue_head_init (&nd->rx_queue);
+      nd->polling = 0;
+      nd->in_poll = 0;
       nd->port = ipc_port_alloc_kernel ();
       if (nd->port == IP_NULL)
 	{
@@ -368,6 +529,11 @@ device_open (ipc_port_t reply_port, mach_msg_type_name_t reply_port_type,
       ipc_port_nsrequest (nd->port, 1, notify, &notify);
       assert (notify == IP_NULL);
 
+      nd->last_intr = 0;
+      nd->rx_mitigation.threshold = net_rx_threshold;
+      nd->rx_mitigation.budget = net_rx_budget;
+      memset (&nd->rx_stats, 0, sizeof nd->rx_stats);
+
       ifp = &nd->ifnet;
       ifp->if_unit = dev->name[strlen (dev->name) - 1] - '0';
       ifp->if_flags = IFF_UP | IFF_RUNNING;
@@ -378,6 +544,10 @@ device_open (ipc_port_t reply_port, mach_msg_type_name_t reply_port_type,
       ifp->if_address = dev->dev_addr;
       if_init_queues (ifp);
 
+      /* netif_rx and net_bh use the data as soon as it is set, and
+	 the driver may receive as soon as it is open.  */
+      dev->net_data = nd;
+
       if (dev->open)
 	{
 	  if ((*dev->open) (dev))
@@ -389,6 +559,19 @@ device_open (ipc_port_t reply_port, mach_msg_type_name_t reply_port_type,
 	{
 	  if (nd)
 	    {
+	      struct sk_buff *skb;
+	      unsigned flags;
+
+	      /* The driver may have received before failing.  */
+	      save_flags (flags);
+	      cli ();
+	      dev->net_data = NULL;
+	      if (nd->polling)
+		enable_irq (dev->irq);
+	      restore_flags (flags);
+	      while ((skb = skb_dequeue (&nd->rx_queue)))
+		dev_kfree_skb (skb, FREE_READ);
+
 	      if (nd->port != IP_NULL)
 		{
 		  ipc_kobject_set (nd->port, IKO_NULL, IKOT_NONE);
@@ -396,7 +579,6 @@ device_open (ipc_port_t reply_port, mach_msg_type_name_t reply_port_type,
 		}
 	      kfree ((vm_offset_t) nd, sizeof (struct net_data));
 	      nd = NULL;
-	      dev->net_data = NULL;
 	    }
 	}
       else
@@ -478,38 +660,50 @@ device_write (void *d, ipc_port_t reply_port,
   splx (s);
 
   /* Send packet to filters.  */
-  {
-    struct packet_header *packet;
-    struct ether_header *header;
-    ipc_kmsg_t kmsg;
-
-    kmsg = net_kmsg_get ();
-
-    if (kmsg != IKM_NULL)
-      {
-        /* Suitable for Ethernet only.  */
-        header = (struct ether_header *) (net_kmsg (kmsg)->header);
-        packet = (struct packet_header *) (net_kmsg (kmsg)->packet);
-        memcpy (header, skb->data, sizeof (struct ether_header));
-
-        /* packet is prefixed with a struct packet_header,
-           see include/device/net_status.h.  */
-        memcpy (packet + 1, skb->data + sizeof (struct ether_header),
-                skb->len - sizeof (struct ether_header));
-        packet->length = skb->len - sizeof (struct ether_header)
-                         + sizeof (struct packet_header);
-        packet->type = header->ether_type;
-        net_kmsg (kmsg)->sent = TRUE; /* Mark packet as sent.  */
-        s = splimp ();
-        net_packet (&dev->net_data->ifnet, kmsg, packet->length,
-                    ethernet_priority (kmsg));
-        splx (s);
-      }
-  }
+  net_echo (dev, skb->data, skb->len);
 
   return MIG_NO_REPLY;
 }
 
+/* Send the frame DATA of LEN bytes from the transmit ring of IFP.  */
+static io_return_t
+ring_xmit (struct ifnet *ifp, const char *data, unsigned int len)
+{
+  struct net_data *nd = structof (ifp, struct net_data, ifnet);
+  struct linux_device *dev = nd->dev;
+  struct sk_buff *skb;
+  int s;
+
+  if (len < sizeof (struct ether_header))
+    return D_INVALID_SIZE;
+
+  skb = dev_alloc_skb (len);
+  if (!skb)
+    return D_NO_MEMORY;
+
+  memcpy (skb->data, data, len);
+  skb->len = len;
+  skb->head = skb->data;
+  skb->tail = skb->data + skb->len;
+  skb->end = skb->tail;
+  skb->dev = dev;
+
+  /* The driver frees the sk_buff as soon as it is sent, so the
+     filters get their copy first.  */
+  net_echo (dev, skb->data, skb->len);
+
+  s = splimp ();
+  if (dev->buffs[0].next != (struct sk_buff *) &dev->buffs[0]
+      || (*dev->hard_start_xmit) (skb, dev))
+    {
+      __skb_queue_tail (&dev->buffs[0], skb);
+      mark_bh (NET_BH);
+    }
+  splx (s);
+
+  return D_SUCCESS;
+}
+
 
 static io_return_t
 device_get_status (void *d, dev_flavor_t flavor, dev_status_t status,
@@ -526,6 +720,30 @@ device_get_status (void *d, dev_flavor_t flavor, dev_status_t status,
       return D_SUCCESS;
     }
 
+  if (flavor == NET_RX_MITIGATION)
+    {
+      struct net_data *nd = d;
+
+      if (*count < NET_RX_MITIGATION_COUNT)
+	return D_INVALID_SIZE;
+
+      memcpy (status, &nd->rx_mitigation, sizeof nd->rx_mitigation);
+      *count = NET_RX_MITIGATION_COUNT;
+      return D_SUCCESS;
+    }
+
+  if (flavor == NET_RX_STATS)
+    {
+      struct net_data *nd = d;
+
+      if (*count < NET_RX_STATS_COUNT)
+	return D_INVALID_SIZE;
+
+      memcpy (status, &nd->rx_stats, sizeof nd->rx_stats);
+      *count = NET_RX_STATS_COUNT;
+      return D_SUCCESS;
+    }
+
   if(flavor >= SIOCIWFIRST && flavor <= SIOCIWLAST)
     {
       /* handle wireless ioctl */
@@ -600,6 +818,28 @@ device_set_status(void *d, dev_flavor_t flavor, dev_status_t status,
       return D_SUCCESS;
     }
 
+  if (flavor == NET_RX_MITIGATION)
+    {
+      struct net_rx_mitigation *m = (struct net_rx_mitigation *) status;
+      struct net_data *nd = d;
+
+      if (count != NET_RX_MITIGATION_COUNT)
+	return D_INVALID_SIZE;
+      if (m->threshold < 0 || m->budget <= 0)
+	return D_INVALID_OPERATION;
+
+      nd->rx_mitigation = *m;
+      return D_SUCCESS;
+    }
+
+  if (flavor == NET_RING_TXSYNC)
+    {
+      if (count != 1)
+	return D_INVALID_SIZE;
+      return net_ring_txsync (&((struct net_data *) d)->ifnet, status[0],
+			      ring_xmit);
+    }
+
   if(flavor < SIOCIWFIRST || flavor > SIOCIWLAST)
     return D_INVALID_OPERATION;
 
@@ -642,6 +882,25 @@ device_set_filter (void *d, ipc_port_t port, int priority,
 			 port, priority, filter, filter_count);
 }
 
+/* Return a pager for the packet rings of the device.  */
+static io_return_t
+device_map (void *d, vm_prot_t prot, vm_offset_t offset, vm_size_t size,
+	    ipc_port_t *pager, boolean_t unmap)
+{
+  return net_ring_map (&((struct net_data *) d)->ifnet,
+		       prot, offset, size, pager);
+}
+
+/* Read the next packet queued on filter port RCV_NAME into the
+   user buffers described by IOVEC.  */
+static io_return_t
+device_readv_trap (void *d, mach_port_name_t rcv_name, dev_mode_t mode,
+		   rpc_recnum_t recnum, io_buf_vec_t *iovec, unsigned iocount,
+		   vm_size_t *bytes_read)
+{
+  return net_read_trap (rcv_name, mode, iovec, iocount, bytes_read);
+}
+
 struct device_emulation_ops linux_net_emulation_ops =
 {
   NULL,
@@ -656,10 +915,11 @@ struct device_emulation_ops linux_net_emulation_ops =
   device_set_status,
   device_get_status,
   device_set_filter,
+  device_map,
   NULL,
   NULL,
   NULL,
-  NULL
+  device_readv_trap
 };
 
 /* Do any initialization required for network devices.  */
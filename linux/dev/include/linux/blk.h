@@ -460,6 +460,9 @@ static void end_request(int uptodate) {
 	if (req->sem != NULL)
 		up(req->sem);
 	req->rq_status = RQ_INACTIVE;
+#ifdef MACH
+	blk_request_done(req);
+#endif
 	wake_up(&wait_for_request);
 }
 #endif /* defined(IDE_DRIVER) && !defined(_IDE_C) */
@@ -67,6 +67,14 @@ extern int md_error (kdev_t mddev, kdev_t rdev);
 extern int * blk_size[MAX_BLKDEV];
 
 extern int * blksize_size[MAX_BLKDEV];
+#ifdef MACH
+extern int max_segments[MAX_BLKDEV];
+extern int max_sectors[MAX_BLKDEV];
+
+extern void blk_queue_init(int major, int max_depth);
+extern void blk_queue_depth(int major, int unit, int max_depth);
+extern void blk_request_done(struct request *req);
+#endif
 
 extern int * hardsect_size[MAX_BLKDEV];
 
@@ -450,5 +450,6 @@ struct device_emulation_ops linux_pcmcia_emulation_ops =
     NULL, /* map */
     NULL, /* no_senders */
     NULL, /* write_trap */
-    NULL /* writev_trap */
+    NULL, /* writev_trap */
+    NULL /* readv_trap */
   };
@@ -3776,6 +3776,11 @@ static int hwif_init (int h)
 		init_gendisk(hwif);
 		blk_dev[hwif->major].request_fn = rfn;
 		read_ahead[hwif->major] = 8;	/* (4kB) */
+#ifdef MACH
+		/* Keep one request ready behind the running one, and let
+		 * the block scheduler order the others */
+		blk_queue_init(hwif->major, 2);
+#endif
 		hwif->present = 1;	/* success */
 	}
 	return hwif->present;
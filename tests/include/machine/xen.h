@@ -0,0 +1,27 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _TESTLIB_MACHINE_XEN_H
+#define _TESTLIB_MACHINE_XEN_H
+
+/* The memory barriers of the Xen rings, for the user-space tests.  */
+#define mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define rmb() mb()
+#define wmb() mb()
+
+#endif /* _TESTLIB_MACHINE_XEN_H */
@@ -79,5 +79,8 @@ MACH_SYSCALL2(73, kern_return_t, syscall_mach_port_deallocate, mach_port_t, mach
  */
 MACH_SYSCALL6(40, io_return_t, syscall_device_write_request, mach_port_name_t,
               mach_port_name_t, dev_mode_t, recnum_t, vm_offset_t, vm_size_t)
+MACH_SYSCALL7(38, io_return_t, syscall_device_readv_request, mach_port_name_t,
+              mach_port_name_t, dev_mode_t, recnum_t, io_buf_vec_t *,
+              vm_size_t, vm_size_t *)
 
 #endif	/* SYSCALLS */
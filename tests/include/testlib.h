@@ -66,6 +66,18 @@ const char* e2s_gnumach(int err);
 void halt();
 int msleep(uint32_t timeout);
 thread_t test_thread_start(task_t task, void(*routine)(void*), void* arg);
+void test_workers_start(void(*routine)(void*), int nworkers);
+int test_workers_running(void);
+void test_workers_wait(void);
+
+#define TEST_ETH_MIN_FRAME 60
+
+struct bpf_insn;
+mach_port_t test_eth_open(void);
+mach_port_t test_eth_port(mach_port_t eth, const struct bpf_insn *filter,
+                          int len);
+void test_eth_frame(unsigned char *frame, size_t size, unsigned short type);
+void test_eth_warm_up(mach_port_t eth);
 
 mach_port_t host_priv(void);
 mach_port_t device_priv(void);
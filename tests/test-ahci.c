@@ -0,0 +1,86 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * AHCI disk: read a disk of zeroes from several threads at once, so
+ * that the driver has several commands queued on the port, and check
+ * the data.  Kernels without the AHCI driver have no sd0, which is not
+ * a failure.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <device/device.h>
+#include <mach/vm_param.h>
+
+#include <device.user.h>
+#include <mach.user.h>
+
+#define NWORKERS	8
+#define ROUNDS		200
+#define NBLOCKS		16384	/* 64 MiB disk, in pages */
+
+static mach_port_t disk;
+
+static void worker(void *arg)
+{
+  unsigned int seed = (unsigned long) arg + 1;
+  io_buf_ptr_t data;
+  mach_msg_type_number_t count;
+  int err;
+
+  for (int i = 0; i < ROUNDS; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      recnum_t block = (seed >> 8) % NBLOCKS;
+
+      err = device_read(disk, 0, block * (vm_page_size / 512), vm_page_size,
+                        &data, &count);
+      ASSERT_RET(err, "device_read");
+      ASSERT(count == vm_page_size, "short read");
+      for (unsigned int j = 0; j < count; j++)
+        ASSERT(data[j] == 0, "bad data");
+
+      err = vm_deallocate(mach_task_self(), (vm_address_t) data, count);
+      ASSERT_RET(err, "vm_deallocate");
+    }
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  int err;
+
+  err = device_open(device_priv(), D_READ, "sd0", &disk);
+  if (err == D_NO_SUCH_DEVICE)
+    {
+      printf("no AHCI disk\n");
+      return 0;
+    }
+  ASSERT_RET(err, "device_open");
+
+  test_workers_start(worker, NWORKERS);
+  test_workers_wait();
+
+  printf("%d random reads done\n", NWORKERS * ROUNDS);
+
+  err = device_close(disk);
+  ASSERT_RET(err, "device_close");
+
+  return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Block device throughput benchmark: write and read back the disks
+ * sequentially with growing transfer sizes, so that the block glue can
+ * build large scatter-gather requests, and check that the data read
+ * back is zeroes.  Disks that the kernel doesn't have are skipped.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <device/device.h>
+#include <mach/vm_param.h>
+
+#include <device.user.h>
+#include <mach.user.h>
+#include <mach_host.user.h>
+
+#define DISK_SIZE	(32 * 1024 * 1024)
+
+static const char *const disks[] = { "sd0", "hd0" };
+static const vm_size_t sizes[] = { 4096, 65536, 262144, 1048576 };
+
+static long elapsed(time_value_t *start)
+{
+  time_value_t stop;
+  int err;
+
+  err = host_get_time(mach_host_self(), &stop);
+  ASSERT_RET(err, "host_get_time");
+  return (stop.seconds - start->seconds) * 1000000
+         + (stop.microseconds - start->microseconds);
+}
+
+/* Throughput in KiB/s of a whole disk pass that took usec.  */
+static long rate(long usec)
+{
+  return (long long) (DISK_SIZE / 1024) * 1000000 / (usec ? usec : 1);
+}
+
+static void bench(mach_port_t disk, const char *name, vm_size_t size)
+{
+  time_value_t start;
+  vm_address_t buf;
+  io_buf_ptr_t data;
+  mach_msg_type_number_t count;
+  int err, written;
+  long usec;
+
+  err = vm_allocate(mach_task_self(), &buf, size, TRUE);
+  ASSERT_RET(err, "vm_allocate");
+
+  err = host_get_time(mach_host_self(), &start);
+  ASSERT_RET(err, "host_get_time");
+  for (vm_size_t off = 0; off < DISK_SIZE; off += size)
+    {
+      err = device_write(disk, 0, off / 512, (io_buf_ptr_t) buf, size,
+                         &written);
+      ASSERT_RET(err, "device_write");
+      ASSERT(written == (int) size, "short write");
+    }
+  usec = elapsed(&start);
+  printf("%s: write %u KiB at a time: %ld KiB/s\n", name,
+         (unsigned) (size / 1024), rate(usec));
+
+  err = vm_deallocate(mach_task_self(), buf, size);
+  ASSERT_RET(err, "vm_deallocate");
+
+  err = host_get_time(mach_host_self(), &start);
+  ASSERT_RET(err, "host_get_time");
+  for (vm_size_t off = 0; off < DISK_SIZE; off += size)
+    {
+      err = device_read(disk, 0, off / 512, size, &data, &count);
+      ASSERT_RET(err, "device_read");
+      ASSERT(count == size, "short read");
+      if (off == 0)
+        for (unsigned int j = 0; j < count; j++)
+          ASSERT(data[j] == 0, "bad data");
+      err = vm_deallocate(mach_task_self(), (vm_address_t) data, count);
+      ASSERT_RET(err, "vm_deallocate");
+    }
+  usec = elapsed(&start);
+  printf("%s: read %u KiB at a time: %ld KiB/s\n", name,
+         (unsigned) (size / 1024), rate(usec));
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  mach_port_t disk;
+  int err, ndisks = 0;
+
+  for (int i = 0; i < sizeof(disks) / sizeof(disks[0]); i++)
+    {
+      err = device_open(device_priv(), D_READ | D_WRITE, disks[i], &disk);
+      if (err == D_NO_SUCH_DEVICE)
+        {
+          printf("no %s disk\n", disks[i]);
+          continue;
+        }
+      ASSERT_RET(err, "device_open");
+
+      for (int j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+        bench(disk, disks[i], sizes[j]);
+
+      err = device_close(disk);
+      ASSERT_RET(err, "device_close");
+      ndisks++;
+    }
+
+  printf("%d disks measured\n", ndisks);
+  return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Block scheduler: threads read interleaved pages of a disk of zeroes,
+ * so that their requests are adjacent and can be merged, then check
+ * the queue statistics, and that those of a second disk on another
+ * port did not move.  Kernels without the AHCI driver have no sd0,
+ * which is not a failure.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <device/device.h>
+#include <device/blkio_status.h>
+#include <mach/vm_param.h>
+
+#include <device.user.h>
+#include <mach.user.h>
+
+#define NWORKERS	8
+#define ROUNDS		256
+
+static mach_port_t disk;
+
+static void worker(void *arg)
+{
+  long id = (long) arg;
+  io_buf_ptr_t data;
+  mach_msg_type_number_t count;
+  int err;
+
+  for (int i = 0; i < ROUNDS; i++)
+    {
+      recnum_t block = i * NWORKERS + id;
+
+      err = device_read(disk, 0, block * (vm_page_size / 512), vm_page_size,
+                        &data, &count);
+      ASSERT_RET(err, "device_read");
+      ASSERT(count == vm_page_size, "short read");
+      for (unsigned int j = 0; j < count; j++)
+        ASSERT(data[j] == 0, "bad data");
+
+      err = vm_deallocate(mach_task_self(), (vm_address_t) data, count);
+      ASSERT_RET(err, "vm_deallocate");
+    }
+}
+
+static void get_status(mach_port_t dev, struct blkio_status *status)
+{
+  mach_msg_type_number_t count;
+  int err;
+
+  count = BLKIO_STATUS_COUNT;
+  err = device_get_status(dev, BLKIO_STATUS, (dev_status_t) status, &count);
+  ASSERT_RET(err, "device_get_status");
+  ASSERT(count == BLKIO_STATUS_COUNT, "bad status count");
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  struct blkio_status status, other_before, other;
+  mach_port_t other_disk;
+  int err;
+
+  err = device_open(device_priv(), D_READ, "sd0", &disk);
+  if (err == D_NO_SUCH_DEVICE)
+    {
+      printf("no AHCI disk\n");
+      return 0;
+    }
+  ASSERT_RET(err, "device_open");
+  err = device_open(device_priv(), D_READ, "sd1", &other_disk);
+  ASSERT_RET(err, "device_open sd1");
+  get_status(other_disk, &other_before);
+
+  test_workers_start(worker, NWORKERS);
+  test_workers_wait();
+
+  get_status(disk, &status);
+  get_status(other_disk, &other);
+
+  printf("%d reads, %d writes, %d merges\n",
+         status.reads, status.writes, status.merges);
+  printf("depth %d, peak %d, average %d.%02d, limit %d\n",
+         status.depth, status.peak_depth, status.avg_depth / 100,
+         status.avg_depth % 100, status.max_depth);
+  printf("latency %d usec average, %d usec max\n",
+         status.avg_latency, status.max_latency);
+
+  ASSERT(status.reads > 0, "no reads accounted");
+  ASSERT(status.reads + status.merges >= NWORKERS * ROUNDS,
+         "lost requests");
+  ASSERT(status.queued == 0 && status.depth == 0, "requests left over");
+  ASSERT(status.peak_depth <= status.max_depth, "queue depth exceeded");
+  ASSERT(status.max_latency >= status.avg_latency, "bad latency");
+  ASSERT(other.reads == other_before.reads
+         && other.writes == other_before.writes,
+         "requests accounted to the other disk");
+
+  err = device_close(other_disk);
+  ASSERT_RET(err, "device_close");
+  err = device_close(disk);
+  ASSERT_RET(err, "device_close");
+
+  return 0;
+}
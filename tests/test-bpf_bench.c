@@ -0,0 +1,159 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Packet filter throughput: install one plain BPF filter per session on
+ * the outgoing side of eth0, and one filter with a MATCH instruction
+ * per session, which share a hash header and go through bpf_match.
+ * Then send packets to every session in turn, check that each of them
+ * reaches both ports of its session, and report the rate.  Every sent
+ * packet runs through all the filters.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <device/device.h>
+#include <device/net_status.h>
+
+#include <device.user.h>
+#include <mach.user.h>
+#include <mach_host.user.h>
+
+#define ETHERTYPE_TEST	0x88b5		/* local experimental */
+#define NSESSIONS	8
+#define NPACKETS	4000
+
+static mach_port_t eth;
+static mach_port_t plain[NSESSIONS];
+static mach_port_t hashed[NSESSIONS];
+
+static struct net_rcv_msg msg;
+
+static long elapsed(time_value_t *start)
+{
+  time_value_t stop;
+  int err;
+
+  err = host_get_time(mach_host_self(), &stop);
+  ASSERT_RET(err, "host_get_time");
+  return (stop.seconds - start->seconds) * 1000000
+         + (stop.microseconds - start->microseconds);
+}
+
+static void add_session(unsigned short session)
+{
+  struct bpf_insn plain_filter[] = {
+    { NETF_BPF | NETF_OUT, 0, 0, 0 },
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETHERTYPE_TEST, 0, 3),
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 14),
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, session, 0, 1),
+    BPF_STMT(BPF_RET|BPF_K, -1),
+    BPF_STMT(BPF_RET|BPF_K, 0),
+  };
+  struct bpf_insn match_filter[] = {
+    { NETF_BPF | NETF_OUT, 0, 0, 0 },
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETHERTYPE_TEST, 0, 4),
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 14),
+    BPF_STMT(BPF_ST, 0),
+    BPF_RETMATCH(BPF_RET|BPF_MATCH_IMM, -1, 1),
+    BPF_STMT(BPF_MISC|BPF_KEY, session),
+    BPF_STMT(BPF_RET|BPF_K, 0),
+  };
+
+  plain[session] = test_eth_port(eth, plain_filter,
+                                 sizeof plain_filter / sizeof plain_filter[0]);
+  hashed[session] = test_eth_port(eth, match_filter,
+                                  sizeof match_filter / sizeof match_filter[0]);
+}
+
+/* Receive the packet for SESSION on PORT, or return an error.  */
+static int receive(mach_port_t port, unsigned short session,
+                   mach_msg_timeout_t timeout)
+{
+  unsigned char *data;
+  int err;
+
+  err = mach_msg(&msg.msg_hdr, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0,
+                 sizeof msg, port, timeout, MACH_PORT_NULL);
+  if (err != MACH_MSG_SUCCESS)
+    return err;
+
+  ASSERT(msg.msg_hdr.msgh_id == NET_RCV_MSG_ID, "not a packet");
+  data = (unsigned char *) msg.packet + sizeof (struct packet_header);
+  ASSERT(((data[0] << 8) | data[1]) == session, "wrong session");
+  return 0;
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  unsigned char frame[TEST_ETH_MIN_FRAME];
+  mach_msg_type_number_t written;
+  time_value_t start;
+  long usec;
+  int err;
+
+  eth = test_eth_open();
+
+  for (int s = 0; s < NSESSIONS; s++)
+    add_session(s);
+
+  test_eth_warm_up(eth);
+  test_eth_frame(frame, sizeof frame, ETHERTYPE_TEST);
+
+  err = host_get_time(mach_host_self(), &start);
+  ASSERT_RET(err, "host_get_time");
+
+  for (int i = 0; i < NPACKETS; i++)
+    {
+      unsigned short session = i % NSESSIONS;
+
+      frame[14] = session >> 8;
+      frame[15] = session & 0xff;
+      err = device_write_inband(eth, 0, 0, (char *) frame, sizeof frame,
+                                &written);
+      ASSERT_RET(err, "device_write_inband");
+      ASSERT(written == sizeof frame, "short write");
+
+      err = receive(plain[session], session, 1000);
+      ASSERT_RET(err, "packet missed by its filter");
+      err = receive(hashed[session], session, 1000);
+      ASSERT_RET(err, "packet missed by its hash entry");
+    }
+
+  usec = elapsed(&start);
+  printf("%d packets through %d filters: %ld packets/s\n", NPACKETS,
+         2 * NSESSIONS,
+         (long) ((long long) NPACKETS * 1000000 / (usec ? usec : 1)));
+
+  /* No packet may have gone to another session.  */
+  for (int s = 0; s < NSESSIONS; s++)
+    {
+      ASSERT(receive(plain[s], s, 0) == MACH_RCV_TIMED_OUT,
+             "stray packet on a filter port");
+      ASSERT(receive(hashed[s], s, 0) == MACH_RCV_TIMED_OUT,
+             "stray packet on a hash entry port");
+    }
+
+  err = device_close(eth);
+  ASSERT_RET(err, "device_close");
+
+  return 0;
+}
@@ -0,0 +1,483 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * BPF compiler against interpreter: set every program below twice on
+ * the outgoing side of eth0, once interpreted and once compiled, by
+ * toggling host_bpf_jit_control.  Then send packets of random contents and
+ * lengths, and check that both copies of each program accept the same
+ * packets and deliver the same number of bytes.  The programs cover
+ * every instruction the compiler handles, with the value of A
+ * reflected in the number of bytes delivered.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <device/bpf.h>
+#include <device/device.h>
+#include <device/net_status.h>
+
+#include <device.user.h>
+#include <mach.user.h>
+#include <mach_debug.user.h>
+
+#define ETHERTYPE_TEST	0x88b5		/* local experimental */
+#define NPACKETS	400
+#define MAX_FRAME	1514
+#define NRETRIES	3
+
+struct program
+{
+  const char *name;
+  const struct bpf_insn *insns;
+  int len;
+};
+
+static const struct bpf_insn absolute_loads[] = {
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 0),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 6),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 13),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 16),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+};
+
+/* The Ethernet header is 14 bytes long.  */
+static const struct bpf_insn straddling_loads[] = {
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 12),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 13),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 11),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 14),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+};
+
+static const struct bpf_insn indexed_loads[] = {
+  BPF_STMT(BPF_LDX|BPF_IMM, 3),
+  BPF_STMT(BPF_LD|BPF_W|BPF_IND, 11),
+  BPF_STMT(BPF_ST, 0),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 20),
+  BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0x3f),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_H|BPF_IND, 12),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_MEM, 0),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+  BPF_STMT(BPF_ST, 0),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 21),
+  BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0x7f),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_B|BPF_IND, 9),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_MEM, 0),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+};
+
+/* Loads around the end of the packet buffer, NET_RCV_MAX bytes.  */
+static const struct bpf_insn bounded_loads[] = {
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 22),
+  BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0x7),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, NET_RCV_MAX - 7),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 23),
+  BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x1, 0, 2),
+  BPF_STMT(BPF_LD|BPF_W|BPF_IND, 0),
+  BPF_JUMP(BPF_JMP|BPF_JA, 4, 0, 0),
+  BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x2, 0, 2),
+  BPF_STMT(BPF_LD|BPF_H|BPF_IND, 0),
+  BPF_JUMP(BPF_JMP|BPF_JA, 1, 0, 0),
+  BPF_STMT(BPF_LD|BPF_B|BPF_IND, 0),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+};
+
+static const struct bpf_insn msh_loads[] = {
+  BPF_STMT(BPF_LDX|BPF_MSH|BPF_B, 14),
+  BPF_STMT(BPF_MISC|BPF_TXA, 0),
+  BPF_STMT(BPF_ST, 1),
+  BPF_STMT(BPF_LDX|BPF_MSH|BPF_B, 23),
+  BPF_STMT(BPF_LD|BPF_B|BPF_IND, 14),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_MEM, 1),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+};
+
+static const struct bpf_insn length_loads[] = {
+  BPF_STMT(BPF_LDX|BPF_W|BPF_LEN, 0),
+  BPF_STMT(BPF_LD|BPF_W|BPF_LEN, 0),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+  BPF_STMT(BPF_ALU|BPF_MUL|BPF_K, 3),
+};
+
+/* X is 0 for one packet out of eight.  */
+static const struct bpf_insn division_by_x[] = {
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 24),
+  BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0x7),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 16),
+  BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),
+};
+
+static const struct bpf_insn division_by_k[] = {
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 16),
+  BPF_STMT(BPF_ALU|BPF_DIV|BPF_K, 7),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 20),
+  BPF_STMT(BPF_ALU|BPF_DIV|BPF_K, 3),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+};
+
+static const struct bpf_insn jset[] = {
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 15),
+  BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x10, 0, 2),
+  BPF_STMT(BPF_LD|BPF_IMM, 100),
+  BPF_JUMP(BPF_JMP|BPF_JA, 1, 0, 0),
+  BPF_STMT(BPF_LD|BPF_IMM, 200),
+  BPF_STMT(BPF_ST, 2),
+  BPF_STMT(BPF_LDX|BPF_IMM, 0x21),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 16),
+  BPF_JUMP(BPF_JMP|BPF_JSET|BPF_X, 0, 0, 2),
+  BPF_STMT(BPF_LD|BPF_MEM, 2),
+  BPF_JUMP(BPF_JMP|BPF_JA, 2, 0, 0),
+  BPF_STMT(BPF_LD|BPF_MEM, 2),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 7),
+};
+
+static const struct bpf_insn alu_k[] = {
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 16),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 0x12345),
+  BPF_STMT(BPF_ALU|BPF_SUB|BPF_K, 0x777),
+  BPF_STMT(BPF_ALU|BPF_MUL|BPF_K, 13),
+  BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0xfff0f),
+  BPF_STMT(BPF_ALU|BPF_OR|BPF_K, 0x300),
+  BPF_STMT(BPF_ALU|BPF_LSH|BPF_K, 3),
+  BPF_STMT(BPF_ALU|BPF_RSH|BPF_K, 5),
+  BPF_STMT(BPF_ALU|BPF_NEG, 0),
+  BPF_STMT(BPF_ALU|BPF_RSH|BPF_K, 7),
+};
+
+static const struct bpf_insn alu_x[] = {
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 20),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 16),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 24),
+  BPF_STMT(BPF_ALU|BPF_SUB|BPF_X, 0),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 28),
+  BPF_STMT(BPF_ALU|BPF_MUL|BPF_X, 0),
+};
+
+static const struct bpf_insn logic_x[] = {
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 16),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 20),
+  BPF_STMT(BPF_ALU|BPF_AND|BPF_X, 0),
+  BPF_STMT(BPF_ST, 3),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 36),
+  BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0x1f),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_MEM, 3),
+  BPF_STMT(BPF_ALU|BPF_LSH|BPF_X, 0),
+  BPF_STMT(BPF_ST, 4),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 37),
+  BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0x1f),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_MEM, 4),
+  BPF_STMT(BPF_ALU|BPF_RSH|BPF_X, 0),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 24),
+  BPF_STMT(BPF_ALU|BPF_OR|BPF_X, 0),
+};
+
+/* Each comparison which holds sets a bit of the result.  */
+static const struct bpf_insn comparisons_k[] = {
+  BPF_STMT(BPF_LD|BPF_IMM, 0),
+  BPF_STMT(BPF_ST, 5),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 16),
+  BPF_JUMP(BPF_JMP|BPF_JGT|BPF_K, 0x80000000, 0, 2),
+  BPF_STMT(BPF_LD|BPF_IMM, 1),
+  BPF_STMT(BPF_ST, 5),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 18),
+  BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 0x4, 0, 3),
+  BPF_STMT(BPF_LD|BPF_MEM, 5),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 2),
+  BPF_STMT(BPF_ST, 5),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 19),
+  BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x7, 0, 3),
+  BPF_STMT(BPF_LD|BPF_MEM, 5),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 4),
+  BPF_STMT(BPF_ST, 5),
+  BPF_STMT(BPF_LD|BPF_MEM, 5),
+};
+
+static const struct bpf_insn comparisons_x[] = {
+  BPF_STMT(BPF_LD|BPF_IMM, 0),
+  BPF_STMT(BPF_ST, 5),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 20),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 24),
+  BPF_JUMP(BPF_JMP|BPF_JGT|BPF_X, 0, 0, 2),
+  BPF_STMT(BPF_LD|BPF_IMM, 1),
+  BPF_STMT(BPF_ST, 5),
+  BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 20),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 22),
+  BPF_JUMP(BPF_JMP|BPF_JGE|BPF_X, 0, 0, 3),
+  BPF_STMT(BPF_LD|BPF_MEM, 5),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 2),
+  BPF_STMT(BPF_ST, 5),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 20),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 24),
+  BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_X, 0, 0, 3),
+  BPF_STMT(BPF_LD|BPF_MEM, 5),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 4),
+  BPF_STMT(BPF_ST, 5),
+  BPF_STMT(BPF_LD|BPF_MEM, 5),
+};
+
+static const struct bpf_insn scratch_memory[] = {
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 16),
+  BPF_STMT(BPF_ST, 15),
+  BPF_STMT(BPF_LDX|BPF_MEM, 15),
+  BPF_STMT(BPF_STX, 0),
+  BPF_STMT(BPF_LD|BPF_IMM, 5),
+  BPF_STMT(BPF_LDX|BPF_IMM, 9),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_MEM, 0),
+  BPF_STMT(BPF_ALU|BPF_SUB|BPF_X, 0),
+};
+
+/* Byte loads are sign-extended.  */
+static const struct bpf_insn signed_loads[] = {
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 30),
+  BPF_STMT(BPF_MISC|BPF_TAX, 0),
+  BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 31),
+  BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+  BPF_STMT(BPF_ALU|BPF_RSH|BPF_K, 2),
+};
+
+/* Returns of their own, the length clipped to the packet.  */
+static const struct bpf_insn returns[] = {
+  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 17),
+  BPF_JUMP(BPF_JMP|BPF_JGT|BPF_K, 0x10, 1, 0),
+  BPF_STMT(BPF_RET|BPF_K, 90),
+  BPF_JUMP(BPF_JMP|BPF_JGT|BPF_K, 0x40, 1, 0),
+  BPF_STMT(BPF_RET|BPF_K, 5000),
+  BPF_JUMP(BPF_JMP|BPF_JGT|BPF_K, 0x60, 1, 0),
+  BPF_STMT(BPF_RET|BPF_K, 0),
+  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 20),
+  BPF_STMT(BPF_RET|BPF_A, 0),
+};
+
+#define PROGRAM(p)	{ #p, p, sizeof p / sizeof p[0] }
+
+static const struct program programs[] = {
+  PROGRAM(absolute_loads),
+  PROGRAM(straddling_loads),
+  PROGRAM(indexed_loads),
+  PROGRAM(bounded_loads),
+  PROGRAM(msh_loads),
+  PROGRAM(length_loads),
+  PROGRAM(division_by_x),
+  PROGRAM(division_by_k),
+  PROGRAM(jset),
+  PROGRAM(alu_k),
+  PROGRAM(alu_x),
+  PROGRAM(logic_x),
+  PROGRAM(comparisons_k),
+  PROGRAM(comparisons_x),
+  PROGRAM(scratch_memory),
+  PROGRAM(signed_loads),
+  PROGRAM(returns),
+};
+
+#define NPROGRAMS	(sizeof programs / sizeof programs[0])
+
+static mach_port_t eth;
+static mach_port_t sentinel;
+static mach_port_t interpreted[NPROGRAMS];
+static mach_port_t compiled[NPROGRAMS];
+static int delivered[NPROGRAMS];
+
+static struct net_rcv_msg msg;
+static unsigned char frame[MAX_FRAME];
+static unsigned int seed = 1;
+
+static unsigned int rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+static void set_jit(int enable)
+{
+  int err;
+
+  err = host_bpf_jit_control(host_priv(), enable);
+  ASSERT_RET(err, "host_bpf_jit_control");
+}
+
+/* Set PROGRAM on a new port, only for packets of our ethertype, and with
+   the result in A turned into a number of bytes to deliver.  */
+static mach_port_t set_program(const struct program *program)
+{
+  struct bpf_insn filter[NET_MAX_BPF];
+  int len;
+
+  ASSERT(program->len + 7 <= NET_MAX_BPF, "program too long");
+  len = 0;
+  filter[len++] = (struct bpf_insn) { NETF_BPF | NETF_OUT, 0, 0, 0 };
+  filter[len++] = (struct bpf_insn) BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12);
+  filter[len++] = (struct bpf_insn)
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETHERTYPE_TEST, 0, program->len + 3);
+  memcpy(&filter[len], program->insns, program->len * sizeof filter[0]);
+  len += program->len;
+  filter[len++] = (struct bpf_insn) BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0x3ff);
+  filter[len++] = (struct bpf_insn) BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 64);
+  filter[len++] = (struct bpf_insn) BPF_STMT(BPF_RET|BPF_A, 0);
+  filter[len++] = (struct bpf_insn) BPF_STMT(BPF_RET|BPF_K, 0);
+
+  return test_eth_port(eth, filter, len);
+}
+
+/* Return the number of bytes delivered on PORT, or -1 if none were.  */
+static int receive(mach_port_t port, mach_msg_timeout_t timeout)
+{
+  int err;
+
+  err = mach_msg(&msg.msg_hdr, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0,
+                 sizeof msg, port, timeout, MACH_PORT_NULL);
+  if (err == MACH_RCV_TIMED_OUT)
+    return -1;
+  ASSERT_RET(err, "mach_msg");
+  ASSERT(msg.msg_hdr.msgh_id == NET_RCV_MSG_ID, "not a packet");
+  return msg.packet_type.msgt_number;
+}
+
+static void send(int len)
+{
+  int written;
+  int err;
+
+  err = device_write(eth, 0, 0, (io_buf_ptr_t) frame, len, &written);
+  ASSERT_RET(err, "device_write");
+  ASSERT(written == len, "short write");
+}
+
+/* Send the LEN bytes of FRAME and compare what the two copies of each
+   program delivered.  Return FALSE if a copy missed the packet, which
+   happens when the network buffers run out.  */
+static boolean_t check_packet(int len, boolean_t last_try)
+{
+  boolean_t ok = TRUE;
+
+  send(len);
+  ASSERT(receive(sentinel, 1000) >= 0, "packet not sent");
+
+  /* The filters all ran when the packet reached the sentinel.  */
+  for (int i = 0; i < NPROGRAMS; i++)
+    {
+      int interp = receive(interpreted[i], 0);
+      int jit = receive(compiled[i], 0);
+
+      if (interp == jit)
+        {
+          if (interp >= 0)
+            delivered[i]++;
+          continue;
+        }
+
+      if (!last_try)
+        {
+          ok = FALSE;
+          continue;
+        }
+      printf("%s: %d bytes interpreted, %d compiled, packet of %d bytes\n",
+             programs[i].name, interp, jit, len);
+      FAILURE("compiled filter differs from the interpreter");
+    }
+
+  return ok;
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  const struct bpf_insn sentinel_filter[] = {
+    { NETF_BPF | NETF_OUT, 0, 0, 0 },
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETHERTYPE_TEST, 0, 1),
+    BPF_STMT(BPF_RET|BPF_K, -1),
+    BPF_STMT(BPF_RET|BPF_K, 0),
+  };
+  mach_msg_type_number_t count;
+  int jit_enable;
+  int err;
+
+  eth = test_eth_open();
+
+  count = 1;
+  err = device_get_status(eth, NET_BPF_JIT, &jit_enable, &count);
+  ASSERT_RET(err, "device_get_status NET_BPF_JIT");
+  err = device_set_status(eth, NET_BPF_JIT, &jit_enable, 1);
+  ASSERT(err == D_INVALID_OPERATION, "NET_BPF_JIT set through the device");
+
+  set_jit(0);
+  for (int i = 0; i < NPROGRAMS; i++)
+    interpreted[i] = set_program(&programs[i]);
+  set_jit(1);
+  for (int i = 0; i < NPROGRAMS; i++)
+    compiled[i] = set_program(&programs[i]);
+  set_jit(jit_enable);
+
+  sentinel = test_eth_port(eth, sentinel_filter,
+                           sizeof sentinel_filter / sizeof sentinel_filter[0]);
+  test_eth_warm_up(eth);
+  test_eth_frame(frame, sizeof frame, ETHERTYPE_TEST);
+
+  for (int n = 0; n < NPACKETS; n++)
+    {
+      int len = 60 + rand() % (MAX_FRAME - 60 + 1);
+
+      /* Small values make equalities and zero divisors likely.  */
+      for (int i = 14; i < len; i++)
+        frame[i] = (n & 1) ? rand() : rand() % 8;
+
+      for (int try = 1; !check_packet(len, try == NRETRIES); try++)
+        msleep(100);
+    }
+
+  for (int i = 0; i < NPROGRAMS; i++)
+    printf("%s: %d packets delivered\n", programs[i].name, delivered[i]);
+
+  err = device_close(eth);
+  ASSERT_RET(err, "device_close");
+
+  return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <mach/policy.h>
+#include <mach/thread_info.h>
+
+#include <gnumach.user.h>
+#include <mach.user.h>
+#include <mach_host.user.h>
+
+#define NHOGS		4
+#define PERIOD_MS	50
+#define NPERIODS	40
+
+static volatile int periods_done;
+static volatile unsigned long progress;
+
+static void hog_thread(void *arg)
+{
+  while (1)
+    ;
+}
+
+static void counter_thread(void *arg)
+{
+  while (1)
+    progress++;
+}
+
+static void idle_thread(void *arg)
+{
+  while (1)
+    msleep(1000);
+}
+
+/* A few milliseconds of work, then sleep until the next period.  */
+static void periodic_thread(void *arg)
+{
+  volatile unsigned long sum = 0;
+
+  for (int i = 0; i < NPERIODS; i++)
+    {
+      for (unsigned long j = 0; j < 100000; j++)
+        sum += j;
+      periods_done++;
+      msleep(PERIOD_MS);
+    }
+
+  while (1)
+    msleep(1000);
+}
+
+static int set_deadline(thread_t thread, int runtime, int period, int deadline)
+{
+  struct policy_deadline_param param;
+
+  param.runtime = runtime;
+  param.period = period;
+  param.deadline = deadline;
+  return thread_set_policy(thread, POLICY_DEADLINE, (policy_param_t)&param,
+                           POLICY_DEADLINE_PARAM_COUNT);
+}
+
+static void enable_deadline_policy(void)
+{
+  processor_set_name_t name;
+  processor_set_t pset;
+  int err;
+
+  err = processor_set_default(mach_host_self(), &name);
+  ASSERT_RET(err, "processor_set_default");
+  err = host_processor_set_priv(host_priv(), name, &pset);
+  ASSERT_RET(err, "host_processor_set_priv");
+  err = processor_set_policy_enable(pset, POLICY_DEADLINE);
+  ASSERT_RET(err, "processor_set_policy_enable");
+}
+
+static void test_params(void)
+{
+  thread_t t;
+  int err;
+
+  t = test_thread_start(mach_task_self(), idle_thread, 0);
+
+  err = thread_policy(t, POLICY_DEADLINE, 0);
+  ASSERT(err == KERN_INVALID_ARGUMENT, "thread_policy without parameters");
+  err = set_deadline(t, 0, 10000, 10000);
+  ASSERT(err == KERN_INVALID_ARGUMENT, "zero runtime");
+  err = set_deadline(t, 20000, 10000, 10000);
+  ASSERT(err == KERN_INVALID_ARGUMENT, "runtime above deadline");
+  err = set_deadline(t, 5000, 10000, 20000);
+  ASSERT(err == KERN_INVALID_ARGUMENT, "deadline above period");
+
+  err = thread_terminate(t);
+  ASSERT_RET(err, "thread_terminate");
+}
+
+static void test_admission(void)
+{
+  host_basic_info_data_t binfo;
+  mach_msg_type_number_t count;
+  thread_t threads[16];
+  int err, i, admitted;
+
+  count = HOST_BASIC_INFO_COUNT;
+  err = host_info(mach_host_self(), HOST_BASIC_INFO,
+                  (host_info_t)&binfo, &count);
+  ASSERT_RET(err, "host_info");
+  ASSERT(binfo.avail_cpus < 16, "too many cpus for this test");
+
+  /* Each thread reserves 90% of a processor.  */
+  admitted = 0;
+  for (i = 0; i <= binfo.avail_cpus; i++)
+    {
+      threads[i] = test_thread_start(mach_task_self(), idle_thread, 0);
+      err = set_deadline(threads[i], 90000, 100000, 100000);
+      if (err == KERN_SUCCESS)
+        admitted++;
+      else
+        ASSERT(err == KERN_RESOURCE_SHORTAGE, "admission error");
+    }
+  printf("admitted %d deadline threads on %d cpus\n",
+         admitted, binfo.avail_cpus);
+  ASSERT(admitted == binfo.avail_cpus, "admission control");
+
+  for (i = 0; i <= binfo.avail_cpus; i++)
+    {
+      err = thread_policy(threads[i], POLICY_TIMESHARE, 0);
+      ASSERT_RET(err, "thread_policy");
+      err = thread_terminate(threads[i]);
+      ASSERT_RET(err, "thread_terminate");
+    }
+}
+
+static void test_misses(void)
+{
+  struct thread_deadline_info info;
+  mach_msg_type_number_t count;
+  thread_t hogs[NHOGS], t;
+  int err, i;
+
+  for (i = 0; i < NHOGS; i++)
+    hogs[i] = test_thread_start(mach_task_self(), hog_thread, 0);
+
+  t = test_thread_start(mach_task_self(), periodic_thread, 0);
+  err = set_deadline(t, 20000, PERIOD_MS * 1000, PERIOD_MS * 1000);
+  ASSERT_RET(err, "thread_set_policy");
+
+  while (periods_done < NPERIODS)
+    msleep(PERIOD_MS);
+
+  count = THREAD_DEADLINE_INFO_COUNT;
+  err = thread_info(t, THREAD_DEADLINE_INFO, (thread_info_t)&info, &count);
+  ASSERT_RET(err, "thread_info");
+  printf("runtime %d period %d deadline %d: %u periods, %u misses\n",
+         info.runtime, info.period, info.deadline,
+         info.periods, info.misses);
+  ASSERT(info.periods >= NPERIODS / 2, "periods");
+  ASSERT(info.misses == 0, "deadline missed under load");
+
+  err = thread_terminate(t);
+  ASSERT_RET(err, "thread_terminate");
+  for (i = 0; i < NHOGS; i++)
+    {
+      err = thread_terminate(hogs[i]);
+      ASSERT_RET(err, "thread_terminate");
+    }
+}
+
+/* A deadline thread that never stops must not starve timesharing.  */
+static void test_overrun(void)
+{
+  struct thread_deadline_info info;
+  mach_msg_type_number_t count;
+  thread_t hog, counter;
+  unsigned long before;
+  int err;
+
+  counter = test_thread_start(mach_task_self(), counter_thread, 0);
+  hog = test_thread_start(mach_task_self(), hog_thread, 0);
+  err = set_deadline(hog, 10000, PERIOD_MS * 1000, PERIOD_MS * 1000);
+  ASSERT_RET(err, "thread_set_policy");
+
+  before = progress;
+  msleep(NPERIODS * PERIOD_MS);
+
+  count = THREAD_DEADLINE_INFO_COUNT;
+  err = thread_info(hog, THREAD_DEADLINE_INFO, (thread_info_t)&info, &count);
+  ASSERT_RET(err, "thread_info");
+  printf("overrun: %u periods, %u misses, %lu timesharing iterations\n",
+         info.periods, info.misses, progress - before);
+  ASSERT(info.misses > 0, "overrun not counted as missed");
+  ASSERT(progress != before, "timesharing thread starved");
+
+  err = thread_terminate(hog);
+  ASSERT_RET(err, "thread_terminate");
+  err = thread_terminate(counter);
+  ASSERT_RET(err, "thread_terminate");
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  enable_deadline_policy();
+  test_params();
+  test_admission();
+  test_misses();
+  test_overrun();
+  return 0;
+}
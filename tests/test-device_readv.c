@@ -0,0 +1,128 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * device_readv trap: scatter reads of a disk of zeroes into several
+ * buffers, some of them unaligned or crossing pages, and check that
+ * exactly the requested bytes were overwritten.  Kernels without the
+ * AHCI driver have no sd0, which is not a failure.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <device/device.h>
+#include <mach/vm_param.h>
+
+#include <device.user.h>
+#include <mach.user.h>
+
+#define FILL	0xa5
+
+static mach_port_t disk;
+
+static void check_buf(const unsigned char *buf, vm_size_t size,
+                      vm_size_t start, vm_size_t count)
+{
+  for (vm_size_t i = 0; i < size; i++)
+    {
+      if (i >= start && i < start + count)
+        ASSERT(buf[i] == 0, "data not read");
+      else
+        ASSERT(buf[i] == FILL, "data read outside of buffer");
+    }
+}
+
+static void test_readv(void)
+{
+  vm_address_t buf;
+  vm_size_t size = 8 * vm_page_size, n;
+  io_buf_vec_t iov[3];
+  int err;
+
+  err = vm_allocate(mach_task_self(), &buf, size, TRUE);
+  ASSERT_RET(err, "vm_allocate");
+  memset((void *) buf, FILL, size);
+
+  /* Page aligned, then crossing a page boundary, then unaligned.  */
+  iov[0].data = buf;
+  iov[0].count = 2 * vm_page_size;
+  iov[1].data = buf + 3 * vm_page_size - 512;
+  iov[1].count = 2 * vm_page_size;
+  iov[2].data = buf + 6 * vm_page_size + 100;
+  iov[2].count = 1000;
+
+  n = 0;
+  err = syscall_device_readv_request(disk, MACH_PORT_NULL, 0, 8,
+                                     iov, 3, &n);
+  ASSERT_RET(err, "syscall_device_readv_request");
+  ASSERT(n == 4 * vm_page_size + 1000, "short read");
+
+  check_buf((unsigned char *) buf, 2 * vm_page_size, 0, 2 * vm_page_size);
+  check_buf((unsigned char *) buf + 2 * vm_page_size, 4 * vm_page_size,
+            vm_page_size - 512, 2 * vm_page_size);
+  check_buf((unsigned char *) buf + 6 * vm_page_size, 2 * vm_page_size,
+            100, 1000);
+
+  err = vm_deallocate(mach_task_self(), buf, size);
+  ASSERT_RET(err, "vm_deallocate");
+}
+
+static void test_errors(void)
+{
+  char c;
+  io_buf_vec_t iov = { (vm_address_t) &c, 1 };
+  vm_size_t n;
+  int err;
+
+  /* Disks have no filter port to receive from.  */
+  err = syscall_device_readv_request(disk, mach_task_self(), 0, 0,
+                                     &iov, 1, &n);
+  ASSERT(err == KERN_INVALID_RIGHT, "receive port accepted for a disk");
+
+  /* The buffer must be writable.  */
+  iov.data = (vm_address_t) test_errors;
+  err = syscall_device_readv_request(disk, MACH_PORT_NULL, 0, 0,
+                                     &iov, 1, &n);
+  ASSERT(err != D_SUCCESS, "read into a read-only buffer");
+
+  err = syscall_device_readv_request(MACH_PORT_NULL, MACH_PORT_NULL, 0, 0,
+                                     &iov, 1, &n);
+  ASSERT(err == KERN_INVALID_CAPABILITY, "read from no device");
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  int err;
+
+  err = device_open(device_priv(), D_READ, "sd0", &disk);
+  if (err == D_NO_SUCH_DEVICE)
+    {
+      printf("no AHCI disk\n");
+      return 0;
+    }
+  ASSERT_RET(err, "device_open");
+
+  test_readv();
+  test_errors();
+
+  err = device_close(disk);
+  ASSERT_RET(err, "device_close");
+
+  return 0;
+}
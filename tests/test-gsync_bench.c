@@ -0,0 +1,126 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Gsync contention benchmark: pairs of threads pass a turn back
+ * and forth through a shared word, each waiting with gsync_wait
+ * until the other hands the turn over with gsync_wake, so that
+ * all pairs hammer the gsync hash table at once.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <mach_debug/mach_debug_types.h>
+
+#include <gnumach.user.h>
+#include <mach.user.h>
+#include <mach_debug.user.h>
+#include <mach_host.user.h>
+
+#ifndef GSYNC_MUTATE
+# define GSYNC_MUTATE      0x10
+#endif
+
+#define NPAIRS		8
+#define ROUNDS		2000
+
+static struct {
+  uint32_t turn;
+  char pad[60];
+} pairs[NPAIRS];
+
+static volatile int players_done;
+
+static void player(void *arg)
+{
+  long id = (long)arg;
+  uint32_t *turn = &pairs[id / 2].turn;
+  uint32_t me = id % 2;
+  int err;
+
+  for (int i = 0; i < ROUNDS; i++)
+    {
+      while (__atomic_load_n(turn, __ATOMIC_ACQUIRE) != me)
+        {
+          err = gsync_wait(mach_task_self(), (vm_offset_t)turn, !me, 0, 0, 0);
+          ASSERT(err == KERN_SUCCESS || err == KERN_INVALID_ARGUMENT,
+                 "gsync_wait");
+        }
+
+      err = gsync_wake(mach_task_self(), (vm_offset_t)turn, !me, GSYNC_MUTATE);
+      ASSERT_RET(err, "gsync_wake");
+    }
+
+  __atomic_add_fetch(&players_done, 1, __ATOMIC_RELEASE);
+  thread_terminate(mach_thread_self());
+  FAILURE("thread_terminate");
+}
+
+static void print_info(const char *when, const gsync_info_t *info)
+{
+  printf("%s: %u buckets (%u resizes), %u waiters on %u addresses "
+         "in %u buckets, longest chain %u\n", when,
+         info->gsi_nbuckets, info->gsi_resizes, info->gsi_nwaiters,
+         info->gsi_nkeys, info->gsi_used, info->gsi_max_chain);
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  gsync_info_t before, during, after;
+  time_value_t start, stop;
+  long usec;
+  int err;
+
+  err = host_gsync_info(mach_host_self(), &before);
+  ASSERT_RET(err, "host_gsync_info");
+  ASSERT(before.gsi_nbuckets >= 512, "table too small");
+  ASSERT((before.gsi_nbuckets & (before.gsi_nbuckets - 1)) == 0,
+         "table size not a power of 2");
+
+  err = host_get_time(mach_host_self(), &start);
+  ASSERT_RET(err, "host_get_time");
+
+  for (long i = 0; i < 2 * NPAIRS; i++)
+    test_thread_start(mach_task_self(), player, (void *)i);
+
+  msleep(10);
+  err = host_gsync_info(mach_host_self(), &during);
+  ASSERT_RET(err, "host_gsync_info");
+
+  while (players_done < 2 * NPAIRS)
+    msleep(10);
+
+  err = host_get_time(mach_host_self(), &stop);
+  ASSERT_RET(err, "host_get_time");
+  err = host_gsync_info(mach_host_self(), &after);
+  ASSERT_RET(err, "host_gsync_info");
+
+  usec = (stop.seconds - start.seconds) * 1000000
+         + (stop.microseconds - start.microseconds);
+  printf("%d pairs, %d rounds in %ld usec, %ld nsec per handoff\n",
+         NPAIRS, ROUNDS, usec, usec * 1000 / (2L * NPAIRS * ROUNDS));
+  print_info("during", &during);
+  print_info("after", &after);
+  printf("%u lookups, %u contended\n",
+         after.gsi_lookups - before.gsi_lookups,
+         after.gsi_contended - before.gsi_contended);
+  ASSERT(after.gsi_nwaiters == 0, "waiters left behind");
+
+  return 0;
+}
@@ -0,0 +1,259 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Priority inversion regression test: a low priority thread holds a
+ * PI mutex while medium priority threads keep every processor busy.
+ * A high priority thread then blocks on the mutex, which must lend
+ * its priority to the holder so that it can run and release it.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <mach/policy.h>
+#include <mach/thread_info.h>
+
+#include <gnumach.user.h>
+#include <mach.user.h>
+#include <mach_host.user.h>
+
+#ifndef GSYNC_TIMED
+# define GSYNC_TIMED       0x04
+#endif
+#ifndef GSYNC_PI_WAITERS
+# define GSYNC_PI_WAITERS  0x80000000U
+#endif
+
+#define MAIN_PRI	5
+#define HIGH_PRI	10
+#define MEDIUM_PRI	15
+#define LOW_PRI		20
+
+static processor_set_t pset;
+static uint32_t mutex;
+static volatile int low_locked, low_released, high_go, high_done;
+static volatile int high_result;
+
+static void pi_lock(mach_port_t self)
+{
+  uint32_t val = 0;
+  int err;
+
+  if (__atomic_compare_exchange_n(&mutex, &val, self, 0,
+                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return;
+
+  err = gsync_pi_lock(mach_task_self(), (vm_offset_t)&mutex, self, 0, 0);
+  ASSERT_RET(err, "gsync_pi_lock");
+}
+
+static void pi_unlock(mach_port_t self)
+{
+  uint32_t val = self;
+  int err;
+
+  if (__atomic_compare_exchange_n(&mutex, &val, 0, 0,
+                                  __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    return;
+
+  err = gsync_pi_unlock(mach_task_self(), (vm_offset_t)&mutex, self, 0);
+  ASSERT_RET(err, "gsync_pi_unlock");
+}
+
+static void set_fixed_priority(thread_t thread, int pri)
+{
+  int err;
+
+  err = thread_max_priority(thread, pset, 0);
+  ASSERT_RET(err, "thread_max_priority");
+  err = thread_policy(thread, POLICY_FIXEDPRI, 10);
+  ASSERT_RET(err, "thread_policy");
+  err = thread_priority(thread, pri, FALSE);
+  ASSERT_RET(err, "thread_priority");
+}
+
+static int current_priority(thread_t thread)
+{
+  struct thread_sched_info info;
+  mach_msg_type_number_t count = THREAD_SCHED_INFO_COUNT;
+  int err;
+
+  err = thread_info(thread, THREAD_SCHED_INFO, (thread_info_t)&info, &count);
+  ASSERT_RET(err, "thread_info");
+  return info.cur_priority;
+}
+
+static void hog_thread(void *arg)
+{
+  while (1)
+    ;
+}
+
+static void low_thread(void *arg)
+{
+  mach_port_t self = mach_thread_self();
+  volatile unsigned long sum = 0;
+
+  pi_lock(self);
+  low_locked = 1;
+
+  for (unsigned long i = 0; i < 10000000; i++)
+    sum += i;
+
+  pi_unlock(self);
+  low_released = 1;
+
+  while (1)
+    msleep(1000);
+}
+
+static void high_thread(void *arg)
+{
+  mach_port_t self = mach_thread_self();
+  uint32_t val = 0;
+
+  /* Block with the priority we were given.  */
+  while (!high_go)
+    msleep(1);
+
+  if (__atomic_compare_exchange_n(&mutex, &val, self, 0,
+                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    high_result = KERN_SUCCESS;
+  else
+    high_result = gsync_pi_lock(mach_task_self(), (vm_offset_t)&mutex,
+                                self, 10000, GSYNC_TIMED);
+  if (high_result == KERN_SUCCESS)
+    pi_unlock(self);
+  high_done = 1;
+
+  while (1)
+    msleep(1000);
+}
+
+static void test_api(void)
+{
+  mach_port_t self = mach_thread_self();
+  int err;
+
+  mutex = 0;
+  err = gsync_pi_trylock(mach_task_self(), (vm_offset_t)&mutex, self, 0);
+  ASSERT_RET(err, "gsync_pi_trylock on a free mutex");
+  ASSERT(mutex == self, "trylock did not store the owner");
+
+  err = gsync_pi_trylock(mach_task_self(), (vm_offset_t)&mutex, self, 0);
+  ASSERT(err == KERN_FAILURE, "gsync_pi_trylock on a held mutex");
+  err = gsync_pi_lock(mach_task_self(), (vm_offset_t)&mutex, self, 0, 0);
+  ASSERT(err == KERN_INVALID_ARGUMENT, "gsync_pi_lock by the owner");
+  err = gsync_pi_unlock(mach_task_self(), (vm_offset_t)&mutex,
+                        mach_task_self(), 0);
+  ASSERT(err == KERN_INVALID_ARGUMENT, "gsync_pi_unlock with a task name");
+
+  err = gsync_pi_unlock(mach_task_self(), (vm_offset_t)&mutex, self, 0);
+  ASSERT_RET(err, "gsync_pi_unlock");
+  ASSERT(mutex == 0, "unlock did not free the mutex");
+
+  err = gsync_pi_unlock(mach_task_self(), (vm_offset_t)&mutex, self, 0);
+  ASSERT(err == KERN_INVALID_ARGUMENT, "gsync_pi_unlock of a free mutex");
+
+  /* An owner which is not a thread leaves the word as it was.  */
+  mutex = mach_task_self();
+  err = gsync_pi_lock(mach_task_self(), (vm_offset_t)&mutex, self, 0, 0);
+  ASSERT(err == KERN_INVALID_ARGUMENT, "gsync_pi_lock with a task owner");
+  ASSERT(mutex == mach_task_self(), "waiters bit left behind");
+  mutex = 0;
+}
+
+static void test_inversion(void)
+{
+  host_basic_info_data_t binfo;
+  mach_msg_type_number_t count;
+  thread_t hogs[16], low, high;
+  int err, i, boosted;
+
+  count = HOST_BASIC_INFO_COUNT;
+  err = host_info(mach_host_self(), HOST_BASIC_INFO,
+                  (host_info_t)&binfo, &count);
+  ASSERT_RET(err, "host_info");
+  ASSERT(binfo.avail_cpus <= 16, "too many cpus for this test");
+
+  mutex = 0;
+  low = test_thread_start(mach_task_self(), low_thread, 0);
+  set_fixed_priority(low, LOW_PRI);
+  while (!low_locked)
+    msleep(10);
+
+  for (i = 0; i < binfo.avail_cpus; i++)
+    {
+      hogs[i] = test_thread_start(mach_task_self(), hog_thread, 0);
+      set_fixed_priority(hogs[i], MEDIUM_PRI);
+    }
+
+  high = test_thread_start(mach_task_self(), high_thread, 0);
+  set_fixed_priority(high, HIGH_PRI);
+  high_go = 1;
+
+  /* While the high priority thread is blocked, the holder
+     must run at its priority.  */
+  boosted = 0;
+  for (i = 0; i < 1000 && !low_released; i++)
+    {
+      if (current_priority(low) == HIGH_PRI)
+        boosted = 1;
+      msleep(1);
+    }
+
+  for (i = 0; i < 1000 && !high_done; i++)
+    msleep(10);
+
+  ASSERT(high_done, "high priority thread still blocked");
+  ASSERT_RET(high_result, "gsync_pi_lock from the high priority thread");
+  ASSERT(low_released, "low priority thread did not release the mutex");
+  printf("holder boosted: %s\n", boosted ? "yes" : "not observed");
+  ASSERT(current_priority(low) == LOW_PRI, "boost not undone on release");
+
+  for (i = 0; i < binfo.avail_cpus; i++)
+    {
+      err = thread_terminate(hogs[i]);
+      ASSERT_RET(err, "thread_terminate");
+    }
+  err = thread_terminate(high);
+  ASSERT_RET(err, "thread_terminate");
+  err = thread_terminate(low);
+  ASSERT_RET(err, "thread_terminate");
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  processor_set_name_t name;
+  int err;
+
+  err = processor_set_default(mach_host_self(), &name);
+  ASSERT_RET(err, "processor_set_default");
+  err = host_processor_set_priv(host_priv(), name, &pset);
+  ASSERT_RET(err, "host_processor_set_priv");
+  err = processor_set_policy_enable(pset, POLICY_FIXEDPRI);
+  ASSERT_RET(err, "processor_set_policy_enable");
+
+  /* Stay above the busy threads so that we can watch them.  */
+  set_fixed_priority(mach_thread_self(), MAIN_PRI);
+
+  test_api();
+  test_inversion();
+  return 0;
+}
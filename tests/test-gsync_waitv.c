@@ -0,0 +1,132 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <mach/gsync.h>
+
+#include <gnumach.user.h>
+#include <mach.user.h>
+
+#ifndef GSYNC_TIMED
+# define GSYNC_TIMED       0x04
+# define GSYNC_QUAD        0x02
+# define GSYNC_MUTATE      0x10
+#endif
+
+#define NWORDS	8
+
+static uint32_t words[NWORDS];
+
+static void setup(gsync_waitv_t *entries, int n)
+{
+  for (int i = 0; i < n; i++)
+    {
+      words[i] = i;
+      entries[i].addr = (vm_offset_t)&words[i];
+      entries[i].val = i;
+    }
+}
+
+static void waker_thread(void *arg)
+{
+  long which = (long)arg;
+  int err;
+
+  /* Give our creator time to block.  */
+  msleep(100);
+  err = gsync_wake(mach_task_self(), (vm_offset_t)&words[which],
+                   100, GSYNC_MUTATE);
+  ASSERT_RET(err, "gsync_wake from thread");
+
+  thread_terminate(mach_thread_self());
+  FAILURE("thread_terminate");
+}
+
+static void test_errors(void)
+{
+  gsync_waitv_t entries[NWORDS];
+  int index, err;
+
+  setup(entries, NWORDS);
+
+  err = gsync_waitv(mach_task_self(), entries, NWORDS, 100, GSYNC_TIMED,
+                    &index);
+  ASSERT(err == KERN_TIMEDOUT, "gsync_waitv did not time out");
+
+  words[3] = 42;
+  err = gsync_waitv(mach_task_self(), entries, NWORDS, 100, GSYNC_TIMED,
+                    &index);
+  ASSERT(err == KERN_INVALID_ARGUMENT, "gsync_waitv on a wrong value");
+  words[3] = 3;
+
+  err = gsync_waitv(mach_task_self(), entries, NWORDS, 100,
+                    GSYNC_TIMED | GSYNC_QUAD, &index);
+  ASSERT(err == KERN_INVALID_ARGUMENT, "gsync_waitv with GSYNC_QUAD");
+
+  entries[5].addr += 1;
+  err = gsync_waitv(mach_task_self(), entries, NWORDS, 100, GSYNC_TIMED,
+                    &index);
+  ASSERT(err == KERN_INVALID_ADDRESS, "gsync_waitv on a misaligned address");
+}
+
+static void test_wake(int which)
+{
+  gsync_waitv_t entries[NWORDS];
+  int index = -1, err;
+
+  setup(entries, NWORDS);
+  test_thread_start(mach_task_self(), waker_thread, (void *)(long)which);
+
+  err = gsync_waitv(mach_task_self(), entries, NWORDS, 5000, GSYNC_TIMED,
+                    &index);
+  ASSERT_RET(err, "gsync_waitv woken by another thread");
+  ASSERT(index == which, "gsync_waitv reported the wrong address");
+  ASSERT(words[which] == 100, "wake didn't mutate");
+
+  /* None of our waiters may be left behind.  */
+  err = gsync_wake(mach_task_self(), (vm_offset_t)&words[(which + 1) % NWORDS],
+                   0, 0);
+  ASSERT(err == KERN_INVALID_ARGUMENT, "stale waiter left queued");
+}
+
+static void test_same_address(void)
+{
+  gsync_waitv_t entries[2];
+  int index = -1, err;
+
+  /* Both entries hash to the same bucket.  */
+  setup(entries, 2);
+  entries[1] = entries[0];
+  test_thread_start(mach_task_self(), waker_thread, (void *)0);
+
+  err = gsync_waitv(mach_task_self(), entries, 2, 5000, GSYNC_TIMED, &index);
+  ASSERT_RET(err, "gsync_waitv on a repeated address");
+  ASSERT(index == 0, "gsync_waitv reported the wrong entry");
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  test_errors();
+  test_wake(0);
+  test_wake(NWORDS - 1);
+  test_wake(NWORDS / 2);
+  test_same_address();
+  return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * I/O completion: threads block reading the kmsg device, so that their
+ * requests are completed by the io_done threads when the main thread
+ * prints something, then check the completion latency histogram, and
+ * that the completions were processed on more than one processor.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <device/device.h>
+#include <device/io_latency_status.h>
+
+#include <device.user.h>
+#include <mach.user.h>
+#include <mach_host.user.h>
+
+#define NWORKERS	4
+#define ROUNDS		10
+
+static mach_port_t kmsg;
+
+static void worker(void *arg)
+{
+  io_buf_ptr_inband_t data;
+  mach_msg_type_number_t count = sizeof data;
+  int err;
+
+  err = device_read_inband(kmsg, 0, 0, sizeof data, data, &count);
+  ASSERT_RET(err, "device_read_inband");
+  ASSERT(count > 0, "empty read");
+}
+
+static int completions(int *queues)
+{
+  struct io_latency_status status;
+  mach_msg_type_number_t count = IO_LATENCY_STATUS_COUNT;
+  int err, n = 0;
+
+  err = device_get_status(kmsg, IO_LATENCY_STATUS,
+                          (dev_status_t) &status, &count);
+  ASSERT_RET(err, "device_get_status");
+  ASSERT(count == IO_LATENCY_STATUS_COUNT, "bad status count");
+  ASSERT(status.tick > 0, "bad tick");
+
+  for (int i = 0; i < IO_LATENCY_BUCKETS; i++)
+    {
+      ASSERT(status.count[i] >= 0, "bad bucket");
+      n += status.count[i];
+    }
+  *queues = status.queues;
+  return n;
+}
+
+static int nqueues(int queues)
+{
+  return __builtin_popcount(queues);
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  host_basic_info_data_t binfo;
+  io_buf_ptr_inband_t data;
+  mach_msg_type_number_t count;
+  int err, before, after, queues, round;
+
+  count = HOST_BASIC_INFO_COUNT;
+  err = host_info(mach_host_self(), HOST_BASIC_INFO,
+                  (host_info_t)&binfo, &count);
+  ASSERT_RET(err, "host_info");
+  ASSERT(binfo.avail_cpus >= 2, "this test needs two processors");
+
+  err = device_open(device_priv(), D_READ, "kmsg", &kmsg);
+  ASSERT_RET(err, "device_open kmsg");
+
+  /* Drain what the kernel printed so far.  */
+  do
+    {
+      count = sizeof data;
+      err = device_read_inband(kmsg, D_NOWAIT, 0, sizeof data, data, &count);
+    }
+  while (err == D_SUCCESS && count > 0);
+  ASSERT(err == D_WOULD_BLOCK || err == D_SUCCESS, "draining kmsg");
+
+  before = completions(&queues);
+
+  /* The readers run on whichever processor is idle: try a few times
+     until their requests were submitted from several.  */
+  round = 0;
+  do
+    {
+      test_workers_start(worker, NWORKERS);
+
+      /* Let them block, then feed them until they are all done.  */
+      msleep(100);
+      while (test_workers_running() > 0)
+        {
+          printf("waking readers\n");
+          msleep(10);
+        }
+
+      after = completions(&queues);
+      round++;
+    }
+  while (round < ROUNDS && nqueues(queues) < 2);
+
+  printf("%d completions in %d rounds, queues %x\n",
+         after - before, round, queues);
+  ASSERT(after - before >= NWORKERS * round, "completions not accounted");
+  ASSERT(nqueues(queues) >= 2, "completions processed on a single queue");
+
+  err = device_close(kmsg);
+  ASSERT_RET(err, "device_close");
+
+  return 0;
+}
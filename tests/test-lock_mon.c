@@ -0,0 +1,169 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Lock profiler: turn profiling on, take the map lock of this task
+ * from several threads at once, check that the class of map locks
+ * accounts for it, and print the most contended classes of locks.  Kernels built without --enable-lock-mon reject
+ * the calls, which is not a failure.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <mach/vm_param.h>
+#include <mach_debug/mach_debug_types.h>
+
+#include <mach.user.h>
+#include <mach_debug.user.h>
+#include <mach_host.user.h>
+
+#define NWORKERS	4
+#define ROUNDS		1000
+#define NTOP		8
+
+
+static void worker(void *arg)
+{
+  vm_address_t addr;
+  int err;
+
+  for (int i = 0; i < ROUNDS; i++)
+    {
+      err = vm_allocate(mach_task_self(), &addr, vm_page_size, TRUE);
+      ASSERT_RET(err, "vm_allocate");
+      *(volatile char *)addr = 1;
+      err = vm_deallocate(mach_task_self(), addr, vm_page_size);
+      ASSERT_RET(err, "vm_deallocate");
+    }
+}
+
+static const char *type_name(unsigned int type)
+{
+  switch (type)
+    {
+    case LOCK_MON_SIMPLE: return "simple";
+    case LOCK_MON_KMUTEX: return "kmutex";
+    case LOCK_MON_READ: return "read";
+    case LOCK_MON_WRITE: return "write";
+    default: return "?";
+    }
+}
+
+/* Acquisitions of the busiest class of locks taken as TYPE.  */
+static unsigned int class_acquired(lock_mon_info_t *info, unsigned int count,
+                                   unsigned int type)
+{
+  unsigned int best = 0;
+
+  for (unsigned int i = 0; i < count; i++)
+    {
+      unsigned int sum = 0;
+
+      if (info[i].lmi_type != type)
+        continue;
+      for (unsigned int j = 0; j < count; j++)
+        if (info[j].lmi_type == type && info[j].lmi_class == info[i].lmi_class)
+          sum += info[j].lmi_acquired;
+      if (sum > best)
+        best = sum;
+    }
+  return best;
+}
+
+static void print_top(lock_mon_info_t *info, unsigned int count)
+{
+  unsigned long long limit = ~0ULL;
+
+  for (int n = 0; n < NTOP; n++)
+    {
+      lock_mon_info_t *top = NULL;
+
+      for (unsigned int i = 0; i < count; i++)
+        if (info[i].lmi_wait < limit
+            && (top == NULL || info[i].lmi_wait > top->lmi_wait))
+          top = &info[i];
+      if (top == NULL || top->lmi_wait == 0)
+        break;
+      limit = top->lmi_wait;
+
+      printf("%-6s class %llx caller %llx: %u acquired, %u contended, "
+             "%u slept, wait %llu (max %llu), hold %llu (max %llu)\n",
+             type_name(top->lmi_type),
+             (unsigned long long)top->lmi_class,
+             (unsigned long long)top->lmi_caller,
+             top->lmi_acquired, top->lmi_contended, top->lmi_sleeps,
+             (unsigned long long)top->lmi_wait,
+             (unsigned long long)top->lmi_max_wait,
+             (unsigned long long)top->lmi_hold,
+             (unsigned long long)top->lmi_max_hold);
+    }
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  lock_mon_info_array_t info;
+  mach_msg_type_number_t count;
+  unsigned int acquired, map_acquired;
+  int err;
+
+  err = host_lock_mon_control(host_priv(), LOCK_MON_ON | LOCK_MON_CLEAR);
+  if (err == MIG_BAD_ID)
+    {
+      printf("lock monitoring not configured\n");
+      return 0;
+    }
+  ASSERT_RET(err, "host_lock_mon_control");
+
+  err = host_lock_mon_control(mach_host_self(), LOCK_MON_ON);
+  ASSERT(err != KERN_SUCCESS, "lock monitoring controlled without privilege");
+
+  test_workers_start(worker, NWORKERS);
+  test_workers_wait();
+
+  err = host_lock_mon_control(host_priv(), 0);
+  ASSERT_RET(err, "host_lock_mon_control");
+
+  count = 0;
+  err = host_lock_mon_info(mach_host_self(), &info, &count);
+  ASSERT_RET(err, "host_lock_mon_info");
+  ASSERT(count > 0, "no locks recorded");
+
+  acquired = 0;
+  for (unsigned int i = 0; i < count; i++)
+    {
+      ASSERT(info[i].lmi_type <= LOCK_MON_WRITE, "bad lock type");
+      ASSERT(info[i].lmi_sleeps <= info[i].lmi_contended,
+             "slept without contention");
+      acquired += info[i].lmi_acquired;
+    }
+  printf("%u lock sites, %u acquisitions\n", count, acquired);
+  ASSERT(acquired >= NWORKERS * ROUNDS, "too few acquisitions");
+
+  /* vm_allocate and vm_deallocate each lock the map for writing.  */
+  map_acquired = class_acquired(info, count, LOCK_MON_WRITE);
+  printf("%u write acquisitions of the busiest class\n", map_acquired);
+  ASSERT(map_acquired >= 2 * NWORKERS * ROUNDS, "map locks not accounted");
+  print_top(info, count);
+
+  err = vm_deallocate(mach_task_self(), (vm_address_t)info,
+                      count * sizeof(*info));
+  ASSERT_RET(err, "vm_deallocate");
+
+  return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Batched packet delivery: install a NETF_BATCH filter on the outgoing
+ * side of eth0, send numbered packets, and check that they all come
+ * back in order in batch messages.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <device/device.h>
+#include <device/net_status.h>
+
+#include <device.user.h>
+#include <mach.user.h>
+
+#define ETHERTYPE_TEST	0x88b5		/* local experimental */
+#define NPACKETS	256
+
+static struct net_rcv_batch_msg msg;
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  struct bpf_insn filter[] = {
+    { NETF_BPF | NETF_OUT | NETF_BATCH, 0, 0, 0 },
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETHERTYPE_TEST, 0, 1),
+    BPF_STMT(BPF_RET|BPF_K, -1),
+    BPF_STMT(BPF_RET|BPF_K, 0),
+  };
+  unsigned char frame[TEST_ETH_MIN_FRAME];
+  mach_msg_type_number_t written;
+  mach_port_t eth, port;
+  int err, sent, received, messages;
+
+  eth = test_eth_open();
+
+  port = test_eth_port(eth, filter, sizeof filter / sizeof filter[0]);
+  test_eth_warm_up(eth);
+  test_eth_frame(frame, sizeof frame, ETHERTYPE_TEST);
+
+  sent = received = messages = 0;
+  while (received < NPACKETS)
+    {
+      unsigned int offset;
+
+      /* Keep a few packets in flight, so that some get batched.  */
+      while (sent < NPACKETS && sent - received < 8)
+        {
+          frame[14] = sent >> 8;
+          frame[15] = sent & 0xff;
+          err = device_write_inband(eth, 0, 0, (char *) frame, sizeof frame,
+                                    &written);
+          ASSERT_RET(err, "device_write_inband");
+          sent++;
+        }
+
+      err = mach_msg(&msg.msg_hdr, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0,
+                     sizeof msg, port, 1000, MACH_PORT_NULL);
+      ASSERT_RET(err, "no batch received");
+      ASSERT(msg.msg_hdr.msgh_id == NET_RCV_BATCH_MSG_ID, "not a batch");
+      ASSERT(msg.packet_type.msgt_number <= NET_RCV_BATCH_MAX,
+             "batch too large");
+      messages++;
+
+      for (offset = 0; offset < msg.packet_type.msgt_number; )
+        {
+          struct net_rcv_batch_entry *entry;
+          unsigned char *data;
+
+          entry = (struct net_rcv_batch_entry *) &msg.packets[offset];
+          ASSERT(entry->header_size == 14, "bad header size");
+          ASSERT(entry->packet_size == sizeof (struct packet_header)
+                                       + sizeof frame - 14,
+                 "bad packet size");
+
+          data = (unsigned char *) entry
+                 + NET_BATCH_PACKET(entry->header_size)
+                 + sizeof (struct packet_header);
+          ASSERT(((data[0] << 8) | data[1]) == received,
+                 "packet lost or out of order");
+          received++;
+
+          offset += NET_BATCH_ENTRY_SIZE(entry->header_size,
+                                         entry->packet_size);
+        }
+      ASSERT(offset == msg.packet_type.msgt_number, "bad batch size");
+    }
+
+  printf("%d packets in %d messages\n", received, messages);
+  ASSERT(messages < received, "no packets batched");
+
+  err = device_close(eth);
+  ASSERT_RET(err, "device_close");
+
+  return 0;
+}
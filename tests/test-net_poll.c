@@ -0,0 +1,177 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Receive interrupt mitigation: make eth0 switch to polling as soon as
+ * a packet waits, have the user network gateway answer bursts of ARP
+ * requests, and check that all the replies come in and that the device
+ * was polled for them.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <device/device.h>
+#include <device/net_status.h>
+
+#include <device.user.h>
+#include <mach.user.h>
+#include <mach_port.user.h>
+
+#define ETHERTYPE_ARP	0x0806
+#define NBURSTS		50
+#define BURST		4
+
+static mach_port_t eth, port;
+static unsigned char mac[6];
+static struct net_rcv_msg msg;
+
+static void get_address(void)
+{
+  int addr[2];
+  mach_msg_type_number_t count = 2;
+  int err;
+
+  err = device_get_status(eth, NET_ADDRESS, addr, &count);
+  ASSERT_RET(err, "device_get_status");
+  /* The address comes in network order.  */
+  addr[0] = __builtin_bswap32(addr[0]);
+  addr[1] = __builtin_bswap32(addr[1]);
+  memcpy(mac, addr, sizeof mac);
+}
+
+static void set_mitigation(int threshold, int budget)
+{
+  struct net_rx_mitigation m;
+  mach_msg_type_number_t count;
+  int err;
+
+  m.threshold = threshold;
+  m.budget = budget;
+  err = device_set_status(eth, NET_RX_MITIGATION, (dev_status_t) &m,
+                          NET_RX_MITIGATION_COUNT);
+  ASSERT_RET(err, "device_set_status");
+
+  count = NET_RX_MITIGATION_COUNT;
+  err = device_get_status(eth, NET_RX_MITIGATION, (dev_status_t) &m, &count);
+  ASSERT_RET(err, "device_get_status");
+  ASSERT(count == NET_RX_MITIGATION_COUNT, "bad status count");
+  ASSERT(m.threshold == threshold && m.budget == budget,
+         "mitigation not set");
+}
+
+/* Ask who has 10.0.2.2, the gateway of the user network.  */
+static void send_arp_request(void)
+{
+  unsigned char frame[TEST_ETH_MIN_FRAME];
+  mach_msg_type_number_t written;
+  int err;
+
+  memset(frame, 0, sizeof frame);
+  memset(frame, 0xff, 6);
+  memcpy(frame + 6, mac, 6);
+  frame[12] = ETHERTYPE_ARP >> 8;
+  frame[13] = ETHERTYPE_ARP & 0xff;
+  frame[15] = 1;			/* Ethernet */
+  frame[16] = 0x08;			/* IPv4 */
+  frame[18] = 6;
+  frame[19] = 4;
+  frame[21] = 1;			/* request */
+  memcpy(frame + 22, mac, 6);
+  memcpy(frame + 28, (unsigned char[]) { 10, 0, 2, 15 }, 4);
+  memcpy(frame + 38, (unsigned char[]) { 10, 0, 2, 2 }, 4);
+
+  err = device_write_inband(eth, 0, 0, (char *) frame, sizeof frame,
+                            &written);
+  ASSERT_RET(err, "device_write_inband");
+}
+
+static int receive_reply(mach_msg_timeout_t timeout)
+{
+  return mach_msg(&msg.msg_hdr, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0,
+                  sizeof msg, port, timeout, MACH_PORT_NULL);
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  struct bpf_insn filter[] = {
+    { NETF_BPF | NETF_IN, 0, 0, 0 },
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETHERTYPE_ARP, 0, 3),
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 20),
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 2, 0, 1),
+    BPF_STMT(BPF_RET|BPF_K, -1),
+    BPF_STMT(BPF_RET|BPF_K, 0),
+  };
+  struct net_rx_mitigation m;
+  struct net_rx_stats stats;
+  mach_msg_type_number_t count;
+  int err, received;
+
+  eth = test_eth_open();
+  get_address();
+
+  m.threshold = 1;
+  m.budget = 0;
+  err = device_set_status(eth, NET_RX_MITIGATION, (dev_status_t) &m,
+                          NET_RX_MITIGATION_COUNT);
+  ASSERT(err == D_INVALID_OPERATION, "empty budget accepted");
+  set_mitigation(1, 2);
+
+  port = test_eth_port(eth, filter, sizeof filter / sizeof filter[0]);
+  err = mach_port_set_qlimit(mach_task_self(), port, MACH_PORT_QLIMIT_MAX);
+  ASSERT_RET(err, "mach_port_set_qlimit");
+  test_eth_warm_up(eth);
+
+  received = 0;
+  for (int i = 0; i < NBURSTS; i++)
+    {
+      for (int j = 0; j < BURST; j++)
+        send_arp_request();
+      for (int j = 0; j < BURST; j++)
+        {
+          err = receive_reply(1000);
+          ASSERT_RET(err, "ARP reply missed");
+          ASSERT(msg.msg_hdr.msgh_id == NET_RCV_MSG_ID, "not a packet");
+          received++;
+        }
+    }
+
+  count = NET_RX_STATS_COUNT;
+  err = device_get_status(eth, NET_RX_STATS, (dev_status_t) &stats, &count);
+  ASSERT_RET(err, "device_get_status");
+  ASSERT(count == NET_RX_STATS_COUNT, "bad status count");
+
+  printf("%d interrupts for %d packets, %d polls for %d packets, "
+         "polling %d times\n", stats.interrupts, stats.intr_packets,
+         stats.polls, stats.poll_packets, stats.poll_starts);
+  ASSERT(stats.interrupts > 0, "no interrupt accounted");
+  ASSERT(stats.intr_packets + stats.poll_packets >= received,
+         "packets not accounted");
+  ASSERT(stats.poll_starts > 0 && stats.polls >= stats.poll_starts,
+         "device never polled");
+  ASSERT(stats.dropped == 0, "packets dropped");
+
+  /* Back to interrupts only.  */
+  set_mitigation(0, 64);
+
+  err = device_close(eth);
+  ASSERT_RET(err, "device_close");
+
+  return 0;
+}
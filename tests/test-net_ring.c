@@ -0,0 +1,163 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Mapped packet rings: map a pair of rings of eth0, steer its outgoing
+ * test packets into the receive ring with a NETF_RING filter, send
+ * numbered packets through the transmit ring, and check that they all
+ * come back in order, waiting for wakeup messages when the ring is
+ * empty.  Filters of other ports cannot take the same rings, nor use
+ * rings which were not mapped.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <device/device.h>
+#include <device/net_status.h>
+#include <device/net_ring.h>
+
+#include <device.user.h>
+#include <mach.user.h>
+
+#define ETHERTYPE_TEST	0x88b5		/* local experimental */
+#define NPACKETS	1000
+#define FRAME_SIZE	TEST_ETH_MIN_FRAME
+#define RING		1		/* not the first, to check the offset */
+
+static mach_port_t eth, port;
+static struct net_ring_area *area;
+
+static void send_packet(unsigned short seq)
+{
+  struct net_ring *tx = &area->tx;
+  unsigned int tail = tx->tail;
+  unsigned char *frame;
+
+  ASSERT(tail - tx->head < NET_RING_SLOTS, "transmit ring full");
+  frame = (unsigned char *) area
+          + NET_RING_TX_BUFFER(tail % NET_RING_SLOTS);
+  test_eth_frame(frame, FRAME_SIZE, ETHERTYPE_TEST);
+  frame[14] = seq >> 8;
+  frame[15] = seq & 0xff;
+  tx->slot[tail % NET_RING_SLOTS].length = FRAME_SIZE;
+  __atomic_store_n(&tx->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void wait_rx(void)
+{
+  struct net_ring *rx = &area->rx;
+  mach_msg_header_t msg;
+  int err;
+
+  while (__atomic_load_n(&rx->tail, __ATOMIC_ACQUIRE) == rx->head)
+    {
+      __atomic_fetch_or(&rx->flags, NET_RING_WAKEUP, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&rx->tail, __ATOMIC_SEQ_CST) != rx->head)
+        break;
+
+      /* This may be the wakeup for a packet already read.  */
+      err = mach_msg(&msg, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0, sizeof msg,
+                     port, 1000, MACH_PORT_NULL);
+      ASSERT_RET(err, "no wakeup received");
+      ASSERT(msg.msgh_id == NET_RING_MSG_ID, "not a wakeup");
+    }
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  struct bpf_insn filter[] = {
+    { NETF_BPF | NETF_OUT | NETF_RING | NETF_RING_INDEX(RING), 0, 0, 0 },
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETHERTYPE_TEST, 0, 1),
+    BPF_STMT(BPF_RET|BPF_K, -1),
+    BPF_STMT(BPF_RET|BPF_K, 0),
+  };
+  mach_port_t pager, other;
+  int ring = RING;
+  int err, sent, received;
+
+  eth = test_eth_open();
+
+  err = device_map(eth, VM_PROT_READ | VM_PROT_WRITE,
+                   RING * NET_RING_SIZE, NET_RING_SIZE, &pager, 0);
+  ASSERT_RET(err, "device_map");
+  err = vm_map(mach_task_self(), (vm_address_t *) &area, NET_RING_SIZE, 0,
+               1, pager, 0, 0, VM_PROT_READ | VM_PROT_WRITE,
+               VM_PROT_READ | VM_PROT_WRITE, VM_INHERIT_NONE);
+  ASSERT_RET(err, "vm_map");
+
+  port = test_eth_port(eth, filter, sizeof filter / sizeof filter[0]);
+
+  err = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &other);
+  ASSERT_RET(err, "mach_port_allocate");
+  err = device_set_filter(eth, other, MACH_MSG_TYPE_MAKE_SEND, 0,
+                          (filter_array_t) filter,
+                          sizeof filter / sizeof (filter_t));
+  ASSERT(err == D_ALREADY_OPEN, "ring shared by two ports");
+  filter[0].code = NETF_BPF | NETF_OUT | NETF_RING
+                   | NETF_RING_INDEX(RING + 1);
+  err = device_set_filter(eth, other, MACH_MSG_TYPE_MAKE_SEND, 0,
+                          (filter_array_t) filter,
+                          sizeof filter / sizeof (filter_t));
+  ASSERT(err == D_INVALID_OPERATION, "filter set on an unmapped ring");
+  err = mach_port_destroy(mach_task_self(), other);
+  ASSERT_RET(err, "mach_port_destroy");
+
+  test_eth_warm_up(eth);
+
+  sent = received = 0;
+  while (received < NPACKETS)
+    {
+      struct net_ring *rx = &area->rx;
+      unsigned char *data;
+      unsigned int head;
+
+      /* Keep a few packets in flight, each sync sends them all.  */
+      if (sent < NPACKETS && sent - received < 2)
+        {
+          while (sent < NPACKETS && sent - received < 2)
+            send_packet(sent++);
+          err = device_set_status(eth, NET_RING_TXSYNC, &ring, 1);
+          ASSERT_RET(err, "device_set_status");
+          ASSERT(area->tx.head == area->tx.tail, "ring not drained");
+        }
+
+      wait_rx();
+
+      head = rx->head;
+      ASSERT(rx->slot[head % NET_RING_SLOTS].length == FRAME_SIZE,
+             "bad frame length");
+      data = (unsigned char *) area
+             + NET_RING_RX_BUFFER(head % NET_RING_SLOTS);
+      ASSERT(((data[12] << 8) | data[13]) == ETHERTYPE_TEST,
+             "bad frame type");
+      ASSERT(((data[14] << 8) | data[15]) == received,
+             "packet lost or out of order");
+      received++;
+      __atomic_store_n(&rx->head, head + 1, __ATOMIC_RELEASE);
+    }
+
+  ASSERT(area->rx.drops == 0, "packets dropped");
+  printf("%d packets through the rings\n", received);
+
+  err = device_close(eth);
+  ASSERT_RET(err, "device_close");
+
+  return 0;
+}
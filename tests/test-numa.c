@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * NUMA nodes: touch some memory and check the statistics of each
+ * node.  The test machine has two nodes of one processor and half the
+ * memory each (see user-qemu.mk); the pages of this task come from the
+ * node of the processor that touched them, unless it ran out of memory.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <mach/vm_param.h>
+#include <mach_debug/mach_debug_types.h>
+
+#include <mach.user.h>
+#include <mach_debug.user.h>
+#include <mach_host.user.h>
+
+#define NPAGES	1024
+#define NNODES	2
+#define NODE_MEM	(1024 * 1024 * 1024ULL)
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  numa_node_info_t info[NUMA_INFO_MAX_NODES];
+  numa_node_info_array_t infop = info;
+  mach_msg_type_number_t count;
+  unsigned long long allocs, remote, node_pages;
+  vm_address_t addr;
+  int err;
+
+  err = vm_allocate(mach_task_self(), &addr, NPAGES * vm_page_size, TRUE);
+  ASSERT_RET(err, "vm_allocate");
+  for (int i = 0; i < NPAGES; i++)
+    ((volatile char *)addr)[i * vm_page_size] = 1;
+
+  count = NUMA_INFO_MAX_NODES;
+  err = host_numa_info(mach_host_self(), &infop, &count);
+  ASSERT_RET(err, "host_numa_info");
+  ASSERT(count == NNODES, "NUMA nodes not found");
+  ASSERT(infop == info, "node information not returned in-line");
+
+  allocs = 0;
+  remote = 0;
+  node_pages = NODE_MEM / vm_page_size;
+  for (unsigned int i = 0; i < count; i++)
+    {
+      ASSERT(info[i].nni_node == i, "bad node number");
+      ASSERT(info[i].nni_free_pages <= info[i].nni_pages,
+             "more free pages than pages");
+      ASSERT(info[i].nni_ncpus == 1, "bad processor count");
+      /* The kernel and the firmware take some memory of the first node */
+      ASSERT(info[i].nni_pages <= node_pages, "too many pages");
+      ASSERT(info[i].nni_pages >= node_pages / 2, "too few pages");
+      printf("node %u: %u cpus, %lu pages, %lu free, %lu local, "
+             "%lu remote, %lu fallback allocations\n",
+             info[i].nni_node, info[i].nni_ncpus,
+             (unsigned long)info[i].nni_pages,
+             (unsigned long)info[i].nni_free_pages,
+             (unsigned long)info[i].nni_local_allocs,
+             (unsigned long)info[i].nni_remote_allocs,
+             (unsigned long)info[i].nni_fallback_allocs);
+      allocs += info[i].nni_local_allocs + info[i].nni_remote_allocs;
+      remote += info[i].nni_remote_allocs;
+    }
+
+  ASSERT(allocs >= NPAGES, "too few allocations");
+  ASSERT(remote * 2 < allocs, "allocations not local");
+
+  err = vm_deallocate(mach_task_self(), addr, NPAGES * vm_page_size);
+  ASSERT_RET(err, "vm_deallocate");
+
+  return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Out-of-line memory moves: send regions the sender gives up to a
+ * port of this task, some of them larger than a single page list and
+ * some only partially touched, check that they are unmapped as soon
+ * as the message is sent, and check the data received.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <mach/vm_param.h>
+
+#include <mach.user.h>
+#include <mach_port.user.h>
+
+struct ool_message
+{
+  mach_msg_header_t head;
+  mach_msg_type_long_t type;
+  vm_offset_t data;
+};
+
+static void check_unmapped(vm_address_t addr, vm_size_t size)
+{
+  vm_address_t region = addr;
+  vm_size_t region_size;
+  vm_prot_t prot, max_prot;
+  vm_inherit_t inherit;
+  boolean_t shared;
+  mach_port_t name;
+  vm_offset_t offset;
+  int err;
+
+  err = vm_region(mach_task_self(), &region, &region_size, &prot, &max_prot,
+                  &inherit, &shared, &name, &offset);
+  if (err == KERN_NO_SPACE)
+    return;
+  ASSERT_RET(err, "vm_region");
+  if (MACH_PORT_VALID(name))
+    mach_port_deallocate(mach_task_self(), name);
+  ASSERT(region >= addr + size, "memory still mapped after the send");
+}
+
+static void send_receive(mach_port_t port, vm_size_t size, vm_size_t touched)
+{
+  struct ool_message msg;
+  vm_address_t addr;
+  unsigned int *words;
+  int err;
+
+  err = vm_allocate(mach_task_self(), &addr, size, TRUE);
+  ASSERT_RET(err, "vm_allocate");
+  words = (unsigned int *)addr;
+  for (vm_size_t i = 0; i < touched / sizeof(*words); i += 64)
+    words[i] = i;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.head.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_MAKE_SEND, 0);
+  msg.head.msgh_size = sizeof(msg);
+  msg.head.msgh_remote_port = port;
+  msg.head.msgh_local_port = MACH_PORT_NULL;
+  msg.head.msgh_id = 1;
+  msg.type.msgtl_header.msgt_inline = FALSE;
+  msg.type.msgtl_header.msgt_longform = TRUE;
+  msg.type.msgtl_header.msgt_deallocate = TRUE;
+  msg.type.msgtl_name = MACH_MSG_TYPE_INTEGER_32;
+  msg.type.msgtl_size = 32;
+  msg.type.msgtl_number = size / sizeof(*words);
+  msg.data = addr;
+
+  err = mach_msg(&msg.head, MACH_SEND_MSG, sizeof(msg), 0, MACH_PORT_NULL,
+                 MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+  ASSERT_RET(err, "mach_msg send");
+  check_unmapped(addr, size);
+
+  memset(&msg, 0, sizeof(msg));
+  err = mach_msg(&msg.head, MACH_RCV_MSG, 0, sizeof(msg), port,
+                 MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+  ASSERT_RET(err, "mach_msg receive");
+  ASSERT(msg.head.msgh_id == 1, "bad message id");
+  ASSERT(msg.type.msgtl_number == size / sizeof(*words), "bad data size");
+
+  words = (unsigned int *)msg.data;
+  for (vm_size_t i = 0; i < size / sizeof(*words); i += 64)
+    ASSERT(words[i] == (i < touched / sizeof(*words) ? i : 0), "bad data");
+
+  /* The receiver owns the memory and can write to it */
+  words[0] = 1;
+
+  err = vm_deallocate(mach_task_self(), msg.data, size);
+  ASSERT_RET(err, "vm_deallocate");
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  mach_port_t port;
+  int err;
+
+  err = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+  ASSERT_RET(err, "mach_port_allocate");
+
+  /* Below the move threshold, copied on write */
+  send_receive(port, 4 * vm_page_size, 4 * vm_page_size);
+  /* One page list */
+  send_receive(port, 32 * vm_page_size, 32 * vm_page_size);
+  /* Largest page list */
+  send_receive(port, 64 * vm_page_size, 64 * vm_page_size);
+  /* Several page lists */
+  send_receive(port, 1024 * vm_page_size, 1024 * vm_page_size);
+  send_receive(port, 4096 * vm_page_size, 4096 * vm_page_size);
+  /* Largest move */
+  send_receive(port, 16384 * vm_page_size, 16384 * vm_page_size);
+  /* Partially touched */
+  send_receive(port, 1024 * vm_page_size, 100 * vm_page_size);
+
+  return 0;
+}
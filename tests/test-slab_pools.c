@@ -0,0 +1,258 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Slab CPU pools: allocate and release ports in bursts from several
+ * threads, then check and print how often the per-processor magazines
+ * served the allocator, for the busiest caches.  Also queue messages
+ * carrying port arrays of a size between two powers of two, check that
+ * kalloc serves them from the intermediate size class, and print the
+ * internal fragmentation of the general purpose caches and how much
+ * memory was given back to the VM system.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <mach_debug/mach_debug_types.h>
+
+#include <mach.user.h>
+#include <mach_debug.user.h>
+#include <mach_host.user.h>
+#include <mach_port.user.h>
+
+#define NWORKERS	4
+#define ROUNDS		100
+#define BURST		256
+#define NTOP		8
+#define NMSGS		MACH_PORT_QLIMIT_MAX
+#define ARRAY_SIZE	1200		/* kalloc_1280, not kalloc_2048 */
+
+
+static void worker(void *arg)
+{
+  mach_port_t ports[BURST];
+  int err;
+
+  for (int i = 0; i < ROUNDS; i++)
+    {
+      for (int j = 0; j < BURST; j++)
+        {
+          err = mach_port_allocate(mach_task_self(),
+                                   MACH_PORT_RIGHT_RECEIVE, &ports[j]);
+          ASSERT_RET(err, "mach_port_allocate");
+        }
+      for (int j = 0; j < BURST; j++)
+        {
+          err = mach_port_destroy(mach_task_self(), ports[j]);
+          ASSERT_RET(err, "mach_port_destroy");
+        }
+    }
+}
+
+static cache_info_t *find_cache(cache_info_t *info, unsigned int count,
+                                const char *name)
+{
+  for (unsigned int i = 0; i < count; i++)
+    if (strcmp(info[i].name, name) == 0)
+      return &info[i];
+  FAILURE(name);
+}
+
+static slab_stats_info_t *find_stats(slab_stats_info_t *stats,
+                                     unsigned int count, const char *name)
+{
+  for (unsigned int i = 0; i < count; i++)
+    if (strcmp(stats[i].name, name) == 0)
+      return &stats[i];
+  FAILURE(name);
+}
+
+/* Leave NMSGS messages queued on PORT, each with an out-of-line port
+   array that the kernel copies into an ARRAY_SIZE bytes kalloc buffer.  */
+static void queue_port_arrays(mach_port_t port)
+{
+  static mach_port_t names[ARRAY_SIZE / sizeof(mach_port_t)];
+  struct
+  {
+    mach_msg_header_t head;
+    mach_msg_type_t type;
+    mach_port_t *names;
+  } msg;
+  int err;
+
+  for (int i = 0; i < NMSGS; i++)
+    {
+      memset(&msg, 0, sizeof msg);
+      msg.head.msgh_bits = MACH_MSGH_BITS_COMPLEX
+                           | MACH_MSGH_BITS(MACH_MSG_TYPE_MAKE_SEND, 0);
+      msg.head.msgh_size = sizeof msg;
+      msg.head.msgh_remote_port = port;
+      msg.type.msgt_name = MACH_MSG_TYPE_COPY_SEND;
+      msg.type.msgt_size = 8 * sizeof(mach_port_t);
+      msg.type.msgt_number = sizeof names / sizeof names[0];
+      msg.type.msgt_inline = FALSE;
+      msg.names = names;
+      err = mach_msg(&msg.head, MACH_SEND_MSG, sizeof msg, 0,
+                     MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+      ASSERT_RET(err, "mach_msg");
+    }
+}
+
+static void check_size_class(void)
+{
+  slab_stats_info_array_t before, after;
+  mach_msg_type_number_t nbefore, nafter;
+  slab_stats_info_t *b, *a;
+  mach_port_t port;
+  int err;
+
+  err = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+  ASSERT_RET(err, "mach_port_allocate");
+  err = mach_port_set_qlimit(mach_task_self(), port, MACH_PORT_QLIMIT_MAX);
+  ASSERT_RET(err, "mach_port_set_qlimit");
+
+  nbefore = 0;
+  err = host_slab_stats(mach_host_self(), &before, &nbefore);
+  ASSERT_RET(err, "host_slab_stats");
+  queue_port_arrays(port);
+  nafter = 0;
+  err = host_slab_stats(mach_host_self(), &after, &nafter);
+  ASSERT_RET(err, "host_slab_stats");
+
+  b = find_stats(before, nbefore, "kalloc_1280");
+  a = find_stats(after, nafter, "kalloc_1280");
+  printf("kalloc_1280: %lu more bytes requested, %lu more allocated\n",
+         (unsigned long)(a->requested - b->requested),
+         (unsigned long)(a->allocated - b->allocated));
+  ASSERT(a->requested - b->requested >= NMSGS * ARRAY_SIZE,
+         "requests not served by their size class");
+  ASSERT(a->allocated - b->allocated >= NMSGS * 1280,
+         "allocations not accounted");
+
+  /* This frees the queued messages.  */
+  err = mach_port_destroy(mach_task_self(), port);
+  ASSERT_RET(err, "mach_port_destroy");
+
+  err = vm_deallocate(mach_task_self(), (vm_address_t)before,
+                      nbefore * sizeof(*before));
+  ASSERT_RET(err, "vm_deallocate");
+  err = vm_deallocate(mach_task_self(), (vm_address_t)after,
+                      nafter * sizeof(*after));
+  ASSERT_RET(err, "vm_deallocate");
+}
+
+static void print_fragmentation(slab_stats_info_t *stats, unsigned int count)
+{
+  unsigned long long requested = 0, allocated = 0;
+
+  for (unsigned int i = 0; i < count; i++)
+    {
+      if (strncmp(stats[i].name, "kalloc_", 7) != 0)
+        continue;
+      requested += stats[i].requested;
+      allocated += stats[i].allocated;
+      if (stats[i].allocated != 0)
+        printf("%-20s %lu bytes requested, %lu allocated\n", stats[i].name,
+               (unsigned long)stats[i].requested,
+               (unsigned long)stats[i].allocated);
+    }
+
+  ASSERT(allocated != 0, "no kalloc allocations");
+  ASSERT(requested <= allocated, "more bytes requested than allocated");
+  printf("kalloc: %llu bytes requested, %llu allocated, %llu%% wasted\n",
+         requested, allocated,
+         allocated > requested
+         ? 100 * (allocated - requested) / allocated : 0);
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  cache_info_array_t info;
+  slab_stats_info_array_t stats;
+  mach_msg_type_number_t count, nstats;
+  slab_stats_info_t *ports;
+  unsigned long limit, reclaimed;
+  int err;
+
+  check_size_class();
+
+  test_workers_start(worker, NWORKERS);
+  test_workers_wait();
+
+  count = 0;
+  err = host_slab_info(mach_host_self(), &info, &count);
+  ASSERT_RET(err, "host_slab_info");
+  ASSERT(count > 0, "no caches");
+  nstats = 0;
+  err = host_slab_stats(mach_host_self(), &stats, &nstats);
+  ASSERT_RET(err, "host_slab_stats");
+  ASSERT(nstats == count, "statistics not returned for every cache");
+
+  limit = ~0UL;
+  for (int n = 0; n < NTOP; n++)
+    {
+      slab_stats_info_t *top = NULL;
+      unsigned long ops, top_ops = 0;
+
+      for (unsigned int i = 0; i < nstats; i++)
+        {
+          ops = stats[i].cpu_pool_hits + stats[i].cpu_pool_misses;
+          if (ops < limit && (top == NULL || ops > top_ops))
+            {
+              top = &stats[i];
+              top_ops = ops;
+            }
+        }
+      if (top == NULL || top_ops == 0)
+        break;
+      limit = top_ops;
+
+      printf("%-20s magazine %lu: %lu%% hits in %lu operations, "
+             "%lu depot hits, depot contended %lu times\n",
+             top->name,
+             (unsigned long)find_cache(info, count, top->name)->cpu_pool_size,
+             (unsigned long)(100 * (unsigned long long)top->cpu_pool_hits
+                             / top_ops),
+             top_ops, (unsigned long)top->depot_hits,
+             (unsigned long)top->depot_contention);
+    }
+
+  /* The pools only exist on multiprocessor kernels.  */
+  ports = find_stats(stats, nstats, "ipc_port");
+  if (find_cache(info, count, "ipc_port")->cpu_pool_size > 0)
+    ASSERT(ports->cpu_pool_hits > 0, "ports not served by the CPU pools");
+  else
+    printf("no CPU pools\n");
+
+  print_fragmentation(stats, nstats);
+
+  reclaimed = 0;
+  for (unsigned int i = 0; i < nstats; i++)
+    reclaimed += stats[i].reclaimed;
+  printf("slab: %lu pages reclaimed\n", reclaimed);
+
+  err = vm_deallocate(mach_task_self(), (vm_address_t)info,
+                      count * sizeof(*info));
+  ASSERT_RET(err, "vm_deallocate");
+  err = vm_deallocate(mach_task_self(), (vm_address_t)stats,
+                      nstats * sizeof(*stats));
+  ASSERT_RET(err, "vm_deallocate");
+
+  return 0;
+}
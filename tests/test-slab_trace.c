@@ -0,0 +1,122 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Allocation tracing: trace every allocation while this task creates
+ * ports, and print the call sites with the most live bytes.  Kernels
+ * built without --enable-slab-trace reject the calls, which is not a
+ * failure.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <mach_debug/mach_debug_types.h>
+
+#include <mach.user.h>
+#include <mach_debug.user.h>
+#include <mach_port.user.h>
+
+#define NPORTS		256
+#define NTOP		8
+
+static void print_top(slab_trace_info_t *info, unsigned int count)
+{
+  unsigned long limit = ~0UL;
+
+  for (int n = 0; n < NTOP; n++)
+    {
+      slab_trace_info_t *top = NULL;
+
+      for (unsigned int i = 0; i < count; i++)
+        if (info[i].sti_live_bytes < limit
+            && (top == NULL || info[i].sti_live_bytes > top->sti_live_bytes))
+          top = &info[i];
+      if (top == NULL || top->sti_live_bytes == 0)
+        break;
+      limit = top->sti_live_bytes;
+
+      printf("%-20s %lu live, %lu bytes, %lu allocs, %lu frees, callers",
+             top->sti_cache, (unsigned long)top->sti_live,
+             (unsigned long)top->sti_live_bytes,
+             (unsigned long)top->sti_allocs, (unsigned long)top->sti_frees);
+      for (int j = 0; j < SLAB_TRACE_DEPTH && top->sti_callers[j] != 0; j++)
+        printf(" %llx", (unsigned long long)top->sti_callers[j]);
+      printf("\n");
+    }
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  slab_trace_info_array_t info;
+  mach_msg_type_number_t count;
+  mach_port_t ports[NPORTS];
+  unsigned long ports_live;
+  int err;
+
+  err = host_slab_trace_control(host_priv(), 1,
+                                SLAB_TRACE_STACK | SLAB_TRACE_CLEAR);
+  if (err == MIG_BAD_ID)
+    {
+      printf("allocation tracing not configured\n");
+      return 0;
+    }
+  ASSERT_RET(err, "host_slab_trace_control");
+
+  err = host_slab_trace_control(mach_host_self(), 1, 0);
+  ASSERT(err != KERN_SUCCESS, "tracing controlled without privilege");
+
+  for (int i = 0; i < NPORTS; i++)
+    {
+      err = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE,
+                               &ports[i]);
+      ASSERT_RET(err, "mach_port_allocate");
+    }
+
+  err = host_slab_trace_control(host_priv(), 0, 0);
+  ASSERT_RET(err, "host_slab_trace_control");
+
+  count = 0;
+  err = host_slab_trace_info(mach_host_self(), &info, &count);
+  ASSERT_RET(err, "host_slab_trace_info");
+  ASSERT(count > 0, "no allocation sites recorded");
+
+  ports_live = 0;
+  for (unsigned int i = 0; i < count; i++)
+    {
+      ASSERT(info[i].sti_cache[sizeof(info[i].sti_cache) - 1] == '\0',
+             "cache name not terminated");
+      if (strcmp(info[i].sti_cache, "ipc_port") == 0)
+        ports_live += info[i].sti_live;
+    }
+  printf("%u allocation sites, %lu ports live\n", count, ports_live);
+  ASSERT(ports_live >= NPORTS, "port allocations not traced");
+  print_top(info, count);
+
+  err = vm_deallocate(mach_task_self(), (vm_address_t)info,
+                      count * sizeof(*info));
+  ASSERT_RET(err, "vm_deallocate");
+
+  for (int i = 0; i < NPORTS; i++)
+    {
+      err = mach_port_destroy(mach_task_self(), ports[i]);
+      ASSERT_RET(err, "mach_port_destroy");
+    }
+
+  return 0;
+}
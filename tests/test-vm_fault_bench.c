@@ -0,0 +1,156 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Page fault scalability benchmark: threads of a single task touch
+ * fresh pages of a shared region, so that every fault takes the map
+ * lock for read, while another thread keeps allocating and freeing
+ * memory, taking the same lock for write.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <mach/vm_param.h>
+
+#include <mach.user.h>
+#include <mach_host.user.h>
+
+#define MAX_FAULTERS	8
+#define PAGES_PER_THREAD 2048
+
+static vm_address_t region;
+static volatile int faulters_done;
+static volatile int stop_mapper;
+static volatile int mapper_done;
+static volatile int mapper_rounds;
+
+static void faulter(void *arg)
+{
+  long id = (long)arg;
+  volatile char *base = (char *)region + id * PAGES_PER_THREAD * vm_page_size;
+
+  for (int i = 0; i < PAGES_PER_THREAD; i++)
+    base[i * vm_page_size] = id + 1;
+
+  __atomic_add_fetch(&faulters_done, 1, __ATOMIC_RELEASE);
+  thread_terminate(mach_thread_self());
+  FAILURE("thread_terminate");
+}
+
+static void mapper(void *arg)
+{
+  vm_address_t addr;
+  int err;
+
+  do
+    {
+      err = vm_allocate(mach_task_self(), &addr, vm_page_size, TRUE);
+      ASSERT_RET(err, "vm_allocate");
+      err = vm_deallocate(mach_task_self(), addr, vm_page_size);
+      ASSERT_RET(err, "vm_deallocate");
+      mapper_rounds++;
+    }
+  while (!stop_mapper);
+
+  __atomic_store_n(&mapper_done, 1, __ATOMIC_RELEASE);
+  thread_terminate(mach_thread_self());
+  FAILURE("thread_terminate");
+}
+
+/* Fault in nthreads slices at once, and return the time it took.  */
+static long run(int nthreads, boolean_t with_mapper)
+{
+  time_value_t start, stop;
+  vm_size_t size;
+  int err;
+
+  size = nthreads * PAGES_PER_THREAD * vm_page_size;
+  err = vm_allocate(mach_task_self(), &region, size, TRUE);
+  ASSERT_RET(err, "vm_allocate");
+
+  faulters_done = 0;
+  stop_mapper = 0;
+  mapper_done = 0;
+  mapper_rounds = 0;
+  if (with_mapper)
+    test_thread_start(mach_task_self(), mapper, NULL);
+
+  err = host_get_time(mach_host_self(), &start);
+  ASSERT_RET(err, "host_get_time");
+
+  for (long i = 0; i < nthreads; i++)
+    test_thread_start(mach_task_self(), faulter, (void *)i);
+  while (faulters_done < nthreads)
+    msleep(1);
+
+  err = host_get_time(mach_host_self(), &stop);
+  ASSERT_RET(err, "host_get_time");
+
+  if (with_mapper)
+    {
+      stop_mapper = 1;
+      while (!mapper_done)
+        msleep(1);
+    }
+
+  for (long i = 0; i < nthreads; i++)
+    {
+      char *base = (char *)region + i * PAGES_PER_THREAD * vm_page_size;
+      for (int j = 0; j < PAGES_PER_THREAD; j++)
+        ASSERT(base[j * vm_page_size] == i + 1, "lost a write");
+    }
+
+  err = vm_deallocate(mach_task_self(), region, size);
+  ASSERT_RET(err, "vm_deallocate");
+
+  return (stop.seconds - start.seconds) * 1000000
+         + (stop.microseconds - start.microseconds);
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  host_basic_info_data_t binfo;
+  mach_msg_type_number_t count;
+  int nthreads, err;
+  long usec1, usec;
+
+  count = HOST_BASIC_INFO_COUNT;
+  err = host_info(mach_host_self(), HOST_BASIC_INFO,
+                  (host_info_t)&binfo, &count);
+  ASSERT_RET(err, "host_info");
+  nthreads = binfo.avail_cpus;
+  if (nthreads > MAX_FAULTERS)
+    nthreads = MAX_FAULTERS;
+
+  usec1 = run(1, FALSE);
+  printf("1 thread: %d faults in %ld usec, %ld nsec per fault\n",
+         PAGES_PER_THREAD, usec1, usec1 * 1000 / PAGES_PER_THREAD);
+
+  usec = run(nthreads, FALSE);
+  printf("%d threads: %d faults in %ld usec, %ld nsec per fault\n",
+         nthreads, nthreads * PAGES_PER_THREAD, usec,
+         usec * 1000 / (nthreads * PAGES_PER_THREAD));
+
+  usec = run(nthreads, TRUE);
+  printf("%d threads and a writer: %d faults in %ld usec, "
+         "%d map changes\n", nthreads, nthreads * PAGES_PER_THREAD,
+         usec, mapper_rounds);
+
+  return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Cross-processor wakeup benchmark: two threads bounce a message
+ * back and forth on two processors, so that each round trip wakes the
+ * other thread from a blocked receive, and check that idle processors
+ * were woken for them by interrupt or through their monitored word.
+ */
+
+#include <syscalls.h>
+#include <testlib.h>
+
+#include <mach/message.h>
+#include <mach_debug/mach_debug_types.h>
+
+#include <mach.user.h>
+#include <mach_debug.user.h>
+#include <mach_host.user.h>
+#include <mach_port.user.h>
+
+#define ROUND_TRIPS	10000
+
+static mach_port_t ping_port, pong_port;
+
+static void send_empty(mach_port_t port)
+{
+  mach_msg_header_t msg;
+  int err;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_MAKE_SEND, 0);
+  msg.msgh_remote_port = port;
+  msg.msgh_size = sizeof(msg);
+  err = mach_msg(&msg, MACH_SEND_MSG, sizeof(msg), 0,
+                 MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+  ASSERT_RET(err, "mach_msg send");
+}
+
+static void receive_empty(mach_port_t port)
+{
+  mach_msg_header_t msg;
+  int err;
+
+  err = mach_msg(&msg, MACH_RCV_MSG, 0, sizeof(msg),
+                 port, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+  ASSERT_RET(err, "mach_msg receive");
+}
+
+static void pong_thread(void *arg)
+{
+  for (int i = 0; i < ROUND_TRIPS; i++)
+    {
+      receive_empty(ping_port);
+      send_empty(pong_port);
+    }
+  thread_terminate(mach_thread_self());
+  FAILURE("thread_terminate");
+}
+
+static int wakeup_counts(unsigned int *ipi, unsigned int *monitor)
+{
+  sched_stats_info_array_t info;
+  mach_msg_type_number_t count = 0;
+  int err;
+
+  *ipi = *monitor = 0;
+  err = host_sched_stats(mach_host_self(), &info, &count);
+  if (err == MIG_BAD_ID)
+    return 0;
+  ASSERT_RET(err, "host_sched_stats");
+  ASSERT(count >= 2, "statistics of too few processors");
+
+  for (int i = 0; i < count; i++)
+    {
+      *ipi += info[i].wakeups[SCHED_STATS_WAKEUP_IPI];
+      *monitor += info[i].wakeups[SCHED_STATS_WAKEUP_MONITOR];
+    }
+  err = vm_deallocate(mach_task_self(), (vm_address_t)info,
+                      count * sizeof(*info));
+  ASSERT_RET(err, "vm_deallocate");
+  return 1;
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  unsigned int ipi0, monitor0, ipi1, monitor1;
+  struct host_basic_info binfo;
+  mach_msg_type_number_t count;
+  time_value_t start, stop;
+  long usec;
+  int err, stats;
+
+  count = HOST_BASIC_INFO_COUNT;
+  err = host_info(mach_host_self(), HOST_BASIC_INFO,
+                  (host_info_t)&binfo, &count);
+  ASSERT_RET(err, "host_info");
+  ASSERT(binfo.avail_cpus >= 2, "the test needs two processors");
+
+  err = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE,
+                           &ping_port);
+  ASSERT_RET(err, "mach_port_allocate");
+  err = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE,
+                           &pong_port);
+  ASSERT_RET(err, "mach_port_allocate");
+
+  test_thread_start(mach_task_self(), pong_thread, NULL);
+
+  stats = wakeup_counts(&ipi0, &monitor0);
+  err = host_get_time(mach_host_self(), &start);
+  ASSERT_RET(err, "host_get_time");
+
+  for (int i = 0; i < ROUND_TRIPS; i++)
+    {
+      send_empty(ping_port);
+      receive_empty(pong_port);
+    }
+
+  err = host_get_time(mach_host_self(), &stop);
+  ASSERT_RET(err, "host_get_time");
+  wakeup_counts(&ipi1, &monitor1);
+
+  usec = (stop.seconds - start.seconds) * 1000000
+         + (stop.microseconds - start.microseconds);
+  printf("%d round trips in %ld usec, %ld nsec per wakeup\n",
+         ROUND_TRIPS, usec, usec * 1000 / (2 * ROUND_TRIPS));
+  if (!stats)
+    {
+      printf("scheduler statistics not configured\n");
+      return 0;
+    }
+  printf("idle wakeups: %u by interrupt, %u by monitor\n",
+         ipi1 - ipi0, monitor1 - monitor0);
+  ASSERT(ipi1 - ipi0 + monitor1 - monitor0 > 0, "no idle processor woken");
+
+  return 0;
+}
@@ -0,0 +1,357 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Xen network frontend rings: run the feature negotiation and the
+ * TX/RX ring handling of xen/netfront.c against a stub backend, which
+ * reads the shared rings directly and answers from a fake store.
+ */
+
+#include <testlib.h>
+
+#include <mach/vm_param.h>
+
+#include <xen/netfront.h>
+
+#define NBUFS 4
+
+/* A fake store, by frontend and node.  */
+struct store_entry {
+  int frontend;
+  const char *node;
+  int value;
+};
+
+static const struct store_entry all_features[] = {
+  { 0, "feature-rx-copy", 1 },
+  { 0, "feature-sg", 1 },
+  { 0, "feature-gso-tcpv4", 1 },
+  { 1, "mtu", 9000 },
+  { 0, NULL, 0 },
+};
+
+static const struct store_entry gso_without_sg[] = {
+  { 0, "feature-rx-copy", 1 },
+  { 0, "feature-gso-tcpv4", 1 },
+  { 0, NULL, 0 },
+};
+
+static const struct store_entry bad_mtu[] = {
+  { 0, "feature-sg", 1 },
+  { 1, "mtu", 20 },
+  { 0, NULL, 0 },
+};
+
+static int store_read(void *arg, int frontend, const char *node)
+{
+  const struct store_entry *e;
+
+  for (e = arg; e->node; e++)
+    if (e->frontend == frontend && strcmp(e->node, node) == 0)
+      return e->value;
+  return -1;
+}
+
+static void test_negotiate(void)
+{
+  struct netfront_features f;
+
+  netfront_negotiate(&f, store_read, (void *) all_features);
+  ASSERT(f.rx_copy && f.tx_sg && f.tx_gso, "all features");
+  ASSERT(f.mtu == 9000, "mtu from the store");
+
+  netfront_negotiate(&f, store_read, (void *) gso_without_sg);
+  ASSERT(f.rx_copy && !f.tx_sg && !f.tx_gso, "gso needs sg");
+  ASSERT(f.mtu == NETFRONT_MTU, "default mtu");
+
+  netfront_negotiate(&f, store_read, (void *) bad_mtu);
+  ASSERT(!f.rx_copy && f.tx_sg && !f.tx_gso, "sg only");
+  ASSERT(f.mtu == NETFRONT_MTU, "mtu too small");
+}
+
+static char tx_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static char rx_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static netif_tx_front_ring_t tx;
+static netif_tx_back_ring_t tx_back;
+static netif_rx_front_ring_t rx;
+static netif_rx_back_ring_t rx_back;
+
+static void init_rings(void)
+{
+  netif_tx_sring_t *tx_sring = (void *) tx_page;
+  netif_rx_sring_t *rx_sring = (void *) rx_page;
+
+  SHARED_RING_INIT(tx_sring);
+  FRONT_RING_INIT(&tx, tx_sring, PAGE_SIZE);
+  BACK_RING_INIT(&tx_back, tx_sring, PAGE_SIZE);
+  SHARED_RING_INIT(rx_sring);
+  FRONT_RING_INIT(&rx, rx_sring, PAGE_SIZE);
+  BACK_RING_INIT(&rx_back, rx_sring, PAGE_SIZE);
+}
+
+/* An Ethernet frame of IPv4 with PROTOCOL, and a TCP header of 20 bytes.  */
+static void make_frame(uint8_t *frame, unsigned len, uint8_t protocol)
+{
+  memset(frame, 0, len);
+  frame[12] = 0x08;
+  frame[13] = 0x00;
+  frame[14] = 0x45;
+  frame[14 + 9] = protocol;
+  frame[14 + 20 + 12] = 0x50;
+}
+
+static void test_tcp_mss(void)
+{
+  uint8_t frame[128];
+
+  make_frame(frame, sizeof frame, 6);
+  ASSERT(netfront_tx_tcp_mss(frame, sizeof frame, 1500) == 1460, "mss");
+  ASSERT(netfront_tx_tcp_mss(frame, sizeof frame, 9000) == 8960, "mss of mtu");
+  ASSERT(netfront_tx_tcp_mss(frame, sizeof frame, 40) == 0, "mtu too small");
+  ASSERT(netfront_tx_tcp_mss(frame, 14 + 20 + 10, 1500) == 0, "short frame");
+
+  make_frame(frame, sizeof frame, 17);
+  ASSERT(netfront_tx_tcp_mss(frame, sizeof frame, 1500) == 0, "udp");
+}
+
+static int tx_done_calls;
+static unsigned tx_done_id;
+
+static void tx_done(void *arg, unsigned id)
+{
+  tx_done_calls++;
+  tx_done_id = id;
+}
+
+/* Answer every request on TX, with NETIF_RSP_NULL for the extra ones.  */
+static void backend_tx_respond(int extra_after_first)
+{
+  netif_tx_request_t *req;
+  netif_tx_response_t *rsp;
+  RING_IDX i;
+  int n;
+
+  n = 0;
+  for (i = tx_back.req_cons; i != tx_back.sring->req_prod; i++, n++)
+    {
+      req = RING_GET_REQUEST(&tx_back, i);
+      rsp = RING_GET_RESPONSE(&tx_back, tx_back.rsp_prod_pvt++);
+      rsp->id = req->id;
+      rsp->status = extra_after_first && n == 1 ? NETIF_RSP_NULL
+                                                : NETIF_RSP_OKAY;
+    }
+  tx_back.req_cons = i;
+  RING_PUSH_RESPONSES(&tx_back);
+}
+
+static void test_tx(void)
+{
+  unsigned short pending[__CONST_RING_SIZE(netif_tx, PAGE_SIZE)];
+  grant_ref_t grefs[] = { 11, 12, 13 };
+  netif_tx_request_t *req;
+  netif_extra_info_t *extra;
+  unsigned id, count;
+  RING_IDX cons;
+
+  init_rings();
+  memset(pending, 0, sizeof pending);
+
+  /* A GSO frame over three pages.  */
+  count = 2 * PAGE_SIZE + 10;
+  id = netfront_tx_frame(&tx, grefs, 3, 100, count, 1460);
+  RING_PUSH_REQUESTS(&tx);
+  pending[id] = 3;
+  ASSERT(tx_back.sring->req_prod == 4, "three pages and the extra info");
+
+  cons = tx_back.req_cons;
+  req = RING_GET_REQUEST(&tx_back, cons);
+  ASSERT(req->gref == 11 && req->offset == 100 && req->size == count,
+         "first request has the whole size");
+  ASSERT(req->flags == (NETTXF_more_data | NETTXF_extra_info
+                        | NETTXF_csum_blank | NETTXF_data_validated),
+         "first request flags");
+  ASSERT(req->id == id, "first request id");
+  extra = (netif_extra_info_t *) RING_GET_REQUEST(&tx_back, cons + 1);
+  ASSERT(extra->type == XEN_NETIF_EXTRA_TYPE_GSO, "gso extra");
+  ASSERT(extra->u.gso.size == 1460, "gso size");
+  ASSERT(extra->u.gso.type == XEN_NETIF_GSO_TYPE_TCPV4, "gso type");
+  req = RING_GET_REQUEST(&tx_back, cons + 2);
+  ASSERT(req->gref == 12 && req->offset == 0 && req->size == PAGE_SIZE
+         && req->flags == NETTXF_more_data && req->id == id, "second page");
+  req = RING_GET_REQUEST(&tx_back, cons + 3);
+  ASSERT(req->gref == 13 && req->offset == 0 && req->size == 110
+         && req->flags == 0 && req->id == id, "third page");
+
+  backend_tx_respond(1);
+  tx_done_calls = 0;
+  netfront_tx_done(&tx, pending, tx_done, NULL);
+  ASSERT(tx_done_calls == 1 && tx_done_id == id, "frame done once");
+  ASSERT(pending[id] == 0, "nothing pending");
+  ASSERT(tx.rsp_cons == 4, "all responses consumed");
+
+  /* A frame in one page, without segmentation.  */
+  id = netfront_tx_frame(&tx, grefs, 1, 0, 60, 0);
+  RING_PUSH_REQUESTS(&tx);
+  pending[id] = 1;
+  req = RING_GET_REQUEST(&tx_back, tx_back.req_cons);
+  ASSERT(req->size == 60 && req->flags == 0, "no checksum offload");
+
+  backend_tx_respond(0);
+  tx_done_calls = 0;
+  netfront_tx_done(&tx, pending, tx_done, NULL);
+  ASSERT(tx_done_calls == 1 && tx_done_id == id, "small frame done");
+
+  /* A response for nothing pending is ignored.  */
+  netfront_tx_frame(&tx, grefs, 1, 0, 60, 0);
+  RING_PUSH_REQUESTS(&tx);
+  backend_tx_respond(0);
+  tx_done_calls = 0;
+  netfront_tx_done(&tx, pending, tx_done, NULL);
+  ASSERT(tx_done_calls == 0, "spurious response");
+}
+
+static char bufs[NBUFS][PAGE_SIZE];
+static int taken[NBUFS];
+static int given[NBUFS];
+
+static void *rx_take(void *arg, unsigned id)
+{
+  ASSERT(id < NBUFS, "take id");
+  taken[id]++;
+  return bufs[id];
+}
+
+static void rx_give(void *arg, unsigned id)
+{
+  ASSERT(id < NBUFS, "give id");
+  given[id]++;
+}
+
+static void rx_copy(void *frame, unsigned offset, const void *data, unsigned len)
+{
+  memcpy((char *) frame + offset, data, len);
+}
+
+static const struct netfront_rx_ops rx_ops = {
+  .take = rx_take,
+  .give = rx_give,
+  .copy = rx_copy,
+};
+
+/* Produce a response on RX for buffer ID.  */
+static void backend_rx(unsigned id, unsigned offset, int status, int flags)
+{
+  netif_rx_response_t *rsp;
+
+  rsp = RING_GET_RESPONSE(&rx_back, rx_back.rsp_prod_pvt++);
+  rsp->id = id;
+  rsp->offset = offset;
+  rsp->status = status;
+  rsp->flags = flags;
+}
+
+static void reset_bufs(void)
+{
+  memset(taken, 0, sizeof taken);
+  memset(given, 0, sizeof given);
+}
+
+static void test_rx(void)
+{
+  static char frame[2 * PAGE_SIZE];
+  int len, flags, i;
+
+  init_rings();
+  for (i = 0; i < NBUFS; i++)
+    memset(bufs[i], 'a' + i, PAGE_SIZE);
+
+  /* A frame over two buffers.  */
+  reset_bufs();
+  backend_rx(0, 10, 100, NETRXF_more_data | NETRXF_data_validated);
+  backend_rx(1, 0, 50, 0);
+  RING_PUSH_RESPONSES(&rx_back);
+  memset(frame, 0, sizeof frame);
+  len = netfront_rx_frame(&rx, &rx_ops, NULL, frame, sizeof frame, &flags);
+  ASSERT(len == 150, "two fragments");
+  ASSERT(flags & NETRXF_data_validated, "flags of the first response");
+  ASSERT(frame[0] == 'a' && frame[99] == 'a' && frame[100] == 'b'
+         && frame[149] == 'b' && frame[150] == 0, "frame contents");
+  ASSERT(taken[0] == 1 && given[0] == 1 && taken[1] == 1 && given[1] == 1,
+         "both buffers handed back");
+  ASSERT(rx.rsp_cons == rx.sring->rsp_prod, "all responses consumed");
+
+  /* The end of the frame was not produced yet.  */
+  reset_bufs();
+  backend_rx(2, 0, 100, NETRXF_more_data);
+  RING_PUSH_RESPONSES(&rx_back);
+  len = netfront_rx_frame(&rx, &rx_ops, NULL, frame, sizeof frame, &flags);
+  ASSERT(len == -1, "frame without its end");
+  ASSERT(rx.rsp_cons == rx.sring->rsp_prod, "no response read past the end");
+  ASSERT(given[2] == 1, "buffer of the truncated frame handed back");
+
+  /* An error from the backend.  */
+  reset_bufs();
+  backend_rx(3, 0, NETIF_RSP_ERROR, 0);
+  RING_PUSH_RESPONSES(&rx_back);
+  len = netfront_rx_frame(&rx, &rx_ops, NULL, frame, sizeof frame, &flags);
+  ASSERT(len == -1, "error status");
+  ASSERT(given[3] == 1, "buffer of the error handed back");
+
+  /* Longer than the frame can hold.  */
+  reset_bufs();
+  backend_rx(0, 0, 100, NETRXF_more_data);
+  backend_rx(1, 0, 100, 0);
+  RING_PUSH_RESPONSES(&rx_back);
+  len = netfront_rx_frame(&rx, &rx_ops, NULL, frame, 150, &flags);
+  ASSERT(len == -1, "frame too long");
+  ASSERT(given[0] == 1 && given[1] == 1, "buffers of the long frame handed back");
+
+  /* Past the end of its page.  */
+  reset_bufs();
+  backend_rx(1, PAGE_SIZE - 10, 100, 0);
+  RING_PUSH_RESPONSES(&rx_back);
+  len = netfront_rx_frame(&rx, &rx_ops, NULL, frame, sizeof frame, &flags);
+  ASSERT(len == -1, "fragment past its page");
+
+  /* No room to receive it.  */
+  reset_bufs();
+  backend_rx(2, 0, 100, NETRXF_more_data);
+  backend_rx(3, 0, 100, 0);
+  RING_PUSH_RESPONSES(&rx_back);
+  len = netfront_rx_frame(&rx, &rx_ops, NULL, NULL, sizeof frame, &flags);
+  ASSERT(len == -1, "no frame");
+  ASSERT(given[2] == 1 && given[3] == 1, "buffers handed back without a frame");
+
+  /* A bad id is dropped, without touching any buffer.  */
+  reset_bufs();
+  backend_rx(RING_SIZE(&rx), 0, 100, 0);
+  RING_PUSH_RESPONSES(&rx_back);
+  len = netfront_rx_frame(&rx, &rx_ops, NULL, frame, sizeof frame, &flags);
+  ASSERT(len == -1, "bad id");
+  for (i = 0; i < NBUFS; i++)
+    ASSERT(taken[i] == 0 && given[i] == 0, "no buffer for a bad id");
+}
+
+int main(int argc, char *argv[], int envc, char *envp[])
+{
+  test_negotiate();
+  test_tcp_mss();
+  test_tx();
+  test_rx();
+  return 0;
+}
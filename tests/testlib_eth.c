@@ -0,0 +1,78 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Helpers for the tests sending packets through the network card. */
+
+#include <testlib.h>
+
+#include <device/bpf.h>
+#include <device/device_types.h>
+#include <device/net_status.h>
+
+#include <device.user.h>
+#include <mach.user.h>
+
+/* Open eth0, which the tests using it are given by QEMU. */
+mach_port_t test_eth_open(void) {
+  mach_port_t eth;
+  int err;
+
+  err = device_open(device_priv(), D_READ | D_WRITE, "eth0", &eth);
+  ASSERT_RET(err, "device_open eth0");
+  return eth;
+}
+
+/* Allocate a port and set a filter of len instructions sending it packets. */
+mach_port_t test_eth_port(mach_port_t eth, const struct bpf_insn *filter,
+                          int len) {
+  mach_port_t port;
+  int err;
+
+  err = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+  ASSERT_RET(err, "mach_port_allocate");
+  err = device_set_filter(eth, port, MACH_MSG_TYPE_MAKE_SEND, 0,
+                          (filter_array_t) filter,
+                          len * sizeof filter[0] / sizeof (filter_t));
+  ASSERT_RET(err, "device_set_filter");
+  return port;
+}
+
+/* Fill size bytes of frame with an empty broadcast of the given type,
+   from a locally administered address. */
+void test_eth_frame(unsigned char *frame, size_t size, unsigned short type) {
+  memset(frame, 0, size);
+  memset(frame, 0xff, 6);
+  frame[6] = 0x02;
+  frame[11] = 0x01;
+  frame[12] = type >> 8;
+  frame[13] = type & 0xff;
+}
+
+/* The network buffers are only allocated once a packet needs one:
+   send a packet no filter of the tests accepts, and let it go. */
+void test_eth_warm_up(mach_port_t eth) {
+  unsigned char frame[TEST_ETH_MIN_FRAME];
+  mach_msg_type_number_t written;
+  int err;
+
+  test_eth_frame(frame, sizeof frame, 0);
+  err = device_write_inband(eth, 0, 0, (char *) frame, sizeof frame,
+                            &written);
+  ASSERT_RET(err, "device_write_inband");
+  msleep(100);
+}
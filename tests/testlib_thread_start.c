@@ -84,3 +84,33 @@ thread_t test_thread_start(task_t task, void(*routine)(void*), void* arg) {
 
   return thread;
 }
+
+static void (*worker_routine)(void*);
+static volatile int workers_running;
+
+static void worker_start(void* arg) {
+  worker_routine(arg);
+  __atomic_sub_fetch(&workers_running, 1, __ATOMIC_RELEASE);
+  thread_terminate(mach_thread_self());
+  FAILURE("thread_terminate");
+}
+
+/* Start nworkers threads running routine, each with its index as argument. */
+void test_workers_start(void(*routine)(void*), int nworkers) {
+  ASSERT(workers_running == 0, "workers already running");
+  worker_routine = routine;
+  workers_running = nworkers;
+  for (long i = 0; i < nworkers; i++)
+    test_thread_start(mach_task_self(), worker_start, (void*)i);
+}
+
+/* Number of workers that have not returned yet. */
+int test_workers_running(void) {
+  return __atomic_load_n(&workers_running, __ATOMIC_ACQUIRE);
+}
+
+/* Wait for all the workers to return. */
+void test_workers_wait(void) {
+  while (test_workers_running() > 0)
+    msleep(1);
+}
@@ -126,6 +126,7 @@ SRC_TESTLIB= \
 	$(srcdir)/tests/start.S \
 	$(srcdir)/tests/testlib.c \
 	$(srcdir)/tests/testlib_thread_start.c \
+	$(srcdir)/tests/testlib_eth.c \
 	$(builddir)/tests/errlist.c \
 	$(MIG_GEN_CC)
 
@@ -204,10 +205,71 @@ USER_TESTS := \
 	tests/test-syscalls \
 	tests/test-machmsg \
 	tests/test-task \
-	tests/test-threads
+	tests/test-threads \
+	tests/test-deadline \
+	tests/test-wakeup \
+	tests/test-gsync_bench \
+	tests/test-gsync_pi \
+	tests/test-gsync_waitv \
+	tests/test-vm_fault_bench \
+	tests/test-lock_mon \
+	tests/test-slab_pools \
+	tests/test-slab_trace \
+	tests/test-numa \
+	tests/test-ool_move \
+	tests/test-ahci \
+	tests/test-blk_bench \
+	tests/test-blkio \
+	tests/test-device_readv \
+	tests/test-io_done \
+	tests/test-bpf_bench \
+	tests/test-bpf_jit \
+	tests/test-net_batch \
+	tests/test-net_ring \
+	tests/test-net_poll \
+	tests/test-xen_netfront
 
 USER_TESTS_CLEAN = $(subst tests/,clean-,$(USER_TESTS))
 
+# two processors, so that threads wake each other across them
+tests/test-wakeup: QEMU_OPTS += -smp 2
+
+# completions processed on the submitting processor
+tests/test-io_done: QEMU_OPTS += -smp 2
+
+# two nodes of one processor and half the memory each
+tests/test-numa: QEMU_OPTS += -smp 2				\
+	-object memory-backend-ram,id=m0,size=1024M		\
+	-object memory-backend-ram,id=m1,size=1024M		\
+	-numa node,nodeid=0,cpus=0,memdev=m0			\
+	-numa node,nodeid=1,cpus=1,memdev=m1
+
+# a 64MiB disk of zeroes on an AHCI controller, which supports NCQ
+tests/test-ahci tests/test-device_readv: QEMU_OPTS += -device ahci,id=ahci			\
+	-blockdev driver=null-co,node-name=disk,size=67108864,read-zeroes=on \
+	-device ide-hd,drive=disk,bus=ahci.0
+
+# two such disks, on two ports
+tests/test-blkio: QEMU_OPTS += -device ahci,id=ahci			\
+	-blockdev driver=null-co,node-name=disk,size=67108864,read-zeroes=on \
+	-device ide-hd,drive=disk,bus=ahci.0				\
+	-blockdev driver=null-co,node-name=disk2,size=67108864,read-zeroes=on \
+	-device ide-hd,drive=disk2,bus=ahci.1
+
+# 64MiB disks of zeroes on AHCI and on the IDE controller
+tests/test-blk_bench: QEMU_OPTS += -device ahci,id=ahci		\
+	-blockdev driver=null-co,node-name=sd,size=67108864,read-zeroes=on \
+	-device ide-hd,drive=sd,bus=ahci.0				\
+	-blockdev driver=null-co,node-name=hd,size=67108864,read-zeroes=on \
+	-device ide-hd,drive=hd,bus=ide.0
+
+# a network card, whose sent packets go through the packet filters
+tests/test-bpf_bench tests/test-bpf_jit tests/test-net_batch tests/test-net_ring tests/test-net_poll: QEMU_OPTS += -nic user,model=rtl8139
+
+# the ring handling of the Xen network frontend, against a stub backend
+tests/module-xen_netfront: TESTCFLAGS += -I$(srcdir)
+tests/module-xen_netfront: SRC_TESTLIB += $(srcdir)/xen/netfront.c $(srcdir)/util/byteorder.c
+
 #
 # helpers for interactive test run and debug
 #
@@ -43,9 +43,11 @@
 #include <mach/vm_param.h>
 #include <mach_debug/vm_info.h>
 #include <mach_debug/hash_info.h>
+#include <mach_debug/numa_info.h>
 #include <vm/vm_map.h>
 #include <vm/vm_kern.h>
 #include <vm/vm_object.h>
+#include <vm/vm_page.h>
 #include <kern/mach_debug.server.h>
 #include <kern/task.h>
 #include <kern/host.h>
@@ -546,3 +548,35 @@ host_virtual_physical_table_info(const host_t host,
 
 	return KERN_SUCCESS;
 }
+
+/*
+ *	Routine:	host_numa_info
+ *	Purpose:
+ *		Return the statistics of each NUMA node.
+ *	Conditions:
+ *		Nothing locked.  Obeys CountInOut protocol.
+ *		The counters are read without synchronization.
+ *	Returns:
+ *		KERN_SUCCESS		Returned information.
+ *		KERN_INVALID_HOST	The host is null.
+ */
+
+kern_return_t
+host_numa_info(const host_t host,
+	       numa_node_info_array_t info, natural_t *countp)
+{
+	unsigned int i, nr_nodes;
+
+	if (host == HOST_NULL)
+		return KERN_INVALID_HOST;
+
+	nr_nodes = vm_page_nr_nodes();
+	if (nr_nodes > *countp)
+		nr_nodes = *countp;
+
+	for (i = 0; i < nr_nodes; i++)
+		vm_page_node_info(i, &info[i]);
+
+	*countp = nr_nodes;
+	return KERN_SUCCESS;
+}
@@ -223,6 +223,19 @@ vm_map_t vm_map_create(
 
 	vm_map_setup(result, pmap, min, max);
 
+#if	NCPUS > 1
+	/*
+	 *	Faults only need the map locked for read, let the
+	 *	threads of a task take their faults in parallel.
+	 */
+	{
+		struct lock_reader *readers = lock_readers_alloc();
+
+		if (readers != NULL)
+			lock_set_readers(&result->lock, readers);
+	}
+#endif	/* NCPUS > 1 */
+
 	return(result);
 }
 
@@ -560,6 +573,9 @@ void vm_map_deallocate(vm_map_t map)
 
 	pmap_destroy(map->pmap);
 
+	if (map->lock.readers != NULL)
+		lock_readers_free(map->lock.readers);
+
 	kmem_cache_free(&vm_map_cache, (vm_offset_t) map);
 }
 
@@ -2209,6 +2225,10 @@ void vm_map_copy_page_discard(vm_map_copy_t copy)
 	}
 }
 
+static kern_return_t	vm_map_copy_chain_cont(
+	vm_map_copyin_args_t	cont_args,
+	vm_map_copy_t		*copy_result);
+
 /*
  *	Routine:	vm_map_copy_discard
  *
@@ -2254,10 +2274,12 @@ free_next_copy:
 
 			/*
 			 *	Special case: recognize
-			 *	vm_map_copy_discard_cont and optimize
+			 *	vm_map_copy_discard_cont and
+			 *	vm_map_copy_chain_cont and optimize
 			 *	here to avoid tail recursion.
 			 */
-			if (copy->cpy_cont == vm_map_copy_discard_cont) {
+			if (copy->cpy_cont == vm_map_copy_discard_cont ||
+			    copy->cpy_cont == vm_map_copy_chain_cont) {
 				vm_map_copy_t	new_copy;
 
 				new_copy = (vm_map_copy_t) copy->cpy_cont_args;
@@ -2349,6 +2371,24 @@ vm_map_copy_t		*copy_result)	/* OUT */
 	return(KERN_SUCCESS);
 }
 
+/*
+ *	Routine:	vm_map_copy_chain_cont
+ *
+ *	Description:
+ *		Continuation of a page list whose successor was
+ *		copied in already, and is given as the argument.
+ */
+static kern_return_t	vm_map_copy_chain_cont(
+vm_map_copyin_args_t	cont_args,
+vm_map_copy_t		*copy_result)	/* OUT */
+{
+	if (copy_result == (vm_map_copy_t *)0)
+		vm_map_copy_discard((vm_map_copy_t) cont_args);
+	else
+		*copy_result = (vm_map_copy_t) cont_args;
+	return(KERN_SUCCESS);
+}
+
 /*
  *	Routine:	vm_map_copy_overwrite
  *
@@ -3201,14 +3241,18 @@ insert_pages:
 		m->busy = FALSE;
 		m->dirty = TRUE;
 		vm_page_replace(m, object, old_last_offset + offset);
-		if (must_wire) {
+		if (must_wire)
 			vm_page_wire(m);
-			PMAP_ENTER(dst_map->pmap,
-				   last->vme_start + m->offset - last->offset,
-				   m, last->protection, TRUE);
-		} else {
+		else
 			vm_page_activate(m);
-		}
+
+		/*
+		 *	Enter the page now rather than on the first
+		 *	fault, since the receiver is about to use it.
+		 */
+		PMAP_ENTER(dst_map->pmap,
+			   last->vme_start + m->offset - last->offset,
+			   m, last->protection, must_wire);
 
 		*page_list++ = VM_PAGE_NULL;
 		if (--(copy->cpy_npages) == 0 &&
@@ -3797,6 +3841,121 @@ static kern_return_t	vm_map_copyin_page_list_cont(
 	return(result);
 }
 
+/*
+ *	vm_map_copyin_movable:
+ *
+ *	Return TRUE if vm_map_copyin_page_list can most likely steal
+ *	all the pages of the given region when destroying it, instead
+ *	of copying them: the region is page aligned, of a size worth
+ *	moving, and only mapped through private, unwired entries of
+ *	temporary objects that neither shadow nor are shadowed by
+ *	other objects.  Pages not resident yet are faulted in by the copy.
+ *
+ *	This is only a hint: the map is unlocked on return, and
+ *	vm_map_copyin_page_list still copies pages that became
+ *	shared in the meantime.
+ */
+boolean_t vm_map_copyin_movable(
+	vm_map_t	map,
+	vm_offset_t	addr,
+	vm_size_t	len)
+{
+	vm_map_entry_t	entry;
+	vm_object_t	object;
+	vm_offset_t	start, end;
+	boolean_t	movable;
+
+	if (!page_aligned(addr) || !page_aligned(len)
+	    || (atop(len) < VM_MAP_COPY_PAGE_MOVE_MIN)
+	    || (atop(len) > VM_MAP_COPY_PAGE_MOVE_MAX)
+	    || (addr + len <= addr))
+		return FALSE;
+
+	start = addr;
+	end = addr + len;
+	movable = FALSE;
+
+	vm_map_lock_read(map);
+
+	if (!vm_map_lookup_entry(map, start, &entry))
+		goto out;
+
+	while (start < end) {
+		if ((entry == vm_map_to_entry(map))
+		    || ((entry->vme_start != start) && (start != addr)))
+			goto out;
+
+		if (entry->is_sub_map || entry->is_shared
+		    || entry->needs_copy || entry->in_transition
+		    || (entry->wired_count != 0)
+		    || !(entry->protection & VM_PROT_READ))
+			goto out;
+
+		object = entry->object.vm_object;
+		if ((object != VM_OBJECT_NULL)
+		    && (!object->temporary || object->shadowed
+			|| object->use_shared_copy
+			|| (object->shadow != VM_OBJECT_NULL)))
+			goto out;
+
+		start = entry->vme_end;
+		entry = entry->vme_next;
+	}
+
+	movable = TRUE;
+
+out:
+	vm_map_unlock_read(map);
+	return movable;
+}
+
+/*
+ *	vm_map_copyin_page_list_move:
+ *
+ *	Steal all the pages of a region given up by its owner, as
+ *	page lists chained by vm_map_copy_chain_cont.  Unlike those
+ *	of vm_map_copyin_page_list, which only copy in the rest of
+ *	the region when the recipient asks for it, these
+ *	continuations have nothing left to do: the whole region is
+ *	removed from the source map on return.
+ *
+ *	Stolen pages are in no object, so holding several lists of
+ *	them cannot deadlock later copies.
+ */
+kern_return_t vm_map_copyin_page_list_move(
+	vm_map_t	src_map,
+	vm_offset_t	src_addr,
+	vm_size_t	len,
+	vm_map_copy_t	*copy_result)	/* OUT */
+{
+	vm_map_copy_t	copy, last, next;
+	kern_return_t	result;
+
+	result = vm_map_copyin_page_list(src_map, src_addr, len,
+					 TRUE, TRUE, &copy, FALSE);
+	if (result != KERN_SUCCESS)
+		return(result);
+
+	for (last = copy;
+	     last != VM_MAP_COPY_NULL && vm_map_copy_has_cont(last);
+	     last = next) {
+		vm_map_copy_invoke_extend_cont(last, &next, &result);
+		last->cpy_cont_args = VM_MAP_COPYIN_ARGS_NULL;
+		if (result != KERN_SUCCESS) {
+			vm_map_copy_discard(copy);
+			return(result);
+		}
+
+		if (next != VM_MAP_COPY_NULL) {
+			last->cpy_cont = vm_map_copy_chain_cont;
+			last->cpy_cont_args = (vm_map_copyin_args_t) next;
+		}
+	}
+
+	*copy_result = copy;
+	return(KERN_SUCCESS);
+}
+
 /*
  *	vm_map_copyin_page_list:
  *
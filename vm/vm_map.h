@@ -255,6 +255,16 @@ typedef struct vm_map_version {
 
 #define VM_MAP_COPY_PAGE_LIST_MAX	64
 
+/*
+ *	Bounds, in pages, of the memory given up by its owner that
+ *	messages move as stolen page lists instead of copy-on-write
+ *	entry lists.  Regions larger than VM_MAP_COPY_PAGE_LIST_MAX
+ *	are moved as chains of page lists, see
+ *	vm_map_copyin_page_list_move.
+ */
+#define VM_MAP_COPY_PAGE_MOVE_MIN	16
+#define VM_MAP_COPY_PAGE_MOVE_MAX	16384
+
 struct vm_map_copy;
 struct vm_map_copyin_args_data;
 typedef kern_return_t (*vm_map_copy_cont_fn)(struct vm_map_copyin_args_data*, struct vm_map_copy**);
@@ -429,6 +439,13 @@ extern kern_return_t	vm_map_copyin_page_list(vm_map_t, vm_offset_t,
 						vm_size_t, boolean_t,
 						boolean_t, vm_map_copy_t *,
 						boolean_t);
+/* Steal all the pages of a region given up by its owner */
+extern kern_return_t	vm_map_copyin_page_list_move(vm_map_t, vm_offset_t,
+						     vm_size_t,
+						     vm_map_copy_t *);
+/* Check whether the pages of a region can be stolen */
+extern boolean_t	vm_map_copyin_movable(vm_map_t, vm_offset_t,
+					      vm_size_t);
 /* Place a copy into a map */
 extern kern_return_t	vm_map_copyout(vm_map_t, vm_offset_t *, vm_map_copy_t);
 /* Overwrite existing memory with a copy */
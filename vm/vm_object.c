@@ -266,6 +266,13 @@ vm_object_t vm_object_allocate(
  */
 void vm_object_bootstrap(void)
 {
+	/*
+	 *	No reclaim function: cached objects hold pages, and
+	 *	the pageout daemon terminates them as soon as it has
+	 *	taken their last one (see vm_page_seg_evict).  Dropping
+	 *	them from here would throw away pages the scan keeps on
+	 *	purpose, to free a few small structures.
+	 */
 	kmem_cache_init(&vm_object_cache, "vm_object",
 			sizeof(struct vm_object), 0, NULL, 0);
 
@@ -40,6 +40,7 @@
 #include <kern/lock.h>
 #include <kern/macros.h>
 #include <kern/printf.h>
+#include <kern/smp.h>
 #include <kern/thread.h>
 #include <mach/vm_param.h>
 #include <machine/pmap.h>
@@ -104,6 +105,47 @@ struct vm_page_free_list {
     struct list blocks;
 };
 
+/*
+ * NUMA node.
+ *
+ * Free blocks of each segment are kept in separate lists per node, so
+ * that blocks never span nodes.
+ */
+struct vm_page_node {
+    unsigned long nr_local_allocs;      /* Pages allocated by local processors */
+    unsigned long nr_remote_allocs;     /* Pages allocated by other processors */
+    unsigned long nr_fallback_allocs;   /* Pages local processors got from
+                                           other nodes */
+    unsigned long nr_pages;
+    unsigned char distances[VM_PAGE_MAX_NODES];
+    unsigned char fallback[VM_PAGE_MAX_NODES]; /* Nodes by increasing
+                                                  distance */
+};
+
+/*
+ * Physical memory range of a NUMA node.
+ */
+struct vm_page_node_range {
+    phys_addr_t start;
+    phys_addr_t end;
+    unsigned int node;
+};
+
+/*
+ * Maximum number of physical memory ranges assigned to nodes.
+ */
+#define VM_PAGE_MAX_NODE_RANGES 32
+
+#if VM_PAGE_MAX_NODES > NUMA_INFO_MAX_NODES
+#error VM_PAGE_MAX_NODES invalid
+#endif /* VM_PAGE_MAX_NODES > NUMA_INFO_MAX_NODES */
+
+/*
+ * Default distances between nodes, as defined by ACPI.
+ */
+#define VM_PAGE_NODE_LOCAL_DISTANCE     10
+#define VM_PAGE_NODE_REMOTE_DISTANCE    20
+
 /*
  * XXX Because of a potential deadlock involving the default pager (see
  * vm_map_lock()), it's currently impossible to reliably determine the
@@ -204,8 +246,10 @@ struct vm_page_seg {
     struct vm_page *pages;
     struct vm_page *pages_end;
     simple_lock_data_t lock;
-    struct vm_page_free_list free_lists[VM_PAGE_NR_FREE_LISTS];
+    struct vm_page_free_list free_lists[VM_PAGE_MAX_NODES]
+                                       [VM_PAGE_NR_FREE_LISTS];
     unsigned long nr_free_pages;
+    unsigned long nr_node_free_pages[VM_PAGE_MAX_NODES];
 
     /* Free memory thresholds */
     unsigned long min_free_pages; /* Privileged allocations only */
@@ -264,6 +308,24 @@ static struct vm_page_boot_seg vm_page_boot_segs[VM_PAGE_MAX_SEGS] __initdata;
  */
 static unsigned int vm_page_segs_size __read_mostly;
 
+/*
+ * Node table, and number of nodes in use.
+ */
+static struct vm_page_node vm_page_nodes[VM_PAGE_MAX_NODES];
+static unsigned int vm_page_nodes_size __read_mostly = 1;
+
+/*
+ * Node of each processor.
+ */
+static unsigned char vm_page_cpu_nodes[NCPUS] __read_mostly;
+
+/*
+ * Physical memory ranges of nodes, as reported at boot time.
+ */
+static struct vm_page_node_range vm_page_node_ranges[VM_PAGE_MAX_NODE_RANGES]
+    __initdata;
+static unsigned int vm_page_node_ranges_size __initdata;
+
 /*
  * If true, unprivileged allocations are blocked, disregarding any other
  * condition.
@@ -358,12 +420,23 @@ vm_page_free_list_remove(struct vm_page_free_list *free_list,
     list_remove(&page->node);
 }
 
+static inline unsigned int
+vm_page_cpu_node(void)
+{
+    return vm_page_cpu_nodes[cpu_number()];
+}
+
+/*
+ * Allocate a block from the buddy system of a segment, preferably from
+ * the given node.
+ */
 static struct vm_page *
-vm_page_seg_alloc_from_buddy(struct vm_page_seg *seg, unsigned int order)
+vm_page_seg_alloc_from_buddy(struct vm_page_seg *seg, unsigned int order,
+                             unsigned int preferred)
 {
     struct vm_page_free_list *free_list = free_list;
     struct vm_page *page, *buddy;
-    unsigned int i;
+    unsigned int i, j, node = 0;
 
     assert(order < VM_PAGE_NR_FREE_LISTS);
 
@@ -380,14 +453,21 @@ vm_page_seg_alloc_from_buddy(struct vm_page_seg *seg, unsigned int order)
         }
     }
 
-    for (i = order; i < VM_PAGE_NR_FREE_LISTS; i++) {
-        free_list = &seg->free_lists[i];
+    for (j = 0; j < vm_page_nodes_size; j++) {
+        node = vm_page_nodes[preferred].fallback[j];
+
+        for (i = order; i < VM_PAGE_NR_FREE_LISTS; i++) {
+            free_list = &seg->free_lists[node][i];
+
+            if (free_list->size != 0)
+                break;
+        }
 
-        if (free_list->size != 0)
+        if (i != VM_PAGE_NR_FREE_LISTS)
             break;
     }
 
-    if (i == VM_PAGE_NR_FREE_LISTS)
+    if (j == vm_page_nodes_size)
         return NULL;
 
     page = list_first_entry(&free_list->blocks, struct vm_page, node);
@@ -397,11 +477,12 @@ vm_page_seg_alloc_from_buddy(struct vm_page_seg *seg, unsigned int order)
     while (i > order) {
         i--;
         buddy = &page[1 << i];
-        vm_page_free_list_insert(&seg->free_lists[i], buddy);
+        vm_page_free_list_insert(&seg->free_lists[node][i], buddy);
         buddy->order = i;
     }
 
     seg->nr_free_pages -= (1 << order);
+    seg->nr_node_free_pages[node] -= (1 << order);
 
     if (seg->nr_free_pages < seg->min_free_pages) {
         vm_page_alloc_paused = TRUE;
@@ -416,7 +497,7 @@ vm_page_seg_free_to_buddy(struct vm_page_seg *seg, struct vm_page *page,
 {
     struct vm_page *buddy;
     phys_addr_t pa, buddy_pa;
-    unsigned int nr_pages;
+    unsigned int nr_pages, node;
 
     assert(page >= seg->pages);
     assert(page < seg->pages_end);
@@ -425,6 +506,7 @@ vm_page_seg_free_to_buddy(struct vm_page_seg *seg, struct vm_page *page,
 
     nr_pages = (1 << order);
     pa = page->phys_addr;
+    node = page->node_index;
 
     while (order < (VM_PAGE_NR_FREE_LISTS - 1)) {
         buddy_pa = pa ^ vm_page_ptoa(1ULL << order);
@@ -434,19 +516,20 @@ vm_page_seg_free_to_buddy(struct vm_page_seg *seg, struct vm_page *page,
 
         buddy = &seg->pages[vm_page_atop(buddy_pa - seg->start)];
 
-        if (buddy->order != order)
+        if ((buddy->order != order) || (buddy->node_index != node))
             break;
 
-        vm_page_free_list_remove(&seg->free_lists[order], buddy);
+        vm_page_free_list_remove(&seg->free_lists[node][order], buddy);
         buddy->order = VM_PAGE_ORDER_UNLISTED;
         order++;
         pa &= -vm_page_ptoa(1ULL << order);
         page = &seg->pages[vm_page_atop(pa - seg->start)];
     }
 
-    vm_page_free_list_insert(&seg->free_lists[order], page);
+    vm_page_free_list_insert(&seg->free_lists[node][order], page);
     page->order = order;
     seg->nr_free_pages += nr_pages;
+    seg->nr_node_free_pages[node] += nr_pages;
 }
 
 static void __init
@@ -498,7 +581,7 @@ vm_page_cpu_pool_fill(struct vm_page_cpu_pool *cpu_pool,
     simple_lock(&seg->lock);
 
     for (i = 0; i < cpu_pool->transfer_size; i++) {
-        page = vm_page_seg_alloc_from_buddy(seg, 0);
+        page = vm_page_seg_alloc_from_buddy(seg, 0, vm_page_cpu_node());
 
         if (page == NULL)
             break;
@@ -649,7 +732,7 @@ vm_page_seg_init(struct vm_page_seg *seg, phys_addr_t start, phys_addr_t end,
 {
     phys_addr_t pa;
     int pool_size;
-    unsigned int i;
+    unsigned int i, j;
 
     seg->start = start;
     seg->end = end;
@@ -662,8 +745,12 @@ vm_page_seg_init(struct vm_page_seg *seg, phys_addr_t start, phys_addr_t end,
     seg->pages_end = pages + vm_page_atop(vm_page_seg_size(seg));
     simple_lock_init(&seg->lock);
 
-    for (i = 0; i < ARRAY_SIZE(seg->free_lists); i++)
-        vm_page_free_list_init(&seg->free_lists[i]);
+    for (i = 0; i < ARRAY_SIZE(seg->free_lists); i++) {
+        for (j = 0; j < ARRAY_SIZE(seg->free_lists[i]); j++)
+            vm_page_free_list_init(&seg->free_lists[i][j]);
+
+        seg->nr_node_free_pages[i] = 0;
+    }
 
     seg->nr_free_pages = 0;
 
@@ -680,6 +767,29 @@ vm_page_seg_init(struct vm_page_seg *seg, phys_addr_t start, phys_addr_t end,
         vm_page_init_pa(&pages[vm_page_atop(pa - seg->start)], i, pa);
 }
 
+/*
+ * Update the allocation statistics of nodes.
+ */
+static void
+vm_page_node_account(const struct vm_page *page, unsigned int order)
+{
+    unsigned long nr_pages;
+    unsigned int node;
+
+    nr_pages = 1UL << order;
+    node = vm_page_cpu_node();
+
+    if (page->node_index == node) {
+        __atomic_add_fetch(&vm_page_nodes[node].nr_local_allocs, nr_pages,
+                           __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&vm_page_nodes[page->node_index].nr_remote_allocs,
+                           nr_pages, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&vm_page_nodes[node].nr_fallback_allocs,
+                           nr_pages, __ATOMIC_RELAXED);
+    }
+}
+
 static struct vm_page *
 vm_page_seg_alloc(struct vm_page_seg *seg, unsigned int order,
                   unsigned short type)
@@ -710,7 +820,7 @@ vm_page_seg_alloc(struct vm_page_seg *seg, unsigned int order,
         thread_unpin();
     } else {
         simple_lock(&seg->lock);
-        page = vm_page_seg_alloc_from_buddy(seg, order);
+        page = vm_page_seg_alloc_from_buddy(seg, order, vm_page_cpu_node());
         simple_unlock(&seg->lock);
 
         if (page == NULL)
@@ -719,6 +829,7 @@ vm_page_seg_alloc(struct vm_page_seg *seg, unsigned int order,
 
     assert(page->type == VM_PT_FREE);
     vm_page_set_type(page, order, type);
+    vm_page_node_account(page, order);
     return page;
 }
 
@@ -733,7 +844,11 @@ vm_page_seg_free(struct vm_page_seg *seg, struct vm_page *page,
 
     vm_page_set_type(page, order, VM_PT_FREE);
 
-    if (order == 0) {
+    /*
+     * Pages of other nodes are returned to the buddy system at once,
+     * so that CPU pools only cache local pages.
+     */
+    if ((order == 0) && (page->node_index == vm_page_cpu_node())) {
         thread_pin();
         cpu_pool = vm_page_cpu_pool_get(seg);
         simple_lock(&cpu_pool->lock);
@@ -1000,7 +1115,7 @@ vm_page_seg_balance_page(struct vm_page_seg *seg,
     assert(src->type != VM_PT_FREE);
     assert(src->order == VM_PAGE_ORDER_UNLISTED);
 
-    dest = vm_page_seg_alloc_from_buddy(remote_seg, 0);
+    dest = vm_page_seg_alloc_from_buddy(remote_seg, 0, src->node_index);
     assert(dest != NULL);
 
     vm_page_seg_double_unlock(seg, remote_seg);
@@ -1310,6 +1425,251 @@ vm_page_load_heap(unsigned int seg_index, phys_addr_t start, phys_addr_t end)
 #endif
 }
 
+void __init
+vm_page_load_node(unsigned int node, phys_addr_t start, phys_addr_t end)
+{
+    struct vm_page_node_range *range;
+
+    assert(node < ARRAY_SIZE(vm_page_nodes));
+    assert(start < end);
+
+    if (vm_page_node_ranges_size == ARRAY_SIZE(vm_page_node_ranges)) {
+        printf("vm_page: too many node ranges, ignoring %llx:%llx\n",
+               (unsigned long long)start, (unsigned long long)end);
+        return;
+    }
+
+    range = &vm_page_node_ranges[vm_page_node_ranges_size];
+    range->start = start;
+    range->end = end;
+    range->node = node;
+    vm_page_node_ranges_size++;
+}
+
+void __init
+vm_page_set_cpu_node(unsigned int cpu, unsigned int node)
+{
+    assert(cpu < ARRAY_SIZE(vm_page_cpu_nodes));
+    assert(node < ARRAY_SIZE(vm_page_nodes));
+    vm_page_cpu_nodes[cpu] = node;
+}
+
+void __init
+vm_page_set_node_distance(unsigned int from, unsigned int to,
+                          unsigned int distance)
+{
+    assert(from < ARRAY_SIZE(vm_page_nodes));
+    assert(to < ARRAY_SIZE(vm_page_nodes));
+
+    if ((distance == 0) || (distance > 0xff))
+        return;
+
+    vm_page_nodes[from].distances[to] = distance;
+}
+
+static unsigned int __init
+vm_page_lookup_node(phys_addr_t pa)
+{
+    const struct vm_page_node_range *range;
+    unsigned int i;
+
+    for (i = 0; i < vm_page_node_ranges_size; i++) {
+        range = &vm_page_node_ranges[i];
+
+        if ((pa >= range->start) && (pa < range->end))
+            return range->node;
+    }
+
+    return 0;
+}
+
+/*
+ * Return true if node a should be tried before node b when allocating
+ * on behalf of the given node. Nodes at the same distance are tried in
+ * a circular order starting after the local node, which spreads the
+ * fallback allocations of the different nodes.
+ */
+static boolean_t __init
+vm_page_node_before(unsigned int node, unsigned int a, unsigned int b,
+                    unsigned int nr_nodes)
+{
+    const unsigned char *distances;
+
+    distances = vm_page_nodes[node].distances;
+
+    if (distances[a] != distances[b])
+        return distances[a] < distances[b];
+
+    return ((a + nr_nodes - node) % nr_nodes)
+           < ((b + nr_nodes - node) % nr_nodes);
+}
+
+static void __init
+vm_page_node_init_fallback(unsigned int node, unsigned int nr_nodes)
+{
+    unsigned char *fallback;
+    unsigned int i, j, tmp;
+
+    fallback = vm_page_nodes[node].fallback;
+
+    for (i = 0; i < nr_nodes; i++) {
+        if (vm_page_nodes[node].distances[i] == 0)
+            vm_page_nodes[node].distances[i] = (i == node)
+                                               ? VM_PAGE_NODE_LOCAL_DISTANCE
+                                               : VM_PAGE_NODE_REMOTE_DISTANCE;
+    }
+
+    for (i = 0; i < nr_nodes; i++) {
+        tmp = i;
+
+        for (j = i; (j > 0)
+                    && vm_page_node_before(node, tmp, fallback[j - 1],
+                                           nr_nodes); j--)
+            fallback[j] = fallback[j - 1];
+
+        fallback[j] = tmp;
+    }
+}
+
+/*
+ * Move the free pages of a segment to the free lists of their node.
+ *
+ * All blocks are first removed from the free lists of node 0, to which
+ * all pages belong until nodes are set up, and released again page per
+ * page once every page knows its node, so that blocks never span nodes.
+ */
+static void __init
+vm_page_seg_setup_nodes(struct vm_page_seg *seg)
+{
+    struct vm_page_cpu_pool *cpu_pool;
+    struct vm_page *page, *end;
+    struct list blocks;
+    unsigned int i, order;
+
+    list_init(&blocks);
+    simple_lock(&seg->lock);
+
+    for (i = 0; i < VM_PAGE_NR_FREE_LISTS; i++) {
+        while (seg->free_lists[0][i].size != 0) {
+            page = list_first_entry(&seg->free_lists[0][i].blocks,
+                                    struct vm_page, node);
+            vm_page_free_list_remove(&seg->free_lists[0][i], page);
+            page->order = VM_PAGE_ORDER_UNLISTED;
+            page->priv = (void *)(unsigned long)i;
+            list_insert_tail(&blocks, &page->node);
+        }
+    }
+
+    seg->nr_free_pages = 0;
+    seg->nr_node_free_pages[0] = 0;
+
+    for (page = seg->pages; page < seg->pages_end; page++) {
+        page->node_index = vm_page_lookup_node(page->phys_addr);
+        vm_page_nodes[page->node_index].nr_pages++;
+    }
+
+    while (!list_empty(&blocks)) {
+        page = list_first_entry(&blocks, struct vm_page, node);
+        list_remove(&page->node);
+        order = (unsigned long)page->priv;
+        page->priv = NULL;
+        end = page + (1 << order);
+
+        while (page < end) {
+            vm_page_seg_free_to_buddy(seg, page, 0);
+            page++;
+        }
+    }
+
+    simple_unlock(&seg->lock);
+
+    /*
+     * Pages cached by processors of other nodes are returned to the
+     * buddy system the next time their pool is drained.
+     */
+    for (i = 0; i < ARRAY_SIZE(seg->cpu_pools); i++) {
+        cpu_pool = &seg->cpu_pools[i];
+        simple_lock(&cpu_pool->lock);
+
+        list_for_each_entry(&cpu_pool->pages, page, node)
+            page->node_index = vm_page_lookup_node(page->phys_addr);
+
+        simple_unlock(&cpu_pool->lock);
+    }
+}
+
+void __init
+vm_page_setup_nodes(void)
+{
+    unsigned int i, nr_nodes;
+
+    assert(vm_page_is_ready);
+
+    nr_nodes = 1;
+
+    for (i = 0; i < vm_page_node_ranges_size; i++)
+        if (vm_page_node_ranges[i].node >= nr_nodes)
+            nr_nodes = vm_page_node_ranges[i].node + 1;
+
+    for (i = 0; i < ARRAY_SIZE(vm_page_cpu_nodes); i++)
+        if (vm_page_cpu_nodes[i] >= nr_nodes)
+            nr_nodes = vm_page_cpu_nodes[i] + 1;
+
+    if (nr_nodes == 1)
+        return;
+
+    for (i = 0; i < nr_nodes; i++)
+        vm_page_node_init_fallback(i, nr_nodes);
+
+    simple_lock(&vm_page_queue_free_lock);
+    vm_page_nodes[0].nr_pages = 0;
+
+    for (i = 0; i < vm_page_segs_size; i++)
+        vm_page_seg_setup_nodes(&vm_page_segs[i]);
+
+    vm_page_nodes_size = nr_nodes;
+    simple_unlock(&vm_page_queue_free_lock);
+
+    for (i = 0; i < nr_nodes; i++)
+        printf("vm_page: node %u: pages: %lu (%luM)\n", i,
+               vm_page_nodes[i].nr_pages,
+               vm_page_nodes[i].nr_pages >> (20 - PAGE_SHIFT));
+}
+
+unsigned int
+vm_page_nr_nodes(void)
+{
+    return vm_page_nodes_size;
+}
+
+void
+vm_page_node_info(unsigned int node, numa_node_info_t *info)
+{
+    const struct vm_page_node *vm_node;
+    unsigned int i, nr_cpus;
+
+    assert(node < vm_page_nodes_size);
+
+    vm_node = &vm_page_nodes[node];
+    nr_cpus = 0;
+
+    for (i = 0; i < smp_get_numcpus(); i++)
+        if (vm_page_cpu_nodes[i] == node)
+            nr_cpus++;
+
+    info->nni_node = node;
+    info->nni_ncpus = nr_cpus;
+    info->nni_pages = vm_node->nr_pages;
+    info->nni_free_pages = 0;
+
+    for (i = 0; i < vm_page_segs_size; i++)
+        info->nni_free_pages += vm_page_segs[i].nr_node_free_pages[node];
+
+    info->nni_local_allocs = vm_node->nr_local_allocs;
+    info->nni_remote_allocs = vm_node->nr_remote_allocs;
+    info->nni_fallback_allocs = vm_node->nr_fallback_allocs;
+}
+
 int
 vm_page_ready(void)
 {
@@ -1421,6 +1781,7 @@ vm_page_setup(void)
     for (i = 0; i < vm_page_segs_size; i++)
         nr_pages += vm_page_atop(vm_page_boot_seg_size(&vm_page_boot_segs[i]));
 
+    vm_page_nodes[0].nr_pages = nr_pages;
     table_size = vm_page_round(nr_pages * sizeof(struct vm_page));
     printf("vm_page: page table size: %lu entries (%luk)\n", nr_pages,
            table_size >> 10);
@@ -1619,6 +1980,22 @@ vm_page_info_all(void)
                vm_page_seg_name(vm_page_seg_index(seg)),
                seg->min_free_pages, seg->low_free_pages, seg->high_free_pages);
     }
+
+    if (vm_page_nodes_size == 1)
+        return;
+
+    for (i = 0; i < vm_page_nodes_size; i++) {
+        numa_node_info_t info;
+
+        vm_page_node_info(i, &info);
+        printf("vm_page: node %u: cpus: %u, pages: %lu, free: %lu, "
+               "local: %lu, remote: %lu, fallback: %lu\n", i,
+               info.nni_ncpus, (unsigned long)info.nni_pages,
+               (unsigned long)info.nni_free_pages,
+               (unsigned long)info.nni_local_allocs,
+               (unsigned long)info.nni_remote_allocs,
+               (unsigned long)info.nni_fallback_allocs);
+    }
 }
 
 phys_addr_t
@@ -1713,6 +2090,26 @@ vm_page_mem_free(void)
     return total;
 }
 
+unsigned long
+vm_page_shortage(void)
+{
+    struct vm_page_seg *seg;
+    unsigned long total;
+    unsigned int i;
+
+    total = 0;
+
+    for (i = 0; i < vm_page_segs_size; i++) {
+        seg = &vm_page_segs[i];
+
+        if (seg->nr_free_pages < seg->high_free_pages) {
+            total += seg->high_free_pages - seg->nr_free_pages;
+        }
+    }
+
+    return total;
+}
+
 /*
  * Mark this page as wired down by yet another map, removing it
  * from paging queues as necessary.
@@ -46,6 +46,7 @@
 
 #include <kern/macros.h>
 #include <kern/sched_prim.h>	/* definitions of wait/wakeup */
+#include <mach_debug/numa_info.h>
 
 #if	MACH_VM_DEBUG
 #include <mach_debug/hash_info.h>
@@ -130,6 +131,7 @@ struct vm_page {
 	unsigned short type:2;
 	unsigned short seg_index:2;
 	unsigned short order:4;
+	unsigned short node_index:3;	/* NUMA node of the page */
 };
 
 #define VM_PAGE_BODY_SIZE					\
@@ -352,6 +354,12 @@ extern unsigned int	vm_page_info(
 #endif
 #define VM_PAGE_SEL_HIGHMEM     3
 
+/*
+ * Maximum number of NUMA nodes, limited by the size of the node_index member
+ * of struct vm_page.
+ */
+#define VM_PAGE_MAX_NODES   8
+
 /*
  * Page usage types.
  */
@@ -412,6 +420,40 @@ void vm_page_load(unsigned int seg_index, phys_addr_t start, phys_addr_t end);
 void vm_page_load_heap(unsigned int seg_index, phys_addr_t start,
                        phys_addr_t end);
 
+/*
+ * Report that physical memory between start and end belongs to the given
+ * NUMA node, that a processor belongs to it, or the relative distance
+ * between two nodes, as found in the firmware tables.
+ *
+ * Memory not covered by any range belongs to node 0, as do processors.
+ * Distances default to 10 within a node, 20 between nodes.
+ */
+void vm_page_load_node(unsigned int node, phys_addr_t start, phys_addr_t end);
+void vm_page_set_cpu_node(unsigned int cpu, unsigned int node);
+void vm_page_set_node_distance(unsigned int from, unsigned int to,
+                               unsigned int distance);
+
+/*
+ * Assign pages to the NUMA nodes reported so far.
+ *
+ * Called once, by architecture-specific code, after the vm_page module is
+ * set up and before other processors are started. From then on, the free
+ * pages of each segment are kept per node, and allocations are served
+ * from the node of the current processor first, then from the other
+ * nodes by increasing distance.
+ */
+void vm_page_setup_nodes(void);
+
+/*
+ * Return the number of NUMA nodes.
+ */
+unsigned int vm_page_nr_nodes(void);
+
+/*
+ * Return the memory and allocation statistics of a NUMA node.
+ */
+void vm_page_node_info(unsigned int node, numa_node_info_t *info);
+
 /*
  * Return true if the vm_page module is completely initialized, false
  * otherwise, in which case only vm_page_bootalloc() can be used for
@@ -510,6 +552,14 @@ phys_addr_t vm_page_mem_size(void);
  */
 unsigned long vm_page_mem_free(void);
 
+/*
+ * Return the number of pages missing for all segments to reach their
+ * high threshold, i.e. the amount the pageout daemon tries to recover.
+ *
+ * Like vm_page_mem_free, this value is only an estimate.
+ */
+unsigned long vm_page_shortage(void);
+
 /*
  * Remove the given page from any page queue it might be in.
  */
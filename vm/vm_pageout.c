@@ -435,7 +435,6 @@ static boolean_t vm_pageout_scan(boolean_t *should_wait)
 	 *	for eviction.
 	 */
 
-	stack_collect();
 	net_kmsg_collect();
 	consider_task_collect();
 	if (0)	/* XXX: pcb_collect doesn't do anything yet, so it is
@@ -443,10 +442,11 @@ static boolean_t vm_pageout_scan(boolean_t *should_wait)
 	consider_thread_collect();
 
 	/*
-	 *	slab_collect should be last, because the other operations
-	 *	might return memory to caches.
+	 *	slab_reclaim should be last, because the other operations
+	 *	might return memory to caches.  It also calls the reclaim
+	 *	functions of caches, e.g. stack_collect.
 	 */
-	slab_collect();
+	slab_reclaim(vm_page_shortage());
 
 	vm_page_refill_inactive();
 
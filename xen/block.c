@@ -23,6 +23,7 @@
 #include <ipc/ipc_space.h>
 #include <vm/vm_kern.h>
 #include <vm/vm_user.h>
+#include <device/blkio.h>
 #include <device/device_types.h>
 #include <device/device_port.h>
 #include <device/disk_status.h>
@@ -56,8 +57,15 @@ struct block_data {
 	ipc_port_t	port;
 	blkif_front_ring_t	ring;
 	evtchn_port_t	evt;
+	struct blkio_queue queue;
 	simple_lock_data_t lock;
-	simple_lock_data_t pushlock;
+};
+
+/* A ring request, queued through the block scheduler.  */
+struct hyp_block_req {
+	struct blkio_req	breq;
+	blkif_request_t		req;	/* copied to the ring when started */
+	io_return_t		err;
 };
 
 static int n_vbds;
@@ -69,32 +77,76 @@ static void hyp_block_intr(int unit) {
 	struct block_data *bd = &vbd_data[unit];
 	blkif_response_t *rsp;
 	int more;
-	io_return_t *err;
+	struct hyp_block_req *hr;
 
 	simple_lock(&bd->lock);
 	more = RING_HAS_UNCONSUMED_RESPONSES(&bd->ring);
 	while (more) {
 		rmb(); /* make sure we see responses */
 		rsp = RING_GET_RESPONSE(&bd->ring, bd->ring.rsp_cons++);
-		err = (void *) (unsigned long) rsp->id;
+		hr = (void *) (unsigned long) rsp->id;
 		switch (rsp->status) {
 		case BLKIF_RSP_ERROR:
-			*err = D_IO_ERROR;
+			hr->err = D_IO_ERROR;
 			break;
 		case BLKIF_RSP_OKAY:
 			break;
 		default:
 			printf("Unrecognized blkif status %d\n", rsp->status);
-			goto drop;
+			hr->err = D_IO_ERROR;
+			break;
 		}
-		thread_wakeup(err);
-drop:
-		thread_wakeup_one(bd);
+		/* This frees a ring slot, start the next request in it */
+		blkio_done(&bd->queue, &hr->breq);
+		thread_wakeup(hr);
 		RING_FINAL_CHECK_FOR_RESPONSES(&bd->ring, more);
 	}
 	simple_unlock(&bd->lock);
 }
 
+/* Push the request of BREQ to the ring.  Invoked with the lock held.  */
+static void hyp_block_start(struct blkio_queue *q, struct blkio_req *breq) {
+	struct block_data *bd = q->private;
+	struct hyp_block_req *hr = breq->private;
+	int notify;
+
+	/* The queue depth is the ring size, so there is always room */
+	assert(!RING_FULL(&bd->ring));
+	*RING_GET_REQUEST(&bd->ring, bd->ring.req_prod_pvt) = hr->req;
+	bd->ring.req_prod_pvt++;
+
+	wmb(); /* make sure it sees requests */
+	RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&bd->ring, notify);
+	if (notify)
+		hyp_event_channel_send(bd->evt);
+}
+
+/* Queue the ring request of HR and wait for its completion.  */
+static io_return_t hyp_block_rw(struct block_data *bd, struct hyp_block_req *hr) {
+	spl_t spl;
+	int i;
+
+	hr->err = 0;
+	hr->req.id = (uint64_t) (unsigned long) hr; /* pointer on the stack */
+	hr->breq.sector = hr->req.sector_number;
+	hr->breq.nr_sectors = 0;
+	for (i = 0; i < hr->req.nr_segments; i++)
+		hr->breq.nr_sectors += hr->req.seg[i].last_sect
+				       - hr->req.seg[i].first_sect + 1;
+	hr->breq.write = hr->req.operation == BLKIF_OP_WRITE;
+	hr->breq.private = hr;
+
+	spl = splsched();
+	simple_lock(&bd->lock);
+	assert_wait((event_t) hr, FALSE);
+	blkio_submit(&bd->queue, &hr->breq);
+	simple_unlock(&bd->lock);
+	splx(spl);
+
+	thread_block(NULL);
+	return hr->err;
+}
+
 #define VBD_PATH "device/vbd"
 void hyp_block_init(void) {
 	char **vbds, **vbd;
@@ -320,7 +372,9 @@ void hyp_block_init(void) {
 		bd->device.emul_ops = &hyp_block_emulation_ops;
 		bd->device.emul_data = bd;
 		simple_lock_init(&bd->lock);
-		simple_lock_init(&bd->pushlock);
+		/* Ring requests carry their own grants, don't merge them */
+		blkio_queue_init(&bd->queue, hyp_block_start, NULL,
+				 RING_SIZE(&bd->ring), 0, bd);
 	}
 }
 
@@ -420,7 +474,8 @@ device_read (void *d, ipc_port_t reply_port,
   vm_page_t m;
   vm_size_t len, size;
   struct block_data *bd = d;
-  struct blkif_request *req;
+  struct hyp_block_req hr;
+  struct blkif_request *req = &hr.req;
 
   *data = 0;
   *bytes_read = 0;
@@ -443,7 +498,6 @@ device_read (void *d, ipc_port_t reply_port,
 
   while (resid && !err)
     {
-      unsigned reqn;
       int i;
       int last_sect;
 
@@ -471,25 +525,9 @@ device_read (void *d, ipc_port_t reply_port,
       if (amt > resid)
 	amt = resid;
 
-      /* allocate a request */
-      spl_t spl = splsched();
-      while(1) {
-        simple_lock(&bd->lock);
-        if (!RING_FULL(&bd->ring))
-	  break;
-	thread_sleep(bd, &bd->lock, FALSE);
-      }
-      mb();
-      reqn = bd->ring.req_prod_pvt++;;
-      simple_lock(&bd->pushlock);
-      simple_unlock(&bd->lock);
-      (void) splx(spl);
-
-      req = RING_GET_REQUEST(&bd->ring, reqn);
       req->operation = BLKIF_OP_READ;
       req->nr_segments = nbpages;
       req->handle = bd->handle;
-      req->id = (uint64_t) (unsigned long) &err; /* pointer on the stack */
       req->sector_number = bn + offset / 512;
       for (i = 0; i < nbpages; i++) {
 	req->seg[i].gref = gref[i] = hyp_grant_give(bd->domid, atop(pages[i]->phys_addr), 0);
@@ -503,17 +541,7 @@ device_read (void *d, ipc_port_t reply_port,
 	      + (last_sect + 1) * 512),
 	      0, PAGE_SIZE - (last_sect + 1) * 512);
 
-      /* no need for a lock: as long as the request is not pushed, the event won't be triggered */
-      assert_wait((event_t) &err, FALSE);
-
-      int notify;
-      wmb(); /* make sure it sees requests */
-      RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&bd->ring, notify);
-      if (notify)
-	hyp_event_channel_send(bd->evt);
-      simple_unlock(&bd->pushlock);
-
-      thread_block(NULL);
+      err = hyp_block_rw(bd, &hr);
 
       if (err)
 	printf("error reading %d bytes at sector %ld\n", amt,
@@ -575,9 +603,10 @@ device_write(void *d, ipc_port_t reply_port,
   unsigned copy_npages = atop(round_page(count));
   phys_addr_t phys_addrs[copy_npages];
   struct block_data *bd = d;
-  blkif_request_t *req;
+  struct hyp_block_req hr;
+  blkif_request_t *req = &hr.req;
   grant_ref_t gref[BLKIF_MAX_SEGMENTS_PER_REQUEST];
-  unsigned reqn, size;
+  unsigned size;
   unsigned i, nbpages, j;
   kern_return_t kr;
 
@@ -620,25 +649,9 @@ device_write(void *d, ipc_port_t reply_port,
     if (nbpages > copy_npages-i)
       nbpages = copy_npages-i;
 
-    /* allocate a request */
-    spl_t spl = splsched();
-    while(1) {
-      simple_lock(&bd->lock);
-      if (!RING_FULL(&bd->ring))
-	break;
-      thread_sleep(bd, &bd->lock, FALSE);
-    }
-    mb();
-    reqn = bd->ring.req_prod_pvt++;;
-    simple_lock(&bd->pushlock);
-    simple_unlock(&bd->lock);
-    (void) splx(spl);
-
-    req = RING_GET_REQUEST(&bd->ring, reqn);
     req->operation = BLKIF_OP_WRITE;
     req->nr_segments = nbpages;
     req->handle = bd->handle;
-    req->id = (uint64_t) (unsigned long) &err; /* pointer on the stack */
     req->sector_number = bn + i*PAGE_SIZE / 512;
 
     for (j = 0; j < nbpages; j++) {
@@ -650,17 +663,7 @@ device_write(void *d, ipc_port_t reply_port,
       req->seg[j].last_sect = size/512 - 1;
     }
 
-    /* no need for a lock: as long as the request is not pushed, the event won't be triggered */
-    assert_wait((event_t) &err, FALSE);
-
-    int notify;
-    wmb(); /* make sure it sees requests */
-    RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&bd->ring, notify);
-    if (notify)
-	    hyp_event_channel_send(bd->evt);
-    simple_unlock(&bd->pushlock);
-
-    thread_block(NULL);
+    err = hyp_block_rw(bd, &hr);
 
     for (j = 0; j < nbpages; j++)
       hyp_grant_takeback(gref[j]);
@@ -703,6 +706,15 @@ device_get_status(void *d, dev_flavor_t flavor, dev_status_t status,
 			status[DEV_GET_RECORDS_RECORD_SIZE] = bd->sector_size;
 			*status_count = DEV_GET_RECORDS_COUNT;
 			break;
+		case BLKIO_STATUS: {
+			io_return_t err;
+			spl_t spl = splsched();
+			simple_lock(&bd->lock);
+			err = blkio_get_status(&bd->queue, status, status_count);
+			simple_unlock(&bd->lock);
+			splx(spl);
+			return err;
+		}
 		default:
 			printf("TODO: block_%s(%d)\n", __func__, flavor);
 			return D_INVALID_OPERATION;
@@ -727,4 +739,5 @@ struct device_emulation_ops hyp_block_emulation_ops = {
 	NULL,	/* no_senders */
 	NULL,	/* write_trap */
 	NULL,	/* writev_trap */
+	NULL,	/* readv_trap */
 };
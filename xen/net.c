@@ -40,6 +40,7 @@
 #include "evt.h"
 #include "store.h"
 #include "net.h"
+#include "netfront.h"
 #include "grant.h"
 #include "ring.h"
 #include "time.h"
@@ -49,6 +50,13 @@
 
 #define ADDRESS_SIZE 6
 #define WINDOW __CONST_RING_SIZE(netif_rx, PAGE_SIZE)
+#define TX_WINDOW __CONST_RING_SIZE(netif_tx, PAGE_SIZE)
+
+/* Largest frame that fits in a received packet message.  */
+#define RX_FRAME_MAX (sizeof(struct ether_header) + NET_RCV_MAX - sizeof(struct packet_header))
+/* Largest frame the backend takes, and the pages it spans.  */
+#define TX_FRAME_MAX 65535
+#define TX_PAGES_MAX (atop(round_page(TX_FRAME_MAX)) + 1)
 
 struct net_data {
 	struct device	device;
@@ -65,10 +73,11 @@ struct net_data {
 	void		*rx_buf[WINDOW];
 	grant_ref_t	rx_buf_gnt[WINDOW];
 	unsigned long	rx_buf_pfn[WINDOW];
-	int		rx_copy;
+	struct netfront_features features;
+	int		rx_csum;	/* NET_CSUM_* flags set by the task */
+	unsigned short	tx_pending[TX_WINDOW];	/* fragments sent, by request id */
 	evtchn_port_t	evt;
 	simple_lock_data_t lock;
-	simple_lock_data_t pushlock;
 };
 
 static int n_vifs;
@@ -97,7 +106,8 @@ static int hextoi(char *cp, int *nump)
 	return(cp - original);
 }
 
-static void enqueue_rx_buf(struct net_data *nd, int number) {
+static void enqueue_rx_buf(void *arg, unsigned number) {
+	struct net_data *nd = arg;
 	unsigned reqn = nd->rx.req_prod_pvt++;
 	netif_rx_request_t *req = RING_GET_REQUEST(&nd->rx, reqn);
 	grant_ref_t gref;
@@ -105,7 +115,7 @@ static void enqueue_rx_buf(struct net_data *nd, int number) {
 	assert(number < WINDOW);
 
 	req->id = number;
-	if (nd->rx_copy) {
+	if (nd->features.rx_copy) {
 		/* Let domD write the data */
 		gref = hyp_grant_give(nd->domid, nd->rx_buf_pfn[number], 0);
 	} else {
@@ -173,15 +183,58 @@ static int recompute_checksum(void *data, int len) {
 	return 0;
 }
 
+static void *take_rx_buf(void *arg, unsigned number) {
+	struct net_data *nd = arg;
+
+	if (nd->features.rx_copy) {
+		hyp_grant_takeback(nd->rx_buf_gnt[number]);
+	} else {
+		unsigned long mfn = hyp_grant_finish_transfer(nd->rx_buf_gnt[number]);
+#ifdef	MACH_PSEUDO_PHYS
+		mfn_list[nd->rx_buf_pfn[number]] = mfn;
+#endif	/* MACH_PSEUDO_PHYS */
+		pmap_map_mfn(nd->rx_buf[number], mfn);
+	}
+	return nd->rx_buf[number];
+}
+
+/* Copy LEN bytes of a received frame, at OFFSET in it, into KMSG.  */
+static void copy_rx_frame(void *frame, unsigned offset, const void *data, unsigned len) {
+	ipc_kmsg_t kmsg = frame;
+	char *header = net_kmsg(kmsg)->header;
+	char *packet = (char *) ((struct packet_header *) net_kmsg(kmsg)->packet + 1);
+	unsigned n;
+
+	if (offset < sizeof(struct ether_header)) {
+		n = MIN(len, sizeof(struct ether_header) - offset);
+		memcpy(header + offset, data, n);
+		offset += n;
+		data += n;
+		len -= n;
+	}
+	memcpy(packet + offset - sizeof(struct ether_header), data, len);
+}
+
+static const struct netfront_rx_ops hyp_net_rx_ops = {
+	.take = take_rx_buf,
+	.give = enqueue_rx_buf,
+	.copy = copy_rx_frame,
+};
+
+/* Wake up the writer of frame ID, all its requests are answered.  */
+static void tx_frame_done(void *arg, unsigned id) {
+	struct net_data *nd = arg;
+
+	thread_wakeup((event_t) &nd->tx_pending[id]);
+}
+
 static void hyp_net_intr(int unit) {
 	ipc_kmsg_t kmsg;
 	struct ether_header *eh;
 	struct packet_header *ph;
-	netif_rx_response_t *rx_rsp;
-	netif_tx_response_t *tx_rsp;
-	void *data;
 	int len, more;
 	struct net_data *nd = &vif_data[unit];
+	int flags;
 
 	simple_lock(&nd->lock);
 	if ((nd->rx.sring->rsp_prod - nd->rx.rsp_cons) >= (WINDOW*3)/4)
@@ -190,71 +243,39 @@ static void hyp_net_intr(int unit) {
 	more = RING_HAS_UNCONSUMED_RESPONSES(&nd->rx);
 	while (more) {
 		rmb(); /* make sure we see responses */
-		rx_rsp = RING_GET_RESPONSE(&nd->rx, nd->rx.rsp_cons++);
-
-		unsigned number = rx_rsp->id;
-		assert(number < WINDOW);
-		if (nd->rx_copy) {
-			hyp_grant_takeback(nd->rx_buf_gnt[number]);
-		} else {
-			unsigned long mfn = hyp_grant_finish_transfer(nd->rx_buf_gnt[number]);
-#ifdef	MACH_PSEUDO_PHYS
-			mfn_list[nd->rx_buf_pfn[number]] = mfn;
-#endif	/* MACH_PSEUDO_PHYS */
-			pmap_map_mfn(nd->rx_buf[number], mfn);
-		}
-
+		/* gasp! Drop if there is no message for the frame.  */
 		kmsg = net_kmsg_get();
-		if (!kmsg)
-			/* gasp! Drop */
-			goto drop;
-
-		if (rx_rsp->status <= 0)
-			switch (rx_rsp->status) {
-				case NETIF_RSP_DROPPED:
-					printf("Packet dropped\n");
-					goto drop_kmsg;
-				case NETIF_RSP_ERROR:
-					printf("Packet error\n");
-					goto drop_kmsg;
-				case 0:
-					printf("nul packet\n");
-					goto drop_kmsg;
-				default:
-					printf("Unknown error %d\n", rx_rsp->status);
-					goto drop_kmsg;
-			}
+		len = netfront_rx_frame(&nd->rx, &hyp_net_rx_ops, nd, kmsg,
+					RX_FRAME_MAX, &flags);
+		RING_FINAL_CHECK_FOR_RESPONSES(&nd->rx, more);
 
-		data = nd->rx_buf[number] + rx_rsp->offset;
-		len = rx_rsp->status;
+		if (len < (int) sizeof(struct ether_header))
+			goto drop_kmsg;
 
-		if (rx_rsp->flags & NETRXF_csum_blank) {
-			struct ether_header *ether = data;
+		eh = (void*) (net_kmsg(kmsg)->header);
+		ph = (void*) (net_kmsg(kmsg)->packet);
+		len -= sizeof(struct ether_header);
 
-			if (!(rx_rsp->flags & NETRXF_data_validated)) {
+		if (flags & NETRXF_csum_blank) {
+			if (!(flags & NETRXF_data_validated)) {
 				printf("packet with no checksum and not validated, dropping it\n");
 				goto drop_kmsg;
 			}
 
-			/* TODO: rather tell pfinet to ignore checksums */
+			/* Unless the task trusts the backend, fill the checksums in.  */
+			if (!(nd->rx_csum & NET_CSUM_RX)) {
+				if (ntohs(eh->ether_type) != 0x0800) {
+					printf("packet with no checksum and not IPv4, dropping it\n");
+					goto drop_kmsg;
+				}
 
-			if (ntohs(ether->ether_type) != 0x0800) {
-				printf("packet with no checksum and not IPv4, dropping it\n");
-				goto drop_kmsg;
+				if (recompute_checksum(ph + 1, len))
+					goto drop_kmsg;
 			}
-
-			if (recompute_checksum(data + sizeof(*ether), len - sizeof(*ether)))
-				goto drop_kmsg;
 		}
 
-		eh = (void*) (net_kmsg(kmsg)->header);
-		ph = (void*) (net_kmsg(kmsg)->packet);
-		memcpy(eh, data, sizeof (struct ether_header));
-		memcpy(ph + 1, data + sizeof (struct ether_header), len - sizeof(struct ether_header));
-		RING_FINAL_CHECK_FOR_RESPONSES(&nd->rx, more);
-		enqueue_rx_buf(nd, number);
 		ph->type = eh->ether_type;
-		ph->length  = len - sizeof(struct ether_header) + sizeof (struct packet_header);
+		ph->length  = len + sizeof (struct packet_header);
 
 		net_kmsg(kmsg)->sent = FALSE; /* Mark packet as received.  */
 
@@ -262,10 +283,8 @@ static void hyp_net_intr(int unit) {
 		continue;
 
 drop_kmsg:
-		net_kmsg_put(kmsg);
-drop:
-		RING_FINAL_CHECK_FOR_RESPONSES(&nd->rx, more);
-		enqueue_rx_buf(nd, number);
+		if (kmsg)
+			net_kmsg_put(kmsg);
 	}
 
 	/* commit new requests */
@@ -276,34 +295,27 @@ drop:
 		hyp_event_channel_send(nd->evt);
 
 	/* Now the tx side */
-	more = RING_HAS_UNCONSUMED_RESPONSES(&nd->tx);
 	spl_t s = splsched ();
-	while (more) {
-		rmb(); /* make sure we see responses */
-		tx_rsp = RING_GET_RESPONSE(&nd->tx, nd->tx.rsp_cons++);
-		switch (tx_rsp->status) {
-			case NETIF_RSP_DROPPED:
-				printf("Packet dropped\n");
-				break;
-			case NETIF_RSP_ERROR:
-				printf("Packet error\n");
-				break;
-			case NETIF_RSP_OKAY:
-				break;
-			default:
-				printf("Unknown error %d\n", tx_rsp->status);
-				break;
-		}
-		thread_wakeup((event_t) hyp_grant_address(tx_rsp->id));
-		thread_wakeup_one(nd);
-		RING_FINAL_CHECK_FOR_RESPONSES(&nd->tx, more);
-	}
+	if (RING_HAS_UNCONSUMED_RESPONSES(&nd->tx))
+		/* Writers may wait for several free requests.  */
+		thread_wakeup(nd);
+	netfront_tx_done(&nd->tx, nd->tx_pending, tx_frame_done, nd);
 	splx(s);
 
 	simple_unlock(&nd->lock);
 }
 
 #define VIF_PATH "device/vif"
+
+/* Read NODE of the backend of ARG, or of ARG itself if FRONTEND.  */
+static int hyp_net_read_int(void *arg, int frontend, const char *node) {
+	struct net_data *nd = arg;
+
+	if (frontend)
+		return hyp_store_read_int(0, 5, VIF_PATH, "/", nd->vif, "/", node);
+	return hyp_store_read_int(0, 3, nd->backend, "/", node);
+}
+
 void hyp_net_init(void) {
 	char **vifs, **vif;
 	char *c;
@@ -387,12 +399,18 @@ void hyp_net_init(void) {
 				panic("eth: couldn't store rx_ring reference for VIF %s (%s)", vifs[n], hyp_store_error);
 			kfree((vm_offset_t) c, strlen(c)+1);
 
-			/* tell we need csums.  */
-			c = hyp_store_write(t, "1", 5, VIF_PATH, "/", vifs[n], "/", "feature-no-csum-offload");
+			/* tell we can take blank csums of validated packets.  */
+			c = hyp_store_write(t, "0", 5, VIF_PATH, "/", vifs[n], "/", "feature-no-csum-offload");
 			if (!c)
 				panic("eth: couldn't store feature-no-csum-offload reference for VIF %s (%s)", vifs[n], hyp_store_error);
 			kfree((vm_offset_t) c, strlen(c)+1);
 
+			/* and frames split over several buffers.  */
+			c = hyp_store_write(t, "1", 5, VIF_PATH, "/", vifs[n], "/", "feature-sg");
+			if (!c)
+				panic("eth: couldn't store feature-sg for VIF %s (%s)", vifs[n], hyp_store_error);
+			kfree((vm_offset_t) c, strlen(c)+1);
+
 			/* Allocate an event channel and give it to backend.  */
 			nd->evt = evt = hyp_event_channel_alloc(domid);
 			i = sprintf(port_name, "%u", evt);
@@ -447,13 +465,13 @@ void hyp_net_init(void) {
 		}
 		printf("\n");
 
-		nd->rx_copy = hyp_store_read_int(0, 3, nd->backend, "/", "feature-rx-copy");
-		if (nd->rx_copy == 1) {
+		netfront_negotiate(&nd->features, hyp_net_read_int, nd);
+		if (nd->features.rx_copy) {
 			c = hyp_store_write(0, "1", 5, VIF_PATH, "/", vifs[n], "/", "request-rx-copy");
 			if (!c)
 				panic("eth: couldn't request rx copy feature for VIF %s (%s)", vifs[n], hyp_store_error);
-		} else
-			nd->rx_copy = 0;
+		}
+		nd->rx_csum = 0;
 
 		c = hyp_store_write(0, hyp_store_state_connected, 5, VIF_PATH, "/", nd->vif, "/", "state");
 		if (!c)
@@ -475,7 +493,7 @@ void hyp_net_init(void) {
 				panic("eth: couldn't allocate space for store tx_ring");
 			nd->rx_buf[i] = (void*)phystokv(addr);
 			nd->rx_buf_pfn[i] = atop(addr);
-			if (!nd->rx_copy) {
+			if (!nd->features.rx_copy) {
 				if (hyp_do_update_va_mapping(kvtolin(nd->rx_buf[i]), 0, UVMF_INVLPG|UVMF_ALL))
 					panic("eth: couldn't clear rx kv buf %d at %llx", i, addr);
 			}
@@ -493,14 +511,14 @@ void hyp_net_init(void) {
 		nd->device.emul_ops = &hyp_net_emulation_ops;
 		nd->device.emul_data = nd;
 		simple_lock_init(&nd->lock);
-		simple_lock_init(&nd->pushlock);
 
 		ifp = &nd->ifnet;
 		ifp->if_unit = n;
 		ifp->if_flags = IFF_UP | IFF_RUNNING;
 		ifp->if_header_size = 14;
 		ifp->if_header_format = HDR_ETHERNET;
-		/* Set to the maximum that we can handle in device_write.  */
+		/* Set to the maximum that we can handle in device_write,
+		   apart from TCP frames which the backend segments.  */
 		ifp->if_mtu = PAGE_SIZE - ifp->if_header_size;
 		ifp->if_address_size = ADDRESS_SIZE;
 		ifp->if_address = (void*) nd->address;
@@ -596,78 +614,93 @@ device_write(void *d, ipc_port_t reply_port,
 	    int *bytes_written)
 {
 	vm_map_copy_t copy = (vm_map_copy_t) data;
-	grant_ref_t gref;
+	grant_ref_t grefs[TX_PAGES_MAX];
+	unsigned long pfn;
 	struct net_data *nd = d;
 	struct ifnet *ifp = &nd->ifnet;
-	netif_tx_request_t *req;
-	unsigned reqn;
-	vm_offset_t buffer;
+	unsigned id, npages, offset, mss, i;
+	vm_offset_t buffer = 0;
 	char *map_data;
 	vm_offset_t map_addr;
 	vm_size_t map_size;
 	kern_return_t kr;
 
-	/* The maximum that we can handle.  */
+	/* The maximum that we can handle without scatter-gather.  */
 	assert(ifp->if_header_size + ifp->if_mtu <= PAGE_SIZE);
 
-	if (count < ifp->if_header_size ||
-	    count > ifp->if_header_size + ifp->if_mtu)
+	if (count < ifp->if_header_size || count > TX_FRAME_MAX)
 		return D_INVALID_SIZE;
 
   	assert(copy->type == VM_MAP_COPY_PAGE_LIST);
 
-	assert(copy->cpy_npages <= 2);
-	assert(copy->cpy_npages >= 1);
-
-	kr = kmem_alloc(device_io_map, &buffer, count);
+	kr = kmem_io_map_copyout(device_io_map, (vm_offset_t *)&map_data,
+				 &map_addr, &map_size, copy, count);
 
 	if (kr != KERN_SUCCESS)
 		return kr;
 
-	kr = kmem_io_map_copyout(device_io_map, (vm_offset_t *)&map_data,
-				 &map_addr, &map_size, copy, count);
+	/* Larger frames can only go out as TCP segmented by the backend.  */
+	mss = 0;
+	if (nd->features.tx_gso && count > sizeof(struct ether_header) + nd->features.mtu)
+		mss = netfront_tx_tcp_mss((uint8_t *) map_data, count, nd->features.mtu);
+	if (!mss && count > ifp->if_header_size + ifp->if_mtu) {
+		kmem_io_map_deallocate(device_io_map, map_addr, map_size);
+		return D_INVALID_SIZE;
+	}
 
-	if (kr != KERN_SUCCESS) {
-		kmem_free(device_io_map, buffer, count);
-		return kr;
+	if (nd->features.tx_sg) {
+		/* Let the backend read the pages of the message.  */
+		offset = copy->offset & PAGE_MASK;
+		npages = atop(round_page(offset + count));
+		assert(npages <= copy->cpy_npages);
+	} else {
+		kr = kmem_alloc(device_io_map, &buffer, count);
+
+		if (kr != KERN_SUCCESS) {
+			kmem_io_map_deallocate(device_io_map, map_addr, map_size);
+			return kr;
+		}
+
+		memcpy((void *)buffer, map_data, count);
+		offset = 0;
+		npages = 1;
 	}
 
-	memcpy((void *)buffer, map_data, count);
-	kmem_io_map_deallocate(device_io_map, map_addr, map_size);
+	/* Let the backend read the pages.  */
+	for (i = 0; i < npages; i++) {
+		if (buffer)
+			pfn = atop(kvtophys(buffer));
+		else
+			pfn = atop(copy->cpy_page_list[i]->phys_addr);
+		grefs[i] = hyp_grant_give(nd->domid, pfn, 1);
+	}
 
-	/* allocate a request */
+	/* allocate requests, one per page and one for the GSO info */
 	spl_t spl = splimp();
 	while (1) {
 		simple_lock(&nd->lock);
-		if (!RING_FULL(&nd->tx))
+		if (RING_FREE_REQUESTS(&nd->tx) >= npages + (mss != 0))
 			break;
 		thread_sleep(nd, &nd->lock, FALSE);
 	}
 	mb();
-	reqn = nd->tx.req_prod_pvt++;;
-	simple_lock(&nd->pushlock);
-	simple_unlock(&nd->lock);
-	(void) splx(spl);
+	id = netfront_tx_frame(&nd->tx, grefs, npages, offset, count, mss);
+	nd->tx_pending[id] = npages;
 
-	req = RING_GET_REQUEST(&nd->tx, reqn);
-	req->gref = gref = hyp_grant_give(nd->domid, atop(kvtophys(buffer)), 1);
-	req->offset = 0;
-	req->flags = 0;
-	req->id = gref;
-	req->size = count;
-
-	assert_wait(hyp_grant_address(gref), FALSE);
+	assert_wait((event_t) &nd->tx_pending[id], FALSE);
 
 	int notify;
 	wmb(); /* make sure it sees requests */
 	RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&nd->tx, notify);
 	if (notify)
 		hyp_event_channel_send(nd->evt);
-	simple_unlock(&nd->pushlock);
+	simple_unlock(&nd->lock);
+	(void) splx(spl);
 
 	thread_block(NULL);
-	
-	hyp_grant_takeback(gref);
+
+	for (i = 0; i < npages; i++)
+		hyp_grant_takeback(grefs[i]);
 
 	/* Send packet to filters.  */
 	{
@@ -677,16 +710,16 @@ device_write(void *d, ipc_port_t reply_port,
 	
 	  kmsg = net_kmsg_get ();
 	
-	  if (kmsg != IKM_NULL)
+	  if (kmsg != IKM_NULL && count <= RX_FRAME_MAX)
 	    {
 	      /* Suitable for Ethernet only.  */
 	      header = (struct ether_header *) (net_kmsg (kmsg)->header);
 	      packet = (struct packet_header *) (net_kmsg (kmsg)->packet);
-	      memcpy (header, (void*)buffer, sizeof (struct ether_header));
+	      memcpy (header, map_data, sizeof (struct ether_header));
 	
 	      /* packet is prefixed with a struct packet_header,
 	         see include/device/net_status.h.  */
-	      memcpy (packet + 1, (void*)buffer + sizeof (struct ether_header),
+	      memcpy (packet + 1, map_data + sizeof (struct ether_header),
 	              count - sizeof (struct ether_header));
 	      packet->length = count - sizeof (struct ether_header)
 	                       + sizeof (struct packet_header);
@@ -697,9 +730,13 @@ device_write(void *d, ipc_port_t reply_port,
 	                  ethernet_priority (kmsg));
 	      splx (s);
 	    }
+	  else if (kmsg != IKM_NULL)
+	    net_kmsg_put (kmsg);
 	}
 
-	kmem_free(device_io_map, buffer, count);
+	kmem_io_map_deallocate(device_io_map, map_addr, map_size);
+	if (buffer)
+		kmem_free(device_io_map, buffer, count);
 
 	vm_map_copy_discard (copy);
 
@@ -717,6 +754,14 @@ device_get_status(void *d, dev_flavor_t flavor, dev_status_t status,
 {
 	struct net_data *nd = d;
 
+	if (flavor == NET_CSUM_OFFLOAD) {
+		if (*status_count < 1)
+			return D_INVALID_SIZE;
+		status[0] = nd->rx_csum;
+		*status_count = 1;
+		return D_SUCCESS;
+	}
+
 	return net_getstat (&nd->ifnet, flavor, status, status_count);
 }
 
@@ -728,6 +773,13 @@ device_set_status(void *d, dev_flavor_t flavor, dev_status_t status,
 
 	switch (flavor)
 	{
+		case NET_CSUM_OFFLOAD:
+			if (count != 1)
+				return D_INVALID_SIZE;
+			if (status[0] & ~NET_CSUM_RX)
+				return D_INVALID_OPERATION;
+			nd->rx_csum = status[0];
+			break;
 		default:
 			printf("TODO: net_%s(%p, 0x%x)\n", __func__, nd, flavor);
 			return D_INVALID_OPERATION;
@@ -747,6 +799,19 @@ device_set_filter(void *d, ipc_port_t port, int priority,
 	return net_set_filter (&nd->ifnet, port, priority, filter, filter_count);
 }
 
+static io_return_t
+device_readv_trap(void *d, mach_port_name_t rcv_name, dev_mode_t mode,
+		  rpc_recnum_t recnum, io_buf_vec_t *iovec, unsigned iocount,
+		  vm_size_t *bytes_read)
+{
+	struct net_data *nd = d;
+
+	if (!nd)
+		return D_NO_SUCH_DEVICE;
+
+	return net_read_trap (rcv_name, mode, iovec, iocount, bytes_read);
+}
+
 struct device_emulation_ops hyp_net_emulation_ops = {
 	NULL,	/* dereference */
 	NULL,	/* deallocate */
@@ -764,4 +829,5 @@ struct device_emulation_ops hyp_net_emulation_ops = {
 	NULL,	/* no_senders */
 	NULL,	/* write_trap */
 	NULL,	/* writev_trap */
+	device_readv_trap,	/* readv_trap */
 };
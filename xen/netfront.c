@@ -0,0 +1,220 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <mach/vm_param.h>
+#include <kern/macros.h>
+#include <kern/printf.h>
+#include <device/if_ether.h>
+#include <util/byteorder.h>
+#include "netfront.h"
+
+/* Smallest MTU of IPv4.  */
+#define MTU_MIN 68
+
+/* Read what the backend offers, and the MTU the toolstack gave us.  */
+void netfront_negotiate(struct netfront_features *f, netfront_read_fn read, void *arg) {
+	int mtu;
+
+	f->rx_copy = read(arg, 0, "feature-rx-copy") == 1;
+	/* Whether we can send frames from several pages, and have TCP ones segmented.  */
+	f->tx_sg = read(arg, 0, "feature-sg") == 1;
+	f->tx_gso = f->tx_sg && read(arg, 0, "feature-gso-tcpv4") == 1;
+
+	mtu = read(arg, 1, "mtu");
+	if (mtu < MTU_MIN || mtu > 0xffff - sizeof(struct ether_header))
+		mtu = NETFRONT_MTU;
+	f->mtu = mtu;
+}
+
+/*
+ * Consume the responses of the next frame on RX, which may span
+ * several buffers with feature-sg, and copy its data into FRAME.
+ * Every buffer is taken back and handed to the backend again.  Return
+ * the length of the frame, with its flags in FLAGS, or -1 if it is
+ * dropped: when FRAME is NULL, on error, when it is longer than MAX,
+ * or when the backend did not produce its end yet.
+ */
+int netfront_rx_frame(netif_rx_front_ring_t *rx, const struct netfront_rx_ops *ops,
+		      void *arg, void *frame, unsigned max, int *flags) {
+	netif_rx_response_t *rsp;
+	unsigned len, id;
+	void *data;
+	int drop;
+
+	rsp = RING_GET_RESPONSE(rx, rx->rsp_cons++);
+	*flags = rsp->flags;
+	drop = frame == NULL;
+
+	if (rsp->status <= 0) {
+		switch (rsp->status) {
+			case NETIF_RSP_DROPPED:
+				printf("Packet dropped\n");
+				break;
+			case NETIF_RSP_ERROR:
+				printf("Packet error\n");
+				break;
+			case 0:
+				printf("nul packet\n");
+				break;
+			default:
+				printf("Unknown error %d\n", rsp->status);
+				break;
+		}
+		drop = 1;
+	}
+
+	len = 0;
+	while (1) {
+		id = rsp->id;
+		if (id >= RING_SIZE(rx)) {
+			printf("eth: bad rx buffer id %u\n", id);
+			drop = 1;
+		} else {
+			data = ops->take(arg, id) + rsp->offset;
+			if (!drop) {
+				if (rsp->status <= 0
+				    || rsp->offset + rsp->status > PAGE_SIZE
+				    || len + rsp->status > max)
+					drop = 1;
+				else {
+					ops->copy(frame, len, data, rsp->status);
+					len += rsp->status;
+				}
+			}
+			ops->give(arg, id);
+		}
+
+		if (!(rsp->flags & NETRXF_more_data))
+			break;
+		if (rx->rsp_cons == rx->sring->rsp_prod) {
+			/* Do not read past what the backend produced.  */
+			printf("eth: frame without its end, dropping it\n");
+			drop = 1;
+			break;
+		}
+		rmb(); /* make sure we see the response */
+		rsp = RING_GET_RESPONSE(rx, rx->rsp_cons++);
+	}
+
+	return drop ? -1 : (int) len;
+}
+
+/* The segment size for the backend to cut FRAME with, or 0 if it is not TCP over IPv4.  */
+unsigned netfront_tx_tcp_mss(const uint8_t *frame, unsigned len, unsigned mtu) {
+	const struct ether_header *ether = (const void *) frame;
+	const uint8_t *ip = frame + sizeof(*ether);
+	unsigned ip_length, tcp_length;
+
+	if (len < sizeof(*ether) + 20 || ntohs(ether->ether_type) != 0x0800 || ip[9] != 6)
+		return 0;
+	ip_length = (ip[0] & 0xf) * 4;
+	if (ip_length < 20 || len < sizeof(*ether) + ip_length + 20)
+		return 0;
+	tcp_length = (ip[ip_length + 12] >> 4) * 4;
+	if (tcp_length < 20 || len < sizeof(*ether) + ip_length + tcp_length)
+		return 0;
+	if (mtu <= ip_length + tcp_length)
+		return 0;
+	return mtu - ip_length - tcp_length;
+}
+
+/*
+ * Queue on TX the requests for a frame of COUNT bytes, at OFFSET in
+ * the first of the NPAGES pages granted in GREFS, and one more for the
+ * segment size MSS unless it is 0.  The caller made room for them.
+ * Return the id of the frame, which all its requests share.
+ */
+unsigned netfront_tx_frame(netif_tx_front_ring_t *tx, const grant_ref_t *grefs,
+			   unsigned npages, unsigned offset, unsigned count,
+			   unsigned mss) {
+	netif_tx_request_t *req;
+	netif_extra_info_t *extra;
+	unsigned reqn, id, size, n, i;
+
+	reqn = tx->req_prod_pvt;
+	tx->req_prod_pvt += npages + (mss != 0);
+	id = reqn % RING_SIZE(tx);
+
+	size = count;
+	for (i = 0; i < npages; i++) {
+		req = RING_GET_REQUEST(tx, reqn++);
+		req->gref = grefs[i];
+		req->offset = i ? 0 : offset;
+		req->flags = i + 1 < npages ? NETTXF_more_data : 0;
+		req->id = id;
+		n = MIN(size, PAGE_SIZE - req->offset);
+		/* The first request has the size of the whole frame.  */
+		req->size = i ? n : count;
+		size -= n;
+
+		if (i == 0 && mss) {
+			/* The backend fills the checksums of the segments in.  */
+			req->flags |= NETTXF_extra_info | NETTXF_csum_blank | NETTXF_data_validated;
+			extra = (netif_extra_info_t *) RING_GET_REQUEST(tx, reqn++);
+			extra->type = XEN_NETIF_EXTRA_TYPE_GSO;
+			extra->flags = 0;
+			extra->u.gso.size = mss;
+			extra->u.gso.type = XEN_NETIF_GSO_TYPE_TCPV4;
+			extra->u.gso.pad = 0;
+			extra->u.gso.features = 0;
+		}
+	}
+
+	return id;
+}
+
+/*
+ * Consume the responses on TX.  PENDING counts the requests of each
+ * frame not answered yet, by id: call DONE for the frames it drops
+ * to zero for.
+ */
+void netfront_tx_done(netif_tx_front_ring_t *tx, unsigned short *pending,
+		      void (*done)(void *arg, unsigned id), void *arg) {
+	netif_tx_response_t *rsp;
+	int more;
+
+	more = RING_HAS_UNCONSUMED_RESPONSES(tx);
+	while (more) {
+		rmb(); /* make sure we see responses */
+		rsp = RING_GET_RESPONSE(tx, tx->rsp_cons++);
+		switch (rsp->status) {
+			case NETIF_RSP_NULL:
+				/* For an extra info request.  */
+				RING_FINAL_CHECK_FOR_RESPONSES(tx, more);
+				continue;
+			case NETIF_RSP_DROPPED:
+				printf("Packet dropped\n");
+				break;
+			case NETIF_RSP_ERROR:
+				printf("Packet error\n");
+				break;
+			case NETIF_RSP_OKAY:
+				break;
+			default:
+				printf("Unknown error %d\n", rsp->status);
+				break;
+		}
+		if (rsp->id >= RING_SIZE(tx) || pending[rsp->id] == 0)
+			printf("eth: bad tx response id %u\n", rsp->id);
+		else if (--pending[rsp->id] == 0)
+			done(arg, rsp->id);
+		RING_FINAL_CHECK_FOR_RESPONSES(tx, more);
+	}
+}
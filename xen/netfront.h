@@ -0,0 +1,70 @@
+/*
+ *  Copyright (C) 2026 Free Software Foundation
+ *
+ * This program is free software ; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation ; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY ; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the program ; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Frontend end of the network rings, apart from the hypervisor: grants,
+ * events and the store are left to the caller, so that this also runs
+ * against a stub backend.
+ */
+
+#ifndef XEN_NETFRONT_H
+#define XEN_NETFRONT_H
+
+#include <sys/types.h>
+#include <machine/xen.h>
+#include <xen/public/xen.h>
+#include <xen/public/io/netif.h>
+
+/* MTU of the backend's interface, unless the store says otherwise.  */
+#define NETFRONT_MTU 1500
+
+/* What the frontend and the backend agreed on.  */
+struct netfront_features {
+	int		rx_copy;	/* backend copies into our pages */
+	int		tx_sg;		/* backend reads frames from several pages */
+	int		tx_gso;		/* backend segments TCP frames */
+	unsigned	mtu;		/* which it cuts TCP frames for */
+};
+
+/* Integer at NODE of the backend, or of the frontend if FRONTEND,
+   or -1 if it is not there.  */
+typedef int (*netfront_read_fn)(void *arg, int frontend, const char *node);
+
+void netfront_negotiate(struct netfront_features *f, netfront_read_fn read, void *arg);
+
+/* Buffers of the receive ring, by request id.  */
+struct netfront_rx_ops {
+	/* Take buffer ID back from the backend, and return its address.  */
+	void *(*take)(void *arg, unsigned id);
+	/* Hand buffer ID to the backend again, with a new request.  */
+	void (*give)(void *arg, unsigned id);
+	/* Copy LEN bytes of DATA at OFFSET in FRAME.  */
+	void (*copy)(void *frame, unsigned offset, const void *data, unsigned len);
+};
+
+int netfront_rx_frame(netif_rx_front_ring_t *rx, const struct netfront_rx_ops *ops,
+		      void *arg, void *frame, unsigned max, int *flags);
+
+unsigned netfront_tx_tcp_mss(const uint8_t *frame, unsigned len, unsigned mtu);
+unsigned netfront_tx_frame(netif_tx_front_ring_t *tx, const grant_ref_t *grefs,
+			   unsigned npages, unsigned offset, unsigned count,
+			   unsigned mss);
+void netfront_tx_done(netif_tx_front_ring_t *tx, unsigned short *pending,
+		      void (*done)(void *arg, unsigned id), void *arg);
+
+#endif /* XEN_NETFRONT_H */